@@ -1,9 +1,10 @@
 
 TEMPLATE = subdirs
 CONFIG -= ordered
-SUBDIRS += qmultithreadnetwork samples
+SUBDIRS += qmultithreadnetwork samples test
 qmultithreadnetwork.file = source/QMultiThreadNetwork.pro
 samples.depends = qmultithreadnetwork
+test.depends = qmultithreadnetwork
 
 OTHER_FILES += README.md
 #EssentialDepends = 
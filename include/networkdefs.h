@@ -19,9 +19,11 @@ That must be called in the main thread.
 #ifndef NETWORKDEF_H
 #define NETWORKDEF_H
 
+#include <functional>
 #include <QEvent>
 #include <QMap>
 #include <QByteArray>
+#include <QStringList>
 #include <QVariant>
 
 #pragma pack(push, _CRT_PACKING)
@@ -49,10 +51,113 @@ namespace QMTNetwork {
         eTypeDelete = 6,
         // HEAD方式请求（支持http(s)）
         eTypeHead = 7,
+        // 根据文件大小、服务器是否支持Range及该主机的历史自动选择单通道或多通道下载（支持http(s)）
+        eTypeAutoDownload = 8,
+        // Multi-Thread Upload：文件分块，由多个连接同时上传（支持http(s)）
+        eTypeMTUpload = 9,
 
         eTypeUnknown = -1,
     };
 
+    // 日志级别
+    enum LogLevel
+    {
+        eLogTrace = 0,
+        eLogDebug = 1,
+        eLogInfo = 2,
+        eLogWarn = 3,
+        eLogError = 4,
+        // 关闭日志
+        eLogOff = 5,
+    };
+
+    // 下载文件的持久化策略
+    //	下载的数据先写入临时文件（文件名+".part"），全部写完后再改名为目标文件，不会出现不完整的目标文件.
+    enum DurabilityPolicy
+    {
+        // 不主动fsync，由系统决定何时写回磁盘
+        eDurabilityNone = 0,
+        // 改名之前fsync一次（并fsync所在目录）
+        eDurabilityOnComplete = 1,
+        // 每写入nSyncIntervalMB兆字节fsync一次，完成时同eDurabilityOnComplete
+        eDurabilityPeriodic = 2,
+    };
+
+    // eTypeMTUpload分块上传的协议
+    enum UploadPartProtocol
+    {
+        // 每块一个PUT请求，带Content-Range: bytes <first>-<last>/<total>（默认）
+        eUploadContentRange = 0,
+        // S3风格：POST ?uploads得到UploadId，PUT ?partNumber=N&uploadId=ID上传各块（响应带ETag），
+        //	最后POST ?uploadId=ID（CompleteMultipartUpload）按顺序合并
+        eUploadS3Multipart = 1,
+    };
+
+    // 请求体的压缩算法（Content-Encoding）
+    enum ContentEncoding
+    {
+        // 不压缩（默认）
+        eEncodingIdentity = 0,
+        // gzip，需要zlib
+        eEncodingGzip = 1,
+        // zstd，需要libzstd
+        eEncodingZstd = 2,
+    };
+
+    // multipart/form-data的一个字段（eTypePost的listFormParts）
+    struct FormPart
+    {
+        // 字段名（name）
+        QString strName;
+        // 文本字段的值，strFilePath不为空时忽略
+        QByteArray bytesValue;
+        // 文件字段：本地文件路径，发送时才从磁盘按块读取，不读入内存
+        QString strFilePath;
+        // 文件字段的filename，空: 取strFilePath的文件名
+        QString strFileName;
+        // 该字段的Content-Type，空: 文件为application/octet-stream，文本不设置
+        QByteArray strContentType;
+    };
+
+    // 请求各阶段的时间点（单调时钟，单位微秒，0表示该阶段未发生）
+    //	注：QNetworkAccessManager不提供DNS解析/TCP连接/TLS握手的时间点，
+    //	这几个阶段都包含在iRequestSent到iFirstByte之间.
+    //	发生重定向时，iRequestSent/iFirstByte为第一次请求的时间点.
+    struct RequestTiming
+    {
+        // 加入线程池队列
+        qint64 iEnqueue;
+        // 开始在线程池的线程中执行
+        qint64 iThreadStart;
+        // 请求已发出
+        qint64 iRequestSent;
+        // 收到响应头
+        qint64 iFirstByte;
+        // 收到最后一个字节
+        qint64 iLastByte;
+        // 在主线程中通知结果
+        qint64 iFinished;
+
+        // 重定向次数
+        quint16 nRedirectCount;
+        // 接收/发送的内容字节数
+        qint64 iBytesReceived;
+        qint64 iBytesSent;
+
+        RequestTiming()
+        {
+            iEnqueue = 0;
+            iThreadStart = 0;
+            iRequestSent = 0;
+            iFirstByte = 0;
+            iLastByte = 0;
+            iFinished = 0;
+            nRedirectCount = 0;
+            iBytesReceived = 0;
+            iBytesSent = 0;
+        }
+    };
+
     //请求结构
     struct RequestTask
     {
@@ -63,13 +168,32 @@ namespace QMTNetwork {
         // 注意: ftp上传的url需指定文件名.如"ftp://10.0.192.47:21/upload/test.zip", 文件将被保存为test.zip.
         QString url;
         QString redirectUrl;
+        // 同一内容的其它地址（镜像），eTypeMTDownload/eTypeAutoDownload分段下载时使用.
+        //	各分段按镜像的实测吞吐分配，出错的分段从已写入的位置改由其它镜像下载.
+        //	偶发出错的镜像暂停使用一段时间，连续出错3次或文件大小/ETag与url不一致时弃用；没有可用镜像时使用url.
+        //	eTypeGet/eTypeHead启用对冲时，对冲请求发往第一个镜像.
+        QStringList listMirrorUrls;
 
         // case eTypeDownload:	下载的文件存放的本地目录. (绝对路径 or 相对路径)
         // case eTypeUpload：	待上传的文件路径. (绝对路径 or 相对路径)
-        // case eTypePost：		post的参数. 如："a=b&c=d".
+        // case eTypeMTUpload：	同eTypeUpload.
+        // case eTypePost：		post的参数. 如："a=b&c=d". （listFormParts不为空时忽略）
         // case eTypePut：		put的数据流.
         QString strReqArg;
 
+        // case eTypePost/eTypePut: 二进制请求体（如protobuf/msgpack），不为null时代替strReqArg，
+        //	不经过QString转换，隐式共享传给QNetworkAccessManager，不复制数据.
+        //	Content-Type默认为application/octet-stream，可在mapRawHeader中指定.
+        QByteArray bytesBody;
+        // case eTypePost/eTypePut: 请求体的数据源，设置时优先于bytesBody和strReqArg.
+        //	在执行请求的线程中调用，每次发出请求（包括重定向后）调用一次，返回已以ReadOnly打开的设备，
+        //	所有权交给请求（随请求释放）. 返回nullptr时请求失败. 非顺序设备以size()作为Content-Length.
+        std::function<QIODevice *()> fnBodyFactory;
+
+        // case eTypePost: 不为空时以multipart/form-data发送这些字段（文本字段和文件），文件边发送边从磁盘读取，
+        //	内存占用与文件的个数和大小无关.
+        QList<FormPart> listFormParts;
+
         // case eTypeDownload: 若指定了strSaveFileName，则保存的文件名是strSaveFileName;否则，根据url.
         QString strSaveFileName;
 
@@ -77,10 +201,17 @@ namespace QMTNetwork {
         //void QNetworkRequest::setRawHeader(const QByteArray &headerName, const QByteArray &value);
         QMap<QByteArray, QByteArray> mapRawHeader;
 
+        // 期望的文件摘要，格式为"算法:十六进制摘要"，如"sha256:9f86d0..."（可由批量请求清单提供）
+        //	边下载边计算，不再读一遍文件. 多线程下载时crc32c按分段计算后合并（重复下载的分段与原请求共享摘要），
+        //	其他算法由写线程在数据写入后按文件顺序计算（先完成的靠后分段等前面的空缺补上后从页缓存读取，
+        //	大文件模式下计入摘要之前不丢弃页缓存），下载完成后不再读取文件. 指定后下载不使用原生传输.
+        QString strChecksum;
+
         // 是否显示进度，默认为false.
         bool bShowProgress;
 
-        // 若文件存在，是否替换，默认为false.
+        // 若文件存在，是否替换，默认为false. 替换时原文件保留到下载成功，再由下载的临时文件原子替换；
+        //	下载失败或取消时原文件不变.
         bool bReplaceFileIfExist;
 
         // 若任务失败，是否再尝试请求一次，默认为false.
@@ -92,15 +223,70 @@ namespace QMTNetwork {
         // 上传文件使用PUT方式，否则POST方式，仅HTTP(s)有效，默认为true.
         bool bUploadUsePut;
 
+        // 断点续传上传(eTypeUpload, HTTP(s))，默认为false. 使用tus 1.0协议：POST url（Upload-Length）创建上传，
+        //	服务器在Location中返回上传地址；PATCH上传地址（Upload-Offset）发送数据. 连接中断后先HEAD查询服务器
+        //	已收到的字节数（Upload-Offset），再从该位置继续，不重新发送整个文件. 设置strUploadStateFile时进程重启后也能继续.
+        bool bResumableUpload;
+
         // 单文件多线程下载模式(需服务器支持) 注：eType为eTypeMTDownload时有效
         //	 多线程下载模式下，一个文件由多个下载通道同时下载.
-        //	 需要先获取http head的Content-Length，所以需要服务器的支持.
+        //	 第一个通道请求文件开头的1MB，由响应的Content-Range得到文件大小后再启动其它通道（不发送HEAD请求）.
+        //	 服务器不支持Range时由第一个通道下载整个文件.
         // n个下载通道(默认是5)(取值范围2-10)
+        //	 eTypeAutoDownload时为通道数的上限.
         quint16 nDownloadThreadCount;
 
+        // eTypeAutoDownload：文件大小不小于该值且服务器支持Range时才分段下载，默认为16MB
+        qint64 nAutoMTThreshold;
+        // eTypeAutoDownload：每个分段至少的字节数（决定实际的通道数），默认为4MB
+        qint64 nAutoMinSegmentSize;
+
+        // eTypeMTUpload：分块的协议，默认为eUploadContentRange
+        UploadPartProtocol eUploadProtocol;
+        // eTypeMTUpload：每块的字节数，默认为8MB（S3要求除最后一块外不小于5MB；超过10000块时自动加大）
+        qint64 nUploadPartSize;
+        // eTypeMTUpload：同时上传的块数(默认是5)(取值范围1-10)
+        quint16 nUploadThreadCount;
+        // 断点续传的状态文件，上传成功后删除. 空: 不记录(默认)
+        //	eTypeMTUpload：记录UploadId和已完成的块，文件、url和分块参数都不变时，再次上传（包括进程重启后）跳过已完成的块.
+        //	eTypeUpload(bResumableUpload)：记录上传地址，文件和url不变时，再次上传从服务器已收到的位置继续.
+        QString strUploadStateFile;
+
+        // 请求体压缩(eTypeUpload(HTTP(s)，非断点续传)/eTypePost/eTypePut)，默认为eEncodingIdentity.
+        //	发送前先按块压缩整个请求体（大文件多块并行压缩，在请求的线程中阻塞进行），不超过4MB时放在内存中，
+        //	否则写入系统临时目录的临时文件（请求结束后删除），设置Content-Encoding和压缩后的Content-Length.
+        //	每块是一个独立的gzip member / zstd frame，服务器须能解压拼接的数据.
+        //	编译时没有对应的库时不压缩，照常发送. 压缩失败时请求失败，不发送.
+        ContentEncoding eBodyEncoding;
+        // 压缩级别，0: 默认（gzip为6，zstd为3）
+        int nBodyCompressLevel;
+
         // 最大重定向次数
         quint16 nMaxRedirectionCount;
 
+        // 对冲请求(eTypeGet/eTypeHead)，默认为false：超过该主机请求耗时的p95仍未返回时，
+        //	再发一个相同的请求（有镜像时发往镜像），先成功返回的为准，另一个被取消.
+        //	对冲的总数受预算限制（NetworkManager::setHedgeBudget）.
+        bool bHedge;
+        // 该主机的耗时样本不足时使用的等待时间（毫秒），0: 样本不足时不对冲（默认）
+        quint32 nHedgeDelayMs;
+
+        // 大文件模式(eTypeDownload/eTypeMTDownload)：文件大小(Content-Length)不小于该值时，
+        //	写入的数据写回磁盘后即从系统页缓存中丢弃，不挤占其它程序的缓存（仅Linux有效）.
+        //	0: 不启用(默认); 1: 总是启用
+        qint64 nLargeFileThreshold;
+
+        // 下载文件的持久化策略(eTypeDownload/eTypeMTDownload)，默认为eDurabilityNone
+        DurabilityPolicy eDurability;
+        // eDurabilityPeriodic时fsync的间隔（MB），默认为64
+        quint32 nSyncIntervalMB;
+
+        // 传输方式（NetworkTransportRegistry中注册的名称）. 空: 按url的协议选择，默认为"qnam"(QNetworkAccessManager)
+        //	"native": Linux原生HTTP/1.1传输(eTypeDownload/eTypeUpload，仅http)，上传用sendfile，下载用splice，
+        //	数据不经过用户空间. 每个请求一个连接，不支持chunked下载. 不支持的任务（平台、协议、请求体压缩、断点续传）使用默认传输.
+        //	"mock"/"file"及自定义的传输见networktransport.h.
+        QString strTransport;
+
         // 用户自定义内容（可用于回传）
         QVariant varArg1;
         // 用户自定义内容（可用于回传）
@@ -126,6 +312,12 @@ namespace QMTNetwork {
         QByteArray bytesContent;
         // 返回的错误信息
         QString strError;
+        // HTTP状态码（非HTTP请求或未收到响应时为0）
+        int nHttpStatusCode;
+        // 网络错误码（QNetworkReply::NetworkError）
+        int nNetworkError;
+        // 各阶段的时间点
+        RequestTiming timing;
 
         // 请求ID
         quint64 uiId;
@@ -140,13 +332,28 @@ namespace QMTNetwork {
             bFinished = false;
             bCancel = false;
             bSuccess = false;
+            nHttpStatusCode = 0;
+            nNetworkError = 0;
             bShowProgress = false;
             bReplaceFileIfExist = false;
             bTryAgainIfFailed = false;
             bAbortBatchWhenFailed = false;
             nDownloadThreadCount = 5;
+            nAutoMTThreshold = 16 * 1024 * 1024;
+            nAutoMinSegmentSize = 4 * 1024 * 1024;
             bUploadUsePut = true;
+            bResumableUpload = false;
+            eUploadProtocol = eUploadContentRange;
+            nUploadPartSize = 8 * 1024 * 1024;
+            nUploadThreadCount = 5;
+            eBodyEncoding = eEncodingIdentity;
+            nBodyCompressLevel = 0;
             nMaxRedirectionCount = 5;
+            bHedge = false;
+            nHedgeDelayMs = 0;
+            nLargeFileThreshold = 0;
+            eDurability = eDurabilityNone;
+            nSyncIntervalMB = 64;
         }
     };
     Q_DECLARE_METATYPE(RequestTask);
@@ -168,11 +375,21 @@ namespace QMTNetwork {
             strType = QStringLiteral("MT下载");
         }
         break;
+        case eTypeAutoDownload:
+        {
+            strType = QStringLiteral("自动下载");
+        }
+        break;
         case eTypeUpload:
         {
             strType = QStringLiteral("上传");
         }
         break;
+        case eTypeMTUpload:
+        {
+            strType = QStringLiteral("MT上传");
+        }
+        break;
         case eTypeGet:
         {
             strType = QStringLiteral("GET");
@@ -0,0 +1,120 @@
+<?php
+ // eTypeMTUpload的参考服务器（仅用于本地测试）
+ //	Content-Range方式: PUT mtupload.php?filename=upload/x.bin，请求头Content-Range: bytes <first>-<last>/<total>，
+ //		写入文件的对应位置（各块可以并发、乱序到达）
+ //	S3方式: POST   mtupload.php?filename=upload/x.bin&uploads                  返回UploadId
+ //	        PUT    mtupload.php?filename=upload/x.bin&partNumber=N&uploadId=ID 返回ETag（该块的md5）
+ //	        POST   mtupload.php?filename=upload/x.bin&uploadId=ID              CompleteMultipartUpload，按顺序合并各块
+ $rootPath = "../";
+ $partsRoot = $rootPath."mtupload_parts/";
+ $method = $_SERVER['REQUEST_METHOD'];
+
+ function fail($code, $message) {
+	 http_response_code($code);
+	 header("Content-Type: application/xml");
+	 echo "<Error><Code>".$code."</Code><Message>".htmlspecialchars($message)."</Message></Error>";
+	 exit;
+ }
+
+ // 未合并的块保存在mtupload_parts/<UploadId>/<PartNumber>
+ function partDir($partsRoot, $uploadId) {
+	 if (!preg_match('/^[0-9a-f]{32}$/', $uploadId) || !is_dir($partsRoot.$uploadId)) {
+		 fail(404, "NoSuchUpload");
+	 }
+	 return $partsRoot.$uploadId;
+ }
+
+ $targetfile = isset($_GET["filename"]) ? $_GET["filename"] : "";
+ if (strlen($targetfile) == 0 || strpos($targetfile, "..") !== false) {
+	 fail(400, "invalid filename");
+ }
+ $filename = $rootPath.$targetfile;
+ if (!file_exists(dirname($filename))) {
+	 mkdir(dirname($filename), 0777, true);
+ }
+
+ if ($method == "POST" && isset($_GET["uploads"])) {
+	 $uploadId = md5(uniqid($targetfile, true));
+	 mkdir($partsRoot.$uploadId, 0777, true);
+	 header("Content-Type: application/xml");
+	 echo "<InitiateMultipartUploadResult><Key>".htmlspecialchars($targetfile)."</Key><UploadId>".$uploadId."</UploadId></InitiateMultipartUploadResult>";
+ }
+ else if ($method == "PUT" && isset($_GET["partNumber"]) && isset($_GET["uploadId"])) {
+	 $dir = partDir($partsRoot, $_GET["uploadId"]);
+	 $partNumber = intval($_GET["partNumber"]);
+	 if ($partNumber < 1 || $partNumber > 10000) {
+		 fail(400, "InvalidPartNumber");
+	 }
+	 $partFile = $dir."/".$partNumber;
+	 $in = fopen("php://input", "rb");
+	 $out = fopen($partFile, "wb");
+	 if ($in === FALSE || $out === FALSE || stream_copy_to_stream($in, $out) === FALSE) {
+		 fail(500, "write part ".$partNumber." failed");
+	 }
+	 fclose($in);
+	 fclose($out);
+	 header("ETag: \"".md5_file($partFile)."\"");
+ }
+ else if ($method == "POST" && isset($_GET["uploadId"])) {
+	 $dir = partDir($partsRoot, $_GET["uploadId"]);
+	 $xml = simplexml_load_string(file_get_contents("php://input"));
+	 if ($xml === FALSE || count($xml->Part) == 0) {
+		 fail(400, "MalformedXML");
+	 }
+	 // 先检查全部块，再合并
+	 $last = 0;
+	 foreach ($xml->Part as $part) {
+		 $partNumber = intval($part->PartNumber);
+		 $partFile = $dir."/".$partNumber;
+		 if ($partNumber <= $last || !file_exists($partFile) || trim((string)$part->ETag, '"') != md5_file($partFile)) {
+			 fail(400, "InvalidPart ".$partNumber);
+		 }
+		 $last = $partNumber;
+	 }
+	 $out = fopen($filename, "wb");
+	 if ($out === FALSE) {
+		 fail(500, "open ".$targetfile." failed");
+	 }
+	 foreach ($xml->Part as $part) {
+		 $in = fopen($dir."/".intval($part->PartNumber), "rb");
+		 stream_copy_to_stream($in, $out);
+		 fclose($in);
+	 }
+	 fclose($out);
+	 array_map("unlink", glob($dir."/*"));
+	 rmdir($dir);
+	 header("Content-Type: application/xml");
+	 echo "<CompleteMultipartUploadResult><Key>".htmlspecialchars($targetfile)."</Key></CompleteMultipartUploadResult>";
+ }
+ else if ($method == "PUT") {
+	 // 没有Content-Range时写入整个文件
+	 $first = 0;
+	 $size = -1;
+	 $mode = "wb";
+	 if (isset($_SERVER["HTTP_CONTENT_RANGE"])) {
+		 if (!preg_match('/^bytes (\d+)-(\d+)\/(\d+)$/', trim($_SERVER["HTTP_CONTENT_RANGE"]), $m)
+			 || intval($m[1]) > intval($m[2]) || intval($m[2]) >= intval($m[3])) {
+			 fail(400, "invalid Content-Range");
+		 }
+		 $first = intval($m[1]);
+		 $size = intval($m[2]) - $first + 1;
+		 // 不截断，其它块可能已经写入
+		 $mode = "c+b";
+	 }
+	 $in = fopen("php://input", "rb");
+	 $out = fopen($filename, $mode);
+	 if ($in === FALSE || $out === FALSE || fseek($out, $first) != 0) {
+		 fail(500, "open ".$targetfile." failed");
+	 }
+	 $written = stream_copy_to_stream($in, $out);
+	 fclose($in);
+	 fclose($out);
+	 if ($written === FALSE || ($size >= 0 && $written != $size)) {
+		 fail(400, "incomplete body: ".$written." of ".$size." bytes");
+	 }
+	 echo $targetfile." ".$first."+".$written." upload success.";
+ }
+ else {
+	 fail(405, "method not allowed");
+ }
+?>
@@ -0,0 +1,110 @@
+<?php
+ // bResumableUpload的参考服务器（tus 1.0协议的core和creation部分，仅用于本地测试）
+ //	POST  resumable.php?filename=upload/x.bin   Upload-Length: <总字节数>  -> 201, Location: 上传地址
+ //	HEAD  上传地址                                                        -> Upload-Offset: 已收到的字节数
+ //	PATCH 上传地址  Upload-Offset: <起始位置>, Content-Type: application/offset+octet-stream
+ //		-> 204, Upload-Offset: 新的位置. 连接中断时已收到的部分保留；收齐后移动到filename
+ ignore_user_abort(true);
+ $rootPath = "../";
+ $uploadsRoot = $rootPath."resumable_uploads/";
+ $method = $_SERVER['REQUEST_METHOD'];
+ header("Tus-Resumable: 1.0.0");
+
+ function fail($code, $message) {
+	 http_response_code($code);
+	 echo $message;
+	 exit;
+ }
+
+ // 未完成的上传：<id>.bin为已收到的数据，<id>.json记录总大小和目标文件
+ function loadUpload($uploadsRoot) {
+	 $id = isset($_GET["id"]) ? $_GET["id"] : "";
+	 if (!preg_match('/^[0-9a-f]{32}$/', $id) || !file_exists($uploadsRoot.$id.".json")) {
+		 fail(404, "upload not found");
+	 }
+	 $info = json_decode(file_get_contents($uploadsRoot.$id.".json"), true);
+	 $info["id"] = $id;
+	 $info["data"] = $uploadsRoot.$id.".bin";
+	 clearstatcache(true, $info["data"]);
+	 // 已完成的上传仍返回总大小，客户端没收到最后的响应时不会重传
+	 $info["offset"] = empty($info["done"]) ? filesize($info["data"]) : $info["length"];
+	 return $info;
+ }
+
+ if ($method == "OPTIONS") {
+	 header("Tus-Version: 1.0.0");
+	 header("Tus-Extension: creation");
+	 http_response_code(204);
+ }
+ else if ($method == "POST") {
+	 $targetfile = isset($_GET["filename"]) ? $_GET["filename"] : "";
+	 if (strlen($targetfile) == 0 || strpos($targetfile, "..") !== false) {
+		 fail(400, "invalid filename");
+	 }
+	 if (!isset($_SERVER["HTTP_UPLOAD_LENGTH"]) || !ctype_digit($_SERVER["HTTP_UPLOAD_LENGTH"])) {
+		 fail(400, "Upload-Length required");
+	 }
+	 if (!file_exists($uploadsRoot)) {
+		 mkdir($uploadsRoot, 0777, true);
+	 }
+	 $id = md5(uniqid($targetfile, true));
+	 touch($uploadsRoot.$id.".bin");
+	 file_put_contents($uploadsRoot.$id.".json", json_encode(array(
+		 "length" => intval($_SERVER["HTTP_UPLOAD_LENGTH"]),
+		 "filename" => $targetfile)));
+	 http_response_code(201);
+	 header("Location: resumable.php?id=".$id);
+ }
+ else if ($method == "HEAD") {
+	 $info = loadUpload($uploadsRoot);
+	 header("Cache-Control: no-store");
+	 header("Upload-Offset: ".$info["offset"]);
+	 header("Upload-Length: ".$info["length"]);
+ }
+ else if ($method == "PATCH") {
+	 $info = loadUpload($uploadsRoot);
+	 if (!empty($info["done"])) {
+		 fail(409, "upload already completed");
+	 }
+	 if (!isset($_SERVER["CONTENT_TYPE"]) || $_SERVER["CONTENT_TYPE"] != "application/offset+octet-stream") {
+		 fail(415, "Content-Type must be application/offset+octet-stream");
+	 }
+	 if (!isset($_SERVER["HTTP_UPLOAD_OFFSET"]) || intval($_SERVER["HTTP_UPLOAD_OFFSET"]) != $info["offset"]) {
+		 fail(409, "Upload-Offset mismatch, server has ".$info["offset"]." bytes");
+	 }
+	 $in = fopen("php://input", "rb");
+	 $out = fopen($info["data"], "ab");
+	 if ($in === FALSE || $out === FALSE || !flock($out, LOCK_EX)) {
+		 fail(500, "open upload failed");
+	 }
+	 // 逐块追加，连接中断时已写入的部分保留
+	 while (!feof($in) && $info["offset"] < $info["length"]) {
+		 $chunk = fread($in, min(1024 * 1024, $info["length"] - $info["offset"]));
+		 if ($chunk === FALSE || strlen($chunk) == 0) {
+			 break;
+		 }
+		 fwrite($out, $chunk);
+		 $info["offset"] += strlen($chunk);
+	 }
+	 fflush($out);
+	 flock($out, LOCK_UN);
+	 fclose($out);
+	 fclose($in);
+	 if ($info["offset"] == $info["length"]) {
+		 $filename = $rootPath.$info["filename"];
+		 if (!file_exists(dirname($filename))) {
+			 mkdir(dirname($filename), 0777, true);
+		 }
+		 rename($info["data"], $filename);
+		 file_put_contents($uploadsRoot.$info["id"].".json", json_encode(array(
+			 "length" => $info["length"],
+			 "filename" => $info["filename"],
+			 "done" => true)));
+	 }
+	 http_response_code(204);
+	 header("Upload-Offset: ".$info["offset"]);
+ }
+ else {
+	 fail(405, "method not allowed");
+ }
+?>
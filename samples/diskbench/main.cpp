@@ -0,0 +1,136 @@
+﻿// 磁盘写入基准测试：从进程内的HTTP服务器并发下载，比较同步写入和io_uring的吞吐与系统调用次数.
+//	DiskBench [任务数=256] [每个文件MB=16] [保存目录=临时目录]
+//	QMTNETWORK_DISK_BACKEND=sync DiskBench	强制同步写入
+//	注意：线程池最多16个线程，超出的任务排队执行.
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <memory>
+#include "networkmanager.h"
+#include "networkreply.h"
+
+using namespace QMTNetwork;
+
+namespace {
+    const qint64 ChunkSize = 256 * 1024;
+
+    // 每个连接返回nFileSize字节的数据，之后关闭连接
+    void serveConnection(QTcpSocket *pSocket, qint64 nFileSize, const QByteArray& bytesChunk)
+    {
+        std::shared_ptr<qint64> pLeft = std::make_shared<qint64>(-1);
+        std::shared_ptr<QByteArray> pHeader = std::make_shared<QByteArray>();
+
+        auto fnPump = [=]() {
+            while (*pLeft > 0 && pSocket->bytesToWrite() < 4 * ChunkSize)
+            {
+                const qint64 nSize = qMin(*pLeft, ChunkSize);
+                pSocket->write(bytesChunk.constData(), nSize);
+                *pLeft -= nSize;
+            }
+            if (*pLeft == 0 && pSocket->bytesToWrite() == 0)
+            {
+                pSocket->disconnectFromHost();
+            }
+        };
+
+        QObject::connect(pSocket, &QTcpSocket::readyRead, [=]() {
+            pHeader->append(pSocket->readAll());
+            if (*pLeft < 0 && pHeader->contains("\r\n\r\n"))
+            {
+                pSocket->write("HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: "
+                    + QByteArray::number(nFileSize) + "\r\nConnection: close\r\n\r\n");
+                *pLeft = nFileSize;
+                fnPump();
+            }
+        });
+        QObject::connect(pSocket, &QTcpSocket::bytesWritten, fnPump);
+        QObject::connect(pSocket, &QTcpSocket::disconnected, pSocket, &QObject::deleteLater);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+    const int nTasks = (args.size() > 1) ? args.at(1).toInt() : 256;
+    const qint64 nFileSize = ((args.size() > 2) ? args.at(2).toLongLong() : 16) * 1024 * 1024;
+    const QString strDir = (args.size() > 3) ? args.at(3) : QDir::tempPath() + "/qmtnetwork_diskbench";
+    QTextStream out(stdout);
+
+    QDir().mkpath(strDir);
+    const QByteArray bytesChunk(ChunkSize, 'x');
+    QTcpServer server;
+    if (!server.listen(QHostAddress::LocalHost))
+    {
+        out << "listen failed: " << server.errorString() << endl;
+        return 1;
+    }
+    QObject::connect(&server, &QTcpServer::newConnection, [&]() {
+        while (QTcpSocket *pSocket = server.nextPendingConnection())
+        {
+            serveConnection(pSocket, nFileSize, bytesChunk);
+        }
+    });
+
+    NetworkManager::initialize();
+    NetworkManager::setLogLevel(eLogWarn);
+    NetworkManager *pManager = NetworkManager::globalInstance();
+    pManager->setMaxThreadCount(16);
+
+    int nFinished = 0;
+    int nFailed = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < nTasks; ++i)
+    {
+        RequestTask task;
+        task.eType = eTypeDownload;
+        task.url = QStringLiteral("http://127.0.0.1:%1/file%2.bin").arg(server.serverPort()).arg(i);
+        task.strReqArg = strDir;
+        task.strSaveFileName = QStringLiteral("file%1.bin").arg(i);
+        NetworkReply *pReply = pManager->addRequest(task);
+        if (!pReply)
+        {
+            ++nFinished;
+            ++nFailed;
+            continue;
+        }
+        QObject::connect(pReply, &NetworkReply::requestFinished, [&](const RequestTask& result) {
+            if (!result.bSuccess)
+            {
+                ++nFailed;
+                out << "failed: " << result.url << " " << result.strError << endl;
+            }
+            QFile::remove(strDir + "/" + result.strSaveFileName);
+            if (++nFinished == nTasks)
+            {
+                app.quit();
+            }
+        });
+    }
+    if (nFinished < nTasks)
+    {
+        app.exec();
+    }
+
+    const double dSeconds = timer.elapsed() / 1000.0;
+    const double dMBytes = double(nFileSize) * (nTasks - nFailed) / (1024 * 1024);
+    out << "tasks: " << nTasks << ", failed: " << nFailed << ", file size: " << nFileSize << endl;
+    out << "elapsed: " << dSeconds << " s, throughput: " << (dSeconds > 0 ? dMBytes / dSeconds : 0) << " MB/s" << endl;
+    const QList<QByteArray> lines = pManager->metricsSnapshot().split('\n');
+    for (const QByteArray& line : lines)
+    {
+        if (line.startsWith("qmtnetwork_disk_"))
+        {
+            out << line << endl;
+        }
+    }
+
+    NetworkManager::unInitialize();
+    QDir(strDir).removeRecursively();
+    return 0;
+}
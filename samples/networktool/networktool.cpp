@@ -802,6 +802,7 @@ void NetworkTool::onBatchRequest()
         {
         case eTypeDownload:
         case eTypeMTDownload:
+        case eTypeAutoDownload:
         {
             QString strSaveDir = strArg;
             if (strSaveDir.isEmpty())
@@ -822,6 +823,7 @@ void NetworkTool::onBatchRequest()
             req.bReplaceFileIfExist = true;
         }
         case eTypeUpload:
+        case eTypeMTUpload:
         {
             req.strReqArg = strArg;
             req.bShowProgress = uiAddBatchTask.cb_showProgress->isChecked();
@@ -1264,7 +1266,8 @@ void TaskDelegate::paint(QPainter * painter, const QStyleOptionViewItem & option
             }
 
             if (!stTask.bFinished && !stTask.bCancel && stTask.bShowProgress
-                && (stTask.eType == eTypeDownload || stTask.eType == eTypeUpload || stTask.eType == eTypeMTDownload))
+                && (stTask.eType == eTypeDownload || stTask.eType == eTypeUpload || stTask.eType == eTypeMTDownload
+                    || stTask.eType == eTypeAutoDownload || stTask.eType == eTypeMTUpload))
             {
                 int p = m_mapProgress.value(stTask.uiId);
                 painter->fillRect(rect.left() + 180, rect.top() + 1, 102, 12, QBrush("#191919"));
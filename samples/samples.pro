@@ -1,3 +1,5 @@
 TEMPLATE = subdirs
 
-SUBDIRS += networktool
+SUBDIRS += networktool \
+           diskbench \
+           transportbench
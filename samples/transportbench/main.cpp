@@ -0,0 +1,217 @@
+﻿// 传输基准测试：从进程内的HTTP服务器下载（或上传到该服务器），比较QNetworkAccessManager和原生传输（sendfile/splice），
+//	以及不经过网络的"mock"（mock://）和"file"（file://）传输.
+//	TransportBench [download|upload] [任务数=64] [每个文件MB=64] [临时目录=系统临时目录]
+//	注意：原生传输仅Linux可用，其它平台下"native"的任务回退到QNetworkAccessManager.
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QUrl>
+#include <memory>
+#include "networkmanager.h"
+#include "networkreply.h"
+
+using namespace QMTNetwork;
+
+namespace {
+    const qint64 ChunkSize = 256 * 1024;
+
+    // GET: 返回nFileSize字节的数据；PUT/POST: 读完请求体后返回200. 之后关闭连接
+    void serveConnection(QTcpSocket *pSocket, qint64 nFileSize, const QByteArray& bytesChunk)
+    {
+        std::shared_ptr<qint64> pLeft = std::make_shared<qint64>(-1);
+        std::shared_ptr<qint64> pBodyLeft = std::make_shared<qint64>(-1);
+        std::shared_ptr<QByteArray> pHeader = std::make_shared<QByteArray>();
+
+        auto fnPump = [=]() {
+            while (*pLeft > 0 && pSocket->bytesToWrite() < 4 * ChunkSize)
+            {
+                const qint64 nSize = qMin(*pLeft, ChunkSize);
+                pSocket->write(bytesChunk.constData(), nSize);
+                *pLeft -= nSize;
+            }
+            if (*pLeft == 0 && pSocket->bytesToWrite() == 0)
+            {
+                pSocket->disconnectFromHost();
+            }
+        };
+
+        QObject::connect(pSocket, &QTcpSocket::readyRead, [=]() {
+            if (*pBodyLeft < 0)
+            {
+                pHeader->append(pSocket->readAll());
+                const int nEnd = pHeader->indexOf("\r\n\r\n");
+                if (nEnd < 0)
+                {
+                    return;
+                }
+                if (pHeader->startsWith("GET"))
+                {
+                    pSocket->write("HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: "
+                        + QByteArray::number(nFileSize) + "\r\nConnection: close\r\n\r\n");
+                    *pBodyLeft = 0;
+                    *pLeft = nFileSize;
+                    fnPump();
+                    return;
+                }
+                *pBodyLeft = 0;
+                for (const QByteArray& line : pHeader->left(nEnd).split('\n'))
+                {
+                    if (line.toLower().startsWith("content-length:"))
+                    {
+                        *pBodyLeft = line.mid(15).trimmed().toLongLong();
+                    }
+                }
+                *pBodyLeft -= pHeader->size() - (nEnd + 4);
+            }
+            else
+            {
+                *pBodyLeft -= pSocket->readAll().size();
+            }
+            if (*pBodyLeft <= 0 && *pLeft < 0)
+            {
+                *pLeft = 0;
+                pSocket->write("HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok");
+                fnPump();
+            }
+        });
+        QObject::connect(pSocket, &QTcpSocket::bytesWritten, fnPump);
+        QObject::connect(pSocket, &QTcpSocket::disconnected, pSocket, &QObject::deleteLater);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+    const bool bUpload = (args.size() > 1 && args.at(1) == QLatin1String("upload"));
+    const int nTasks = (args.size() > 2) ? args.at(2).toInt() : 64;
+    const qint64 nFileSize = ((args.size() > 3) ? args.at(3).toLongLong() : 64) * 1024 * 1024;
+    const QString strDir = (args.size() > 4) ? args.at(4) : QDir::tempPath() + "/qmtnetwork_transportbench";
+    QTextStream out(stdout);
+
+    QDir().mkpath(strDir);
+    const QByteArray bytesChunk(ChunkSize, 'x');
+    // 上传的源文件，也是file://下载的源文件
+    const QString strUploadFile = strDir + "/upload.bin";
+    {
+        QFile file(strUploadFile);
+        if (!file.open(QIODevice::WriteOnly))
+        {
+            out << "create failed: " << file.errorString() << endl;
+            return 1;
+        }
+        for (qint64 nWritten = 0; nWritten < nFileSize; nWritten += ChunkSize)
+        {
+            file.write(bytesChunk.constData(), qMin(ChunkSize, nFileSize - nWritten));
+        }
+    }
+
+    QTcpServer server;
+    if (!server.listen(QHostAddress::LocalHost))
+    {
+        out << "listen failed: " << server.errorString() << endl;
+        return 1;
+    }
+    QObject::connect(&server, &QTcpServer::newConnection, [&]() {
+        while (QTcpSocket *pSocket = server.nextPendingConnection())
+        {
+            serveConnection(pSocket, nFileSize, bytesChunk);
+        }
+    });
+
+    NetworkManager::initialize();
+    NetworkManager::setLogLevel(eLogWarn);
+    NetworkManager *pManager = NetworkManager::globalInstance();
+    pManager->setMaxThreadCount(16);
+
+    out << (bUpload ? "upload" : "download") << ", tasks: " << nTasks << ", file size: " << nFileSize << endl;
+    const QStringList listTransport = QStringList() << QString() << QStringLiteral("native")
+        << QStringLiteral("mock") << QStringLiteral("file");
+    for (const QString& strTransport : listTransport)
+    {
+        int nFinished = 0;
+        int nFailed = 0;
+        QEventLoop loop;
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < nTasks; ++i)
+        {
+            RequestTask task;
+            task.strTransport = strTransport;
+            if (bUpload)
+            {
+                task.eType = eTypeUpload;
+                task.url = QStringLiteral("http://127.0.0.1:%1/upload%2.bin").arg(server.serverPort()).arg(i);
+                if (strTransport == QLatin1String("mock"))
+                {
+                    task.url = QStringLiteral("mock://bench/upload%1.bin").arg(i);
+                }
+                else if (strTransport == QLatin1String("file"))
+                {
+                    task.url = QUrl::fromLocalFile(strDir + QStringLiteral("/uploaded%1.bin").arg(i)).toString();
+                }
+                task.strReqArg = strUploadFile;
+            }
+            else
+            {
+                task.eType = eTypeDownload;
+                task.url = QStringLiteral("http://127.0.0.1:%1/file%2.bin").arg(server.serverPort()).arg(i);
+                if (strTransport == QLatin1String("mock"))
+                {
+                    task.url = QStringLiteral("mock://bench/file%1.bin?size=%2").arg(i).arg(nFileSize);
+                }
+                else if (strTransport == QLatin1String("file"))
+                {
+                    task.url = QUrl::fromLocalFile(strUploadFile).toString();
+                }
+                task.strReqArg = strDir;
+                task.strSaveFileName = QStringLiteral("file%1.bin").arg(i);
+                task.bReplaceFileIfExist = true;
+            }
+            NetworkReply *pReply = pManager->addRequest(task);
+            if (!pReply)
+            {
+                ++nFinished;
+                ++nFailed;
+                continue;
+            }
+            QObject::connect(pReply, &NetworkReply::requestFinished, [&](const RequestTask& result) {
+                if (!result.bSuccess)
+                {
+                    ++nFailed;
+                    out << "failed: " << result.url << " " << result.strError << endl;
+                }
+                if (!bUpload)
+                {
+                    QFile::remove(strDir + "/" + result.strSaveFileName);
+                }
+                else if (result.url.startsWith(QLatin1String("file:")))
+                {
+                    QFile::remove(QUrl(result.url).toLocalFile());
+                }
+                if (++nFinished == nTasks)
+                {
+                    loop.quit();
+                }
+            });
+        }
+        if (nFinished < nTasks)
+        {
+            loop.exec();
+        }
+
+        const double dSeconds = timer.elapsed() / 1000.0;
+        const double dMBytes = double(nFileSize) * (nTasks - nFailed) / (1024 * 1024);
+        out << (strTransport.isEmpty() ? QStringLiteral("qnam") : strTransport) << ": failed: " << nFailed
+            << ", elapsed: " << dSeconds << " s, throughput: " << (dSeconds > 0 ? dMBytes / dSeconds : 0) << " MB/s" << endl;
+    }
+
+    NetworkManager::unInitialize();
+    QDir(strDir).removeRecursively();
+    return 0;
+}
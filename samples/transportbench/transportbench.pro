@@ -0,0 +1,45 @@
+######################################################################
+# Transport benchmark: QNetworkAccessManager vs. the native transport
+######################################################################
+
+TEMPLATE = app
+TARGET = TransportBench
+
+QT += core network
+QT -= gui
+CONFIG += console debug_and_release
+CONFIG -= app_bundle
+
+INCLUDEPATH += . \
+                $$PWD/../../include
+
+# Input
+SOURCES += main.cpp
+
+greaterThan(QT_MAJOR_VERSION, 4) {
+    TARGET_ARCH=$${QT_ARCH}
+} else {
+    TARGET_ARCH=$${QMAKE_HOST.arch}
+}
+
+CONFIG(debug, debug|release) {
+        contains(TARGET_ARCH, x86_64) {
+            DESTDIR = $$PWD/../../bin/x64/Debug
+            LIBPATH += $$PWD/../../bin/x64/Debug
+        } else {
+            DESTDIR = $$PWD/../../bin/Win32/Debug
+            LIBPATH += $$PWD/../../bin/Win32/Debug
+        }
+        LIBPATH += $$PWD/../../lib/Debug
+        LIBS += -lQMultiThreadNetworkd
+} else {
+        contains(TARGET_ARCH, x86_64) {
+            DESTDIR = $$PWD/../../bin/x64/Release
+            LIBPATH += $$PWD/../../bin/x64/Release
+        } else {
+            DESTDIR = $$PWD/../../bin/Win32/Release
+            LIBPATH += $$PWD/../../bin/Win32/Release
+        }
+        LIBPATH += $$PWD/../../lib/Release
+        LIBS += -lQMultiThreadNetwork
+}
@@ -28,7 +28,23 @@ HEADERS += $$PWD/inc/classmemorytracer.h \
            networkdownloadrequest.h \
            networkuploadrequest.h \
            networkcommonrequest.h \
-           networkrunnable.h
+           networkrunnable.h \
+           networkutility.h \
+           $$PWD/inc/networkbatchmanifest.h \
+           networkmetrics.h \
+           networktracer.h \
+           networklog.h \
+           networkfilewriter.h \
+           networkuring.h \
+           networkchecksum.h \
+           networkhosthistory.h \
+           networkmtuploadrequest.h \
+           networkcompressor.h \
+           networkmappedfile.h \
+           networknativehttprequest.h \
+           $$PWD/inc/networktransport.h \
+           networklocaltransport.h \
+           networktransportrequest.h
 
 SOURCES += dllmain.cpp \
            classmemorytracer.cpp \
@@ -39,7 +55,23 @@ SOURCES += dllmain.cpp \
            networkuploadrequest.cpp \
            networkrunnable.cpp \
            networkreply.cpp \
-           networkmanager.cpp
+           networkmanager.cpp \
+           networkutility.cpp \
+           networkbatchmanifest.cpp \
+           networkmetrics.cpp \
+           networktracer.cpp \
+           networklog.cpp \
+           networkfilewriter.cpp \
+           networkuring.cpp \
+           networkchecksum.cpp \
+           networkhosthistory.cpp \
+           networkmtuploadrequest.cpp \
+           networkcompressor.cpp \
+           networkmappedfile.cpp \
+           networknativehttprequest.cpp \
+           networktransport.cpp \
+           networklocaltransport.cpp \
+           networktransportrequest.cpp
 
 greaterThan(QT_MAJOR_VERSION, 4) {
     TARGET_ARCH=$${QT_ARCH}
@@ -80,6 +112,28 @@ win32 {
             -loleaut32
 }
 
+# Linux: 找到liburing时启用io_uring磁盘写入
+linux {
+    CONFIG += link_pkgconfig
+    packagesExist(liburing) {
+        DEFINES += QMTNETWORK_USE_IO_URING
+        PKGCONFIG += liburing
+    }
+}
+
+# 请求体压缩(RequestTask::eBodyEncoding)：找到zlib时支持gzip，找到libzstd时支持zstd
+unix {
+    CONFIG += link_pkgconfig
+    packagesExist(zlib) {
+        DEFINES += QMTNETWORK_USE_ZLIB
+        PKGCONFIG += zlib
+    }
+    packagesExist(libzstd) {
+        DEFINES += QMTNETWORK_USE_ZSTD
+        PKGCONFIG += libzstd
+    }
+}
+
 !rc_file {
     ##RC_ICONS = QtMultiThreadNetwork.ico
     QMAKE_TARGET_COMPANY = ""
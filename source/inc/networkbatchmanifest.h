@@ -0,0 +1,77 @@
+﻿/*
+@Brief:			Qt multi-threaded network module
+@Author:		vilas wang
+@Contact:		QQ451930733
+
+The Qt multi-threaded network module is a wrapper of Qt Network module, and combine with thread-pool to realize multi-threaded networking.
+- Multi-task concurrent(Each request task is executed in different threads).
+- Both single request and batch request mode are supported.
+- Large file multi-thread downloading supported. (The thread here refers to the download channel. Download speed is faster.)
+- HTTP(S)/FTP protocol supported.
+- Multiple request methods supported. (GET/POST/PUT/DELETE/HEAD)
+- Asynchronous API.
+- Thread-safe.
+
+Note: You must call NetworkManager::initialize() before use, and call NetworkManager::unInitialize() before application quit.
+That must be called in the main thread.
+*/
+
+#ifndef NETWORKBATCHMANIFEST_H
+#define NETWORKBATCHMANIFEST_H
+
+#include <QScopedPointer>
+#include "networkdefs.h"
+#include "networkglobal.h"
+
+// 批量请求清单读取器
+//	清单文件以内存映射的方式打开，按行增量解析，不会一次性把整个清单读入内存.
+//	支持两种格式（每行一个任务，空行和以#开头的行会被忽略）:
+//	1.CSV:	url,type,arg[,saveFileName[,headers[,checksum]]]
+//			type为RequestType的数值，为空则使用模板任务的类型;
+//			headers格式为"Name: value|Name2: value2";
+//			字段中含有逗号时可用双引号括起来，双引号本身用""转义.
+//	2.JSON Lines:	{"url":"...", "type":0, "arg":"...", "saveFileName":"...", "headers":{"Name":"value"}, "checksum":"sha256:...",
+//						"mirrors":["http://..."]}
+class NetworkBatchManifestPrivate;
+class NETWORK_EXPORT NetworkBatchManifest
+{
+    Q_DECLARE_PRIVATE(NetworkBatchManifest)
+
+public:
+    enum Format
+    {
+        // 根据文件后缀判断（.jsonl/.ndjson/.json 为JSON Lines，其它为CSV）
+        eFormatAuto = 0,
+        eFormatCsv = 1,
+        eFormatJsonLines = 2,
+    };
+
+    NetworkBatchManifest();
+    ~NetworkBatchManifest();
+
+    bool open(const QString& strFilePath, Format eFormat, QString& strError);
+    void close();
+    bool isOpen() const;
+
+    // 跳到第nLine行（从0开始计数），用于从上次中断的位置继续
+    bool seekLine(qint64 nLine);
+
+    // 读取下一个任务. task作为模板传入，清单中指定的字段会覆盖模板的值
+    // nLine返回该任务所在的行号. 返回false表示清单已读完
+    bool readNext(QMTNetwork::RequestTask& task, qint64& nLine);
+
+    bool atEnd() const;
+    // 下一个将被读取的行号
+    qint64 currentLine() const;
+    // 已解析的字节数 / 清单文件总字节数
+    qint64 bytesRead() const;
+    qint64 size() const;
+    // 格式错误被跳过的行数
+    qint64 invalidLineCount() const;
+
+private:
+    Q_DISABLE_COPY(NetworkBatchManifest);
+    QScopedPointer<NetworkBatchManifestPrivate> d_ptr;
+};
+
+#endif // NETWORKBATCHMANIFEST_H
@@ -49,6 +49,13 @@ public:
     // 添加批量请求任务
     NetworkReply *addBatchRequest(QMTNetwork::BatchRequestTask& tasks, quint64 &uiBatchId);
 
+    // 以清单文件的方式添加批量请求任务（清单格式见NetworkBatchManifest）
+    //	清单被按需读取，只有正在执行和即将执行的任务会被创建，适用于超大批量的任务.
+    //	taskTemplate: 清单中未指定的字段使用该模板的值
+    //	nStartLine: 从清单的第nStartLine行开始执行（用于从上次中断的位置继续）
+    NetworkReply *addBatchRequest(const QString& strManifestFile, const QMTNetwork::RequestTask& taskTemplate,
+        quint64 &uiBatchId, qint64 nStartLine = 0);
+
     // 停止所有的请求任务
     void stopAllRequest();
     // 停止指定batchid的批次请求任务
@@ -60,6 +67,27 @@ public:
     bool setMaxThreadCount(int iMax);
     int maxThreadCount();
 
+    // 统计信息快照（Prometheus文本格式）: 请求数、收发字节数、重试数、按错误分类的失败数、
+    //	排队数/活动线程数/未完成的请求数，以及按请求类型和主机统计的耗时直方图
+    QByteArray metricsSnapshot();
+    // 将统计信息快照写入文件，或以"local:"开头时写入本地套接字（如"local:qmtnetwork-metrics"）
+    bool writeMetricsSnapshot(const QString& strTarget, QString& strError);
+
+    // 对冲请求（RequestTask::bHedge）的预算：最多占启用了对冲的请求数的百分比（0-100，默认10）
+    //	发出数、先返回的次数、因预算不足未发出的次数见统计信息中的qmtnetwork_hedge*
+    static void setHedgeBudget(int nPercent);
+
+    // 设置日志级别. strCategory为空时设置所有分类，
+    //	否则为manager/request/download/mtdownload/upload/batch/trace之一（无效时返回false）
+    //	注：Release版本编译时已去掉Trace/Debug级别的日志
+    static bool setLogLevel(QMTNetwork::LogLevel eLevel, const QString& strCategory = QString());
+
+    // 开始记录任务排队、执行、重定向、多线程下载分段和写文件等事件（默认不记录）
+    //	nEventsPerThread: 每个线程最多保留的事件数，超出后覆盖最早的事件
+    void startTracing(int nEventsPerThread = 65536);
+    // 结束记录，并保存为Chrome Trace格式的JSON文件（可用chrome://tracing或Perfetto打开）
+    bool stopTracing(const QString& strJsonFile, QString& strError);
+
 Q_SIGNALS:
     void errorMessage(const QString& error);
     void batchRequestFinished(quint64 uiBatchId, bool bAllSuccess);
@@ -69,6 +97,8 @@ Q_SIGNALS:
     void uploadProgress(quint64 uiRequestId, qint64 iBytesUpload, qint64 iBytesTotal);
     void batchDownloadProgress(quint64 uiBatchId, qint64 iBytesDownload);
     void batchUploadProgress(quint64 uiBatchId, qint64 iBytesUpload);
+    // 清单批量请求的进度. nResumeLine之前的任务均已结束，可作为下次继续执行的起始行
+    void batchManifestProgress(quint64 uiBatchId, qint64 nResumeLine, qint64 iBytesRead, qint64 iBytesTotal);
 
 public Q_SLOTS :
     void onRequestFinished(const QMTNetwork::RequestTask &);
@@ -0,0 +1,94 @@
+﻿/*
+@Brief:			Qt multi-threaded network module
+@Author:		vilas wang
+@Contact:		QQ451930733
+
+The Qt multi-threaded network module is a wrapper of Qt Network module, and combine with thread-pool to realize multi-threaded networking.
+- Multi-task concurrent(Each request task is executed in different threads).
+- Both single request and batch request mode are supported.
+- Large file multi-thread downloading supported. (The thread here refers to the download channel. Download speed is faster.)
+- HTTP(S)/FTP protocol supported.
+- Multiple request methods supported. (GET/POST/PUT/DELETE/HEAD)
+- Asynchronous API.
+- Thread-safe.
+
+Note: You must call NetworkManager::initialize() before use, and call NetworkManager::unInitialize() before application quit.
+That must be called in the main thread.
+*/
+
+#ifndef NETWORKTRANSPORT_H
+#define NETWORKTRANSPORT_H
+
+#include <functional>
+#include <memory>
+#include <QMap>
+#include <QStringList>
+#include "networkdefs.h"
+#include "networkglobal.h"
+
+// 传输向请求回报响应的接口（由本模块实现，传输只调用）
+//	所有函数都须在调用NetworkTransport::start()的线程中调用.
+class NetworkTransportSink
+{
+public:
+    // 响应的状态码（非HTTP的传输用HTTP的语义，如200/404）和长度（未知时为-1）
+    virtual void setMetaData(int nStatusCode, qint64 nContentLength, const QMap<QByteArray, QByteArray>& mapHeader) = 0;
+    // 响应体数据. eTypeDownload写入文件，其它类型作为RequestTask::bytesContent返回. 写入失败时返回false，传输应停止
+    virtual bool write(const char *pData, qint64 nSize) = 0;
+    // 写文件跟不上时返回true，传输应暂停产生数据，直到NetworkTransport::resume()被调用
+    virtual bool isBackedUp() const = 0;
+    // 进度（bDownload: false为上传）
+    virtual void setProgress(qint64 iBytes, qint64 iTotalBytes, bool bDownload) = 0;
+    // 结束. 只有第一次调用有效，之后不应再调用其它函数
+    virtual void finish(bool bSuccess, const QString& strError) = 0;
+
+protected:
+    virtual ~NetworkTransportSink() {}
+};
+
+// 可替换的传输（代替QNetworkAccessManager执行eTypeDownload/eTypeUpload/eTypeGet/eTypePost/eTypePut/eTypeDelete/eTypeHead）
+//	对象在执行请求的线程中创建、使用和释放，该线程有事件循环，传输可在其中使用QObject/定时器异步完成，
+//	也可在start()中同步完成. 重定向、重试等由传输自己处理.
+class NetworkTransport
+{
+public:
+    virtual ~NetworkTransport() {}
+
+    // 能否执行该任务，不能时使用默认传输
+    virtual bool supports(const QMTNetwork::RequestTask& task) const { Q_UNUSED(task); return true; }
+    // 开始执行. 请求体由传输从task中读取（strReqArg/bytesBody/fnBodyFactory）
+    virtual void start(const QMTNetwork::RequestTask& task, NetworkTransportSink *pSink) = 0;
+    // isBackedUp()之后写文件已追上
+    virtual void resume() {}
+    // 取消，之后不能再调用pSink
+    virtual void abort() = 0;
+};
+
+// 传输的注册表（线程安全）
+//	内置的传输: "qnam"（QNetworkAccessManager，默认）, "native"（Linux sendfile/splice，见RequestTask::strTransport）,
+//	"mock"（mock://，内存中生成响应，用于测试和基准），"file"（直接读写本地文件）.
+//	选择顺序: RequestTask::strTransport; 为空时按url的协议查找; 都没有时使用"qnam".
+//	内置的协议映射只有mock:// -> "mock"；file://默认使用"qnam"，要改用"file"须设置strTransport或调用setSchemeTransport().
+class NETWORK_EXPORT NetworkTransportRegistry
+{
+public:
+    typedef std::function<std::unique_ptr<NetworkTransport>()> Factory;
+
+    // 注册（已存在时替换）名为strName的传输. listSchemes: 这些协议的url默认使用该传输.
+    //	"qnam"和"native"不能替换，返回false. 之后开始执行的请求生效.
+    static bool registerTransport(const QString& strName, const Factory& factory, const QStringList& listSchemes = QStringList());
+    static void unregisterTransport(const QString& strName);
+    // 指定协议的url默认使用的传输（strName为空时取消，改用"qnam"）. 之后开始执行的请求生效.
+    static void setSchemeTransport(const QString& strScheme, const QString& strName);
+    // 已注册的传输名（包括内置的）
+    static QStringList transports();
+
+private:
+    friend class NetworkRequestFactory;
+    // 任务使用的传输名
+    static QString transportName(const QMTNetwork::RequestTask& task);
+    // 创建已注册的传输（不包括"qnam"和"native"），不存在时返回nullptr
+    static std::unique_ptr<NetworkTransport> create(const QString& strName);
+};
+
+#endif // NETWORKTRANSPORT_H
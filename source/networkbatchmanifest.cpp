@@ -0,0 +1,400 @@
+﻿#include "networkbatchmanifest.h"
+#include <cstring>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonParseError>
+#include "classmemorytracer.h"
+#include "networklog.h"
+
+using namespace QMTNetwork;
+
+class NetworkBatchManifestPrivate
+{
+public:
+    NetworkBatchManifestPrivate()
+        : eFormat(NetworkBatchManifest::eFormatCsv)
+        , pData(nullptr)
+        , nSize(0)
+        , nOffset(0)
+        , nLine(0)
+        , nInvalidLine(0)
+    {
+    }
+
+    // 取出下一行（不含换行符），返回false表示已到末尾
+    bool nextLine(const char*& pLine, qint64& nLength);
+
+    bool parseCsvLine(const QString& strLine, RequestTask& task) const;
+    bool parseJsonLine(const QByteArray& bytesLine, RequestTask& task) const;
+
+    static QStringList splitCsv(const QString& strLine);
+    static void parseHeaders(const QString& strHeaders, QMap<QByteArray, QByteArray>& mapHeader);
+
+    QFile file;
+    NetworkBatchManifest::Format eFormat;
+    const char *pData;
+    qint64 nSize;
+    qint64 nOffset;
+    qint64 nLine;
+    qint64 nInvalidLine;
+};
+
+bool NetworkBatchManifestPrivate::nextLine(const char*& pLine, qint64& nLength)
+{
+    if (nullptr == pData || nOffset >= nSize)
+    {
+        return false;
+    }
+
+    pLine = pData + nOffset;
+    const void *pEnd = memchr(pLine, '\n', static_cast<size_t>(nSize - nOffset));
+    if (pEnd)
+    {
+        nLength = static_cast<const char *>(pEnd) - pLine;
+        nOffset += nLength + 1;
+    }
+    else
+    {
+        nLength = nSize - nOffset;
+        nOffset = nSize;
+    }
+    if (nLength > 0 && pLine[nLength - 1] == '\r')
+    {
+        --nLength;
+    }
+    ++nLine;
+    return true;
+}
+
+QStringList NetworkBatchManifestPrivate::splitCsv(const QString& strLine)
+{
+    QStringList lstField;
+    QString strField;
+    bool bQuoted = false;
+    for (int i = 0; i < strLine.size(); ++i)
+    {
+        const QChar ch = strLine.at(i);
+        if (bQuoted)
+        {
+            if (ch == QLatin1Char('"'))
+            {
+                if (i + 1 < strLine.size() && strLine.at(i + 1) == QLatin1Char('"'))
+                {
+                    strField.append(ch);
+                    ++i;
+                }
+                else
+                {
+                    bQuoted = false;
+                }
+            }
+            else
+            {
+                strField.append(ch);
+            }
+        }
+        else if (ch == QLatin1Char('"'))
+        {
+            bQuoted = true;
+        }
+        else if (ch == QLatin1Char(','))
+        {
+            lstField.append(strField);
+            strField.clear();
+        }
+        else
+        {
+            strField.append(ch);
+        }
+    }
+    lstField.append(strField);
+    return lstField;
+}
+
+void NetworkBatchManifestPrivate::parseHeaders(const QString& strHeaders, QMap<QByteArray, QByteArray>& mapHeader)
+{
+    foreach(const QString& strHeader, strHeaders.split(QLatin1Char('|'), QString::SkipEmptyParts))
+    {
+        const int nPos = strHeader.indexOf(QLatin1Char(':'));
+        if (nPos > 0)
+        {
+            mapHeader.insert(strHeader.left(nPos).trimmed().toUtf8(), strHeader.mid(nPos + 1).trimmed().toUtf8());
+        }
+    }
+}
+
+bool NetworkBatchManifestPrivate::parseCsvLine(const QString& strLine, RequestTask& task) const
+{
+    const QStringList& lstField = splitCsv(strLine);
+    if (lstField.size() < 1 || lstField.at(0).trimmed().isEmpty())
+    {
+        return false;
+    }
+
+    task.url = lstField.at(0).trimmed();
+    if (lstField.size() > 1 && !lstField.at(1).trimmed().isEmpty())
+    {
+        bool bOk = false;
+        const int nType = lstField.at(1).trimmed().toInt(&bOk);
+        if (!bOk)
+        {
+            return false;
+        }
+        task.eType = RequestType(nType);
+    }
+    if (lstField.size() > 2 && !lstField.at(2).isEmpty())
+    {
+        task.strReqArg = lstField.at(2);
+    }
+    if (lstField.size() > 3 && !lstField.at(3).trimmed().isEmpty())
+    {
+        task.strSaveFileName = lstField.at(3).trimmed();
+    }
+    if (lstField.size() > 4)
+    {
+        parseHeaders(lstField.at(4), task.mapRawHeader);
+    }
+    if (lstField.size() > 5 && !lstField.at(5).trimmed().isEmpty())
+    {
+        task.strChecksum = lstField.at(5).trimmed();
+    }
+    return true;
+}
+
+bool NetworkBatchManifestPrivate::parseJsonLine(const QByteArray& bytesLine, RequestTask& task) const
+{
+    QJsonParseError error;
+    const QJsonDocument& doc = QJsonDocument::fromJson(bytesLine, &error);
+    if (error.error != QJsonParseError::NoError || !doc.isObject())
+    {
+        return false;
+    }
+
+    const QJsonObject& obj = doc.object();
+    task.url = obj.value(QLatin1String("url")).toString().trimmed();
+    if (task.url.isEmpty())
+    {
+        return false;
+    }
+    if (obj.contains(QLatin1String("type")))
+    {
+        task.eType = RequestType(obj.value(QLatin1String("type")).toInt(eTypeUnknown));
+    }
+    if (obj.contains(QLatin1String("arg")))
+    {
+        task.strReqArg = obj.value(QLatin1String("arg")).toString();
+    }
+    if (obj.contains(QLatin1String("saveFileName")))
+    {
+        task.strSaveFileName = obj.value(QLatin1String("saveFileName")).toString();
+    }
+    if (obj.contains(QLatin1String("checksum")))
+    {
+        task.strChecksum = obj.value(QLatin1String("checksum")).toString();
+    }
+    const QJsonArray& arrMirrors = obj.value(QLatin1String("mirrors")).toArray();
+    for (const QJsonValue& value : arrMirrors)
+    {
+        const QString& strMirror = value.toString().trimmed();
+        if (!strMirror.isEmpty())
+        {
+            task.listMirrorUrls << strMirror;
+        }
+    }
+    const QJsonObject& objHeaders = obj.value(QLatin1String("headers")).toObject();
+    for (auto iter = objHeaders.constBegin(); iter != objHeaders.constEnd(); ++iter)
+    {
+        task.mapRawHeader.insert(iter.key().toUtf8(), iter.value().toString().toUtf8());
+    }
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+NetworkBatchManifest::NetworkBatchManifest()
+    : d_ptr(new NetworkBatchManifestPrivate)
+{
+    TRACE_CLASS_CONSTRUCTOR(NetworkBatchManifest);
+}
+
+NetworkBatchManifest::~NetworkBatchManifest()
+{
+    TRACE_CLASS_DESTRUCTOR(NetworkBatchManifest);
+    close();
+}
+
+bool NetworkBatchManifest::open(const QString& strFilePath, Format eFormat, QString& strError)
+{
+    Q_D(NetworkBatchManifest);
+    close();
+    strError.clear();
+
+    if (eFormat == eFormatAuto)
+    {
+        const QString& strSuffix = QFileInfo(strFilePath).suffix();
+        if (strSuffix.compare(QLatin1String("jsonl"), Qt::CaseInsensitive) == 0
+            || strSuffix.compare(QLatin1String("ndjson"), Qt::CaseInsensitive) == 0
+            || strSuffix.compare(QLatin1String("json"), Qt::CaseInsensitive) == 0)
+        {
+            eFormat = eFormatJsonLines;
+        }
+        else
+        {
+            eFormat = eFormatCsv;
+        }
+    }
+    d->eFormat = eFormat;
+
+    d->file.setFileName(strFilePath);
+    if (!d->file.open(QIODevice::ReadOnly))
+    {
+        strError = QStringLiteral("Error: QFile::open(%1) - %2").arg(strFilePath).arg(d->file.errorString());
+        NETWORK_LOG(eLogWarn, eCategoryBatch) << strError;
+        return false;
+    }
+
+    d->nSize = d->file.size();
+    if (d->nSize > 0)
+    {
+        // 清单以只读映射的方式访问，由系统按需换页，不占用堆内存
+        d->pData = reinterpret_cast<const char *>(d->file.map(0, d->nSize));
+        if (nullptr == d->pData)
+        {
+            strError = QStringLiteral("Error: QFile::map(%1) - %2").arg(strFilePath).arg(d->file.errorString());
+            NETWORK_LOG(eLogWarn, eCategoryBatch) << strError;
+            d->file.close();
+            d->nSize = 0;
+            return false;
+        }
+
+        // 跳过UTF-8 BOM
+        if (d->nSize >= 3 && memcmp(d->pData, "\xEF\xBB\xBF", 3) == 0)
+        {
+            d->nOffset = 3;
+        }
+    }
+    return true;
+}
+
+void NetworkBatchManifest::close()
+{
+    Q_D(NetworkBatchManifest);
+    if (d->pData)
+    {
+        d->file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(d->pData)));
+        d->pData = nullptr;
+    }
+    if (d->file.isOpen())
+    {
+        d->file.close();
+    }
+    d->nSize = 0;
+    d->nOffset = 0;
+    d->nLine = 0;
+    d->nInvalidLine = 0;
+}
+
+bool NetworkBatchManifest::isOpen() const
+{
+    Q_D(const NetworkBatchManifest);
+    return d->file.isOpen();
+}
+
+bool NetworkBatchManifest::seekLine(qint64 nLine)
+{
+    Q_D(NetworkBatchManifest);
+    if (!isOpen() || nLine < d->nLine)
+    {
+        return false;
+    }
+
+    const char *pLine = nullptr;
+    qint64 nLength = 0;
+    while (d->nLine < nLine)
+    {
+        if (!d->nextLine(pLine, nLength))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NetworkBatchManifest::readNext(RequestTask& task, qint64& nLine)
+{
+    Q_D(NetworkBatchManifest);
+
+    const char *pLine = nullptr;
+    qint64 nLength = 0;
+    while (d->nextLine(pLine, nLength))
+    {
+        // 跳过行首空白、空行和注释行
+        while (nLength > 0 && (*pLine == ' ' || *pLine == '\t'))
+        {
+            ++pLine;
+            --nLength;
+        }
+        if (nLength == 0 || *pLine == '#')
+        {
+            continue;
+        }
+
+        RequestTask t = task;
+        bool bOk = false;
+        if (d->eFormat == eFormatJsonLines)
+        {
+            bOk = d->parseJsonLine(QByteArray::fromRawData(pLine, static_cast<int>(nLength)), t);
+        }
+        else
+        {
+            bOk = d->parseCsvLine(QString::fromUtf8(pLine, static_cast<int>(nLength)), t);
+        }
+
+        if (!bOk)
+        {
+            ++d->nInvalidLine;
+            NETWORK_LOG(eLogWarn, eCategoryBatch) << "Invalid manifest line:" << (d->nLine - 1);
+            continue;
+        }
+
+        nLine = d->nLine - 1;
+        task = t;
+        return true;
+    }
+    return false;
+}
+
+bool NetworkBatchManifest::atEnd() const
+{
+    Q_D(const NetworkBatchManifest);
+    return (nullptr == d->pData || d->nOffset >= d->nSize);
+}
+
+qint64 NetworkBatchManifest::currentLine() const
+{
+    Q_D(const NetworkBatchManifest);
+    return d->nLine;
+}
+
+qint64 NetworkBatchManifest::bytesRead() const
+{
+    Q_D(const NetworkBatchManifest);
+    return d->nOffset;
+}
+
+qint64 NetworkBatchManifest::size() const
+{
+    Q_D(const NetworkBatchManifest);
+    return d->nSize;
+}
+
+qint64 NetworkBatchManifest::invalidLineCount() const
+{
+    Q_D(const NetworkBatchManifest);
+    return d->nInvalidLine;
+}
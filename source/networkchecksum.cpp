@@ -0,0 +1,529 @@
+﻿#include "networkchecksum.h"
+#include <string.h>
+#include <vector>
+#include <QFile>
+#include <QtEndian>
+#include <QCryptographicHash>
+#include "networklog.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define NETWORK_CRC32C_X86
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define NETWORK_CRC32C_TARGET
+#else
+#include <cpuid.h>
+#define NETWORK_CRC32C_TARGET __attribute__((target("sse4.2")))
+#endif
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define NETWORK_CRC32C_ARM
+#include <arm_acle.h>
+#endif
+
+namespace {
+    //////////////////////////////////////////////////////////////////////////
+    // CRC32C (Castagnoli)
+    const quint32 Crc32cPoly = 0x82F63B78u;
+
+    // 查表法（slicing-by-8），没有CRC指令时使用
+    struct Crc32cTable
+    {
+        quint32 table[8][256];
+
+        Crc32cTable()
+        {
+            for (quint32 i = 0; i < 256; ++i)
+            {
+                quint32 crc = i;
+                for (int k = 0; k < 8; ++k)
+                {
+                    crc = (crc & 1) ? (crc >> 1) ^ Crc32cPoly : (crc >> 1);
+                }
+                table[0][i] = crc;
+            }
+            for (quint32 i = 0; i < 256; ++i)
+            {
+                for (int k = 1; k < 8; ++k)
+                {
+                    table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+                }
+            }
+        }
+    };
+
+    quint32 crc32cSoftware(quint32 crc, const uchar *p, size_t n)
+    {
+        static const Crc32cTable s_table;
+        const quint32 (*t)[256] = s_table.table;
+        while (n >= 8)
+        {
+            const quint64 v = qFromLittleEndian<quint64>(p) ^ crc;
+            crc = t[7][v & 0xFF] ^ t[6][(v >> 8) & 0xFF] ^ t[5][(v >> 16) & 0xFF] ^ t[4][(v >> 24) & 0xFF]
+                ^ t[3][(v >> 32) & 0xFF] ^ t[2][(v >> 40) & 0xFF] ^ t[1][(v >> 48) & 0xFF] ^ t[0][v >> 56];
+            p += 8;
+            n -= 8;
+        }
+        while (n--)
+        {
+            crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#if defined(NETWORK_CRC32C_X86)
+    bool cpuHasSse42()
+    {
+#if defined(_MSC_VER)
+        int info[4] = { 0 };
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+#else
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+        return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2);
+#endif
+    }
+
+    NETWORK_CRC32C_TARGET quint32 crc32cHardware(quint32 crc, const uchar *p, size_t n)
+    {
+        while (n > 0 && (reinterpret_cast<quintptr>(p) & 7))
+        {
+            crc = _mm_crc32_u8(crc, *p++);
+            --n;
+        }
+        quint64 crc64 = crc;
+        while (n >= 8)
+        {
+            crc64 = _mm_crc32_u64(crc64, *reinterpret_cast<const quint64 *>(p));
+            p += 8;
+            n -= 8;
+        }
+        crc = static_cast<quint32>(crc64);
+        while (n--)
+        {
+            crc = _mm_crc32_u8(crc, *p++);
+        }
+        return crc;
+    }
+#elif defined(NETWORK_CRC32C_ARM)
+    quint32 crc32cHardware(quint32 crc, const uchar *p, size_t n)
+    {
+        while (n > 0 && (reinterpret_cast<quintptr>(p) & 7))
+        {
+            crc = __crc32cb(crc, *p++);
+            --n;
+        }
+        while (n >= 8)
+        {
+            crc = __crc32cd(crc, *reinterpret_cast<const quint64 *>(p));
+            p += 8;
+            n -= 8;
+        }
+        while (n--)
+        {
+            crc = __crc32cb(crc, *p++);
+        }
+        return crc;
+    }
+#endif
+
+    typedef quint32 (*Crc32cFunc)(quint32, const uchar *, size_t);
+    Crc32cFunc crc32cFunc()
+    {
+#if defined(NETWORK_CRC32C_X86)
+        static const Crc32cFunc s_func = cpuHasSse42() ? crc32cHardware : crc32cSoftware;
+        return s_func;
+#elif defined(NETWORK_CRC32C_ARM)
+        return crc32cHardware;
+#else
+        return crc32cSoftware;
+#endif
+    }
+
+    // GF(2)矩阵运算，用于合并两段的CRC（同zlib的crc32_combine）
+    quint32 gf2MatrixTimes(const quint32 *pMatrix, quint32 uiVector)
+    {
+        quint32 uiSum = 0;
+        while (uiVector)
+        {
+            if (uiVector & 1)
+            {
+                uiSum ^= *pMatrix;
+            }
+            uiVector >>= 1;
+            ++pMatrix;
+        }
+        return uiSum;
+    }
+
+    void gf2MatrixSquare(quint32 *pSquare, const quint32 *pMatrix)
+    {
+        for (int n = 0; n < 32; ++n)
+        {
+            pSquare[n] = gf2MatrixTimes(pMatrix, pMatrix[n]);
+        }
+    }
+
+    // crc1: 前一段的CRC, crc2: 后一段（长度nSize2）的CRC
+    quint32 crc32cCombine(quint32 crc1, quint32 crc2, qint64 nSize2)
+    {
+        if (nSize2 <= 0)
+        {
+            return crc1;
+        }
+
+        quint32 even[32];
+        quint32 odd[32];
+        odd[0] = Crc32cPoly;
+        quint32 uiRow = 1;
+        for (int n = 1; n < 32; ++n)
+        {
+            odd[n] = uiRow;
+            uiRow <<= 1;
+        }
+        gf2MatrixSquare(even, odd);
+        gf2MatrixSquare(odd, even);
+
+        do
+        {
+            gf2MatrixSquare(even, odd);
+            if (nSize2 & 1)
+            {
+                crc1 = gf2MatrixTimes(even, crc1);
+            }
+            nSize2 >>= 1;
+            if (nSize2 == 0)
+            {
+                break;
+            }
+            gf2MatrixSquare(odd, even);
+            if (nSize2 & 1)
+            {
+                crc1 = gf2MatrixTimes(odd, crc1);
+            }
+            nSize2 >>= 1;
+        } while (nSize2 != 0);
+
+        return crc1 ^ crc2;
+    }
+
+    class Crc32cChecksum : public NetworkChecksum
+    {
+    public:
+        Crc32cChecksum() : m_uiState(0xFFFFFFFFu) {}
+
+        bool isCombinable() const Q_DECL_OVERRIDE { return true; }
+
+        void combine(const NetworkChecksum& next) Q_DECL_OVERRIDE
+        {
+            const Crc32cChecksum& crcNext = static_cast<const Crc32cChecksum&>(next);
+            m_uiState = ~crc32cCombine(~m_uiState, ~crcNext.m_uiState, next.size());
+            m_nSize += next.size();
+        }
+
+        QByteArray hexDigest() const Q_DECL_OVERRIDE
+        {
+            return QByteArray::number(~m_uiState, 16).rightJustified(8, '0');
+        }
+
+    protected:
+        void doUpdate(const char *pData, qint64 nSize) Q_DECL_OVERRIDE
+        {
+            m_uiState = crc32cFunc()(m_uiState, reinterpret_cast<const uchar *>(pData), static_cast<size_t>(nSize));
+        }
+
+        void doReset() Q_DECL_OVERRIDE
+        {
+            m_uiState = 0xFFFFFFFFu;
+        }
+
+    private:
+        quint32 m_uiState;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // XXH64（seed = 0）
+    const quint64 Prime64_1 = 11400714785074694791ULL;
+    const quint64 Prime64_2 = 14029467366897019727ULL;
+    const quint64 Prime64_3 = 1609587929392839161ULL;
+    const quint64 Prime64_4 = 9650029242287828579ULL;
+    const quint64 Prime64_5 = 2870177450012600261ULL;
+
+    inline quint64 rotl64(quint64 x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    inline quint64 xxh64Round(quint64 acc, quint64 input)
+    {
+        acc += input * Prime64_2;
+        acc = rotl64(acc, 31);
+        return acc * Prime64_1;
+    }
+
+    inline quint64 xxh64MergeRound(quint64 acc, quint64 val)
+    {
+        acc ^= xxh64Round(0, val);
+        return acc * Prime64_1 + Prime64_4;
+    }
+
+    class Xxh64Checksum : public NetworkChecksum
+    {
+    public:
+        Xxh64Checksum() { doReset(); }
+
+        QByteArray hexDigest() const Q_DECL_OVERRIDE
+        {
+            quint64 h = 0;
+            if (m_nSize >= 32)
+            {
+                h = rotl64(m_v[0], 1) + rotl64(m_v[1], 7) + rotl64(m_v[2], 12) + rotl64(m_v[3], 18);
+                for (int i = 0; i < 4; ++i)
+                {
+                    h = xxh64MergeRound(h, m_v[i]);
+                }
+            }
+            else
+            {
+                h = Prime64_5;
+            }
+            h += static_cast<quint64>(m_nSize);
+
+            const uchar *p = m_buffer;
+            const uchar *pEnd = m_buffer + m_nBuffered;
+            while (p + 8 <= pEnd)
+            {
+                h ^= xxh64Round(0, qFromLittleEndian<quint64>(p));
+                h = rotl64(h, 27) * Prime64_1 + Prime64_4;
+                p += 8;
+            }
+            if (p + 4 <= pEnd)
+            {
+                h ^= static_cast<quint64>(qFromLittleEndian<quint32>(p)) * Prime64_1;
+                h = rotl64(h, 23) * Prime64_2 + Prime64_3;
+                p += 4;
+            }
+            while (p < pEnd)
+            {
+                h ^= (*p++) * Prime64_5;
+                h = rotl64(h, 11) * Prime64_1;
+            }
+
+            h ^= h >> 33;
+            h *= Prime64_2;
+            h ^= h >> 29;
+            h *= Prime64_3;
+            h ^= h >> 32;
+            return QByteArray::number(h, 16).rightJustified(16, '0');
+        }
+
+    protected:
+        void doUpdate(const char *pData, qint64 nSize) Q_DECL_OVERRIDE
+        {
+            const uchar *p = reinterpret_cast<const uchar *>(pData);
+            const uchar *pEnd = p + nSize;
+
+            // 先补齐上次剩下的不足32字节的数据
+            if (m_nBuffered > 0)
+            {
+                const int nCopy = static_cast<int>(qMin<qint64>(32 - m_nBuffered, nSize));
+                memcpy(m_buffer + m_nBuffered, p, nCopy);
+                m_nBuffered += nCopy;
+                p += nCopy;
+                if (m_nBuffered < 32)
+                {
+                    return;
+                }
+                consume(m_buffer);
+                m_nBuffered = 0;
+            }
+            while (p + 32 <= pEnd)
+            {
+                consume(p);
+                p += 32;
+            }
+            if (p < pEnd)
+            {
+                m_nBuffered = static_cast<int>(pEnd - p);
+                memcpy(m_buffer, p, m_nBuffered);
+            }
+        }
+
+        void doReset() Q_DECL_OVERRIDE
+        {
+            m_v[0] = Prime64_1 + Prime64_2;
+            m_v[1] = Prime64_2;
+            m_v[2] = 0;
+            m_v[3] = 0 - Prime64_1;
+            m_nBuffered = 0;
+        }
+
+    private:
+        void consume(const uchar *p)
+        {
+            m_v[0] = xxh64Round(m_v[0], qFromLittleEndian<quint64>(p));
+            m_v[1] = xxh64Round(m_v[1], qFromLittleEndian<quint64>(p + 8));
+            m_v[2] = xxh64Round(m_v[2], qFromLittleEndian<quint64>(p + 16));
+            m_v[3] = xxh64Round(m_v[3], qFromLittleEndian<quint64>(p + 24));
+        }
+
+    private:
+        quint64 m_v[4];
+        uchar m_buffer[32];
+        int m_nBuffered;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    class CryptographicChecksum : public NetworkChecksum
+    {
+    public:
+        explicit CryptographicChecksum(QCryptographicHash::Algorithm eAlgorithm) : m_hash(eAlgorithm) {}
+
+        QByteArray hexDigest() const Q_DECL_OVERRIDE
+        {
+            return m_hash.result().toHex();
+        }
+
+    protected:
+        void doUpdate(const char *pData, qint64 nSize) Q_DECL_OVERRIDE
+        {
+            m_hash.addData(pData, static_cast<int>(nSize));
+        }
+
+        void doReset() Q_DECL_OVERRIDE
+        {
+            m_hash.reset();
+        }
+
+    private:
+        QCryptographicHash m_hash;
+    };
+
+    // 算法名对应的实现和十六进制摘要的长度
+    NetworkChecksum *createAlgorithm(const QByteArray& strAlgorithm, int& nHexLength)
+    {
+        if (strAlgorithm == "crc32c")
+        {
+            nHexLength = 8;
+            return new Crc32cChecksum;
+        }
+        if (strAlgorithm == "xxh64")
+        {
+            nHexLength = 16;
+            return new Xxh64Checksum;
+        }
+        if (strAlgorithm == "md5")
+        {
+            nHexLength = 32;
+            return new CryptographicChecksum(QCryptographicHash::Md5);
+        }
+        if (strAlgorithm == "sha1")
+        {
+            nHexLength = 40;
+            return new CryptographicChecksum(QCryptographicHash::Sha1);
+        }
+        if (strAlgorithm == "sha256")
+        {
+            nHexLength = 64;
+            return new CryptographicChecksum(QCryptographicHash::Sha256);
+        }
+        if (strAlgorithm == "sha512")
+        {
+            nHexLength = 128;
+            return new CryptographicChecksum(QCryptographicHash::Sha512);
+        }
+        return nullptr;
+    }
+}
+
+std::unique_ptr<NetworkChecksum> NetworkChecksum::create(const QString& strChecksum, QString& strError)
+{
+    std::unique_ptr<NetworkChecksum> pChecksum;
+    const int nPos = strChecksum.indexOf(QLatin1Char(':'));
+    if (nPos <= 0)
+    {
+        strError = QStringLiteral("Error: Invalid checksum(%1), expected \"algorithm:hexdigest\"").arg(strChecksum);
+        return pChecksum;
+    }
+
+    // "SHA-256"与"sha256"等价
+    const QByteArray strAlgorithm = strChecksum.left(nPos).trimmed().toLower().remove(QLatin1Char('-')).toLatin1();
+    const QByteArray strExpected = strChecksum.mid(nPos + 1).trimmed().toLower().toLatin1();
+    int nHexLength = 0;
+    pChecksum.reset(createAlgorithm(strAlgorithm, nHexLength));
+    if (!pChecksum.get())
+    {
+        strError = QStringLiteral("Error: Unsupported checksum algorithm(%1)").arg(QString::fromLatin1(strAlgorithm));
+        return pChecksum;
+    }
+    if (strExpected.size() != nHexLength || QByteArray::fromHex(strExpected).toHex() != strExpected)
+    {
+        strError = QStringLiteral("Error: Invalid %1 digest(%2)").arg(QString::fromLatin1(strAlgorithm)).arg(QString::fromLatin1(strExpected));
+        pChecksum.reset();
+        return pChecksum;
+    }
+    pChecksum->m_strAlgorithm = strAlgorithm;
+    pChecksum->m_strExpected = strExpected;
+    return pChecksum;
+}
+
+std::unique_ptr<NetworkChecksum> NetworkChecksum::clone() const
+{
+    int nHexLength = 0;
+    std::unique_ptr<NetworkChecksum> pChecksum(createAlgorithm(m_strAlgorithm, nHexLength));
+    pChecksum->m_strAlgorithm = m_strAlgorithm;
+    pChecksum->m_strExpected = m_strExpected;
+    return pChecksum;
+}
+
+void NetworkChecksum::update(const char *pData, qint64 nSize)
+{
+    if (nSize > 0)
+    {
+        doUpdate(pData, nSize);
+        m_nSize += nSize;
+    }
+}
+
+void NetworkChecksum::reset()
+{
+    doReset();
+    m_nSize = 0;
+}
+
+bool NetworkChecksum::updateFromFile(const QString& strFilePath, qint64 nOffset, qint64 nSize, QString& strError)
+{
+    QFile file(strFilePath);
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(nOffset))
+    {
+        strError = QStringLiteral("Error: QFile::open(%1) - %2").arg(strFilePath).arg(file.errorString());
+        return false;
+    }
+
+    std::vector<char> buffer(1024 * 1024);
+    while (nSize > 0)
+    {
+        const qint64 nRead = file.read(buffer.data(), qMin<qint64>(nSize, buffer.size()));
+        if (nRead <= 0)
+        {
+            strError = QStringLiteral("Error: QFile::read(%1) - %2").arg(strFilePath).arg(file.errorString());
+            return false;
+        }
+        update(buffer.data(), nRead);
+        nSize -= nRead;
+    }
+    return true;
+}
+
+bool NetworkChecksum::verify(QString& strError) const
+{
+    const QByteArray& strActual = hexDigest();
+    if (strActual != m_strExpected)
+    {
+        strError = QStringLiteral("Error: %1 checksum mismatch - expected %2, actual %3")
+            .arg(QString::fromLatin1(m_strAlgorithm)).arg(QString::fromLatin1(m_strExpected)).arg(QString::fromLatin1(strActual));
+        NETWORK_LOG(eLogError, eCategoryDownload) << strError;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+﻿#ifndef NETWORKCHECKSUM_H
+#define NETWORKCHECKSUM_H
+
+#include <memory>
+#include <QString>
+#include <QByteArray>
+
+// 下载数据的摘要，随数据到达流式计算，不需要下载完成后再读一遍文件
+//	RequestTask::strChecksum格式为"算法:十六进制摘要"，支持的算法：
+//	crc32c（SSE4.2/ARMv8 CRC指令，可由分段的结果合并）, xxh64, md5, sha1, sha256, sha512.
+class NetworkChecksum
+{
+public:
+    // 解析strChecksum，格式错误或算法不支持时返回nullptr
+    static std::unique_ptr<NetworkChecksum> create(const QString& strChecksum, QString& strError);
+    virtual ~NetworkChecksum() {}
+
+    // 同一算法、同一期望值的新对象（多线程下载的每个分段一个）
+    std::unique_ptr<NetworkChecksum> clone() const;
+
+    void update(const char *pData, qint64 nSize);
+    void update(const QByteArray& bytes) { update(bytes.constData(), bytes.size()); }
+    void reset();
+    // 读取文件的一段并计入摘要（多线程下载按顺序计算时，用于补上空缺之后读取靠后分段已写入的数据）
+    bool updateFromFile(const QString& strFilePath, qint64 nOffset, qint64 nSize, QString& strError);
+
+    // 是否可以由分段的摘要合并出整个文件的摘要
+    virtual bool isCombinable() const { return false; }
+    // 把紧接在后面的一段数据的摘要合并进来
+    virtual void combine(const NetworkChecksum& next) { Q_UNUSED(next); }
+
+    // 小写十六进制
+    virtual QByteArray hexDigest() const = 0;
+    // 与期望值比较，不一致时返回false
+    bool verify(QString& strError) const;
+
+    const QByteArray& algorithm() const { return m_strAlgorithm; }
+    qint64 size() const { return m_nSize; }
+
+protected:
+    NetworkChecksum() : m_nSize(0) {}
+    virtual void doUpdate(const char *pData, qint64 nSize) = 0;
+    virtual void doReset() = 0;
+
+    qint64 m_nSize;
+
+private:
+    Q_DISABLE_COPY(NetworkChecksum);
+    QByteArray m_strAlgorithm;
+    QByteArray m_strExpected;
+};
+
+#endif // NETWORKCHECKSUM_H
@@ -1,12 +1,24 @@
 ﻿#include "networkcommonrequest.h"
+#include <climits>
 #include <QDebug>
 #include <QNetworkAccessManager>
+#include <QHttpMultiPart>
+#include <QBuffer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTimer>
 #include "networkutility.h"
+#include "networkmetrics.h"
+#include "networktracer.h"
+#include "networklog.h"
 
 using namespace QMTNetwork;
 
 NetworkCommonRequest::NetworkCommonRequest(QObject *parent /* = nullptr */)
     : NetworkRequest(parent)
+    , m_pHedgeTimer(nullptr)
+    , m_pHedge(nullptr)
+    , m_bPrimaryFailed(false)
 {
 }
 
@@ -34,7 +46,7 @@ void NetworkCommonRequest::start()
         {
             const QString& strType = getRequestTypeString(m_request.eType);
             m_strError = QStringLiteral("Unsupported FTP request type[%1], url: %2").arg(strType).arg(url.url());
-            qDebug() << "[QMultiThreadNetwork]" << m_strError;
+            NETWORK_LOG(eLogWarn, eCategoryRequest) << m_strError;
 
             emit requestFinished(false, QByteArray(), m_strError);
             return;
@@ -70,21 +82,43 @@ void NetworkCommonRequest::start()
     {
         m_pNetworkReply = m_pNetworkManager->get(request);
     }
-    else if (m_request.eType == eTypePost)
+    else if (m_request.eType == eTypePost && !m_request.listFormParts.isEmpty())
     {
-        request.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded;");
-
-        const QByteArray& bytes = m_request.strReqArg.toUtf8();
-        request.setHeader(QNetworkRequest::ContentLengthHeader, bytes.length());
-
-        m_pNetworkReply = m_pNetworkManager->post(request, bytes);
+        // Content-Type（带boundary）和Content-Length由QNetworkAccessManager设置
+        QHttpMultiPart *pMultiPart = createFormData(m_strError);
+        if (nullptr == pMultiPart)
+        {
+            NETWORK_LOG(eLogWarn, eCategoryRequest) << m_strError;
+            emit requestFinished(false, QByteArray(), m_strError);
+            return;
+        }
+        m_pNetworkReply = m_pNetworkManager->post(request, pMultiPart);
+        // 请求体（及其中的文件）随reply一起释放
+        pMultiPart->setParent(m_pNetworkReply);
     }
-    else if (m_request.eType == eTypePut)
+    else if (m_request.eType == eTypePost || m_request.eType == eTypePut)
     {
-        const QByteArray& bytes = m_request.strReqArg.toUtf8();
-        request.setHeader(QNetworkRequest::ContentLengthHeader, bytes.length());
+        QByteArray bytes;
+        QIODevice *pBody = nullptr;
+        if (!createBody(request, bytes, pBody, m_strError))
+        {
+            NETWORK_LOG(eLogWarn, eCategoryRequest) << m_strError;
+            emit requestFinished(false, QByteArray(), m_strError);
+            return;
+        }
 
-        m_pNetworkReply = m_pNetworkManager->put(request, bytes);
+        if (pBody)
+        {
+            m_pNetworkReply = (m_request.eType == eTypePost) ? m_pNetworkManager->post(request, pBody)
+                : m_pNetworkManager->put(request, pBody);
+            // 请求体随reply一起释放
+            pBody->setParent(m_pNetworkReply);
+        }
+        else
+        {
+            m_pNetworkReply = (m_request.eType == eTypePost) ? m_pNetworkManager->post(request, bytes)
+                : m_pNetworkManager->put(request, bytes);
+        }
     }
     else if (m_request.eType == eTypeDelete)
     {
@@ -95,10 +129,239 @@ void NetworkCommonRequest::start()
         m_pNetworkReply = m_pNetworkManager->head(request);
     }
 
+    trackReply(m_pNetworkReply);
     connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onFinished()));
     connect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
     connect(m_pNetworkManager, SIGNAL(authenticationRequired(QNetworkReply *, QAuthenticator *)),
         SLOT(onAuthenticationRequired(QNetworkReply *, QAuthenticator *)));
+
+    // 重定向后重新发出的请求不再计时
+    if (m_request.bHedge && m_nRedirectionCount == 0
+        && (m_request.eType == eTypeGet || m_request.eType == eTypeHead))
+    {
+        m_bPrimaryFailed = false;
+        NetworkMetrics::globalInstance()->recordHedgeEligible();
+        const int nDelay = hedgeDelay(url);
+        if (nDelay >= 0)
+        {
+            if (nullptr == m_pHedgeTimer)
+            {
+                m_pHedgeTimer = new QTimer(this);
+                m_pHedgeTimer->setSingleShot(true);
+                connect(m_pHedgeTimer, SIGNAL(timeout()), this, SLOT(onHedgeTimeout()));
+            }
+            m_pHedgeTimer->start(nDelay);
+        }
+    }
+}
+
+bool NetworkCommonRequest::createBody(QNetworkRequest& request, QByteArray& bytes, QIODevice *&pBody, QString& strError)
+{
+    pBody = nullptr;
+    const bool bBinary = m_request.fnBodyFactory || !m_request.bytesBody.isNull();
+    if (!m_request.mapRawHeader.contains("Content-Type"))
+    {
+        if (bBinary)
+        {
+            request.setHeader(QNetworkRequest::ContentTypeHeader, "application/octet-stream");
+        }
+        else if (m_request.eType == eTypePost)
+        {
+            request.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded;");
+        }
+    }
+
+    QIODevice *pSource = nullptr;
+    if (m_request.fnBodyFactory)
+    {
+        pSource = m_request.fnBodyFactory();
+        if (nullptr == pSource || !pSource->isReadable())
+        {
+            strError = QStringLiteral("Error: body device is null or not readable, url: %1").arg(request.url().toString());
+            delete pSource;
+            return false;
+        }
+        if (!pSource->isSequential())
+        {
+            request.setHeader(QNetworkRequest::ContentLengthHeader, pSource->size() - pSource->pos());
+        }
+    }
+    else
+    {
+        // bytesBody隐式共享，不复制
+        bytes = m_request.bytesBody.isNull() ? m_request.strReqArg.toUtf8() : m_request.bytesBody;
+        request.setHeader(QNetworkRequest::ContentLengthHeader, bytes.length());
+    }
+
+    if (m_request.eBodyEncoding != eEncodingIdentity && !isFtpProxy(request.url().scheme()))
+    {
+        if (nullptr == pSource)
+        {
+            QBuffer *pBuffer = new QBuffer;
+            pBuffer->setData(bytes);
+            pBuffer->open(QIODevice::ReadOnly);
+            pSource = pBuffer;
+        }
+        QString strCompressError;
+        pBody = createCompressedBody(pSource, request, strCompressError);
+        if (nullptr == pBody && !strCompressError.isEmpty())
+        {
+            strError = strCompressError;
+            delete pSource;
+            return false;
+        }
+    }
+    if (nullptr == pBody && m_request.fnBodyFactory)
+    {
+        pBody = pSource;
+    }
+    else if (nullptr == pBody)
+    {
+        // 不压缩，直接发送bytes
+        delete pSource;
+    }
+    return true;
+}
+
+QHttpMultiPart *NetworkCommonRequest::createFormData(QString& strError) const
+{
+    QHttpMultiPart *pMultiPart = new QHttpMultiPart(QHttpMultiPart::FormDataType);
+    for (const FormPart& field : m_request.listFormParts)
+    {
+        // 字段名和文件名中的引号按HTML规范转义
+        QByteArray strDisposition = "form-data; name=\"" + field.strName.toUtf8().replace('"', "%22") + "\"";
+        QHttpPart part;
+        if (field.strFilePath.isEmpty())
+        {
+            if (!field.strContentType.isEmpty())
+            {
+                part.setRawHeader("Content-Type", field.strContentType);
+            }
+            part.setRawHeader("Content-Disposition", strDisposition);
+            part.setBody(field.bytesValue);
+        }
+        else
+        {
+            QFile *pFile = new QFile(field.strFilePath, pMultiPart);
+            if (!pFile->open(QIODevice::ReadOnly))
+            {
+                strError = QStringLiteral("Error: open file(%1) failed - %2").arg(field.strFilePath).arg(pFile->errorString());
+                delete pMultiPart;
+                return nullptr;
+            }
+            const QString& strFileName = field.strFileName.isEmpty() ? QFileInfo(field.strFilePath).fileName() : field.strFileName;
+            strDisposition += "; filename=\"" + strFileName.toUtf8().replace('"', "%22") + "\"";
+            part.setRawHeader("Content-Type", field.strContentType.isEmpty() ? QByteArray("application/octet-stream") : field.strContentType);
+            part.setRawHeader("Content-Disposition", strDisposition);
+            part.setBodyDevice(pFile);
+        }
+        pMultiPart->append(part);
+    }
+    return pMultiPart;
+}
+
+void NetworkCommonRequest::abort()
+{
+    cancelHedge();
+    __super::abort();
+}
+
+int NetworkCommonRequest::hedgeDelay(const QUrl& url) const
+{
+    std::shared_ptr<LatencyHistogram> pHistogram = NetworkMetrics::globalInstance()->hostLatency(url.host());
+    if (pHistogram.get() && pHistogram->count() >= MinHedgeSamples)
+    {
+        // 直方图的单位是微秒
+        return static_cast<int>(qBound<qint64>(1, pHistogram->valueAtPercentile(95) / 1000, INT_MAX));
+    }
+    return (m_request.nHedgeDelayMs > 0) ? static_cast<int>(m_request.nHedgeDelayMs) : -1;
+}
+
+void NetworkCommonRequest::onHedgeTimeout()
+{
+    if (m_bAbortManual || nullptr == m_pNetworkReply || m_pHedge)
+    {
+        return;
+    }
+    if (!NetworkMetrics::globalInstance()->tryAcquireHedge())
+    {
+        NETWORK_LOG(eLogDebug, eCategoryRequest) << "Hedge budget exhausted:" << m_request.url;
+        return;
+    }
+
+    RequestTask task = m_request;
+    task.bHedge = false;
+    task.redirectUrl.clear();
+    if (!task.listMirrorUrls.isEmpty())
+    {
+        task.url = task.listMirrorUrls.first();
+    }
+    NETWORK_LOG(eLogDebug, eCategoryRequest) << "Hedge request:" << task.url;
+    NETWORK_TRACE_INSTANT("net", "hedge", m_request.uiId, "delay", m_pHedgeTimer->interval());
+
+    // 子对象使用自己的QNetworkAccessManager，即新的连接
+    m_pHedge = new NetworkCommonRequest(this);
+    m_pHedge->setRequestTask(task);
+    connect(m_pHedge, SIGNAL(requestFinished(bool, const QByteArray&, const QString&)),
+        this, SLOT(onHedgeFinished(bool, const QByteArray&, const QString&)));
+    m_pHedge->start();
+}
+
+void NetworkCommonRequest::onHedgeFinished(bool bSuccess, const QByteArray& bytesContent, const QString& strError)
+{
+    if (m_bAbortManual || nullptr == m_pHedge)
+    {
+        return;
+    }
+
+    if (!bSuccess)
+    {
+        NETWORK_LOG(eLogDebug, eCategoryRequest) << "Hedge request failed:" << strError;
+        cancelHedge();
+        // 两个请求都失败了，返回原请求的错误
+        if (m_bPrimaryFailed)
+        {
+            emit requestFinished(false, QByteArray(), m_strError);
+        }
+        return;
+    }
+
+    const QByteArray bytes = bytesContent;
+    const QString strHedgeError = strError;
+    m_nHttpStatusCode = m_pHedge->httpStatusCode();
+    m_nNetworkError = m_pHedge->networkError();
+    NetworkMetrics::globalInstance()->recordHedgeWin();
+    cancelHedge();
+
+    // 取消还没有返回的原请求（不再触发onFinished）
+    if (m_pNetworkReply)
+    {
+        m_pNetworkReply->disconnect(this);
+    }
+    NetworkRequest::abort();
+
+    if (m_request.timing.iFirstByte == 0)
+    {
+        m_request.timing.iFirstByte = NetworkUtility::monotonicTime();
+    }
+    m_request.timing.iLastByte = NetworkUtility::monotonicTime();
+    emit requestFinished(true, bytes, strHedgeError);
+}
+
+void NetworkCommonRequest::cancelHedge()
+{
+    if (m_pHedgeTimer)
+    {
+        m_pHedgeTimer->stop();
+    }
+    if (m_pHedge)
+    {
+        // 可能正在对冲请求的信号里，延迟删除
+        m_pHedge->disconnect(this);
+        m_pHedge->abort();
+        m_pHedge->deleteLater();
+        m_pHedge = nullptr;
+    }
 }
 
 void NetworkCommonRequest::onFinished()
@@ -121,7 +384,8 @@ void NetworkCommonRequest::onFinished()
             if (redirectUrl.isValid() && url != redirectUrl && ++m_nRedirectionCount <= m_request.nMaxRedirectionCount)
             {
                 m_request.redirectUrl = redirectUrl.toString();
-                qDebug() << "[QMultiThreadNetwork] url:" << url.toString() << "redirectUrl:" << m_request.redirectUrl;
+                NETWORK_LOG(eLogDebug, eCategoryRequest) << "url:" << url.toString() << "redirectUrl:" << m_request.redirectUrl;
+                NETWORK_TRACE_INSTANT("net", "redirect", m_request.uiId, "count", m_nRedirectionCount);
 
                 m_pNetworkReply->deleteLater();
                 m_pNetworkReply = nullptr;
@@ -132,10 +396,24 @@ void NetworkCommonRequest::onFinished()
         }
         else if (statusCode != 200 && statusCode != 0)
         {
-            qDebug() << "[QMultiThreadNetwork] HttpStatusCode: " << statusCode;
+            NETWORK_LOG(eLogDebug, eCategoryRequest) << "HttpStatusCode: " << statusCode;
         }
     }
 
+    // 对冲请求还在进行，等它的结果
+    if (!bSuccess && !m_bAbortManual && m_pHedge)
+    {
+        m_bPrimaryFailed = true;
+        if (m_pNetworkReply->isOpen())
+        {
+            m_strError.append(QString::fromUtf8(m_pNetworkReply->readAll()));
+        }
+        m_pNetworkReply->deleteLater();
+        m_pNetworkReply = nullptr;
+        return;
+    }
+    cancelHedge();
+
     QByteArray bytes;
     if (!m_bAbortManual)//非调用abort()结束
     {
@@ -167,6 +445,10 @@ void NetworkCommonRequest::onFinished()
     }
     emit requestFinished(bSuccess, bytes, m_strError);
 
-    m_pNetworkReply->deleteLater();
-    m_pNetworkReply = nullptr;
+    // 接收方可能已经调用了abort()（对冲请求）
+    if (m_pNetworkReply)
+    {
+        m_pNetworkReply->deleteLater();
+        m_pNetworkReply = nullptr;
+    }
 }
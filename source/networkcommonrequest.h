@@ -4,6 +4,9 @@
 #include <QObject>
 #include "networkrequest.h"
 
+class QTimer;
+class QHttpMultiPart;
+
 
 //一般请求
 class NetworkCommonRequest : public NetworkRequest
@@ -16,7 +19,34 @@ public:
 
 public Q_SLOTS:
     void start() Q_DECL_OVERRIDE;
+    void abort() Q_DECL_OVERRIDE;
     void onFinished() Q_DECL_OVERRIDE;
+
+private Q_SLOTS:
+    void onHedgeTimeout();
+    void onHedgeFinished(bool bSuccess, const QByteArray& bytesContent, const QString& strError);
+
+private:
+    enum
+    {
+        // 主机的耗时样本少于该数目时p95不可信
+        MinHedgeSamples = 20,
+    };
+    // 发出对冲请求前等待的毫秒数（该主机耗时的p95），不对冲时返回-1
+    int hedgeDelay(const QUrl& url) const;
+    void cancelHedge();
+    // 由listFormParts生成multipart/form-data请求体，文件字段以QFile作为数据源（发送时按块读取）
+    QHttpMultiPart *createFormData(QString& strError) const;
+    // eTypePost/eTypePut的请求体：以设备发送时pBody不为空（fnBodyFactory或需要压缩），否则发送bytes.
+    //	同时设置Content-Type/Content-Length
+    bool createBody(QNetworkRequest& request, QByteArray& bytes, QIODevice *&pBody, QString& strError);
+
+private:
+    QTimer *m_pHedgeTimer;
+    // 对冲请求（子对象），先成功返回的为准
+    NetworkCommonRequest *m_pHedge;
+    // 原请求已失败，等待对冲请求的结果
+    bool m_bPrimaryFailed;
 };
 
 #endif // NETWORKCOMMONREQUEST_H
\ No newline at end of file
@@ -0,0 +1,263 @@
+﻿#include "networkcompressor.h"
+#ifdef QMTNETWORK_USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef QMTNETWORK_USE_ZSTD
+#include <zstd.h>
+#endif
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include "networktracer.h"
+#include "networklog.h"
+
+using namespace QMTNetwork;
+
+namespace {
+    // 压缩线程池，与请求的线程池分开，压缩不会占用请求的线程
+    QThreadPool *compressPool()
+    {
+        static QThreadPool s_pool;
+        static bool s_bInit = (s_pool.setMaxThreadCount(qMax(QThread::idealThreadCount(), 2)), true);
+        Q_UNUSED(s_bInit);
+        return &s_pool;
+    }
+
+    class CompressTask : public QRunnable
+    {
+    public:
+        explicit CompressTask(std::packaged_task<NetworkCompressDevice::CompressedBlock()>&& task) : m_task(std::move(task)) {}
+        void run() Q_DECL_OVERRIDE { m_task(); }
+
+    private:
+        std::packaged_task<NetworkCompressDevice::CompressedBlock()> m_task;
+    };
+}
+
+NetworkCompressDevice::NetworkCompressDevice(QIODevice *pSource, ContentEncoding eEncoding, int nLevel, QObject *parent)
+    : QIODevice(parent)
+    , m_pSource(pSource)
+    , m_eEncoding(eEncoding)
+    , m_nLevel(nLevel)
+    , m_nMaxInFlight(1)
+    , m_nOutputPos(0)
+    , m_bSourceEnd(false)
+    , m_bEnd(false)
+    , m_bFailed(false)
+    , m_nSourceBytes(0)
+    , m_nCompressedBytes(0)
+    , m_nBlocks(0)
+{
+    if (m_nLevel <= 0)
+    {
+        m_nLevel = (eEncoding == eEncodingZstd) ? 3 : 6;
+    }
+    // 大的数据源多块同时压缩
+    if (!pSource->isSequential() && pSource->size() >= ParallelThreshold)
+    {
+        m_nMaxInFlight = compressPool()->maxThreadCount();
+    }
+    open(QIODevice::ReadOnly);
+}
+
+NetworkCompressDevice::~NetworkCompressDevice()
+{
+    // 等待还在压缩的块，任务持有的数据随future释放
+    for (std::future<CompressedBlock>& future : m_queue)
+    {
+        if (future.valid())
+        {
+            future.wait();
+        }
+    }
+}
+
+bool NetworkCompressDevice::isSupported(ContentEncoding eEncoding)
+{
+    switch (eEncoding)
+    {
+#ifdef QMTNETWORK_USE_ZLIB
+    case eEncodingGzip:
+        return true;
+#endif
+#ifdef QMTNETWORK_USE_ZSTD
+    case eEncodingZstd:
+        return true;
+#endif
+    default:
+        break;
+    }
+    return false;
+}
+
+QByteArray NetworkCompressDevice::encodingName(ContentEncoding eEncoding)
+{
+    switch (eEncoding)
+    {
+    case eEncodingGzip:		return "gzip";
+    case eEncodingZstd:		return "zstd";
+    default:
+        break;
+    }
+    return "identity";
+}
+
+bool NetworkCompressDevice::atEnd() const
+{
+    return m_bEnd && QIODevice::bytesAvailable() == 0;
+}
+
+qint64 NetworkCompressDevice::bytesAvailable() const
+{
+    return (m_bytesOutput.size() - m_nOutputPos) + QIODevice::bytesAvailable();
+}
+
+qint64 NetworkCompressDevice::readData(char *pData, qint64 nMaxSize)
+{
+    while (m_nOutputPos >= m_bytesOutput.size())
+    {
+        if (!fill())
+        {
+            // 没有更多数据或压缩失败（isFailed()）
+            return -1;
+        }
+    }
+    const int nCopy = static_cast<int>(qMin<qint64>(nMaxSize, m_bytesOutput.size() - m_nOutputPos));
+    memcpy(pData, m_bytesOutput.constData() + m_nOutputPos, nCopy);
+    m_nOutputPos += nCopy;
+    return nCopy;
+}
+
+qint64 NetworkCompressDevice::writeData(const char *pData, qint64 nSize)
+{
+    Q_UNUSED(pData);
+    Q_UNUSED(nSize);
+    return -1;
+}
+
+bool NetworkCompressDevice::fill()
+{
+    m_bytesOutput.clear();
+    m_nOutputPos = 0;
+    if (m_bFailed)
+    {
+        return false;
+    }
+
+    // 读出后续的块交给压缩线程，保持m_nMaxInFlight块在压缩
+    while (!m_bSourceEnd && m_queue.size() < static_cast<size_t>(m_nMaxInFlight))
+    {
+        QByteArray bytes = m_pSource->read(BlockSize);
+        if (bytes.size() < BlockSize)
+        {
+            m_bSourceEnd = true;
+            // 空的数据源也输出一个合法的（空）member/frame
+            if (bytes.isEmpty() && m_nBlocks > 0)
+            {
+                break;
+            }
+        }
+        m_nSourceBytes += bytes.size();
+        ++m_nBlocks;
+
+        const ContentEncoding eEncoding = m_eEncoding;
+        const int nLevel = m_nLevel;
+        std::packaged_task<CompressedBlock()> task([bytes, eEncoding, nLevel]() {
+            return compressBlock(bytes, eEncoding, nLevel);
+        });
+        m_queue.push_back(task.get_future());
+        if (m_nMaxInFlight > 1)
+        {
+            compressPool()->start(new CompressTask(std::move(task)));
+        }
+        else
+        {
+            task();
+        }
+    }
+
+    if (m_queue.empty())
+    {
+        if (!m_bEnd)
+        {
+            m_bEnd = true;
+            NETWORK_LOG(eLogDebug, eCategoryRequest) << "Compressed body:" << m_nSourceBytes << "->" << m_nCompressedBytes
+                << "bytes," << encodingName(m_eEncoding) << m_nBlocks << "blocks";
+        }
+        return false;
+    }
+
+    NETWORK_TRACE_SCOPE("compress", "wait", m_nBlocks, "inflight", static_cast<qint64>(m_queue.size()));
+    CompressedBlock block = m_queue.front().get();
+    m_queue.pop_front();
+    if (!block.bSuccess)
+    {
+        // 剩余的块在析构时等待完成，不再输出
+        m_bFailed = true;
+        m_bEnd = true;
+        setErrorString(block.strError);
+        NETWORK_LOG(eLogError, eCategoryRequest) << "Compress body failed:" << block.strError;
+        return false;
+    }
+    m_bytesOutput = block.bytes;
+    m_nCompressedBytes += m_bytesOutput.size();
+    return true;
+}
+
+NetworkCompressDevice::CompressedBlock NetworkCompressDevice::compressBlock(const QByteArray& bytes, ContentEncoding eEncoding, int nLevel)
+{
+    CompressedBlock block;
+    block.bSuccess = false;
+    QByteArray& bytesOut = block.bytes;
+#ifdef QMTNETWORK_USE_ZLIB
+    if (eEncoding == eEncodingGzip)
+    {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        // windowBits + 16: gzip头和尾
+        if (deflateInit2(&stream, qBound(1, nLevel, 9), Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            block.strError = QStringLiteral("Error: deflateInit2 failed");
+            return block;
+        }
+        bytesOut.resize(static_cast<int>(deflateBound(&stream, static_cast<uLong>(bytes.size()))));
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(bytes.constData()));
+        stream.avail_in = static_cast<uInt>(bytes.size());
+        stream.next_out = reinterpret_cast<Bytef *>(bytesOut.data());
+        stream.avail_out = static_cast<uInt>(bytesOut.size());
+        const int nRet = deflate(&stream, Z_FINISH);
+        bytesOut.resize((nRet == Z_STREAM_END) ? static_cast<int>(stream.total_out) : 0);
+        deflateEnd(&stream);
+        block.bSuccess = (nRet == Z_STREAM_END);
+        if (!block.bSuccess)
+        {
+            block.strError = QStringLiteral("Error: deflate failed(%1)").arg(nRet);
+        }
+        return block;
+    }
+#endif
+#ifdef QMTNETWORK_USE_ZSTD
+    if (eEncoding == eEncodingZstd)
+    {
+        bytesOut.resize(static_cast<int>(ZSTD_compressBound(static_cast<size_t>(bytes.size()))));
+        const size_t nRet = ZSTD_compress(bytesOut.data(), static_cast<size_t>(bytesOut.size()),
+            bytes.constData(), static_cast<size_t>(bytes.size()), qBound(1, nLevel, ZSTD_maxCLevel()));
+        if (ZSTD_isError(nRet))
+        {
+            block.strError = QStringLiteral("Error: ZSTD_compress failed(%1)").arg(QString::fromLatin1(ZSTD_getErrorName(nRet)));
+            bytesOut.clear();
+        }
+        else
+        {
+            bytesOut.resize(static_cast<int>(nRet));
+            block.bSuccess = true;
+        }
+        return block;
+    }
+#endif
+    Q_UNUSED(bytes);
+    Q_UNUSED(eEncoding);
+    Q_UNUSED(nLevel);
+    block.strError = QStringLiteral("Error: Content-Encoding %1 not supported").arg(QString::fromLatin1(encodingName(eEncoding)));
+    return block;
+}
@@ -0,0 +1,82 @@
+﻿#ifndef NETWORKCOMPRESSOR_H
+#define NETWORKCOMPRESSOR_H
+
+#include <deque>
+#include <future>
+#include <QIODevice>
+#include "networkdefs.h"
+
+// 请求体压缩（Content-Encoding: gzip / zstd），读取时从数据源按块读出并压缩
+//	每块（BlockSize）压缩成一个独立的gzip member / zstd frame，拼接后仍是合法的gzip/zstd数据
+//	（解压端须支持多member的gzip，zlib的inflate需循环处理）. 数据源不小于ParallelThreshold时
+//	同时有多块在压缩线程池中压缩，按顺序输出. gzip需要zlib（定义QMTNETWORK_USE_ZLIB），
+//	zstd需要libzstd（定义QMTNETWORK_USE_ZSTD），编译时未找到的算法isSupported()返回false.
+//	顺序设备，读取时阻塞等待压缩完成；在发出请求的线程中使用.
+//	压缩后的长度事先未知，请求不直接从本设备读取：NetworkRequest::createCompressedBody先把全部压缩数据
+//	写入内存（数据源不超过MaxMemoryBodySize）或临时文件，再带Content-Length发送
+//	（Qt5的QNetworkAccessManager对没有Content-Length的请求体会先把全部数据读入内存）.
+//	某块压缩失败时readData返回-1（与结束相同），errorString()为失败原因，isFailed()返回true.
+class NetworkCompressDevice : public QIODevice
+{
+public:
+    enum
+    {
+        BlockSize = 1024 * 1024,
+        ParallelThreshold = 4 * BlockSize,
+        // 不超过此大小的数据源压缩到内存中，更大的或长度未知的数据源压缩到临时文件
+        MaxMemoryBodySize = 4 * BlockSize,
+    };
+    // 一块的压缩结果（压缩线程池中的任务返回）
+    struct CompressedBlock
+    {
+        bool bSuccess;
+        QByteArray bytes;
+        QString strError;
+    };
+
+    // pSource必须已打开，由调用者保证在本对象之后释放（可作为本对象的子对象）
+    //	nLevel: 0为默认级别（gzip 6, zstd 3）
+    NetworkCompressDevice(QIODevice *pSource, QMTNetwork::ContentEncoding eEncoding, int nLevel, QObject *parent = nullptr);
+    ~NetworkCompressDevice();
+
+    static bool isSupported(QMTNetwork::ContentEncoding eEncoding);
+    // Content-Encoding的值
+    static QByteArray encodingName(QMTNetwork::ContentEncoding eEncoding);
+
+    bool isSequential() const Q_DECL_OVERRIDE { return true; }
+    bool atEnd() const Q_DECL_OVERRIDE;
+    qint64 bytesAvailable() const Q_DECL_OVERRIDE;
+
+    // 有块压缩失败，之后不再输出数据
+    bool isFailed() const { return m_bFailed; }
+    qint64 sourceBytes() const { return m_nSourceBytes; }
+    qint64 compressedBytes() const { return m_nCompressedBytes; }
+
+protected:
+    qint64 readData(char *pData, qint64 nMaxSize) Q_DECL_OVERRIDE;
+    qint64 writeData(const char *pData, qint64 nSize) Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(NetworkCompressDevice);
+    // 取出下一块压缩好的数据，没有更多数据或压缩失败时返回false
+    bool fill();
+    static CompressedBlock compressBlock(const QByteArray& bytes, QMTNetwork::ContentEncoding eEncoding, int nLevel);
+
+private:
+    QIODevice *m_pSource;
+    QMTNetwork::ContentEncoding m_eEncoding;
+    int m_nLevel;
+    // 同时在压缩的块数，1为在读取的线程中直接压缩
+    int m_nMaxInFlight;
+    std::deque<std::future<CompressedBlock>> m_queue;
+    QByteArray m_bytesOutput;
+    int m_nOutputPos;
+    bool m_bSourceEnd;
+    bool m_bEnd;
+    bool m_bFailed;
+    qint64 m_nSourceBytes;
+    qint64 m_nCompressedBytes;
+    int m_nBlocks;
+};
+
+#endif // NETWORKCOMPRESSOR_H
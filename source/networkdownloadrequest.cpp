@@ -8,22 +8,38 @@
 #include <QCoreApplication>
 #include "networkmanager.h"
 #include "networkutility.h"
+#include "networkfilewriter.h"
+#include "networkchecksum.h"
+#include "networktracer.h"
+#include "networklog.h"
 
 using namespace QMTNetwork;
 
 NetworkDownloadRequest::NetworkDownloadRequest(QObject *parent /* = nullptr */)
     : NetworkRequest(parent)
-    , m_pFile(nullptr)
 {
 }
 
 NetworkDownloadRequest::~NetworkDownloadRequest()
 {
-    if (m_pFile.get())
+    closeFile(false);
+}
+
+void NetworkDownloadRequest::closeFile(bool bRemove)
+{
+    if (m_pWriter.get())
     {
-        m_pFile->close();
-        m_pFile.reset();
+        if (bRemove)
+        {
+            m_pWriter->discard();
+        }
+        m_pWriter.reset();
     }
+    if (bRemove && !m_strFilePath.isEmpty())
+    {
+        QFile::remove(m_strFilePath);
+    }
+    m_strFilePath.clear();
 }
 
 void NetworkDownloadRequest::start()
@@ -38,12 +54,40 @@ void NetworkDownloadRequest::start()
         return;
     }
 
-    m_pFile = std::move(NetworkUtility::createAndOpenFile(m_request, m_strError));
-    if (!m_pFile.get())
+    m_pChecksum.reset();
+    if (!m_request.strChecksum.isEmpty())
+    {
+        m_pChecksum = NetworkChecksum::create(m_request.strChecksum, m_strError);
+        if (!m_pChecksum.get())
+        {
+            emit requestFinished(false, QByteArray(), m_strError);
+            return;
+        }
+    }
+
+    std::unique_ptr<QFile> pFile = std::move(NetworkUtility::createAndOpenFile(m_request, m_strError));
+    if (!pFile.get())
     {
         emit requestFinished(false, QByteArray(), m_strError);
         return;
     }
+    m_strFilePath = pFile->fileName();
+    pFile->close();
+    pFile.reset();
+
+    // 数据由磁盘写线程写入，网络线程只做拷贝
+    std::shared_ptr<NetworkWriteFile> pWriteFile = NetworkWriteFile::open(m_strFilePath, m_strError);
+    if (!pWriteFile.get())
+    {
+        closeFile(true);
+        emit requestFinished(false, QByteArray(), m_strError);
+        return;
+    }
+    m_pWriter.reset(new NetworkFileWriter(pWriteFile, 0, this, "onWriterDrained"));
+    if (m_request.eDurability == eDurabilityPeriodic)
+    {
+        m_pWriter->setSyncInterval(qint64(qMax<quint32>(m_request.nSyncIntervalMB, 1)) * 1024 * 1024);
+    }
 
     QNetworkRequest request(url);
     request.setRawHeader("Accept-Encoding", "gzip,deflate,compress,br");
@@ -71,6 +115,7 @@ void NetworkDownloadRequest::start()
     }
     m_pNetworkReply = m_pNetworkManager->get(request);
 
+    trackReply(m_pNetworkReply);
     connect(m_pNetworkReply, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
     connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onFinished()));
     connect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
@@ -86,17 +131,58 @@ void NetworkDownloadRequest::onReadyRead()
         && m_pNetworkReply->error() == QNetworkReply::NoError
         && m_pNetworkReply->isOpen())
     {
-        if (NetworkUtility::fileOpened(m_pFile.get()))
+        if (m_pWriter.get())
         {
+            // 写线程跟不上时暂停读取，数据留在QNetworkReply的读缓冲区里，由TCP流控限制接收速度
+            if (m_pWriter->isBackedUp())
+            {
+                m_pNetworkReply->setReadBufferSize(NetworkFileWriter::ReplyReadBufferSize);
+                return;
+            }
+
+            // 收到第一块数据时根据Content-Length决定是否启用大文件模式
+            if (m_pWriter->offset() == 0 && m_request.nLargeFileThreshold > 0)
+            {
+                const qint64 nFileSize = m_pNetworkReply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+                if (nFileSize >= m_request.nLargeFileThreshold && !m_pWriter->isDropCache())
+                {
+                    NETWORK_LOG(eLogInfo, eCategoryDownload) << "Large file mode:" << m_strFilePath << nFileSize;
+                    m_pWriter->setDropCache(true);
+                }
+            }
+
             const QByteArray& bytesRev = m_pNetworkReply->readAll();
-            if (!bytesRev.isEmpty() && -1 == m_pFile->write(bytesRev))
+            NETWORK_TRACE_SCOPE("disk", "write", m_request.uiId, "bytes", bytesRev.size());
+            if (m_pChecksum.get())
+            {
+                m_pChecksum->update(bytesRev);
+            }
+            if (!bytesRev.isEmpty() && !m_pWriter->write(bytesRev))
             {
-                qDebug() << "[QMultiThreadNetwork]" << m_pFile->errorString();
+                // 磁盘写入出错（磁盘已满、IO错误）时立即结束，不再接收剩余的数据
+                m_strError = m_pWriter->errorString();
+                if (m_strError.isEmpty())
+                {
+                    m_strError = QStringLiteral("Error: write(%1) failed").arg(m_strFilePath);
+                }
+                NETWORK_LOG(eLogError, eCategoryDownload) << m_strError;
+                // 保留写入的错误，不被取消请求的错误覆盖
+                disconnect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
+                m_pNetworkReply->abort();
             }
         }
     }
 }
 
+void NetworkDownloadRequest::onWriterDrained()
+{
+    if (m_pNetworkReply)
+    {
+        m_pNetworkReply->setReadBufferSize(0);
+        onReadyRead();
+    }
+}
+
 void NetworkDownloadRequest::onFinished()
 {
     bool bSuccess = (m_pNetworkReply->error() == QNetworkReply::NoError);
@@ -117,18 +203,14 @@ void NetworkDownloadRequest::onFinished()
             if (redirectUrl.isValid() && url != redirectUrl && ++m_nRedirectionCount <= m_request.nMaxRedirectionCount)
             {
                 m_request.redirectUrl = redirectUrl.toString();
-                qDebug() << "[QMultiThreadNetwork] url:" << url.toString() << "redirectUrl:" << m_request.redirectUrl;
+                NETWORK_LOG(eLogDebug, eCategoryDownload) << "url:" << url.toString() << "redirectUrl:" << m_request.redirectUrl;
+                NETWORK_TRACE_INSTANT("net", "redirect", m_request.uiId, "count", m_nRedirectionCount);
 
                 m_pNetworkReply->deleteLater();
                 m_pNetworkReply = nullptr;
 
                 //重定向需要关闭之前打开的文件
-                if (NetworkUtility::fileExists(m_pFile.get()))
-                {
-                    m_pFile->close();
-                    m_pFile->remove();
-                }
-                m_pFile.reset();
+                closeFile(true);
 
                 start();
                 return;
@@ -136,19 +218,29 @@ void NetworkDownloadRequest::onFinished()
         }
         else if ((statusCode >= 300 || statusCode < 200) && statusCode != 0)
         {
-            qDebug() << "[QMultiThreadNetwork] HttpStatusCode:" << statusCode;
+            NETWORK_LOG(eLogDebug, eCategoryDownload) << "HttpStatusCode:" << statusCode;
         }
     }
 
-    if (NetworkUtility::fileExists(m_pFile.get()))
+    if (m_pWriter.get() && bSuccess)
     {
-        m_pFile->close();
-        if (!bSuccess)
+        // 暂停读取时留在缓冲区里的数据
+        if (m_pNetworkReply->isOpen() && m_pNetworkReply->bytesAvailable() > 0)
         {
-            m_pFile->remove();
+            const QByteArray& bytesRev = m_pNetworkReply->readAll();
+            if (m_pChecksum.get())
+            {
+                m_pChecksum->update(bytesRev);
+            }
+            m_pWriter->write(bytesRev);
         }
+
+        m_pNetworkReply->deleteLater();
+        m_pNetworkReply = nullptr;
+        // 不在网络线程中等待磁盘，写线程写完后在onWriterFinished()中结束
+        m_pWriter->finish("onWriterFinished", m_request.eDurability != eDurabilityNone);
+        return;
     }
-    m_pFile.reset();
 
     if (!m_bAbortManual)//非调用abort()结束
     {
@@ -160,10 +252,42 @@ void NetworkDownloadRequest::onFinished()
             }
         }
     }
-    emit requestFinished(bSuccess, QByteArray(), m_strError);
-
     m_pNetworkReply->deleteLater();
     m_pNetworkReply = nullptr;
+
+    finishDownload(bSuccess);
+}
+
+void NetworkDownloadRequest::onWriterFinished(bool bSuccess, const QString& strError)
+{
+    // 文件已被关闭（重新开始或释放）
+    if (!m_pWriter.get() || !m_pWriter->isFinished())
+    {
+        return;
+    }
+
+    if (!bSuccess)
+    {
+        m_strError = strError;
+    }
+    else if (m_pChecksum.get() && !m_pChecksum->verify(m_strError))
+    {
+        bSuccess = false;
+    }
+    finishDownload(bSuccess);
+}
+
+void NetworkDownloadRequest::finishDownload(bool bSuccess)
+{
+    const QString strPartFilePath = m_strFilePath;
+    closeFile(!bSuccess);
+    if (bSuccess && !strPartFilePath.isEmpty()
+        && !NetworkUtility::renamePartFile(strPartFilePath, m_request.eDurability != eDurabilityNone, m_strError))
+    {
+        bSuccess = false;
+        QFile::remove(strPartFilePath);
+    }
+    emit requestFinished(bSuccess, QByteArray(), m_strError);
 }
 
 void NetworkDownloadRequest::onDownloadProgress(qint64 iReceived, qint64 iTotal)
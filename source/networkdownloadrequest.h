@@ -4,7 +4,8 @@
 #include <QObject>
 #include "networkrequest.h"
 
-class QFile;
+class NetworkFileWriter;
+class NetworkChecksum;
 
 //下载请求
 class NetworkDownloadRequest : public NetworkRequest
@@ -20,9 +21,22 @@ public Q_SLOTS:
     void onFinished() Q_DECL_OVERRIDE;
     void onReadyRead();
     void onDownloadProgress(qint64 iReceived, qint64 iTotal);
+    // 写线程已追上，恢复读取
+    void onWriterDrained();
+    // 写线程已写完全部数据（NetworkFileWriter::finish()）
+    void onWriterFinished(bool bSuccess, const QString& strError);
 
 private:
-    std::unique_ptr<QFile> m_pFile;
+    // 关闭文件（bRemove: 丢弃未写入的数据并删除文件）
+    void closeFile(bool bRemove);
+    // 关闭文件，成功时把临时文件改名为目标文件，发出requestFinished
+    void finishDownload(bool bSuccess);
+
+private:
+    QString m_strFilePath;
+    std::unique_ptr<NetworkFileWriter> m_pWriter;
+    // 指定了RequestTask::strChecksum时，边下载边计算摘要
+    std::unique_ptr<NetworkChecksum> m_pChecksum;
 };
 
 #endif // NETWORKDOWNLOADREQUEST_H
\ No newline at end of file
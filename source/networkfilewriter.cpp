@@ -0,0 +1,817 @@
+﻿#include "networkfilewriter.h"
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+#include <deque>
+#include <limits>
+#include <map>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <QMetaObject>
+#include <QPointer>
+#if (QT_VERSION >= QT_VERSION_CHECK(5,4,0))
+#include <QStorageInfo>
+#endif
+#include "classmemorytracer.h"
+#include "networkchecksum.h"
+#include "networktracer.h"
+#include "networklog.h"
+#include "networkmetrics.h"
+#include "networkuring.h"
+
+NetworkWriteFile::NetworkWriteFile()
+#ifdef WIN32
+    : m_hFile(INVALID_HANDLE_VALUE)
+#else
+    : m_fd(-1)
+#endif
+{
+}
+
+NetworkWriteFile::~NetworkWriteFile()
+{
+#ifdef WIN32
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hFile);
+    }
+#else
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+#endif
+}
+
+std::shared_ptr<NetworkWriteFile> NetworkWriteFile::open(const QString& strFilePath, QString& strError)
+{
+    std::shared_ptr<NetworkWriteFile> pFile(new NetworkWriteFile);
+    pFile->m_strFilePath = strFilePath;
+
+#ifdef WIN32
+    pFile->m_hFile = CreateFileW(QDir::toNativeSeparators(strFilePath).toStdWString().c_str(), GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (pFile->m_hFile == INVALID_HANDLE_VALUE)
+    {
+        strError = QStringLiteral("Error: CreateFileW(%1) - %2").arg(strFilePath).arg(GetLastError());
+        return nullptr;
+    }
+#else
+    pFile->m_fd = ::open(QFile::encodeName(strFilePath).constData(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (pFile->m_fd < 0)
+    {
+        strError = QStringLiteral("Error: open(%1) - %2").arg(strFilePath).arg(QString::fromLocal8Bit(strerror(errno)));
+        return nullptr;
+    }
+#endif
+
+#if (QT_VERSION >= QT_VERSION_CHECK(5,4,0))
+    pFile->m_strDeviceId = QStorageInfo(QFileInfo(strFilePath).absolutePath()).device();
+#endif
+    return pFile;
+}
+
+bool NetworkWriteFile::writeAt(qint64 nOffset, const char *pData, qint64 nSize, QString& strError)
+{
+#ifdef WIN32
+    while (nSize > 0)
+    {
+        OVERLAPPED ov = { 0 };
+        ov.Offset = static_cast<DWORD>(nOffset & 0xFFFFFFFF);
+        ov.OffsetHigh = static_cast<DWORD>(nOffset >> 32);
+        DWORD dwWritten = 0;
+        const DWORD dwSize = static_cast<DWORD>(qMin<qint64>(nSize, 0x40000000));
+        if (!WriteFile(m_hFile, pData, dwSize, &dwWritten, &ov) || dwWritten == 0)
+        {
+            strError = QStringLiteral("Error: WriteFile(%1) - %2").arg(m_strFilePath).arg(GetLastError());
+            return false;
+        }
+        pData += dwWritten;
+        nOffset += dwWritten;
+        nSize -= dwWritten;
+    }
+#else
+    while (nSize > 0)
+    {
+        const ssize_t nWritten = ::pwrite(m_fd, pData, static_cast<size_t>(nSize), static_cast<off_t>(nOffset));
+        if (nWritten < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            strError = QStringLiteral("Error: pwrite(%1) - %2").arg(m_strFilePath).arg(QString::fromLocal8Bit(strerror(errno)));
+            return false;
+        }
+        pData += nWritten;
+        nOffset += nWritten;
+        nSize -= nWritten;
+    }
+#endif
+    return true;
+}
+
+bool NetworkWriteFile::flush()
+{
+#ifdef WIN32
+    return FlushFileBuffers(m_hFile) != FALSE;
+#else
+    return ::fsync(m_fd) == 0;
+#endif
+}
+
+void NetworkWriteFile::startWriteback(qint64 nOffset, qint64 nSize)
+{
+#if defined(Q_OS_LINUX)
+    ::sync_file_range(m_fd, static_cast<off64_t>(nOffset), static_cast<off64_t>(nSize), SYNC_FILE_RANGE_WRITE);
+#else
+    Q_UNUSED(nOffset);
+    Q_UNUSED(nSize);
+#endif
+}
+
+void NetworkWriteFile::dropCache(qint64 nOffset, qint64 nSize)
+{
+#if defined(Q_OS_LINUX)
+    // 脏页不会被DONTNEED丢弃，先等它们写回
+    ::sync_file_range(m_fd, static_cast<off64_t>(nOffset), static_cast<off64_t>(nSize),
+        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    ::posix_fadvise(m_fd, static_cast<off_t>(nOffset), static_cast<off_t>(nSize), POSIX_FADV_DONTNEED);
+#else
+    Q_UNUSED(nOffset);
+    Q_UNUSED(nSize);
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+NetworkOrderedChecksum::NetworkOrderedChecksum(std::unique_ptr<NetworkChecksum> pChecksum)
+    : m_pChecksum(std::move(pChecksum))
+    , m_nOffset(0)
+{
+}
+
+NetworkOrderedChecksum::~NetworkOrderedChecksum()
+{
+}
+
+void NetworkOrderedChecksum::onWritten(NetworkWriteFile *pFile, const char *pData, qint64 nOffset, qint64 nSize, bool bDropCache)
+{
+    QMutexLocker locker(&m_mutex);
+    qint64 nHashed = m_nOffset;
+    const qint64 nEnd = nOffset + nSize;
+    if (!m_strError.isEmpty() || nEnd <= nHashed)
+    {
+        return;
+    }
+
+    if (nOffset <= nHashed)
+    {
+        m_pChecksum->update(pData + (nHashed - nOffset), nEnd - nHashed);
+        nHashed = nEnd;
+    }
+    else
+    {
+        // 与前一个范围相连时合并，同一段的缓冲区只占一项
+        auto iterPrev = m_mapWritten.lower_bound(nOffset);
+        if (iterPrev != m_mapWritten.begin() && (--iterPrev)->second >= nOffset)
+        {
+            iterPrev->second = qMax(iterPrev->second, nEnd);
+        }
+        else
+        {
+            qint64& nRangeEnd = m_mapWritten[nOffset];
+            nRangeEnd = qMax(nRangeEnd, nEnd);
+        }
+    }
+
+    // 空缺补上之后，紧接着的范围从文件读取（仍在页缓存中）
+    auto iter = m_mapWritten.begin();
+    while (iter != m_mapWritten.end() && iter->first <= nHashed)
+    {
+        while (iter->second > nHashed)
+        {
+            const qint64 nRead = qMin<qint64>(iter->second - nHashed, NetworkFileWriter::DropCacheWindow);
+            NETWORK_TRACE_SCOPE("checksum", "catchup", 0, "bytes", nRead);
+            if (!m_pChecksum->updateFromFile(pFile->filePath(), nHashed, nRead, m_strError))
+            {
+                NETWORK_LOG(eLogError, eCategoryMTDownload) << m_strError;
+                m_nOffset = nHashed;
+                return;
+            }
+            if (bDropCache)
+            {
+                pFile->dropCache(nHashed, nRead);
+            }
+            nHashed += nRead;
+        }
+        iter = m_mapWritten.erase(iter);
+    }
+    m_nOffset = nHashed;
+}
+
+bool NetworkOrderedChecksum::verify(qint64 nSize, QString& strError) const
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_strError.isEmpty())
+    {
+        strError = m_strError;
+        return false;
+    }
+    if (nSize >= 0 && m_nOffset != nSize)
+    {
+        strError = QStringLiteral("Error: %1 checksum covers %2 of %3 bytes")
+            .arg(QString::fromLatin1(m_pChecksum->algorithm())).arg(qint64(m_nOffset)).arg(nSize);
+        NETWORK_LOG(eLogError, eCategoryMTDownload) << strError;
+        return false;
+    }
+    return m_pChecksum->verify(strError);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// 写入者与写线程之间共享的状态
+class NetworkWriterState
+{
+public:
+    NetworkWriterState()
+        : nPending(0)
+        , bBackedUp(false)
+        , bDiscard(false)
+        , bFailed(false)
+        , bDropCache(false)
+        , nDropOffset(0)
+        , nWrittenEnd(0)
+        , pReceiver(nullptr)
+        , pDrainedSlot(nullptr)
+        , pFinishedSlot(nullptr)
+    {
+    }
+
+    // 写线程写完一个缓冲区（bFinish: 结束标记，本段之前的写入都已完成）
+    void onWritten(qint64 nSize, const QString& strWriteError, bool bFinish)
+    {
+        QMutexLocker locker(&mutex);
+        if (!strWriteError.isEmpty() && !bFailed)
+        {
+            bFailed = true;
+            strError = strWriteError;
+        }
+        const qint64 nLeft = (nPending -= nSize);
+        if (nLeft <= NetworkFileWriter::MaxPendingBytes / 2 && bBackedUp.exchange(false))
+        {
+            if (pReceiver && pDrainedSlot)
+            {
+                QMetaObject::invokeMethod(pReceiver, pDrainedSlot, Qt::QueuedConnection);
+            }
+        }
+        if (bFinish && !bDiscard && pReceiver && pFinishedSlot)
+        {
+            QMetaObject::invokeMethod(pReceiver, pFinishedSlot, Qt::QueuedConnection,
+                Q_ARG(bool, !bFailed), Q_ARG(QString, strError));
+        }
+    }
+
+    std::atomic<qint64> nPending;
+    std::atomic<bool> bBackedUp;
+    std::atomic<bool> bDiscard;
+    std::atomic<bool> bFailed;
+    std::atomic<bool> bDropCache;
+    // 大文件模式：已从页缓存丢弃到哪里、已写到哪里（只由写线程访问）
+    qint64 nDropOffset;
+    qint64 nWrittenEnd;
+    QMutex mutex;
+    QString strError;
+    QObject *pReceiver;
+    const char *pDrainedSlot;
+    const char *pFinishedSlot;
+    // 多个写入者共享，由写线程按文件顺序计算（在第一次写入之前设置）
+    std::shared_ptr<NetworkOrderedChecksum> pOrderedChecksum;
+};
+
+namespace {
+    // 缓冲区池，避免每次申请1MB的内存
+    class WriteBufferPool
+    {
+    public:
+        enum { MaxIdleBuffers = 32 };
+
+        std::unique_ptr<NetworkWriteBuffer> acquire()
+        {
+            {
+                QMutexLocker locker(&m_mutex);
+                if (!m_vecIdle.empty())
+                {
+                    std::unique_ptr<NetworkWriteBuffer> pBuffer = std::move(m_vecIdle.back());
+                    m_vecIdle.pop_back();
+                    pBuffer->nOffset = 0;
+                    pBuffer->nSize = 0;
+                    return pBuffer;
+                }
+            }
+            std::unique_ptr<NetworkWriteBuffer> pBuffer(new NetworkWriteBuffer);
+            pBuffer->data.resize(NetworkFileWriter::BufferSize);
+            return pBuffer;
+        }
+
+        void release(std::unique_ptr<NetworkWriteBuffer> pBuffer)
+        {
+            QMutexLocker locker(&m_mutex);
+            if (pBuffer.get() && m_vecIdle.size() < MaxIdleBuffers)
+            {
+                m_vecIdle.push_back(std::move(pBuffer));
+            }
+        }
+
+    private:
+        QMutex m_mutex;
+        std::vector<std::unique_ptr<NetworkWriteBuffer>> m_vecIdle;
+    };
+
+    WriteBufferPool *bufferPool()
+    {
+        static WriteBufferPool s_pool;
+        return &s_pool;
+    }
+
+    struct WriteJob
+    {
+        std::shared_ptr<NetworkWriterState> pState;
+        std::shared_ptr<NetworkWriteFile> pFile;
+        // 为空时表示fsync（bSync）或该段写入结束（bFinish）
+        std::unique_ptr<NetworkWriteBuffer> pBuffer;
+        // 计入NetworkWriterState::nPending的数量（结束标记计为1）
+        qint64 nPending;
+        bool bSync;
+        bool bFinish;
+
+        WriteJob() : nPending(0), bSync(false), bFinish(false) {}
+    };
+
+    bool useIoUring()
+    {
+        static const bool s_bUseIoUring = NetworkUring::isCompiledIn()
+            && qgetenv("QMTNETWORK_DISK_BACKEND").trimmed().toLower() != "sync";
+        return s_bUseIoUring;
+    }
+
+    // 一个磁盘设备一个写线程，同一设备上的写入按提交顺序执行
+    class DeviceWriterThread : public QThread
+    {
+    public:
+        enum { MaxBatchSize = 64 };
+
+        DeviceWriterThread() : m_bQuit(false) {}
+        ~DeviceWriterThread()
+        {
+            {
+                QMutexLocker locker(&m_mutex);
+                m_bQuit = true;
+                m_condition.wakeAll();
+            }
+            wait();
+        }
+
+        void post(WriteJob&& job)
+        {
+            QMutexLocker locker(&m_mutex);
+            m_queJob.push_back(std::move(job));
+            m_condition.wakeOne();
+        }
+
+    protected:
+        void run() Q_DECL_OVERRIDE
+        {
+            NetworkUring uring;
+            if (useIoUring() && uring.init(MaxBatchSize))
+            {
+                NetworkMetrics::globalInstance()->setDiskBackend("io_uring");
+            }
+
+            std::vector<WriteJob> vecJob;
+            vecJob.reserve(MaxBatchSize);
+            while (true)
+            {
+                {
+                    QMutexLocker locker(&m_mutex);
+                    while (m_queJob.empty() && !m_bQuit)
+                    {
+                        m_condition.wait(&m_mutex);
+                    }
+                    if (m_queJob.empty())
+                    {
+                        break;
+                    }
+                    while (!m_queJob.empty() && vecJob.size() < MaxBatchSize)
+                    {
+                        vecJob.push_back(std::move(m_queJob.front()));
+                        m_queJob.pop_front();
+                    }
+                }
+
+                std::vector<QString> vecError(vecJob.size());
+                if (!uring.isValid() || !executeUring(uring, vecJob, vecError))
+                {
+                    executeSync(vecJob, vecError);
+                }
+
+                for (size_t i = 0; i < vecJob.size(); ++i)
+                {
+                    WriteJob& job = vecJob[i];
+                    if (!vecError[i].isEmpty())
+                    {
+                        NETWORK_LOG(eLogError, eCategoryDownload) << vecError[i];
+                    }
+                    else if (!isSkipped(job))
+                    {
+                        // 先计入摘要，再丢弃页缓存
+                        if (job.pState->pOrderedChecksum.get() && job.pBuffer.get())
+                        {
+                            job.pState->pOrderedChecksum->onWritten(job.pFile.get(), job.pBuffer->data.data(),
+                                job.pBuffer->nOffset, job.pBuffer->nSize, job.pState->bDropCache);
+                        }
+                        if (job.pState->bDropCache)
+                        {
+                            dropWrittenPages(job);
+                        }
+                    }
+                    bufferPool()->release(std::move(job.pBuffer));
+                    // 先释放文件句柄，收到结束通知的一方可能会改名或删除文件
+                    job.pFile.reset();
+                    job.pState->onWritten(job.nPending, vecError[i], job.bFinish);
+                }
+                vecJob.clear();
+            }
+        }
+
+    private:
+        static bool isSkipped(const WriteJob& job)
+        {
+            return job.pState->bDiscard || job.pState->bFailed;
+        }
+
+        // 大文件模式：写完的数据立即开始写回，落后DropCacheWindow以上的部分从页缓存丢弃.
+        //	有按顺序计算的摘要时只丢弃已计入的部分，其余部分由摘要补上空缺时丢弃
+        static void dropWrittenPages(const WriteJob& job)
+        {
+            NetworkWriterState *pState = job.pState.get();
+            const qint64 nHashed = pState->pOrderedChecksum.get()
+                ? pState->pOrderedChecksum->offset() : std::numeric_limits<qint64>::max();
+            if (job.pBuffer.get())
+            {
+                job.pFile->startWriteback(job.pBuffer->nOffset, job.pBuffer->nSize);
+                pState->nWrittenEnd = job.pBuffer->nOffset + job.pBuffer->nSize;
+                const qint64 nDropEnd = qMin(pState->nWrittenEnd - NetworkFileWriter::DropCacheWindow, nHashed);
+                if (nDropEnd - pState->nDropOffset < NetworkFileWriter::DropCacheWindow)
+                {
+                    return;
+                }
+                NETWORK_TRACE_SCOPE("disk", "dropcache", 0, "bytes", nDropEnd - pState->nDropOffset);
+                job.pFile->dropCache(pState->nDropOffset, nDropEnd - pState->nDropOffset);
+                pState->nDropOffset = nDropEnd;
+            }
+            else
+            {
+                const qint64 nDropEnd = qMin(pState->nWrittenEnd, nHashed);
+                if (nDropEnd <= pState->nDropOffset)
+                {
+                    return;
+                }
+                NETWORK_TRACE_SCOPE("disk", "dropcache", 0, "bytes", nDropEnd - pState->nDropOffset);
+                job.pFile->dropCache(pState->nDropOffset, nDropEnd - pState->nDropOffset);
+                pState->nDropOffset = nDropEnd;
+            }
+        }
+
+        void executeSync(std::vector<WriteJob>& vecJob, std::vector<QString>& vecError)
+        {
+            qint64 nOps = 0;
+            qint64 nBytes = 0;
+            for (size_t i = 0; i < vecJob.size(); ++i)
+            {
+                const WriteJob& job = vecJob[i];
+                if (isSkipped(job))
+                {
+                    continue;
+                }
+                if (!job.pBuffer.get() && !job.bSync)
+                {
+                    continue;
+                }
+                ++nOps;
+                if (!job.pBuffer.get())
+                {
+                    NETWORK_TRACE_SCOPE("disk", "fsync");
+                    if (!job.pFile->flush())
+                    {
+                        vecError[i] = QStringLiteral("Error: fsync(%1) failed").arg(job.pFile->filePath());
+                    }
+                    continue;
+                }
+                NETWORK_TRACE_SCOPE("disk", "pwrite", 0, "bytes", job.pBuffer->nSize);
+                if (job.pFile->writeAt(job.pBuffer->nOffset, job.pBuffer->data.data(), job.pBuffer->nSize, vecError[i]))
+                {
+                    nBytes += job.pBuffer->nSize;
+                }
+            }
+            NetworkMetrics::globalInstance()->recordDiskIo(nOps, nOps, nBytes);
+        }
+
+        // 整批提交给io_uring，提交失败时返回false（调用者改用同步写入，偏移写入可以安全地重做）
+        bool executeUring(NetworkUring& uring, std::vector<WriteJob>& vecJob, std::vector<QString>& vecError)
+        {
+#ifdef WIN32
+            Q_UNUSED(uring);
+            Q_UNUSED(vecJob);
+            Q_UNUSED(vecError);
+            return false;
+#else
+            std::vector<NetworkUringOp> vecOp;
+            std::vector<size_t> vecIndex;
+            vecOp.reserve(vecJob.size());
+            vecIndex.reserve(vecJob.size());
+            for (size_t i = 0; i < vecJob.size(); ++i)
+            {
+                const WriteJob& job = vecJob[i];
+                if (isSkipped(job) || (!job.pBuffer.get() && !job.bSync))
+                {
+                    continue;
+                }
+                NetworkUringOp op;
+                op.fd = job.pFile->fd();
+                if (job.pBuffer.get())
+                {
+                    op.pData = job.pBuffer->data.data();
+                    op.nSize = static_cast<unsigned int>(job.pBuffer->nSize);
+                    op.nOffset = job.pBuffer->nOffset;
+                }
+                else
+                {
+                    op.bSync = true;
+                }
+                vecOp.push_back(op);
+                vecIndex.push_back(i);
+            }
+            if (vecOp.empty())
+            {
+                return true;
+            }
+
+            qint64 nSyscalls = 0;
+            {
+                NETWORK_TRACE_SCOPE("disk", "io_uring", 0, "ops", static_cast<qint64>(vecOp.size()));
+                if (!uring.execute(vecOp, nSyscalls))
+                {
+                    return false;
+                }
+            }
+
+            qint64 nBytes = 0;
+            for (size_t k = 0; k < vecOp.size(); ++k)
+            {
+                const NetworkUringOp& op = vecOp[k];
+                const WriteJob& job = vecJob[vecIndex[k]];
+                QString& strError = vecError[vecIndex[k]];
+                if (op.nResult < 0)
+                {
+                    strError = QStringLiteral("Error: %1(%2) - %3").arg(QLatin1String(op.bSync ? "fsync" : "pwrite"))
+                        .arg(job.pFile->filePath()).arg(QString::fromLocal8Bit(strerror(-op.nResult)));
+                    continue;
+                }
+                if (op.bSync)
+                {
+                    continue;
+                }
+                const qint64 nWritten = op.nResult;
+                if (nWritten < op.nSize)
+                {
+                    // 写入不完整（很少见），剩余部分同步写完
+                    ++nSyscalls;
+                    if (!job.pFile->writeAt(op.nOffset + nWritten, op.pData + nWritten, op.nSize - nWritten, strError))
+                    {
+                        continue;
+                    }
+                }
+                nBytes += op.nSize;
+            }
+            NetworkMetrics::globalInstance()->recordDiskIo(static_cast<qint64>(vecOp.size()), nSyscalls, nBytes);
+            return true;
+#endif
+        }
+
+    private:
+        QMutex m_mutex;
+        QWaitCondition m_condition;
+        std::deque<WriteJob> m_queJob;
+        bool m_bQuit;
+    };
+
+    class DiskWriterPool
+    {
+    public:
+        void post(WriteJob&& job)
+        {
+            DeviceWriterThread *pThread = nullptr;
+            {
+                QMutexLocker locker(&m_mutex);
+                std::unique_ptr<DeviceWriterThread>& thread = m_mapThread[job.pFile->deviceId()];
+                if (!thread.get())
+                {
+                    thread.reset(new DeviceWriterThread);
+                    thread->setObjectName(QStringLiteral("QMTNetwork disk writer"));
+                    thread->start();
+                }
+                pThread = thread.get();
+            }
+            pThread->post(std::move(job));
+        }
+
+    private:
+        QMutex m_mutex;
+        std::map<QByteArray, std::unique_ptr<DeviceWriterThread>> m_mapThread;
+    };
+
+    DiskWriterPool *diskWriterPool()
+    {
+        static DiskWriterPool s_pool;
+        return &s_pool;
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+NetworkFileWriter::NetworkFileWriter(std::shared_ptr<NetworkWriteFile> pFile, qint64 nStartOffset,
+    QObject *pReceiver, const char *pDrainedSlot)
+    : m_pFile(pFile)
+    , m_pState(std::make_shared<NetworkWriterState>())
+    , m_nOffset(nStartOffset)
+    , m_nSyncInterval(0)
+    , m_nSyncOffset(nStartOffset)
+    , m_bFinished(false)
+{
+    TRACE_CLASS_CONSTRUCTOR(NetworkFileWriter);
+    m_pState->pReceiver = pReceiver;
+    m_pState->pDrainedSlot = pDrainedSlot;
+    m_pState->nDropOffset = nStartOffset;
+    m_pState->nWrittenEnd = nStartOffset;
+}
+
+NetworkFileWriter::~NetworkFileWriter()
+{
+    TRACE_CLASS_DESTRUCTOR(NetworkFileWriter);
+    if (!m_bFinished)
+    {
+        discard();
+    }
+    QMutexLocker locker(&m_pState->mutex);
+    m_pState->pReceiver = nullptr;
+}
+
+bool NetworkFileWriter::write(const char *pData, qint64 nSize)
+{
+    if (m_pState->bFailed || m_bFinished)
+    {
+        return false;
+    }
+
+    while (nSize > 0)
+    {
+        if (!m_pBuffer.get())
+        {
+            m_pBuffer = bufferPool()->acquire();
+            m_pBuffer->nOffset = m_nOffset;
+        }
+
+        // 第一个缓冲区只写到下一个1MB边界，之后的写入都是对齐的整块
+        const qint64 nCapacity = BufferSize - (m_pBuffer->nOffset % BufferSize);
+        const qint64 nCopy = qMin(nSize, nCapacity - m_pBuffer->nSize);
+        memcpy(m_pBuffer->data.data() + m_pBuffer->nSize, pData, static_cast<size_t>(nCopy));
+        m_pBuffer->nSize += static_cast<int>(nCopy);
+        m_nOffset += nCopy;
+        pData += nCopy;
+        nSize -= nCopy;
+
+        if (m_pBuffer->nSize == nCapacity)
+        {
+            submit();
+        }
+    }
+    return true;
+}
+
+QString NetworkFileWriter::errorString() const
+{
+    QMutexLocker locker(&m_pState->mutex);
+    return m_pState->strError;
+}
+
+void NetworkFileWriter::skip(qint64 nSize)
+{
+    if (nSize <= 0 || m_bFinished)
+    {
+        return;
+    }
+    // 缓冲区中的数据必须连续，先把已有的部分提交
+    submit();
+    m_nOffset += nSize;
+}
+
+void NetworkFileWriter::submit()
+{
+    if (!m_pBuffer.get())
+    {
+        return;
+    }
+    if (m_pBuffer->nSize == 0)
+    {
+        bufferPool()->release(std::move(m_pBuffer));
+        return;
+    }
+
+    const qint64 nSize = m_pBuffer->nSize;
+    post(std::move(m_pBuffer), nSize);
+
+    if (m_nSyncInterval > 0 && m_nOffset - m_nSyncOffset >= m_nSyncInterval)
+    {
+        post(nullptr, 1, true);
+        m_nSyncOffset = m_nOffset;
+    }
+}
+
+void NetworkFileWriter::post(std::unique_ptr<NetworkWriteBuffer> pBuffer, qint64 nPending, bool bSync, bool bFinish)
+{
+    m_pState->nPending += nPending;
+    WriteJob job;
+    job.pState = m_pState;
+    job.pFile = m_pFile;
+    job.pBuffer = std::move(pBuffer);
+    job.nPending = nPending;
+    job.bSync = bSync;
+    job.bFinish = bFinish;
+    diskWriterPool()->post(std::move(job));
+}
+
+bool NetworkFileWriter::isBackedUp() const
+{
+    if (m_pState->nPending < MaxPendingBytes)
+    {
+        return false;
+    }
+    m_pState->bBackedUp = true;
+    // 写线程可能在设置标志之前就已经追上了
+    if (m_pState->nPending <= MaxPendingBytes / 2 && m_pState->bBackedUp.exchange(false))
+    {
+        return false;
+    }
+    return true;
+}
+
+void NetworkFileWriter::setDropCache(bool bDropCache)
+{
+    m_pState->bDropCache = bDropCache;
+}
+
+bool NetworkFileWriter::isDropCache() const
+{
+    return m_pState->bDropCache;
+}
+
+void NetworkFileWriter::setOrderedChecksum(const std::shared_ptr<NetworkOrderedChecksum>& pChecksum)
+{
+    m_pState->pOrderedChecksum = pChecksum;
+}
+
+void NetworkFileWriter::finish(const char *pFinishedSlot, bool bSync)
+{
+    if (m_bFinished)
+    {
+        return;
+    }
+    submit();
+    {
+        QMutexLocker locker(&m_pState->mutex);
+        m_pState->pFinishedSlot = pFinishedSlot;
+    }
+    // 同一设备的写入按顺序执行，结束标记排在本段所有写入之后（fsync，丢弃剩余的页缓存，通知pReceiver）
+    post(nullptr, 1, bSync, true);
+    m_bFinished = true;
+}
+
+void NetworkFileWriter::discard()
+{
+    // 已提交的缓冲区由写线程跳过，不必等待. 写线程仍持有文件句柄，文件打开时允许删除（Win32: FILE_SHARE_DELETE）
+    m_pState->bDiscard = true;
+    bufferPool()->release(std::move(m_pBuffer));
+    m_bFinished = true;
+}
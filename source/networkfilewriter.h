@@ -0,0 +1,165 @@
+﻿#ifndef NETWORKFILEWRITER_H
+#define NETWORKFILEWRITER_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+#include <QString>
+#include <QByteArray>
+#include <QMutex>
+
+class QObject;
+class NetworkChecksum;
+
+// 以指定偏移写入的文件句柄（Win32: WriteFile + OVERLAPPED偏移, 其它: pwrite）
+//	不改变文件指针，可被多个写入者同时使用.
+class NetworkWriteFile
+{
+public:
+    // 打开已存在的文件或创建新文件（不会截断）
+    static std::shared_ptr<NetworkWriteFile> open(const QString& strFilePath, QString& strError);
+    ~NetworkWriteFile();
+
+    bool writeAt(qint64 nOffset, const char *pData, qint64 nSize, QString& strError);
+    bool flush();
+
+    // 开始把该范围的脏页写回磁盘，不等待（仅Linux，其它平台不做任何事）
+    void startWriteback(qint64 nOffset, qint64 nSize);
+    // 等该范围写回磁盘后从页缓存中丢弃（仅Linux）
+    void dropCache(qint64 nOffset, qint64 nSize);
+
+    const QString& filePath() const { return m_strFilePath; }
+    // 文件所在的磁盘设备，同一设备的写入由同一个写线程执行
+    const QByteArray& deviceId() const { return m_strDeviceId; }
+#ifndef WIN32
+    int fd() const { return m_fd; }
+#endif
+
+private:
+    NetworkWriteFile();
+    Q_DISABLE_COPY(NetworkWriteFile);
+
+    QString m_strFilePath;
+    QByteArray m_strDeviceId;
+#ifdef WIN32
+    void *m_hFile;
+#else
+    int m_fd;
+#endif
+};
+
+// 写入缓冲区（从池中分配，写完后归还）
+struct NetworkWriteBuffer
+{
+    std::vector<char> data;
+    qint64 nOffset;
+    int nSize;
+
+    NetworkWriteBuffer() : nOffset(0), nSize(0) {}
+};
+
+// 按文件顺序计算无法合并的摘要（xxh64, md5, sha*），多个写入者共享
+//	写线程写完一个缓冲区后交给它：紧接在已计算部分之后的数据直接从缓冲区计入，其它范围先记下，
+//	前面的空缺补上后再从文件读取（大文件模式下这些页面在计入摘要之前不会从页缓存中丢弃，读取不经过磁盘）.
+class NetworkOrderedChecksum
+{
+public:
+    explicit NetworkOrderedChecksum(std::unique_ptr<NetworkChecksum> pChecksum);
+    ~NetworkOrderedChecksum();
+
+    // 写线程写完[nOffset, nOffset + nSize)后调用. bDropCache: 从文件读取计入的部分随后从页缓存中丢弃
+    void onWritten(NetworkWriteFile *pFile, const char *pData, qint64 nOffset, qint64 nSize, bool bDropCache);
+    // 之前的数据都已计入摘要的位置
+    qint64 offset() const { return m_nOffset; }
+    // 全部写完之后调用：计入的字节数必须为nSize（-1: 不检查），再与期望值比较
+    bool verify(qint64 nSize, QString& strError) const;
+
+private:
+    Q_DISABLE_COPY(NetworkOrderedChecksum);
+
+    mutable QMutex m_mutex;
+    std::unique_ptr<NetworkChecksum> m_pChecksum;
+    std::atomic<qint64> m_nOffset;
+    // 已写入但还没有计入的范围：起始位置 -> 结束位置
+    std::map<qint64, qint64> m_mapWritten;
+    QString m_strError;
+};
+
+class NetworkWriterState;
+
+// 顺序写入文件的某一段
+//	收到的数据先拷贝到大块缓冲区（默认1MB，按文件偏移对齐），缓冲区写满后交给该磁盘的写线程，
+//	网络线程不会被磁盘IO阻塞. 写线程每次取出一批写入，Linux上（编译时找到liburing）用io_uring
+//	一次提交整批，否则逐个同步写入；环境变量QMTNETWORK_DISK_BACKEND=sync可强制同步写入. 交给写线程但未写完的数据超过上限时isBackedUp()返回true，
+//	调用者应暂停读取网络数据（见QNetworkReply::setReadBufferSize），写线程追上后会以
+//	Qt::QueuedConnection调用pReceiver的pDrainedSlot（无参数的槽函数名，如"onWriterDrained"）.
+//	finish()和discard()都不等待写线程，写完的结果同样以Qt::QueuedConnection通知pReceiver.
+//	大文件模式（setDropCache）下写完的数据会尽快写回磁盘并从页缓存中丢弃，避免挤掉其它程序的缓存
+//	（设置了setOrderedChecksum时只丢弃已计入摘要的部分）.
+class NetworkFileWriter
+{
+public:
+    enum
+    {
+        BufferSize = 1024 * 1024,
+        // 单个写入者最多有多少字节在写线程中排队
+        MaxPendingBytes = 8 * BufferSize,
+        // 暂停读取时QNetworkReply的读缓冲区大小
+        ReplyReadBufferSize = 256 * 1024,
+        // 大文件模式下保留在页缓存中（正在写回）的数据量
+        DropCacheWindow = MaxPendingBytes,
+    };
+
+    NetworkFileWriter(std::shared_ptr<NetworkWriteFile> pFile, qint64 nStartOffset,
+        QObject *pReceiver = nullptr, const char *pDrainedSlot = nullptr);
+    // 未调用finish()时丢弃还没写入的数据
+    ~NetworkFileWriter();
+
+    // 写入数据（接在上一次写入之后），之前的写入出错时返回false
+    bool write(const char *pData, qint64 nSize);
+    bool write(const QByteArray& bytes) { return write(bytes.constData(), bytes.size()); }
+    // 跳过nSize字节（这部分由别的写入者写入），之后的写入从新的偏移开始
+    void skip(qint64 nSize);
+
+    bool isBackedUp() const;
+
+    // 大文件模式，应在第一次写入之前设置
+    void setDropCache(bool bDropCache);
+    bool isDropCache() const;
+    // 每写入nBytes字节fsync一次（0: 不fsync），应在第一次写入之前设置
+    void setSyncInterval(qint64 nBytes) { m_nSyncInterval = nBytes; }
+    // 写完的数据由写线程按文件顺序计入摘要，应在第一次写入之前设置
+    void setOrderedChecksum(const std::shared_ptr<NetworkOrderedChecksum>& pChecksum);
+    // 下一次写入的文件偏移
+    qint64 offset() const { return m_nOffset; }
+
+    // 提交剩余的数据并排入结束标记，不等待. 本段全部写完（bSync: 写完后再fsync）后以Qt::QueuedConnection
+    //	调用pReceiver的pFinishedSlot（参数为(bool bSuccess, const QString& strError)的槽函数名，如"onWriterFinished"）.
+    //	调用discard()或析构之后不再通知
+    void finish(const char *pFinishedSlot, bool bSync = false);
+    // 已调用finish()或discard()
+    bool isFinished() const { return m_bFinished; }
+    // 写线程写入出错后，之后的write()都返回false；返回第一次出错的原因
+    QString errorString() const;
+    // 丢弃还没写入的数据，不等待（已提交的缓冲区由写线程跳过）
+    void discard();
+
+    const std::shared_ptr<NetworkWriteFile>& file() const { return m_pFile; }
+
+private:
+    Q_DISABLE_COPY(NetworkFileWriter);
+    void submit();
+    void post(std::unique_ptr<NetworkWriteBuffer> pBuffer, qint64 nPending, bool bSync = false, bool bFinish = false);
+
+private:
+    std::shared_ptr<NetworkWriteFile> m_pFile;
+    std::shared_ptr<NetworkWriterState> m_pState;
+    std::unique_ptr<NetworkWriteBuffer> m_pBuffer;
+    qint64 m_nOffset;
+    qint64 m_nSyncInterval;
+    qint64 m_nSyncOffset;
+    bool m_bFinished;
+};
+
+#endif // NETWORKFILEWRITER_H
@@ -0,0 +1,59 @@
+﻿#include "networkhosthistory.h"
+
+NetworkHostHistory *NetworkHostHistory::globalInstance()
+{
+    static NetworkHostHistory s_instance;
+    return &s_instance;
+}
+
+NetworkHostHistory::HostEntry *NetworkHostHistory::entry(const QString& strHost)
+{
+    if (strHost.isEmpty())
+    {
+        return nullptr;
+    }
+    auto iter = m_hosts.find(strHost);
+    if (iter == m_hosts.end())
+    {
+        if (m_hosts.size() >= MaxHostCount)
+        {
+            return nullptr;
+        }
+        iter = m_hosts.insert(strHost, HostEntry());
+    }
+    return &iter.value();
+}
+
+NetworkHostHistory::RangeSupport NetworkHostHistory::rangeSupport(const QString& strHost) const
+{
+    QReadLocker locker(&m_lock);
+    return m_hosts.value(strHost).eRange;
+}
+
+void NetworkHostHistory::setRangeSupport(const QString& strHost, RangeSupport eSupport)
+{
+    QWriteLocker locker(&m_lock);
+    if (HostEntry *pEntry = entry(strHost))
+    {
+        pEntry->eRange = eSupport;
+    }
+}
+
+int NetworkHostHistory::maxChannels(const QString& strHost) const
+{
+    QReadLocker locker(&m_lock);
+    return m_hosts.value(strHost).nMaxChannels;
+}
+
+void NetworkHostHistory::limitChannels(const QString& strHost, int nChannels)
+{
+    nChannels = qMax(nChannels, 1);
+    QWriteLocker locker(&m_lock);
+    if (HostEntry *pEntry = entry(strHost))
+    {
+        if (pEntry->nMaxChannels == 0 || nChannels < pEntry->nMaxChannels)
+        {
+            pEntry->nMaxChannels = nChannels;
+        }
+    }
+}
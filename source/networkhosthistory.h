@@ -0,0 +1,55 @@
+﻿#ifndef NETWORKHOSTHISTORY_H
+#define NETWORKHOSTHISTORY_H
+
+#include <QHash>
+#include <QString>
+#include <QReadWriteLock>
+
+// 按主机记录下载时观察到的服务器特性，供eTypeAutoDownload选择单通道或多通道下载
+//	只保存在内存中，可在任意线程中调用.
+class NetworkHostHistory
+{
+public:
+    enum RangeSupport
+    {
+        eRangeUnknown = 0,
+        // 返回过206
+        eRangeSupported,
+        // 忽略过Range请求（返回200）
+        eRangeUnsupported,
+    };
+
+    enum
+    {
+        // 超过该数目的主机不再记录
+        MaxHostCount = 256,
+    };
+
+    static NetworkHostHistory *globalInstance();
+
+    RangeSupport rangeSupport(const QString& strHost) const;
+    void setRangeSupport(const QString& strHost, RangeSupport eSupport);
+
+    // 服务器限制并发连接（429/503）后记录的通道上限，0: 没有限制
+    int maxChannels(const QString& strHost) const;
+    void limitChannels(const QString& strHost, int nChannels);
+
+private:
+    NetworkHostHistory() {}
+    Q_DISABLE_COPY(NetworkHostHistory);
+
+    struct HostEntry
+    {
+        RangeSupport eRange;
+        int nMaxChannels;
+        HostEntry() : eRange(eRangeUnknown), nMaxChannels(0) {}
+    };
+    // 不存在时创建，主机过多时返回nullptr. 调用者持有写锁
+    HostEntry *entry(const QString& strHost);
+
+private:
+    mutable QReadWriteLock m_lock;
+    QHash<QString, HostEntry> m_hosts;
+};
+
+#endif // NETWORKHOSTHISTORY_H
@@ -0,0 +1,299 @@
+﻿#include "networklocaltransport.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QUrlQuery>
+#include "networkutility.h"
+#include "networklog.h"
+
+using namespace QMTNetwork;
+
+namespace {
+    const int ChunkSize = 1024 * 1024;
+
+    bool isUploadType(RequestType eType)
+    {
+        return eType == eTypeUpload || eType == eTypePost || eType == eTypePut;
+    }
+}
+
+NetworkMockTransport::NetworkMockTransport()
+    : m_pSink(nullptr)
+    , m_nSize(0)
+    , m_nSent(0)
+{
+}
+
+NetworkMockTransport::~NetworkMockTransport()
+{
+}
+
+void NetworkMockTransport::start(const RequestTask& task, NetworkTransportSink *pSink)
+{
+    m_pSink = pSink;
+    m_nSent = 0;
+
+    const QUrlQuery query(NetworkUtility::currentRequestUrl(task));
+    const int nStatus = query.hasQueryItem(QStringLiteral("status")) ? query.queryItemValue(QStringLiteral("status")).toInt() : 200;
+    qint64 nContentLength = query.queryItemValue(QStringLiteral("size")).toLongLong();
+    QMap<QByteArray, QByteArray> mapHeader;
+    mapHeader.insert("Content-Type", "application/octet-stream");
+
+    if (isUploadType(task.eType))
+    {
+        // 读完请求体，返回收到的字节数
+        qint64 nBody = 0;
+        if (task.fnBodyFactory)
+        {
+            std::unique_ptr<QIODevice> pDevice(task.fnBodyFactory());
+            QByteArray bytes;
+            while (pDevice.get() && !(bytes = pDevice->read(ChunkSize)).isEmpty())
+            {
+                nBody += bytes.size();
+            }
+        }
+        else if (task.eType == eTypeUpload)
+        {
+            if (!QFile::exists(task.strReqArg))
+            {
+                m_pSink->finish(false, QStringLiteral("Error: File is not exists(%1)").arg(task.strReqArg));
+                return;
+            }
+            nBody = QFileInfo(task.strReqArg).size();
+        }
+        else
+        {
+            nBody = task.bytesBody.isNull() ? task.strReqArg.toUtf8().size() : task.bytesBody.size();
+        }
+        m_pSink->setProgress(nBody, nBody, false);
+        m_bytesChunk = QByteArray::number(nBody);
+        nContentLength = m_bytesChunk.size();
+    }
+    else if (m_bytesChunk.size() != ChunkSize)
+    {
+        m_bytesChunk = QByteArray(ChunkSize, 'x');
+    }
+    m_nSize = (task.eType == eTypeHead) ? 0 : nContentLength;
+
+    m_pSink->setMetaData(nStatus, nContentLength, mapHeader);
+    pump();
+}
+
+void NetworkMockTransport::resume()
+{
+    pump();
+}
+
+void NetworkMockTransport::abort()
+{
+    m_pSink = nullptr;
+}
+
+void NetworkMockTransport::pump()
+{
+    while (m_pSink && m_nSent < m_nSize)
+    {
+        if (m_pSink->isBackedUp())
+        {
+            return;
+        }
+        const qint64 nSize = qMin<qint64>(m_nSize - m_nSent, m_bytesChunk.size());
+        if (!m_pSink->write(m_bytesChunk.constData(), nSize))
+        {
+            m_pSink->finish(false, QStringLiteral("Error: write failed"));
+            m_pSink = nullptr;
+            return;
+        }
+        m_nSent += nSize;
+        m_pSink->setProgress(m_nSent, m_nSize, true);
+    }
+    if (m_pSink)
+    {
+        m_pSink->finish(true, QString());
+        m_pSink = nullptr;
+    }
+}
+
+NetworkFileTransport::NetworkFileTransport()
+    : m_pSink(nullptr)
+    , m_nSize(0)
+{
+}
+
+NetworkFileTransport::~NetworkFileTransport()
+{
+}
+
+bool NetworkFileTransport::supports(const RequestTask& task) const
+{
+    return task.eType == eTypeDownload || task.eType == eTypeGet || task.eType == eTypeHead
+        || task.eType == eTypeUpload || task.eType == eTypePut || task.eType == eTypeDelete;
+}
+
+void NetworkFileTransport::start(const RequestTask& task, NetworkTransportSink *pSink)
+{
+    m_pSink = pSink;
+    const QString& strFilePath = NetworkUtility::currentRequestUrl(task).toLocalFile();
+    QMap<QByteArray, QByteArray> mapHeader;
+    QString strError;
+
+    if (task.eType == eTypeUpload || task.eType == eTypePut)
+    {
+        const bool bSuccess = store(task, strFilePath, strError);
+        m_pSink->setMetaData(bSuccess ? 201 : 500, 0, mapHeader);
+        m_pSink->finish(bSuccess, strError);
+        m_pSink = nullptr;
+        return;
+    }
+    if (!QFile::exists(strFilePath))
+    {
+        m_pSink->setMetaData(404, 0, mapHeader);
+        m_pSink->finish(false, QStringLiteral("Error: File is not exists(%1)").arg(strFilePath));
+        m_pSink = nullptr;
+        return;
+    }
+    if (task.eType == eTypeDelete)
+    {
+        const bool bSuccess = NetworkUtility::removeFile(strFilePath, strError);
+        m_pSink->setMetaData(bSuccess ? 200 : 500, 0, mapHeader);
+        m_pSink->finish(bSuccess, strError);
+        m_pSink = nullptr;
+        return;
+    }
+
+    m_pFile.reset(new QFile(strFilePath));
+    if (!m_pFile->open(QIODevice::ReadOnly))
+    {
+        m_pSink->setMetaData(403, 0, mapHeader);
+        m_pSink->finish(false, QStringLiteral("Error: QFile::open(%1) - %2").arg(strFilePath).arg(m_pFile->errorString()));
+        m_pSink = nullptr;
+        m_pFile.reset();
+        return;
+    }
+    m_nSize = m_pFile->size();
+    mapHeader.insert("Content-Type", "application/octet-stream");
+    m_pSink->setMetaData(200, m_nSize, mapHeader);
+    if (task.eType == eTypeHead)
+    {
+        m_pSink->finish(true, QString());
+        m_pSink = nullptr;
+        m_pFile.reset();
+        return;
+    }
+    m_bytesBuffer.resize(ChunkSize);
+    pump();
+}
+
+void NetworkFileTransport::resume()
+{
+    pump();
+}
+
+void NetworkFileTransport::abort()
+{
+    m_pSink = nullptr;
+    m_pFile.reset();
+}
+
+void NetworkFileTransport::pump()
+{
+    while (m_pSink && m_pFile.get())
+    {
+        if (m_pSink->isBackedUp())
+        {
+            return;
+        }
+        const qint64 nRead = m_pFile->read(m_bytesBuffer.data(), m_bytesBuffer.size());
+        if (nRead < 0)
+        {
+            m_pSink->finish(false, QStringLiteral("Error: QFile::read(%1) - %2").arg(m_pFile->fileName()).arg(m_pFile->errorString()));
+            break;
+        }
+        if (nRead == 0)
+        {
+            m_pSink->finish(true, QString());
+            break;
+        }
+        if (!m_pSink->write(m_bytesBuffer.constData(), nRead))
+        {
+            m_pSink->finish(false, QStringLiteral("Error: write failed"));
+            break;
+        }
+        m_pSink->setProgress(m_pFile->pos(), m_nSize, true);
+    }
+    m_pSink = nullptr;
+    m_pFile.reset();
+}
+
+bool NetworkFileTransport::store(const RequestTask& task, const QString& strFilePath, QString& strError)
+{
+    std::unique_ptr<QIODevice> pSource;
+    QByteArray bytes;
+    if (task.eType == eTypeUpload)
+    {
+        pSource.reset(new QFile(task.strReqArg));
+        if (!pSource->open(QIODevice::ReadOnly))
+        {
+            strError = QStringLiteral("Error: QFile::open(%1) - %2").arg(task.strReqArg).arg(pSource->errorString());
+            return false;
+        }
+    }
+    else if (task.fnBodyFactory)
+    {
+        pSource.reset(task.fnBodyFactory());
+        if (nullptr == pSource.get() || !pSource->isReadable())
+        {
+            strError = QStringLiteral("Error: body device is null or not readable, url: %1").arg(task.url);
+            return false;
+        }
+    }
+    else
+    {
+        bytes = task.bytesBody.isNull() ? task.strReqArg.toUtf8() : task.bytesBody;
+    }
+
+    // 写完后再替换目标文件，不会留下写了一半的文件
+    QSaveFile file(strFilePath);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        strError = QStringLiteral("Error: QSaveFile::open(%1) - %2").arg(strFilePath).arg(file.errorString());
+        return false;
+    }
+    if (pSource.get())
+    {
+        const qint64 nTotal = pSource->isSequential() ? 0 : pSource->size();
+        qint64 nWritten = 0;
+        QByteArray buffer(ChunkSize, Qt::Uninitialized);
+        qint64 nRead = 0;
+        while ((nRead = pSource->read(buffer.data(), buffer.size())) > 0)
+        {
+            if (file.write(buffer.constData(), nRead) != nRead)
+            {
+                strError = QStringLiteral("Error: QSaveFile::write(%1) - %2").arg(strFilePath).arg(file.errorString());
+                file.cancelWriting();
+                return false;
+            }
+            nWritten += nRead;
+            if (m_pSink)
+            {
+                m_pSink->setProgress(nWritten, nTotal, false);
+            }
+        }
+        if (nRead < 0)
+        {
+            strError = QStringLiteral("Error: read request body - %1").arg(pSource->errorString());
+            file.cancelWriting();
+            return false;
+        }
+    }
+    else
+    {
+        file.write(bytes);
+    }
+    if (!file.commit())
+    {
+        strError = QStringLiteral("Error: QSaveFile::commit(%1) - %2").arg(strFilePath).arg(file.errorString());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,62 @@
+﻿#ifndef NETWORKLOCALTRANSPORT_H
+#define NETWORKLOCALTRANSPORT_H
+
+#include <memory>
+#include <QByteArray>
+#include "networktransport.h"
+
+class QFile;
+
+// 内存中的模拟传输（mock://host/path?size=字节数&status=状态码）
+//	eTypeDownload/eTypeGet返回size字节的数据（默认0）；上传类请求读完请求体，返回收到的字节数.
+//	不经过网络，用于测试和比较各传输的开销.
+class NetworkMockTransport : public NetworkTransport
+{
+public:
+    NetworkMockTransport();
+    ~NetworkMockTransport();
+
+    void start(const QMTNetwork::RequestTask& task, NetworkTransportSink *pSink) Q_DECL_OVERRIDE;
+    void resume() Q_DECL_OVERRIDE;
+    void abort() Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(NetworkMockTransport);
+    // 产生数据直到写完或写文件跟不上
+    void pump();
+
+private:
+    NetworkTransportSink *m_pSink;
+    QByteArray m_bytesChunk;
+    qint64 m_nSize;
+    qint64 m_nSent;
+};
+
+// 本地文件传输（file://）
+//	eTypeDownload/eTypeGet读取文件，eTypeHead返回文件大小，eTypeUpload/eTypePut写入文件，eTypeDelete删除文件.
+//	文件不存在时以404结束.
+class NetworkFileTransport : public NetworkTransport
+{
+public:
+    NetworkFileTransport();
+    ~NetworkFileTransport();
+
+    bool supports(const QMTNetwork::RequestTask& task) const Q_DECL_OVERRIDE;
+    void start(const QMTNetwork::RequestTask& task, NetworkTransportSink *pSink) Q_DECL_OVERRIDE;
+    void resume() Q_DECL_OVERRIDE;
+    void abort() Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(NetworkFileTransport);
+    void pump();
+    // eTypeUpload/eTypePut: 把请求体写入strFilePath
+    bool store(const QMTNetwork::RequestTask& task, const QString& strFilePath, QString& strError);
+
+private:
+    NetworkTransportSink *m_pSink;
+    std::unique_ptr<QFile> m_pFile;
+    QByteArray m_bytesBuffer;
+    qint64 m_nSize;
+};
+
+#endif // NETWORKLOCALTRANSPORT_H
@@ -0,0 +1,331 @@
+﻿#include "networklog.h"
+#include <QMutex>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QWaitCondition>
+#include <QStringList>
+#ifdef LOG_USELOG4CPLUS
+#include "Log4cplusWrapper.h"
+#endif
+
+using namespace QMTNetwork;
+
+namespace {
+    struct LogNode
+    {
+        std::atomic<LogNode *> next;
+        NetworkLogCategory eCategory;
+        LogLevel eLevel;
+        QString strMessage;
+
+        LogNode() : next(nullptr), eCategory(eCategoryManager), eLevel(eLogDebug) {}
+    };
+
+    // 多生产者单消费者的无锁队列（Vyukov）
+    //	push可在任意线程中调用，pop只在输出线程中调用
+    class LogQueue
+    {
+    public:
+        LogQueue() : m_head(&m_stub), m_tail(&m_stub) {}
+
+        void push(LogNode *pNode)
+        {
+            pNode->next.store(nullptr, std::memory_order_relaxed);
+            LogNode *pPrev = m_head.exchange(pNode, std::memory_order_acq_rel);
+            pPrev->next.store(pNode, std::memory_order_release);
+        }
+
+        LogNode *pop()
+        {
+            LogNode *pTail = m_tail;
+            LogNode *pNext = pTail->next.load(std::memory_order_acquire);
+            if (pTail == &m_stub)
+            {
+                if (nullptr == pNext)
+                {
+                    return nullptr;
+                }
+                m_tail = pNext;
+                pTail = pNext;
+                pNext = pNext->next.load(std::memory_order_acquire);
+            }
+            if (pNext)
+            {
+                m_tail = pNext;
+                return pTail;
+            }
+            if (pTail != m_head.load(std::memory_order_acquire))
+            {
+                // 有生产者正在插入
+                return nullptr;
+            }
+            push(&m_stub);
+            pNext = pTail->next.load(std::memory_order_acquire);
+            if (pNext)
+            {
+                m_tail = pNext;
+                return pTail;
+            }
+            return nullptr;
+        }
+
+    private:
+        std::atomic<LogNode *> m_head;
+        LogNode *m_tail;
+        LogNode m_stub;
+    };
+
+    class LogWriterThread : public QThread
+    {
+    public:
+        LogWriterThread()
+            : m_bQuit(false)
+            , m_bStarted(false)
+            , m_bSleeping(false)
+            , m_nPushed(0)
+            , m_nWritten(0)
+        {
+        }
+
+        ~LogWriterThread()
+        {
+            m_bQuit = true;
+            wakeUp();
+            wait();
+        }
+
+        // 只有原子操作：输出线程启动后不再加锁，只有输出线程在等待时才由第一个写入者唤醒它
+        void push(LogNode *pNode)
+        {
+            if (!m_bStarted.load(std::memory_order_acquire))
+            {
+                startOnce();
+            }
+            m_nPushed.fetch_add(1, std::memory_order_relaxed);
+            m_queue.push(pNode);
+            if (m_bSleeping.load(std::memory_order_relaxed) && m_bSleeping.exchange(false, std::memory_order_acq_rel))
+            {
+                wakeUp();
+            }
+        }
+
+        void flush()
+        {
+            const qint64 nPushed = m_nPushed.load(std::memory_order_relaxed);
+            QElapsedTimer timer;
+            timer.start();
+            while (isRunning() && m_nWritten.load(std::memory_order_acquire) < nPushed && timer.elapsed() < 1000)
+            {
+                wakeUp();
+                QThread::msleep(1);
+            }
+        }
+
+    protected:
+        void run() Q_DECL_OVERRIDE
+        {
+            while (true)
+            {
+                drain();
+                if (m_bQuit)
+                {
+                    drain();
+                    break;
+                }
+
+                // 持有锁时设置标志，唤醒者要等到本线程进入等待后才能拿到锁，不会错过唤醒.
+                //	设置标志之前插入的日志等到超时后输出
+                QMutexLocker locker(&m_mutex);
+                m_bSleeping.store(true, std::memory_order_release);
+                m_condition.wait(&m_mutex, 50);
+                m_bSleeping.store(false, std::memory_order_release);
+            }
+        }
+
+    private:
+        void startOnce()
+        {
+            QMutexLocker locker(&m_mutex);
+            if (!m_bStarted.load(std::memory_order_relaxed) && !m_bQuit)
+            {
+                start(QThread::LowPriority);
+                m_bStarted.store(true, std::memory_order_release);
+            }
+        }
+
+        void wakeUp()
+        {
+            QMutexLocker locker(&m_mutex);
+            m_condition.wakeOne();
+        }
+
+        void drain()
+        {
+            while (LogNode *pNode = m_queue.pop())
+            {
+                output(*pNode);
+                delete pNode;
+                m_nWritten.fetch_add(1, std::memory_order_release);
+            }
+        }
+
+        static void output(const LogNode& node)
+        {
+            const QString& strLine = QStringLiteral("[QMultiThreadNetwork][%1] %2")
+                .arg(QLatin1String(NetworkLog::categoryName(node.eCategory))).arg(node.strMessage);
+
+#if defined(LOG_USELOG4CPLUS) && defined(LOG4CPLUS_ENABLE)
+            const QByteArray& bytes = strLine.toLocal8Bit();
+            switch (node.eLevel)
+            {
+            case eLogTrace:	LOG_NO_FILENUM(LOG_LEVEL_TRACE, bytes.constData()); break;
+            case eLogDebug:	LOG_NO_FILENUM(LOG_LEVEL_DEBUG, bytes.constData()); break;
+            case eLogInfo:	LOG_NO_FILENUM(LOG_LEVEL_INFO, bytes.constData()); break;
+            case eLogWarn:	LOG_NO_FILENUM(LOG_LEVEL_WARN, bytes.constData()); break;
+            default:		LOG_NO_FILENUM(LOG_LEVEL_ERROR, bytes.constData()); break;
+            }
+#else
+            switch (node.eLevel)
+            {
+            case eLogTrace:
+            case eLogDebug:
+            case eLogInfo:
+                qDebug().noquote() << strLine;
+                break;
+            case eLogWarn:
+                qWarning().noquote() << strLine;
+                break;
+            default:
+                qCritical().noquote() << strLine;
+                break;
+            }
+#endif
+        }
+
+    private:
+        LogQueue m_queue;
+        std::atomic<bool> m_bQuit;
+        // 输出线程已启动（push的快速路径不调用要加锁的QThread::isRunning()）
+        std::atomic<bool> m_bStarted;
+        std::atomic<bool> m_bSleeping;
+        std::atomic<qint64> m_nPushed;
+        std::atomic<qint64> m_nWritten;
+        QMutex m_mutex;
+        QWaitCondition m_condition;
+    };
+
+    LogWriterThread *logWriter()
+    {
+        static LogWriterThread s_writer;
+        return &s_writer;
+    }
+
+    LogLevel levelFromString(const QString& strLevel, bool *pOk)
+    {
+        static const char *s_names[] = { "trace", "debug", "info", "warn", "error", "off" };
+        for (int i = 0; i <= eLogOff; ++i)
+        {
+            if (strLevel.compare(QLatin1String(s_names[i]), Qt::CaseInsensitive) == 0)
+            {
+                *pOk = true;
+                return LogLevel(i);
+            }
+        }
+        *pOk = false;
+        return eLogInfo;
+    }
+
+    // 设置默认级别，并读取环境变量QMTNETWORK_LOG
+    struct LogLevelInitializer
+    {
+        LogLevelInitializer()
+        {
+#if defined(NDEBUG) || defined(QT_NO_DEBUG)
+            NetworkLog::setLevel(eLogInfo);
+#else
+            NetworkLog::setLevel(eLogDebug);
+#endif
+            const QString& strEnv = QString::fromLocal8Bit(qgetenv("QMTNETWORK_LOG"));
+            foreach(const QString& strItem, strEnv.split(QLatin1Char(','), QString::SkipEmptyParts))
+            {
+                const int nPos = strItem.indexOf(QLatin1Char('='));
+                bool bOk = false;
+                if (nPos < 0)
+                {
+                    const LogLevel eLevel = levelFromString(strItem.trimmed(), &bOk);
+                    if (bOk)
+                    {
+                        NetworkLog::setLevel(eLevel);
+                    }
+                }
+                else
+                {
+                    const LogLevel eLevel = levelFromString(strItem.mid(nPos + 1).trimmed(), &bOk);
+                    if (bOk)
+                    {
+                        NetworkLog::setLevel(strItem.left(nPos).trimmed(), eLevel);
+                    }
+                }
+            }
+        }
+    };
+}
+
+std::atomic<int> NetworkLog::ms_levels[eCategoryCount];
+static LogLevelInitializer s_logLevelInitializer;
+
+void NetworkLog::setLevel(NetworkLogCategory eCategory, LogLevel eLevel)
+{
+    if (eCategory >= 0 && eCategory < eCategoryCount)
+    {
+        ms_levels[eCategory].store(eLevel, std::memory_order_relaxed);
+    }
+}
+
+void NetworkLog::setLevel(LogLevel eLevel)
+{
+    for (int i = 0; i < eCategoryCount; ++i)
+    {
+        ms_levels[i].store(eLevel, std::memory_order_relaxed);
+    }
+}
+
+bool NetworkLog::setLevel(const QString& strCategory, LogLevel eLevel)
+{
+    for (int i = 0; i < eCategoryCount; ++i)
+    {
+        if (strCategory.compare(QLatin1String(categoryName(NetworkLogCategory(i))), Qt::CaseInsensitive) == 0)
+        {
+            setLevel(NetworkLogCategory(i), eLevel);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *NetworkLog::categoryName(NetworkLogCategory eCategory)
+{
+    static const char *s_names[eCategoryCount] = {
+        "manager", "request", "download", "mtdownload", "upload", "batch", "trace"
+    };
+    return (eCategory >= 0 && eCategory < eCategoryCount) ? s_names[eCategory] : "unknown";
+}
+
+void NetworkLog::write(NetworkLogCategory eCategory, LogLevel eLevel, const QString& strMessage)
+{
+    LogNode *pNode = new LogNode;
+    pNode->eCategory = eCategory;
+    pNode->eLevel = eLevel;
+    pNode->strMessage = strMessage;
+    // QDebug在每一项后面加空格
+    while (pNode->strMessage.endsWith(QLatin1Char(' ')))
+    {
+        pNode->strMessage.chop(1);
+    }
+    logWriter()->push(pNode);
+}
+
+void NetworkLog::flush()
+{
+    logWriter()->flush();
+}
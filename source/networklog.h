@@ -0,0 +1,88 @@
+﻿#ifndef NETWORKLOG_H
+#define NETWORKLOG_H
+
+#include <atomic>
+#include <QDebug>
+#include <QString>
+#include "networkdefs.h"
+
+// 日志分类（每个子模块一个）
+enum NetworkLogCategory
+{
+    eCategoryManager = 0,
+    eCategoryRequest,
+    eCategoryDownload,
+    eCategoryMTDownload,
+    eCategoryUpload,
+    eCategoryBatch,
+    eCategoryTrace,
+    eCategoryCount
+};
+
+// 编译期的最低日志级别，低于该级别的日志语句会被编译器整个去掉
+//	Release默认去掉Trace/Debug级别，可在工程中定义QMTNETWORK_LOG_MIN_LEVEL覆盖
+#ifndef QMTNETWORK_LOG_MIN_LEVEL
+#if defined(NDEBUG) || defined(QT_NO_DEBUG)
+#define QMTNETWORK_LOG_MIN_LEVEL 2
+#else
+#define QMTNETWORK_LOG_MIN_LEVEL 0
+#endif
+#endif
+
+// 分级日志
+//	先检查编译期和运行期（按分类）的级别，通过后才格式化日志内容；
+//	格式化后的日志放入无锁队列，由后台线程输出（定义了LOG_USELOG4CPLUS时输出到log4cplus，否则输出到Qt的消息处理函数）.
+//	运行期的级别也可以通过环境变量QMTNETWORK_LOG设置，如"info"或"mtdownload=trace,manager=warn".
+class NetworkLog
+{
+public:
+    static bool isEnabled(NetworkLogCategory eCategory, QMTNetwork::LogLevel eLevel)
+    {
+        return eLevel >= ms_levels[eCategory].load(std::memory_order_relaxed);
+    }
+
+    static void setLevel(NetworkLogCategory eCategory, QMTNetwork::LogLevel eLevel);
+    static void setLevel(QMTNetwork::LogLevel eLevel);
+    // 按分类名设置（如"mtdownload"），分类名无效时返回false
+    static bool setLevel(const QString& strCategory, QMTNetwork::LogLevel eLevel);
+
+    static void write(NetworkLogCategory eCategory, QMTNetwork::LogLevel eLevel, const QString& strMessage);
+    // 等待队列中的日志全部输出
+    static void flush();
+
+    static const char *categoryName(NetworkLogCategory eCategory);
+
+private:
+    static std::atomic<int> ms_levels[eCategoryCount];
+};
+
+// 一条日志语句，析构时提交
+class NetworkLogMessage
+{
+public:
+    NetworkLogMessage(NetworkLogCategory eCategory, QMTNetwork::LogLevel eLevel)
+        : m_eCategory(eCategory)
+        , m_eLevel(eLevel)
+        , m_debug(&m_strMessage)
+    {
+    }
+    ~NetworkLogMessage()
+    {
+        NetworkLog::write(m_eCategory, m_eLevel, m_strMessage);
+    }
+    QDebug &stream() { return m_debug; }
+
+private:
+    Q_DISABLE_COPY(NetworkLogMessage);
+    NetworkLogCategory m_eCategory;
+    QMTNetwork::LogLevel m_eLevel;
+    QString m_strMessage;
+    QDebug m_debug;
+};
+
+// 用法: NETWORK_LOG(eLogDebug, eCategoryMTDownload) << "Part" << m_nIndex << "Range:" << range;
+#define NETWORK_LOG(level, category) \
+    if ((QMTNetwork::level) < QMTNETWORK_LOG_MIN_LEVEL || !NetworkLog::isEnabled(category, QMTNetwork::level)) {} \
+    else NetworkLogMessage(category, QMTNetwork::level).stream()
+
+#endif // NETWORKLOG_H
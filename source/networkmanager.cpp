@@ -1,5 +1,6 @@
 ﻿#include "networkmanager.h"
 #include <atomic>
+#include <climits>
 #include <QMutex>
 #include <QMutexLocker>
 #include <QUrl>
@@ -9,13 +10,33 @@
 #include <QEvent>
 #include <QDebug>
 #include <QCoreApplication>
+#include <QFile>
+#include <QLocalSocket>
 #include "classmemorytracer.h"
 #include "networkrunnable.h"
 #include "networkreply.h"
+#include "networkbatchmanifest.h"
+#include "networkutility.h"
+#include "networkmetrics.h"
+#include "networktracer.h"
+#include "networklog.h"
 
 using namespace QMTNetwork;
 #define DEFAULT_MAX_THREAD_COUNT 5
 
+// 清单批量请求的状态
+struct BatchManifestFeeder
+{
+    std::unique_ptr<NetworkBatchManifest> manifest;
+    RequestTask taskTemplate;
+    // 执行中的任务 (requestId <---> 清单行号)
+    QMap<quint64, qint64> mapRunningLine;
+    int nStarted;
+    bool bEnd;
+
+    BatchManifestFeeder() : nStarted(0), bEnd(false) {}
+};
+
 class NetworkManagerPrivate
 {
     Q_DECLARE_PUBLIC(NetworkManager)
@@ -27,6 +48,13 @@ public:
 private:
     std::shared_ptr<NetworkReply> addRequest(const QUrl& url, quint64& uiTaskId);
     std::shared_ptr<NetworkReply> addBatchRequest(BatchRequestTask& tasks, quint64& uiBatchId);
+    std::shared_ptr<NetworkReply> addBatchRequest(const QString& strManifestFile, const RequestTask& taskTemplate,
+        qint64 nStartLine, quint64& uiBatchId, QString& strError);
+
+    // 从清单中读取任务，使执行中的任务数保持在窗口大小以内
+    void fillBatchManifest(quint64 uiBatchId, BatchManifestFeeder *pFeeder);
+    // 清单批量请求中的任务结束，补充新的任务（非清单批量请求返回false）
+    bool feedBatchManifest(const RequestTask& task, qint64& nResumeLine, qint64& iBytesRead, qint64& iBytesTotal);
 
     bool startRunnable(std::shared_ptr<NetworkRunnable> r);
     void stopRequest(quint64 uiTaskId);
@@ -41,6 +69,8 @@ private:
     bool isRequestValid(const QUrl &url) const;
     bool isThreadAvailable() const;
 
+    NetworkGauges gauges() const;
+
     bool addToFailedQueue(const RequestTask &request);
     void clearFailQueue();
 
@@ -98,6 +128,9 @@ private:
     QMap<quint64, QMap<quint64, qint64>> m_mapBatchUCurrentBytes;
     // (batchId <---> 总上传字节数)
     QMap<quint64, qint64> m_mapBatchUTotalBytes;
+
+    // (batchId <---> 清单批量请求)
+    QMap<quint64, std::shared_ptr<BatchManifestFeeder>> m_mapBatchManifest;
 };
 #if defined(_MSC_VER) && _MSC_VER < 1700
 quint64 NetworkManagerPrivate::ms_uiRequestId = 0;
@@ -118,7 +151,7 @@ NetworkManagerPrivate::NetworkManagerPrivate()
 
 NetworkManagerPrivate::~NetworkManagerPrivate()
 {
-    qDebug() << "[QMultiThreadNetwork] Runnable size: " << m_mapRunnable.size();
+    NETWORK_LOG(eLogDebug, eCategoryManager) << "Runnable size: " << m_mapRunnable.size();
 
     unInitialize();
     m_pThreadPool->deleteLater();
@@ -148,8 +181,9 @@ void NetworkManagerPrivate::unInitialize()
     m_pThreadPool->clear();
     if (!m_pThreadPool->waitForDone(3000))
     {
-        qDebug() << "[QMultiThreadNetwork] ThreadPool waitForDone failed!";
+        NETWORK_LOG(eLogWarn, eCategoryManager) << "ThreadPool waitForDone failed!";
     }
+    NetworkLog::flush();
 }
 
 void NetworkManagerPrivate::reset()
@@ -164,6 +198,7 @@ void NetworkManagerPrivate::reset()
     m_mapBatchDTotalBytes.clear();
     m_mapBatchUCurrentBytes.clear();
     m_mapBatchUTotalBytes.clear();
+    m_mapBatchManifest.clear();
 
     m_mapRunnable.clear();
     m_mapReply.clear();
@@ -302,6 +337,10 @@ void NetworkManagerPrivate::stopBatchRequests(quint64 uiBatchId)
         {
             m_mapBatchUTotalBytes.remove(uiBatchId);
         }
+        if (m_mapBatchManifest.contains(uiBatchId))
+        {
+            m_mapBatchManifest.remove(uiBatchId);
+        }
     }
 
     if (reply.get())
@@ -401,6 +440,109 @@ std::shared_ptr<NetworkReply> NetworkManagerPrivate::addBatchRequest(BatchReques
     return pReply;
 }
 
+std::shared_ptr<NetworkReply> NetworkManagerPrivate::addBatchRequest(const QString& strManifestFile,
+    const RequestTask& taskTemplate, qint64 nStartLine, quint64& uiBatchId, QString& strError)
+{
+    std::shared_ptr<BatchManifestFeeder> pFeeder = std::make_shared<BatchManifestFeeder>();
+#if defined(_MSC_VER) && _MSC_VER < 1700
+    pFeeder->manifest.reset(new NetworkBatchManifest());
+#else
+    pFeeder->manifest = std::make_unique<NetworkBatchManifest>();
+#endif
+    if (!pFeeder->manifest->open(strManifestFile, NetworkBatchManifest::eFormatAuto, strError))
+    {
+        return nullptr;
+    }
+    if (nStartLine > 0 && !pFeeder->manifest->seekLine(nStartLine))
+    {
+        strError = QStringLiteral("Error: Invalid start line(%1) of manifest(%2)").arg(nStartLine).arg(strManifestFile);
+        return nullptr;
+    }
+    pFeeder->taskTemplate = taskTemplate;
+
+    QMutexLocker locker(&m_mutex);
+    uiBatchId = nextBatchId();
+    // 清单读完之前任务总数未知
+    m_mapBatchTotalSize[uiBatchId] = INT_MAX;
+    m_mapBatchManifest.insert(uiBatchId, pFeeder);
+
+    std::shared_ptr<NetworkReply> pReply = std::make_shared<NetworkReply>(true);
+    m_mapBatchReply.insert(uiBatchId, pReply);
+
+    fillBatchManifest(uiBatchId, pFeeder.get());
+    if (pFeeder->nStarted == 0)
+    {
+        m_mapBatchTotalSize.remove(uiBatchId);
+        m_mapBatchManifest.remove(uiBatchId);
+        m_mapBatchReply.remove(uiBatchId);
+        strError = QStringLiteral("Error: No valid task in manifest(%1)").arg(strManifestFile);
+        return nullptr;
+    }
+    return pReply;
+}
+
+void NetworkManagerPrivate::fillBatchManifest(quint64 uiBatchId, BatchManifestFeeder *pFeeder)
+{
+    QMutexLocker locker(&m_mutex);
+    if (pFeeder->bEnd)
+    {
+        return;
+    }
+
+    Q_Q(NetworkManager);
+    const int nWindow = qMax(1, maxThreadCount()) * 2;
+    while (pFeeder->mapRunningLine.size() < nWindow)
+    {
+        RequestTask task = pFeeder->taskTemplate;
+        qint64 nLine = 0;
+        if (!pFeeder->manifest->readNext(task, nLine))
+        {
+            // 清单已读完，此时才能确定该批次的任务总数
+            pFeeder->bEnd = true;
+            m_mapBatchTotalSize[uiBatchId] = pFeeder->nStarted;
+            break;
+        }
+
+        task.uiBatchId = uiBatchId;
+        task.uiId = nextRequestId();
+        pFeeder->mapRunningLine.insert(task.uiId, nLine);
+        ++pFeeder->nStarted;
+
+        q->startAsRunnable(task);
+    }
+}
+
+bool NetworkManagerPrivate::feedBatchManifest(const RequestTask& task, qint64& nResumeLine, qint64& iBytesRead, qint64& iBytesTotal)
+{
+    QMutexLocker locker(&m_mutex);
+    std::shared_ptr<BatchManifestFeeder> pFeeder = m_mapBatchManifest.value(task.uiBatchId);
+    if (!pFeeder.get())
+    {
+        return false;
+    }
+
+    pFeeder->mapRunningLine.remove(task.uiId);
+    // 该任务失败会终止整批请求，不再补充新任务
+    if (task.bSuccess || !task.bAbortBatchWhenFailed)
+    {
+        fillBatchManifest(task.uiBatchId, pFeeder.get());
+    }
+
+    nResumeLine = pFeeder->manifest->currentLine();
+    for (auto iter = pFeeder->mapRunningLine.cbegin(); iter != pFeeder->mapRunningLine.cend(); ++iter)
+    {
+        nResumeLine = qMin(nResumeLine, iter.value());
+    }
+    iBytesRead = pFeeder->manifest->bytesRead();
+    iBytesTotal = pFeeder->manifest->size();
+
+    if (pFeeder->bEnd && pFeeder->mapRunningLine.isEmpty())
+    {
+        m_mapBatchManifest.remove(task.uiBatchId);
+    }
+    return true;
+}
+
 quint64 NetworkManagerPrivate::nextRequestId() const
 {
 #if _MSC_VER < 1700
@@ -432,11 +574,11 @@ bool NetworkManagerPrivate::startRunnable(std::shared_ptr<NetworkRunnable> r)
         }
         catch (std::exception* e)
         {
-            qCritical() << "[QMultiThreadNetwork] startRunnable() exception:" << QString::fromUtf8(e->what());
+            NETWORK_LOG(eLogError, eCategoryManager) << "startRunnable() exception:" << QString::fromUtf8(e->what());
         }
         catch (...)
         {
-            qCritical() << "[QMultiThreadNetwork] startRunnable() unknown exception";
+            NETWORK_LOG(eLogError, eCategoryManager) << "startRunnable() unknown exception";
         }
     }
 
@@ -448,7 +590,7 @@ bool NetworkManagerPrivate::setMaxThreadCount(int nMax)
     bool bRet = false;
     if (nMax >= 1 && nMax <= 16 && m_pThreadPool)
     {
-        qDebug() << "[QMultiThreadNetwork] ThreadPool maxThreadCount: " << nMax;
+        NETWORK_LOG(eLogInfo, eCategoryManager) << "ThreadPool maxThreadCount: " << nMax;
         m_pThreadPool->setMaxThreadCount(nMax);
         bRet = true;
     }
@@ -473,6 +615,21 @@ bool NetworkManagerPrivate::isThreadAvailable() const
     return false;
 }
 
+NetworkGauges NetworkManagerPrivate::gauges() const
+{
+    NetworkGauges gauges;
+    QMutexLocker locker(&m_mutex);
+    if (m_pThreadPool)
+    {
+        gauges.nActiveThreads = m_pThreadPool->activeThreadCount();
+        gauges.nMaxThreads = m_pThreadPool->maxThreadCount();
+    }
+    // 已加入线程池但还没有线程执行的任务
+    gauges.nQueueDepth = qMax(0, m_mapRunnable.size() - gauges.nActiveThreads);
+    gauges.nOpenReplies = m_mapReply.size() + m_mapBatchReply.size();
+    return gauges;
+}
+
 bool NetworkManagerPrivate::isRequestValid(const QUrl &url) const
 {
     return (url.isValid());
@@ -492,7 +649,7 @@ std::shared_ptr<NetworkReply> NetworkManagerPrivate::getReply(quint64 uiRequestI
             return m_mapReply.value(uiRequestId);
         }
     }
-    qDebug() << QString("%1 failed! Id: ").arg(__FUNCTION__) << uiRequestId;
+    NETWORK_LOG(eLogDebug, eCategoryManager) << QString("%1 failed! Id: ").arg(__FUNCTION__) << uiRequestId;
     return nullptr;
 }
 
@@ -673,7 +830,7 @@ NetworkReply *NetworkManager::addRequest(RequestTask& request)
 {
     if (!NetworkManager::isInitialized())
     {
-        qDebug() << "[QMultiThreadNetwork] You must call NetworkManager::initialize() before any request.";
+        NETWORK_LOG(eLogWarn, eCategoryManager) << "You must call NetworkManager::initialize() before any request.";
         return nullptr;
     }
 
@@ -692,7 +849,7 @@ NetworkReply *NetworkManager::addBatchRequest(BatchRequestTask& tasks, quint64 &
 {
     if (!NetworkManager::isInitialized())
     {
-        qDebug() << "[QMultiThreadNetwork] You must call NetworkManager::initialize() before any request.";
+        NETWORK_LOG(eLogWarn, eCategoryManager) << "You must call NetworkManager::initialize() before any request.";
         return nullptr;
     }
 
@@ -708,6 +865,29 @@ NetworkReply *NetworkManager::addBatchRequest(BatchRequestTask& tasks, quint64 &
     return nullptr;
 }
 
+NetworkReply *NetworkManager::addBatchRequest(const QString& strManifestFile, const RequestTask& taskTemplate,
+    quint64 &uiBatchId, qint64 nStartLine)
+{
+    if (!NetworkManager::isInitialized())
+    {
+        NETWORK_LOG(eLogWarn, eCategoryManager) << "You must call NetworkManager::initialize() before any request.";
+        return nullptr;
+    }
+
+    Q_D(NetworkManager);
+    d->resetStopAllFlag();
+
+    uiBatchId = 0;
+    QString strError;
+    std::shared_ptr<NetworkReply> pReply = d->addBatchRequest(strManifestFile, taskTemplate, nStartLine, uiBatchId, strError);
+    if (!pReply.get())
+    {
+        NETWORK_LOG(eLogWarn, eCategoryManager) << strError;
+        emit errorMessage(strError);
+    }
+    return pReply.get();
+}
+
 void NetworkManager::stopRequest(quint64 uiTaskId)
 {
     Q_D(NetworkManager);
@@ -728,6 +908,7 @@ void NetworkManager::stopAllRequest()
 
 bool NetworkManager::startAsRunnable(const RequestTask &request)
 {
+    NETWORK_TRACE_ASYNC_BEGIN("task", "queued", request.uiId, "batch", request.uiBatchId);
     std::shared_ptr<NetworkRunnable> r = std::make_shared<NetworkRunnable>(request);
     qRegisterMetaType<RequestTask>("QMTNetwork::RequestTask");
     connect(r.get(), &NetworkRunnable::requestFinished, this, &NetworkManager::onRequestFinished);
@@ -735,7 +916,7 @@ bool NetworkManager::startAsRunnable(const RequestTask &request)
     Q_D(NetworkManager);
     if (!d->startRunnable(r))
     {
-        qDebug() << "[QMultiThreadNetwork] startRunnable() failed!";
+        NETWORK_LOG(eLogWarn, eCategoryManager) << "startRunnable() failed!";
 
         d->addToFailedQueue(request);
         r.reset();
@@ -756,6 +937,81 @@ int NetworkManager::maxThreadCount()
     return d->maxThreadCount();
 }
 
+bool NetworkManager::setLogLevel(LogLevel eLevel, const QString& strCategory)
+{
+    if (strCategory.isEmpty())
+    {
+        NetworkLog::setLevel(eLevel);
+        return true;
+    }
+    return NetworkLog::setLevel(strCategory, eLevel);
+}
+
+void NetworkManager::startTracing(int nEventsPerThread)
+{
+    NetworkTracer::globalInstance()->start(nEventsPerThread);
+}
+
+bool NetworkManager::stopTracing(const QString& strJsonFile, QString& strError)
+{
+    strError.clear();
+    return NetworkTracer::globalInstance()->stop(strJsonFile, strError);
+}
+
+QByteArray NetworkManager::metricsSnapshot()
+{
+    Q_D(NetworkManager);
+    return NetworkMetrics::globalInstance()->toPrometheusText(d->gauges());
+}
+
+void NetworkManager::setHedgeBudget(int nPercent)
+{
+    NetworkMetrics::globalInstance()->setHedgeBudget(nPercent);
+}
+
+bool NetworkManager::writeMetricsSnapshot(const QString& strTarget, QString& strError)
+{
+    strError.clear();
+    const QByteArray& bytes = metricsSnapshot();
+
+    if (strTarget.startsWith(QLatin1String("local:")))
+    {
+        const QString& strServer = strTarget.mid(6);
+        QLocalSocket socket;
+        socket.connectToServer(strServer, QIODevice::WriteOnly);
+        if (!socket.waitForConnected(1000))
+        {
+            strError = QStringLiteral("Error: QLocalSocket::connectToServer(%1) - %2").arg(strServer).arg(socket.errorString());
+            return false;
+        }
+        socket.write(bytes);
+        while (socket.bytesToWrite() > 0)
+        {
+            if (!socket.waitForBytesWritten(1000))
+            {
+                strError = QStringLiteral("Error: QLocalSocket::write(%1) - %2").arg(strServer).arg(socket.errorString());
+                return false;
+            }
+        }
+        socket.disconnectFromServer();
+        return true;
+    }
+
+    QFile file(strTarget);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        strError = QStringLiteral("Error: QFile::open(%1) - %2").arg(strTarget).arg(file.errorString());
+        return false;
+    }
+    if (file.write(bytes) != bytes.size())
+    {
+        strError = QStringLiteral("Error: QFile::write(%1) - %2").arg(strTarget).arg(file.errorString());
+        return false;
+    }
+    file.close();
+    return true;
+}
+
 bool NetworkManager::event(QEvent *event)
 {
     if (event->type() == NetworkEvent::NetworkProgress)
@@ -820,6 +1076,7 @@ void NetworkManager::onRequestFinished(const RequestTask &request)
     bool bNotify = true;
 
     RequestTask task = request;
+    task.timing.iFinished = NetworkUtility::monotonicTime();
     //1.处理请求失败的情况
     if (!task.bSuccess)
     {
@@ -831,6 +1088,8 @@ void NetworkManager::onRequestFinished(const RequestTask &request)
             bNotify = false;
         }
     }
+    NetworkMetrics::globalInstance()->recordFinished(task, !bNotify);
+    NETWORK_TRACE_INSTANT("task", "finished", task.uiId, "success", task.bSuccess);
 
     try
     {
@@ -845,6 +1104,15 @@ void NetworkManager::onRequestFinished(const RequestTask &request)
             }
             else if (task.uiBatchId > 0)//批量任务
             {
+                // 清单批量请求：补充新的任务，并通知可继续执行的起始行
+                qint64 nResumeLine = 0;
+                qint64 iBytesRead = 0;
+                qint64 iBytesTotal = 0;
+                if (d->feedBatchManifest(task, nResumeLine, iBytesRead, iBytesTotal))
+                {
+                    emit batchManifestProgress(task.uiBatchId, nResumeLine, iBytesRead, iBytesTotal);
+                }
+
                 int sizeFinished = 0;
                 int sizeTotal = 0;
                 {
@@ -887,7 +1155,7 @@ void NetworkManager::onRequestFinished(const RequestTask &request)
                 pReply->replyResult(task, bDestroyed);
                 if (task.uiBatchId > 0 && bDestroyed)
                 {
-                    qDebug() << QStringLiteral("[QMultiThreadNetwork] Batch request finished! Id：%1").arg(task.uiBatchId);
+                    NETWORK_LOG(eLogDebug, eCategoryManager) << QStringLiteral("Batch request finished! Id：%1").arg(task.uiBatchId);
                     emit batchRequestFinished(task.uiBatchId, task.bSuccess);
                 }
             }
@@ -909,10 +1177,10 @@ void NetworkManager::onRequestFinished(const RequestTask &request)
     }
     catch (std::exception* e)
     {
-        qCritical() << "NetworkManager::onRequestFinished() exception:" << QString::fromUtf8(e->what());
+        NETWORK_LOG(eLogError, eCategoryManager) << "NetworkManager::onRequestFinished() exception:" << QString::fromUtf8(e->what());
     }
     catch (...)
     {
-        qCritical() << "NetworkManager::onRequestFinished() unknown exception";
+        NETWORK_LOG(eLogError, eCategoryManager) << "NetworkManager::onRequestFinished() unknown exception";
     }
 }
@@ -0,0 +1,149 @@
+﻿#include "networkmappedfile.h"
+#include <climits>
+#include <memory>
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "networklog.h"
+
+NetworkMappedFile::NetworkMappedFile(QObject *parent)
+    : QBuffer(parent)
+    , m_pData(nullptr)
+{
+}
+
+NetworkMappedFile::~NetworkMappedFile()
+{
+    // 先释放引用映射内存的数据，再解除映射
+    close();
+    setData(QByteArray());
+    if (m_pData)
+    {
+        m_file.unmap(m_pData);
+        m_pData = nullptr;
+    }
+}
+
+QIODevice *NetworkMappedFile::create(const QString& strFilePath, QString& strError, QObject *parent)
+{
+    return create(strFilePath, 0, -1, strError, parent);
+}
+
+QIODevice *NetworkMappedFile::create(const QString& strFilePath, qint64 nOffset, qint64 nSize, QString& strError, QObject *parent)
+{
+    if (!QFile::exists(strFilePath))
+    {
+        strError = QStringLiteral("Error: File is not exists(%1)").arg(strFilePath);
+        return nullptr;
+    }
+
+    std::unique_ptr<NetworkMappedFile> pMapped(new NetworkMappedFile(parent));
+    pMapped->m_file.setFileName(strFilePath);
+    if (!pMapped->m_file.open(QIODevice::ReadOnly))
+    {
+        strError = QStringLiteral("Error: QFile::open(%1) - %2").arg(strFilePath).arg(pMapped->m_file.errorString());
+        return nullptr;
+    }
+
+    const bool bWholeFile = (nOffset == 0 && nSize < 0);
+    const qint64 nFileSize = pMapped->m_file.size();
+    if (bWholeFile)
+    {
+        nSize = nFileSize;
+    }
+    else if (nOffset < 0 || nSize < 0 || nOffset + nSize > nFileSize)
+    {
+        strError = QStringLiteral("Error: Range %1+%2 is out of file(%3, %4 bytes)").arg(nOffset).arg(nSize).arg(strFilePath).arg(nFileSize);
+        return nullptr;
+    }
+
+    // QByteArray的长度是int
+    if (nSize > 0 && nSize <= INT_MAX)
+    {
+        pMapped->m_pData = pMapped->m_file.map(nOffset, nSize);
+    }
+    if (nullptr == pMapped->m_pData)
+    {
+        if (nSize > 0)
+        {
+            NETWORK_LOG(eLogDebug, eCategoryUpload) << "map failed, reading from file:" << strFilePath << pMapped->m_file.errorString();
+        }
+        QIODevice *pFile = bWholeFile ? static_cast<QIODevice *>(new QFile(strFilePath, parent))
+            : new NetworkFileRange(strFilePath, nOffset, nSize, parent);
+        if (!pFile->open(QIODevice::ReadOnly))
+        {
+            strError = QStringLiteral("Error: QFile::open(%1) - %2").arg(strFilePath).arg(pFile->errorString());
+            delete pFile;
+            return nullptr;
+        }
+        return pFile;
+    }
+
+#ifdef Q_OS_UNIX
+    // 偏移不是页大小的整数倍时，映射的地址不是页的起始地址
+    const quintptr nPageMask = static_cast<quintptr>(sysconf(_SC_PAGESIZE)) - 1;
+    uchar *pPage = reinterpret_cast<uchar *>(reinterpret_cast<quintptr>(pMapped->m_pData) & ~nPageMask);
+    madvise(pPage, static_cast<size_t>(nSize + (pMapped->m_pData - pPage)), MADV_SEQUENTIAL);
+#endif
+    pMapped->setData(QByteArray::fromRawData(reinterpret_cast<const char *>(pMapped->m_pData), static_cast<int>(nSize)));
+    pMapped->open(QIODevice::ReadOnly);
+    return pMapped.release();
+}
+
+NetworkFileRange::NetworkFileRange(const QString& strFilePath, qint64 nOffset, qint64 nSize, QObject *parent)
+    : QIODevice(parent)
+    , m_file(strFilePath)
+    , m_nOffset(nOffset)
+    , m_nSize(nSize)
+{
+}
+
+bool NetworkFileRange::open(OpenMode mode)
+{
+    if ((mode & QIODevice::WriteOnly) || !m_file.open(QIODevice::ReadOnly))
+    {
+        setErrorString(m_file.errorString());
+        return false;
+    }
+    if (!m_file.seek(m_nOffset))
+    {
+        setErrorString(m_file.errorString());
+        m_file.close();
+        return false;
+    }
+    return QIODevice::open(mode);
+}
+
+void NetworkFileRange::close()
+{
+    QIODevice::close();
+    m_file.close();
+}
+
+bool NetworkFileRange::seek(qint64 pos)
+{
+    if (pos < 0 || pos > m_nSize || !QIODevice::seek(pos))
+    {
+        return false;
+    }
+    return m_file.seek(m_nOffset + pos);
+}
+
+qint64 NetworkFileRange::readData(char *data, qint64 maxlen)
+{
+    // 按文件的位置计算剩余的字节数，与QIODevice的缓冲无关
+    const qint64 nRemain = m_nOffset + m_nSize - m_file.pos();
+    if (nRemain <= 0)
+    {
+        return 0;
+    }
+    return m_file.read(data, qMin(maxlen, nRemain));
+}
+
+qint64 NetworkFileRange::writeData(const char *data, qint64 len)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(len);
+    return -1;
+}
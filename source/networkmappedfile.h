@@ -0,0 +1,51 @@
+﻿#ifndef NETWORKMAPPEDFILE_H
+#define NETWORKMAPPEDFILE_H
+
+#include <QBuffer>
+#include <QFile>
+
+// 内存映射的上传文件（QFile::map），以只读QBuffer的形式交给QNetworkAccessManager.
+//	QNetworkAccessManager对QBuffer直接使用其数据指针发送，文件内容不复制到堆内存，
+//	同一文件的多个上传共享页缓存. 映射后madvise(MADV_SEQUENTIAL)提示内核预读（仅Unix）.
+class NetworkMappedFile : public QBuffer
+{
+public:
+    // 返回已以ReadOnly打开的设备：能映射时为NetworkMappedFile，否则（空文件、超过2GB或映射失败）
+    //	为按块读取的QFile. 打开失败时返回nullptr.
+    static QIODevice *create(const QString& strFilePath, QString& strError, QObject *parent = nullptr);
+    // 只包含文件中[nOffset, nOffset + nSize)的一段（分块上传的一块），不能映射时为NetworkFileRange
+    static QIODevice *create(const QString& strFilePath, qint64 nOffset, qint64 nSize, QString& strError, QObject *parent = nullptr);
+    ~NetworkMappedFile();
+
+private:
+    explicit NetworkMappedFile(QObject *parent);
+    Q_DISABLE_COPY(NetworkMappedFile);
+
+private:
+    QFile m_file;
+    uchar *m_pData;
+};
+
+// 文件中的一段，按块从文件读取，size()为这一段的长度
+class NetworkFileRange : public QIODevice
+{
+public:
+    NetworkFileRange(const QString& strFilePath, qint64 nOffset, qint64 nSize, QObject *parent = nullptr);
+
+    bool open(OpenMode mode) Q_DECL_OVERRIDE;
+    void close() Q_DECL_OVERRIDE;
+    qint64 size() const Q_DECL_OVERRIDE { return m_nSize; }
+    bool seek(qint64 pos) Q_DECL_OVERRIDE;
+
+protected:
+    qint64 readData(char *data, qint64 maxlen) Q_DECL_OVERRIDE;
+    qint64 writeData(const char *data, qint64 len) Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(NetworkFileRange);
+    QFile m_file;
+    qint64 m_nOffset;
+    qint64 m_nSize;
+};
+
+#endif // NETWORKMAPPEDFILE_H
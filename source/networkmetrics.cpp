@@ -0,0 +1,438 @@
+﻿#include "networkmetrics.h"
+#include <climits>
+#include <QNetworkReply>
+#include <QUrl>
+#include <QReadLocker>
+#include <QWriteLocker>
+
+using namespace QMTNetwork;
+
+LatencyHistogram::LatencyHistogram()
+    : m_count(0)
+    , m_sum(0)
+{
+    for (int i = 0; i < BucketCount; ++i)
+    {
+        m_buckets[i] = 0;
+    }
+}
+
+int LatencyHistogram::bucketIndex(qint64 iValue)
+{
+    if (iValue < SubBucketCount)
+    {
+        return (iValue < 0) ? 0 : static_cast<int>(iValue);
+    }
+
+    // 最高位的位置
+    int nMsb = 0;
+    for (quint64 v = static_cast<quint64>(iValue); v > 1; v >>= 1)
+    {
+        ++nMsb;
+    }
+    const int nShift = nMsb - SubBucketBits;
+    const int nSub = static_cast<int>((iValue >> nShift) & (SubBucketCount - 1));
+    return SubBucketCount + nShift * SubBucketCount + nSub;
+}
+
+qint64 LatencyHistogram::bucketUpperBound(int nIndex)
+{
+    if (nIndex < SubBucketCount)
+    {
+        return nIndex;
+    }
+
+    const int nShift = (nIndex - SubBucketCount) / SubBucketCount;
+    const int nSub = (nIndex - SubBucketCount) % SubBucketCount;
+    const quint64 uiLower = static_cast<quint64>(SubBucketCount + nSub) << nShift;
+    const quint64 uiUpper = uiLower + (Q_UINT64_C(1) << nShift) - 1;
+    return static_cast<qint64>(qMin(uiUpper, static_cast<quint64>(LLONG_MAX)));
+}
+
+void LatencyHistogram::record(qint64 iMicroseconds)
+{
+    if (iMicroseconds < 0)
+    {
+        iMicroseconds = 0;
+    }
+    m_buckets[bucketIndex(iMicroseconds)].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(iMicroseconds, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+qint64 LatencyHistogram::count() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+qint64 LatencyHistogram::sum() const
+{
+    return m_sum.load(std::memory_order_relaxed);
+}
+
+qint64 LatencyHistogram::countAtOrBelow(qint64 iMicroseconds) const
+{
+    qint64 nCount = 0;
+    for (int i = 0; i < BucketCount && bucketUpperBound(i) <= iMicroseconds; ++i)
+    {
+        nCount += m_buckets[i].load(std::memory_order_relaxed);
+    }
+    return nCount;
+}
+
+qint64 LatencyHistogram::valueAtPercentile(double dPercentile) const
+{
+    // 各个桶单独读取，总数以桶的累加值为准
+    qint64 nTotal = 0;
+    for (int i = 0; i < BucketCount; ++i)
+    {
+        nTotal += m_buckets[i].load(std::memory_order_relaxed);
+    }
+    if (nTotal == 0)
+    {
+        return -1;
+    }
+
+    dPercentile = qBound(0.0, dPercentile, 100.0);
+    const qint64 nRank = qMax<qint64>(1, static_cast<qint64>(dPercentile / 100.0 * nTotal + 0.5));
+    qint64 nCount = 0;
+    for (int i = 0; i < BucketCount; ++i)
+    {
+        nCount += m_buckets[i].load(std::memory_order_relaxed);
+        if (nCount >= nRank)
+        {
+            return bucketUpperBound(i);
+        }
+    }
+    return bucketUpperBound(BucketCount - 1);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+namespace {
+    // Prometheus直方图导出的桶边界（秒）
+    const double s_dBucketBounds[] = {
+        0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5,
+        1, 2.5, 5, 10, 30, 60, 120, 300
+    };
+
+    QByteArray escapeLabel(const QString& strValue)
+    {
+        QByteArray bytes = strValue.toUtf8();
+        bytes.replace('\\', "\\\\");
+        bytes.replace('"', "\\\"");
+        bytes.replace('\n', "\\n");
+        return bytes;
+    }
+
+    void appendHistogram(QByteArray& bytes, const QByteArray& strName,
+        const QByteArray& strLabels, const LatencyHistogram& histogram)
+    {
+        const QByteArray strPrefix = strLabels.isEmpty() ? QByteArray() : (strLabels + ',');
+        for (double dBound : s_dBucketBounds)
+        {
+            bytes += strName + "_bucket{" + strPrefix + "le=\"" + QByteArray::number(dBound) + "\"} "
+                + QByteArray::number(histogram.countAtOrBelow(static_cast<qint64>(dBound * 1000000))) + '\n';
+        }
+        const qint64 nCount = histogram.count();
+        bytes += strName + "_bucket{" + strPrefix + "le=\"+Inf\"} " + QByteArray::number(nCount) + '\n';
+        const QByteArray strBraced = strLabels.isEmpty() ? QByteArray() : ('{' + strLabels + '}');
+        bytes += strName + "_sum" + strBraced + ' ' + QByteArray::number(histogram.sum() / 1000000.0, 'f', 6) + '\n';
+        bytes += strName + "_count" + strBraced + ' ' + QByteArray::number(nCount) + '\n';
+    }
+
+    void appendHeader(QByteArray& bytes, const char *pName, const char *pType, const char *pHelp)
+    {
+        bytes += QByteArray("# HELP ") + pName + ' ' + pHelp + '\n';
+        bytes += QByteArray("# TYPE ") + pName + ' ' + pType + '\n';
+    }
+}
+
+NetworkMetrics *NetworkMetrics::globalInstance()
+{
+    static NetworkMetrics s_instance;
+    return &s_instance;
+}
+
+NetworkMetrics::NetworkMetrics()
+    : m_retries(0)
+    , m_redirects(0)
+    , m_bytesReceived(0)
+    , m_bytesSent(0)
+    , m_diskOps(0)
+    , m_diskSyscalls(0)
+    , m_diskBytes(0)
+    , m_pDiskBackend("sync")
+    , m_hedgeEligible(0)
+    , m_hedges(0)
+    , m_hedgeWins(0)
+    , m_hedgeDenied(0)
+    , m_nHedgeBudgetPercent(DefaultHedgeBudgetPercent)
+{
+    for (int i = 0; i < MaxRequestType; ++i)
+    {
+        m_requests[i] = 0;
+        m_typeLatency[i].reset(new LatencyHistogram);
+    }
+    for (int i = 0; i < eFailureClassCount; ++i)
+    {
+        m_failures[i] = 0;
+    }
+}
+
+void NetworkMetrics::recordDiskIo(qint64 nOps, qint64 nSyscalls, qint64 nBytes)
+{
+    m_diskOps.fetch_add(nOps, std::memory_order_relaxed);
+    m_diskSyscalls.fetch_add(nSyscalls, std::memory_order_relaxed);
+    m_diskBytes.fetch_add(nBytes, std::memory_order_relaxed);
+}
+
+void NetworkMetrics::recordHedgeEligible()
+{
+    m_hedgeEligible.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool NetworkMetrics::tryAcquireHedge()
+{
+    const qint64 nAllowed = m_hedgeEligible.load(std::memory_order_relaxed) * m_nHedgeBudgetPercent.load() / 100;
+    qint64 nHedges = m_hedges.load(std::memory_order_relaxed);
+    while (nHedges < nAllowed)
+    {
+        if (m_hedges.compare_exchange_weak(nHedges, nHedges + 1, std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+    m_hedgeDenied.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void NetworkMetrics::recordHedgeWin()
+{
+    m_hedgeWins.fetch_add(1, std::memory_order_relaxed);
+}
+
+void NetworkMetrics::recordFinished(const RequestTask& task, bool bRetry)
+{
+    const int nType = (task.eType >= 0 && task.eType < MaxRequestType) ? task.eType : (MaxRequestType - 1);
+    m_requests[nType].fetch_add(1, std::memory_order_relaxed);
+    if (!task.bSuccess)
+    {
+        m_failures[classifyFailure(task)].fetch_add(1, std::memory_order_relaxed);
+    }
+    if (bRetry)
+    {
+        m_retries.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const RequestTiming& timing = task.timing;
+    m_redirects.fetch_add(timing.nRedirectCount, std::memory_order_relaxed);
+    m_bytesReceived.fetch_add(timing.iBytesReceived, std::memory_order_relaxed);
+    m_bytesSent.fetch_add(timing.iBytesSent, std::memory_order_relaxed);
+
+    if (timing.iEnqueue > 0 && timing.iThreadStart >= timing.iEnqueue)
+    {
+        m_queueWait.record(timing.iThreadStart - timing.iEnqueue);
+    }
+    if (timing.iRequestSent > 0 && timing.iFirstByte >= timing.iRequestSent)
+    {
+        m_firstByte.record(timing.iFirstByte - timing.iRequestSent);
+    }
+    if (timing.iThreadStart > 0 && timing.iFinished >= timing.iThreadStart)
+    {
+        const qint64 iElapsed = timing.iFinished - timing.iThreadStart;
+        m_typeLatency[nType]->record(iElapsed);
+
+        // 取消的请求不计入主机的耗时，避免拉低统计值
+        const QString& strHost = QUrl(task.url).host();
+        if (!task.bCancel && !strHost.isEmpty())
+        {
+            hostHistogram(strHost)->record(iElapsed);
+        }
+    }
+}
+
+std::shared_ptr<LatencyHistogram> NetworkMetrics::hostHistogram(const QString& strHost)
+{
+    {
+        QReadLocker locker(&m_lockHost);
+        auto iter = m_hostLatency.constFind(strHost);
+        if (iter != m_hostLatency.constEnd())
+        {
+            return iter.value();
+        }
+    }
+
+    QWriteLocker locker(&m_lockHost);
+    const QString& strKey = (m_hostLatency.size() < MaxHostCount) ? strHost : QStringLiteral("other");
+    std::shared_ptr<LatencyHistogram>& histogram = m_hostLatency[strKey];
+    if (!histogram.get())
+    {
+        histogram = std::make_shared<LatencyHistogram>();
+    }
+    return histogram;
+}
+
+std::shared_ptr<LatencyHistogram> NetworkMetrics::hostLatency(const QString& strHost) const
+{
+    QReadLocker locker(&m_lockHost);
+    return m_hostLatency.value(strHost);
+}
+
+FailureClass NetworkMetrics::classifyFailure(const RequestTask& task)
+{
+    if (task.bCancel)
+    {
+        return eFailureCancelled;
+    }
+    if (task.nHttpStatusCode >= 500)
+    {
+        return eFailureHttp5xx;
+    }
+    if (task.nHttpStatusCode >= 400)
+    {
+        return eFailureHttp4xx;
+    }
+
+    switch (task.nNetworkError)
+    {
+    case QNetworkReply::NoError:
+        // 网络正常但请求失败，如文件创建或写入失败
+        return eFailureLocal;
+    case QNetworkReply::OperationCanceledError:
+        return eFailureCancelled;
+    case QNetworkReply::HostNotFoundError:
+        return eFailureDns;
+    case QNetworkReply::TimeoutError:
+        return eFailureTimeout;
+    case QNetworkReply::SslHandshakeFailedError:
+        return eFailureTls;
+    default:
+        break;
+    }
+
+    if (task.nNetworkError >= QNetworkReply::ProxyConnectionRefusedError
+        && task.nNetworkError <= QNetworkReply::UnknownProxyError)
+    {
+        return eFailureProxy;
+    }
+    if (task.nNetworkError >= QNetworkReply::ContentAccessDenied)
+    {
+        return eFailureProtocol;
+    }
+    return eFailureConnection;
+}
+
+const char *NetworkMetrics::failureClassName(FailureClass eClass)
+{
+    static const char *s_names[eFailureClassCount] = {
+        "cancelled", "dns", "timeout", "connection", "tls", "proxy", "http_4xx", "http_5xx", "protocol", "local"
+    };
+    return s_names[eClass];
+}
+
+QByteArray NetworkMetrics::requestTypeName(int nType)
+{
+    switch (nType)
+    {
+    case eTypeDownload:		return "download";
+    case eTypeMTDownload:	return "mt_download";
+    case eTypeUpload:		return "upload";
+    case eTypeGet:			return "get";
+    case eTypePost:			return "post";
+    case eTypePut:			return "put";
+    case eTypeDelete:		return "delete";
+    case eTypeHead:			return "head";
+    case eTypeAutoDownload:	return "auto_download";
+    case eTypeMTUpload:		return "mt_upload";
+    default:
+        break;
+    }
+    return "type_" + QByteArray::number(nType);
+}
+
+QByteArray NetworkMetrics::toPrometheusText(const NetworkGauges& gauges) const
+{
+    QByteArray bytes;
+    bytes.reserve(16 * 1024);
+
+    appendHeader(bytes, "qmtnetwork_requests_total", "counter", "Finished requests by type.");
+    for (int i = 0; i < MaxRequestType; ++i)
+    {
+        const qint64 nCount = m_requests[i].load(std::memory_order_relaxed);
+        if (nCount > 0)
+        {
+            bytes += "qmtnetwork_requests_total{type=\"" + requestTypeName(i) + "\"} " + QByteArray::number(nCount) + '\n';
+        }
+    }
+
+    appendHeader(bytes, "qmtnetwork_request_failures_total", "counter", "Failed requests by error class.");
+    for (int i = 0; i < eFailureClassCount; ++i)
+    {
+        bytes += QByteArray("qmtnetwork_request_failures_total{class=\"") + failureClassName(FailureClass(i)) + "\"} "
+            + QByteArray::number(m_failures[i].load(std::memory_order_relaxed)) + '\n';
+    }
+
+    appendHeader(bytes, "qmtnetwork_retries_total", "counter", "Requests retried after the first failure.");
+    bytes += "qmtnetwork_retries_total " + QByteArray::number(m_retries.load(std::memory_order_relaxed)) + '\n';
+    appendHeader(bytes, "qmtnetwork_redirects_total", "counter", "Followed HTTP redirects.");
+    bytes += "qmtnetwork_redirects_total " + QByteArray::number(m_redirects.load(std::memory_order_relaxed)) + '\n';
+    appendHeader(bytes, "qmtnetwork_received_bytes_total", "counter", "Bytes received by finished requests.");
+    bytes += "qmtnetwork_received_bytes_total " + QByteArray::number(m_bytesReceived.load(std::memory_order_relaxed)) + '\n';
+    appendHeader(bytes, "qmtnetwork_sent_bytes_total", "counter", "Bytes sent by finished requests.");
+    bytes += "qmtnetwork_sent_bytes_total " + QByteArray::number(m_bytesSent.load(std::memory_order_relaxed)) + '\n';
+
+    appendHeader(bytes, "qmtnetwork_hedge_eligible_total", "counter", "Requests started with hedging enabled.");
+    bytes += "qmtnetwork_hedge_eligible_total " + QByteArray::number(m_hedgeEligible.load(std::memory_order_relaxed)) + '\n';
+    appendHeader(bytes, "qmtnetwork_hedges_total", "counter", "Duplicate requests sent after the host's p95 latency.");
+    bytes += "qmtnetwork_hedges_total " + QByteArray::number(m_hedges.load(std::memory_order_relaxed)) + '\n';
+    appendHeader(bytes, "qmtnetwork_hedge_wins_total", "counter", "Hedged requests that answered before the original.");
+    bytes += "qmtnetwork_hedge_wins_total " + QByteArray::number(m_hedgeWins.load(std::memory_order_relaxed)) + '\n';
+    appendHeader(bytes, "qmtnetwork_hedge_budget_exhausted_total", "counter", "Hedges not sent because the budget was used up.");
+    bytes += "qmtnetwork_hedge_budget_exhausted_total " + QByteArray::number(m_hedgeDenied.load(std::memory_order_relaxed)) + '\n';
+
+    appendHeader(bytes, "qmtnetwork_disk_ops_total", "counter", "Positioned writes and fsyncs done by the disk writer threads.");
+    bytes += "qmtnetwork_disk_ops_total " + QByteArray::number(m_diskOps.load(std::memory_order_relaxed)) + '\n';
+    appendHeader(bytes, "qmtnetwork_disk_syscalls_total", "counter", "System calls issued by the disk writer threads.");
+    bytes += "qmtnetwork_disk_syscalls_total " + QByteArray::number(m_diskSyscalls.load(std::memory_order_relaxed)) + '\n';
+    appendHeader(bytes, "qmtnetwork_disk_written_bytes_total", "counter", "Bytes written to disk by downloads.");
+    bytes += "qmtnetwork_disk_written_bytes_total " + QByteArray::number(m_diskBytes.load(std::memory_order_relaxed)) + '\n';
+    appendHeader(bytes, "qmtnetwork_disk_backend", "gauge", "Disk I/O backend of the writer threads.");
+    bytes += QByteArray("qmtnetwork_disk_backend{name=\"") + m_pDiskBackend.load() + "\"} 1\n";
+
+    appendHeader(bytes, "qmtnetwork_queue_depth", "gauge", "Requests waiting for a pool thread.");
+    bytes += "qmtnetwork_queue_depth " + QByteArray::number(gauges.nQueueDepth) + '\n';
+    appendHeader(bytes, "qmtnetwork_active_threads", "gauge", "Pool threads executing a request.");
+    bytes += "qmtnetwork_active_threads " + QByteArray::number(gauges.nActiveThreads) + '\n';
+    appendHeader(bytes, "qmtnetwork_max_threads", "gauge", "Maximum thread count of the pool.");
+    bytes += "qmtnetwork_max_threads " + QByteArray::number(gauges.nMaxThreads) + '\n';
+    appendHeader(bytes, "qmtnetwork_open_replies", "gauge", "NetworkReply objects waiting for a result.");
+    bytes += "qmtnetwork_open_replies " + QByteArray::number(gauges.nOpenReplies) + '\n';
+
+    appendHeader(bytes, "qmtnetwork_request_duration_seconds", "histogram", "Request execution time by type.");
+    for (int i = 0; i < MaxRequestType; ++i)
+    {
+        if (m_typeLatency[i]->count() > 0)
+        {
+            appendHistogram(bytes, "qmtnetwork_request_duration_seconds",
+                "type=\"" + requestTypeName(i) + '"', *m_typeLatency[i]);
+        }
+    }
+
+    appendHeader(bytes, "qmtnetwork_host_request_duration_seconds", "histogram", "Request execution time by host.");
+    {
+        QReadLocker locker(&m_lockHost);
+        for (auto iter = m_hostLatency.constBegin(); iter != m_hostLatency.constEnd(); ++iter)
+        {
+            appendHistogram(bytes, "qmtnetwork_host_request_duration_seconds",
+                "host=\"" + escapeLabel(iter.key()) + '"', *iter.value());
+        }
+    }
+
+    appendHeader(bytes, "qmtnetwork_queue_wait_seconds", "histogram", "Time from enqueue to thread start.");
+    appendHistogram(bytes, "qmtnetwork_queue_wait_seconds", QByteArray(), m_queueWait);
+    appendHeader(bytes, "qmtnetwork_time_to_first_byte_seconds", "histogram", "Time from request sent to response headers.");
+    appendHistogram(bytes, "qmtnetwork_time_to_first_byte_seconds", QByteArray(), m_firstByte);
+
+    return bytes;
+}
@@ -0,0 +1,147 @@
+﻿#ifndef NETWORKMETRICS_H
+#define NETWORKMETRICS_H
+
+#include <atomic>
+#include <memory>
+#include <QHash>
+#include <QString>
+#include <QByteArray>
+#include <QReadWriteLock>
+#include "networkdefs.h"
+
+// 延时直方图（HDR风格，单位：微秒）
+//	小于8的值各占一个桶，之后每个2的幂区间再均分为8个子桶，相对误差不超过12.5%.
+//	记录只做原子加，可在任意线程中调用.
+class LatencyHistogram
+{
+public:
+    enum
+    {
+        SubBucketBits = 3,
+        SubBucketCount = 1 << SubBucketBits,
+        BucketCount = SubBucketCount + (64 - SubBucketBits) * SubBucketCount,
+    };
+
+    LatencyHistogram();
+
+    void record(qint64 iMicroseconds);
+
+    qint64 count() const;
+    qint64 sum() const;
+    // 小于等于iMicroseconds的样本数
+    qint64 countAtOrBelow(qint64 iMicroseconds) const;
+    // 百分位对应的值（dPercentile: 0-100），没有样本时返回-1
+    qint64 valueAtPercentile(double dPercentile) const;
+
+    static int bucketIndex(qint64 iValue);
+    static qint64 bucketUpperBound(int nIndex);
+
+private:
+    Q_DISABLE_COPY(LatencyHistogram);
+    std::atomic<qint64> m_buckets[BucketCount];
+    std::atomic<qint64> m_count;
+    std::atomic<qint64> m_sum;
+};
+
+// 请求失败的分类
+enum FailureClass
+{
+    eFailureCancelled = 0,
+    eFailureDns,
+    eFailureTimeout,
+    eFailureConnection,
+    eFailureTls,
+    eFailureProxy,
+    eFailureHttp4xx,
+    eFailureHttp5xx,
+    eFailureProtocol,
+    eFailureLocal,
+    eFailureClassCount
+};
+
+// 由NetworkManager在快照时提供的瞬时值
+struct NetworkGauges
+{
+    int nQueueDepth;
+    int nActiveThreads;
+    int nMaxThreads;
+    int nOpenReplies;
+
+    NetworkGauges() : nQueueDepth(0), nActiveThreads(0), nMaxThreads(0), nOpenReplies(0) {}
+};
+
+// 全局的请求统计（计数器 + 延时直方图），导出为Prometheus文本格式
+class NetworkMetrics
+{
+public:
+    enum
+    {
+        MaxRequestType = 16,
+        // 超过该数目的主机统一计入"other"，避免无限增长
+        MaxHostCount = 256,
+        // 默认的对冲预算：对冲请求数不超过可对冲请求数的百分比
+        DefaultHedgeBudgetPercent = 10,
+    };
+
+    static NetworkMetrics *globalInstance();
+
+    // 请求结束（bRetry: 失败后将重新执行一次）
+    void recordFinished(const QMTNetwork::RequestTask& task, bool bRetry);
+
+    // 磁盘写线程完成一批写入（nOps: 写入/fsync个数, nSyscalls: 进入内核的次数）
+    void recordDiskIo(qint64 nOps, qint64 nSyscalls, qint64 nBytes);
+    // 当前使用的磁盘IO方式（"sync"或"io_uring"）
+    void setDiskBackend(const char *pName) { m_pDiskBackend = pName; }
+
+    // 主机的请求耗时直方图，不存在时返回nullptr
+    std::shared_ptr<LatencyHistogram> hostLatency(const QString& strHost) const;
+
+    // 启用了对冲的请求开始执行
+    void recordHedgeEligible();
+    // 申请发出一个对冲请求，超出预算时返回false
+    bool tryAcquireHedge();
+    // 对冲请求先于原请求成功返回
+    void recordHedgeWin();
+    void setHedgeBudget(int nPercent) { m_nHedgeBudgetPercent = qBound(0, nPercent, 100); }
+
+    QByteArray toPrometheusText(const NetworkGauges& gauges) const;
+
+    static FailureClass classifyFailure(const QMTNetwork::RequestTask& task);
+    static const char *failureClassName(FailureClass eClass);
+    static QByteArray requestTypeName(int nType);
+
+private:
+    NetworkMetrics();
+    Q_DISABLE_COPY(NetworkMetrics);
+
+    std::shared_ptr<LatencyHistogram> hostHistogram(const QString& strHost);
+
+private:
+    std::atomic<qint64> m_requests[MaxRequestType];
+    std::atomic<qint64> m_failures[eFailureClassCount];
+    std::atomic<qint64> m_retries;
+    std::atomic<qint64> m_redirects;
+    std::atomic<qint64> m_bytesReceived;
+    std::atomic<qint64> m_bytesSent;
+    std::atomic<qint64> m_diskOps;
+    std::atomic<qint64> m_diskSyscalls;
+    std::atomic<qint64> m_diskBytes;
+    std::atomic<const char *> m_pDiskBackend;
+    std::atomic<qint64> m_hedgeEligible;
+    std::atomic<qint64> m_hedges;
+    std::atomic<qint64> m_hedgeWins;
+    std::atomic<qint64> m_hedgeDenied;
+    std::atomic<int> m_nHedgeBudgetPercent;
+
+    // 按请求类型的请求耗时（线程开始执行到结束）
+    std::unique_ptr<LatencyHistogram> m_typeLatency[MaxRequestType];
+    // 排队等待时间（加入线程池到线程开始执行）
+    LatencyHistogram m_queueWait;
+    // 首字节时间（请求发出到收到响应头）
+    LatencyHistogram m_firstByte;
+
+    mutable QReadWriteLock m_lockHost;
+    QHash<QString, std::shared_ptr<LatencyHistogram>> m_hostLatency;
+};
+
+#endif // NETWORKMETRICS_H
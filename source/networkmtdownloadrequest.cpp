@@ -13,12 +13,24 @@
 #include "classmemorytracer.h"
 #include "networkmanager.h"
 #include "networkutility.h"
+#include "networkfilewriter.h"
+#include "networkchecksum.h"
+#include "networkhosthistory.h"
+#include "networktracer.h"
+#include "networklog.h"
 
 using namespace QMTNetwork;
 
 NetworkMTDownloadRequest::NetworkMTDownloadRequest(QObject *parent /* = nullptr */)
     : NetworkRequest(parent)
     , m_nThreadCount(0)
+    , m_nChannelCount(0)
+    , m_bDropCache(false)
+    , m_nSyncInterval(0)
+    , m_nFinishedBytes(0)
+    , m_nFinishedElapsed(0)
+    , m_pStragglerTimer(nullptr)
+    , m_nSupersededWriting(0)
     , m_nSuccess(0)
     , m_nFailed(0)
     , m_bytesReceived(0)
@@ -34,157 +46,660 @@ NetworkMTDownloadRequest::~NetworkMTDownloadRequest()
 void NetworkMTDownloadRequest::abort()
 {
     __super::abort();
+    if (m_pStragglerTimer)
+    {
+        m_pStragglerTimer->stop();
+    }
     clearDownloaders();
     clearProgress();
 }
 
-bool NetworkMTDownloadRequest::requestFileSize(const QUrl& url)
+void NetworkMTDownloadRequest::start()
 {
+    __super::start();
+
+    m_nSuccess = 0;
+    m_nFailed = 0;
+    m_nThreadCount = 1;
+    m_nChannelCount = 1;
+    m_nFileSize = -1;
+    m_strDstFilePath.clear();
+    m_strETag.clear();
+    m_vecMirror.clear();
+    m_mapSegmentMirror.clear();
+    m_listPendingSegment.clear();
+    m_mapSegmentRange.clear();
+    m_mapDuplicate.clear();
+    m_setSuperseded.clear();
+    m_nSupersededWriting = 0;
+    m_nFinishedBytes = 0;
+    m_nFinishedElapsed = 0;
+    if (m_pStragglerTimer)
+    {
+        m_pStragglerTimer->stop();
+    }
+    clearDownloaders();
+    clearProgress();
+
+    const QUrl url(m_request.url);
     if (!url.isValid())
     {
-        return false;
+        m_strError = QStringLiteral("Invalid Url").toUtf8();
+        emit requestFinished(false, QByteArray(), m_strError);
+        return;
+    }
+    m_strHost = url.host();
+
+    m_pChecksum.reset();
+    m_pOrderedChecksum.reset();
+    if (!m_request.strChecksum.isEmpty())
+    {
+        m_pChecksum = NetworkChecksum::create(m_request.strChecksum, m_strError);
+        if (!m_pChecksum.get())
+        {
+            emit requestFinished(false, QByteArray(), m_strError);
+            return;
+        }
+        // 无法合并的算法由写线程按文件顺序计算，趁数据还在页缓存中，下载完成后不必再读一遍文件
+        if (!m_pChecksum->isCombinable())
+        {
+            m_pOrderedChecksum = std::make_shared<NetworkOrderedChecksum>(m_pChecksum->clone());
+        }
     }
-    m_nFileSize = -1;
-    m_url = url;
 
     if (nullptr == m_pNetworkManager)
     {
         m_pNetworkManager = new QNetworkAccessManager;
     }
-    QNetworkRequest request(url);
-    request.setRawHeader("Accept-Encoding", "gzip,deflate,compress,br");
 
-#ifndef QT_NO_SSL
-    if (isHttpsProxy(url.scheme()))
+    // 第一段直接请求文件开头的ProbeChunkSize字节，从Content-Range得到文件大小，省去HEAD请求的往返
+    //	只要求一个通道或eTypeAutoDownload时请求整个文件（bytes=0-），需要分段时再缩短第一段
+    Downloader *pDownloader = createDownloader(0);
+    pDownloader->setProbe(true);
+    const qint64 nEnd = (m_request.eType != eTypeAutoDownload && m_request.nDownloadThreadCount > 1) ? ProbeChunkSize - 1 : -1;
+    if (!pDownloader->start(url, 0, nEnd))
     {
-        // 发送https请求前准备工作;
-        QSslConfiguration conf = request.sslConfiguration();
-        conf.setPeerVerifyMode(QSslSocket::VerifyNone);
-        conf.setProtocol(QSsl::TlsV1SslV3);
-        request.setSslConfiguration(conf);
+        abort();
+        m_strError = QStringLiteral("part %1 download failed!").arg(0);
+        emit requestFinished(false, QByteArray(), m_strError);
     }
+}
+
+Downloader *NetworkMTDownloadRequest::createDownloader(int index)
+{
+    std::unique_ptr<Downloader> downloader;
+#if defined(_MSC_VER) && _MSC_VER < 1700
+    downloader.reset(new Downloader(index, m_strDstFilePath, m_pNetworkManager, m_request.bShowProgress, m_request.nMaxRedirectionCount, this));
+#else
+    downloader = std::make_unique<Downloader>(index, m_strDstFilePath, m_pNetworkManager, m_request.bShowProgress, m_request.nMaxRedirectionCount, this);
 #endif
+    if (m_pOrderedChecksum.get())
+    {
+        downloader->setOrderedChecksum(m_pOrderedChecksum);
+    }
+    else if (m_pChecksum.get())
+    {
+        downloader->setChecksum(m_pChecksum->clone());
+    }
+    // 探测请求在收到响应头时同步创建文件，必须直接连接
+    connect(downloader.get(), SIGNAL(responseReceived(int, qint64, bool)),
+        this, SLOT(onSubPartResponse(int, qint64, bool)), Qt::DirectConnection);
+    connect(downloader.get(), SIGNAL(downloadFinished(int, bool, const QString&)),
+        this, SLOT(onSubPartFinished(int, bool, const QString&)));
+    connect(downloader.get(), SIGNAL(writeFinished(int, bool, const QString&)),
+        this, SLOT(onSubPartWritten(int, bool, const QString&)));
+    connect(downloader.get(), SIGNAL(downloadProgress(int, qint64, qint64)),
+        this, SLOT(onSubPartDownloadProgress(int, qint64, qint64)));
 
-    m_pNetworkReply = m_pNetworkManager->head(request);
-    if (m_pNetworkReply)
+    Downloader *pDownloader = downloader.get();
+    m_mapDownloader[index] = std::move(downloader);
+    m_mapBytes.insert(index, ProgressData());
+    return pDownloader;
+}
+
+void NetworkMTDownloadRequest::onSubPartResponse(int index, qint64 nTotalSize, bool bRangeSupported)
+{
+    auto iter = m_mapDownloader.find(index);
+    if (m_bAbortManual || iter == m_mapDownloader.end() || !iter->second.get())
     {
-        connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onFinished()));
-        connect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
+        return;
+    }
+    Downloader *pProbe = iter->second.get();
+    m_strHost = pProbe->url().host();
+
+    // 返回206说明支持Range；返回200且没有Accept-Ranges: bytes说明不支持
+    if (pProbe->httpStatusCode() == 206)
+    {
+        NetworkHostHistory::globalInstance()->setRangeSupport(m_strHost, NetworkHostHistory::eRangeSupported);
+    }
+    else if (pProbe->httpStatusCode() == 200 && !bRangeSupported)
+    {
+        NetworkHostHistory::globalInstance()->setRangeSupport(m_strHost, NetworkHostHistory::eRangeUnsupported);
+    }
+
+    // 没有设置文件路径时第一段以失败结束，错误信息以这里的为准
+    if (pProbe->httpStatusCode() == 206 && nTotalSize < 0)
+    {
+        m_strError = QStringLiteral("[MT]服务器未返回文件大小");
+        NETWORK_LOG(eLogWarn, eCategoryMTDownload) << m_strError;
+        return;
+    }
+    m_nFileSize = nTotalSize;
+    NETWORK_LOG(eLogDebug, eCategoryMTDownload) << "File size:" << m_nFileSize << "Range supported:" << bRangeSupported;
+
+    m_strDstFilePath = NetworkUtility::createSharedRWFile(m_request, m_strError, qMax<qint64>(m_nFileSize, 0));
+    if (m_strDstFilePath.isEmpty())
+    {
+        return;
+    }
+
+    m_bDropCache = (m_request.nLargeFileThreshold > 0 && m_nFileSize >= m_request.nLargeFileThreshold);
+    m_nSyncInterval = (m_request.eDurability == eDurabilityPeriodic)
+        ? qint64(qMax<quint32>(m_request.nSyncIntervalMB, 1)) * 1024 * 1024 : 0;
+    if (m_bDropCache)
+    {
+        NETWORK_LOG(eLogInfo, eCategoryMTDownload) << "Large file mode:" << m_strDstFilePath << m_nFileSize;
+    }
+    pProbe->setFilePath(m_strDstFilePath);
+    pProbe->setDropCache(m_bDropCache);
+    pProbe->setSyncInterval(m_nSyncInterval);
+
+    qint64 nOffset = 0;
+    int nCount = 0;
+    if (!planSegments(pProbe, bRangeSupported, nOffset, nCount))
+    {
+        NETWORK_LOG(eLogDebug, eCategoryMTDownload) << "Single channel download:" << m_request.url;
+        return;
+    }
+    if (pProbe->endPoint() != nOffset - 1)
+    {
+        pProbe->setEndPoint(nOffset - 1);
+    }
+    const qint64 nRemain = m_nFileSize - nOffset;
+    m_strETag = pProbe->eTag();
+    initMirrors(pProbe->url());
+
+    // 有镜像时切成更多的小段，由空出的通道领取
+    int nSegments = nCount;
+    if (m_vecMirror.size() > 1)
+    {
+        nSegments = static_cast<int>(qBound<qint64>(nCount, nRemain / MinMirrorChunkSize, nCount * MirrorChunksPerChannel));
+    }
+    m_nThreadCount = 1 + nSegments;
+    m_nChannelCount = 1 + nCount;
+    m_bytesTotal = m_nFileSize;
+
+    //将剩余部分分成n段，用异步的方式下载（使用第一段重定向之后的地址）
+    for (int i = 0; i < nSegments; i++)
+    {
+        const int index = i + 1;
+        const qint64 start = nOffset + nRemain * i / nSegments;
+        const qint64 end = nOffset + nRemain * (i + 1) / nSegments - 1;
+
+        Downloader *pDownloader = createDownloader(index);
+        pDownloader->setFilePath(m_strDstFilePath);
+        pDownloader->setDropCache(m_bDropCache);
+        pDownloader->setSyncInterval(m_nSyncInterval);
+        pDownloader->setExpectedEntity(m_nFileSize, m_strETag);
+        m_mapSegmentRange.insert(index, qMakePair(start, end));
+        m_listPendingSegment.append(index);
+    }
+    for (int i = 0; i < nCount; i++)
+    {
+        const int index = m_listPendingSegment.takeFirst();
+        if (!startSegment(index))
+        {
+            abort();
+            m_strError = QStringLiteral("part %1 download failed!").arg(index);
+            QFile::remove(m_strDstFilePath);
+            emit requestFinished(false, QByteArray(), m_strError);
+            return;
+        }
     }
-    return true;
 }
 
-void NetworkMTDownloadRequest::start()
+void NetworkMTDownloadRequest::initMirrors(const QUrl& primaryUrl)
 {
-    __super::start();
+    m_vecMirror.clear();
+    m_mapSegmentMirror.clear();
 
-    m_nSuccess = 0;
-    m_nFailed = 0;
-    m_nThreadCount = 1;
+    MirrorState primary;
+    primary.url = primaryUrl;
+    primary.nActive = 1;
+    m_vecMirror.append(primary);
+    // 第一段使用url
+    m_mapSegmentMirror.insert(0, 0);
 
-    if (!requestFileSize(m_request.url))
+    for (const QString& strMirror : m_request.listMirrorUrls)
     {
-        m_strError = QStringLiteral("Invalid Url").toUtf8();
-        emit requestFinished(false, QByteArray(), m_strError);
+        const QUrl url(strMirror.trimmed());
+        if (!url.isValid() || url.isRelative() || url == primaryUrl || url == QUrl(m_request.url))
+        {
+            continue;
+        }
+        MirrorState mirror;
+        mirror.url = url;
+        m_vecMirror.append(mirror);
+    }
+    if (m_vecMirror.size() > 1)
+    {
+        NETWORK_LOG(eLogDebug, eCategoryMTDownload) << "Mirrors:" << m_vecMirror.size();
     }
 }
 
-void NetworkMTDownloadRequest::startMTDownload()
+int NetworkMTDownloadRequest::selectMirror(int nExclude, bool bCoolingAllowed) const
 {
-    if (m_bAbortManual)
+    const qint64 nNow = NetworkUtility::monotonicTime();
+    int nBest = -1;
+    double dBest = -1;
+    for (int i = 0; i < m_vecMirror.size(); ++i)
     {
-        return;
+        const MirrorState& mirror = m_vecMirror.at(i);
+        if (i == nExclude || mirror.bFailed || (!bCoolingAllowed && mirror.nCoolDownUntil > nNow))
+        {
+            continue;
+        }
+        // 字节/毫秒；还没有完成过分段的镜像视为最快，先试一次
+        const double dRate = (mirror.nElapsed > 0) ? double(mirror.nBytes) / mirror.nElapsed : 1e18;
+        const double dScore = dRate / (mirror.nActive + 1);
+        if (dScore > dBest)
+        {
+            dBest = dScore;
+            nBest = i;
+        }
     }
+    return nBest;
+}
 
-    if (m_nFileSize <= 0)
+bool NetworkMTDownloadRequest::startSegment(int index)
+{
+    auto iter = m_mapDownloader.find(index);
+    if (iter == m_mapDownloader.end() || !iter->second.get() || !m_mapSegmentRange.contains(index) || m_vecMirror.isEmpty())
     {
-        m_strError = QStringLiteral("[MT]服务器未返回Content-Length");
-        qDebug() << "[QMultiThreadNetwork]" << m_strError;
+        return false;
+    }
+    int nMirror = selectMirror();
+    if (nMirror < 0)
+    {
+        // 镜像都在暂停使用或已弃用，仍用第一段的地址（出错时由分段自己重试）
+        nMirror = 0;
+    }
+    const QPair<qint64, qint64>& range = m_mapSegmentRange.value(index);
+    m_mapSegmentMirror.insert(index, nMirror);
+    ++m_vecMirror[nMirror].nActive;
+    return iter->second->start(m_vecMirror.at(nMirror).url, range.first, range.second);
+}
 
-        emit requestFinished(false, QByteArray(), m_strError);
+void NetworkMTDownloadRequest::releaseMirror(int index, bool bSuccess, bool bFatal)
+{
+    auto iter = m_mapSegmentMirror.find(index);
+    if (iter == m_mapSegmentMirror.end() || iter.value() >= m_vecMirror.size())
+    {
         return;
     }
+    MirrorState& mirror = m_vecMirror[iter.value()];
+    mirror.nActive = qMax(mirror.nActive - 1, 0);
+    auto iterDownloader = m_mapDownloader.find(index);
+    if (!bSuccess)
+    {
+        // 偶发的错误（连接断开、超时）只暂停使用该镜像，连续出错才弃用
+        ++mirror.nFailures;
+        if (bFatal || mirror.nFailures >= MaxMirrorFailures)
+        {
+            mirror.bFailed = true;
+        }
+        else
+        {
+            const qint64 nCoolDown = qint64(MirrorCoolDown) << (mirror.nFailures - 1);
+            mirror.nCoolDownUntil = NetworkUtility::monotonicTime() + nCoolDown * 1000;
+        }
+    }
+    else
+    {
+        mirror.nFailures = 0;
+        mirror.nCoolDownUntil = 0;
+        if (iterDownloader != m_mapDownloader.end() && iterDownloader->second.get())
+        {
+            mirror.nBytes += iterDownloader->second->bytesReceived();
+            mirror.nElapsed += iterDownloader->second->elapsed();
+        }
+    }
+    m_mapSegmentMirror.erase(iter);
+}
 
-    m_strDstFilePath = NetworkUtility::createSharedRWFileWin32(m_request, m_strError);
-    if (m_strDstFilePath.isEmpty())
+bool NetworkMTDownloadRequest::failoverSegment(int index, const QString& strErr)
+{
+    auto iter = m_mapDownloader.find(index);
+    auto iterMirror = m_mapSegmentMirror.constFind(index);
+    if (m_vecMirror.size() < 2 || iter == m_mapDownloader.end() || !iter->second.get()
+        || iter->second->isLocalError() || iterMirror == m_mapSegmentMirror.constEnd())
+    {
+        return false;
+    }
+
+    const int nFailed = iterMirror.value();
+    const QUrl failedUrl = m_vecMirror.at(nFailed).url;
+    const bool bMismatch = iter->second->isMirrorMismatch();
+    int nMirror = selectMirror(nFailed);
+    if (nMirror < 0 && bMismatch)
+    {
+        // 该地址提供的不是同一个文件，在原地址上重试无济于事，暂停使用中的镜像也可以
+        nMirror = selectMirror(nFailed, true);
+    }
+    releaseMirror(index, false, bMismatch);
+    if (nMirror < 0)
+    {
+        // 没有其它可用的镜像，由该段在原地址上重试
+        m_mapSegmentMirror.insert(index, nFailed);
+        ++m_vecMirror[nFailed].nActive;
+        return false;
+    }
+    NETWORK_LOG(eLogWarn, eCategoryMTDownload) << "Mirror" << failedUrl.toString()
+        << (m_vecMirror.at(nFailed).bFailed ? "dropped:" : "paused:") << strErr
+        << "- part" << index << "continues on" << m_vecMirror.at(nMirror).url.toString();
+    m_mapSegmentMirror.insert(index, nMirror);
+    ++m_vecMirror[nMirror].nActive;
+    return iter->second->restart(m_vecMirror.at(nMirror).url);
+}
+
+bool NetworkMTDownloadRequest::hedgeStraggler()
+{
+    if (m_nFinishedBytes <= 0 || m_nFinishedElapsed <= 0 || m_strDstFilePath.isEmpty())
+    {
+        return false;
+    }
+
+    // 已完成分段的平均速度（字节/毫秒）
+    const double dPeerRate = double(m_nFinishedBytes) / m_nFinishedElapsed;
+    int nStraggler = -1;
+    double dWorst = 0;
+    for (const std::pair<const int, std::unique_ptr<Downloader>>& pair : m_mapDownloader)
+    {
+        const Downloader *pDownloader = pair.second.get();
+        if (pair.first >= DuplicateIndexBase || !pDownloader || !pDownloader->isRunning() || pDownloader->endPoint() < 0
+            || m_setSuperseded.contains(pair.first) || m_mapDownloader.count(DuplicateIndexBase + pair.first) > 0)
+        {
+            continue;
+        }
+        const qint64 nRemain = pDownloader->endPoint() + 1 - pDownloader->offset();
+        if (nRemain < MinStragglerBytes || pDownloader->elapsed() < MinStragglerTime)
+        {
+            continue;
+        }
+        // 按本段目前的速度还需要的时间，还没有收到数据的视为无限慢
+        const double dRemainTime = (pDownloader->bytesReceived() > 0)
+            ? double(nRemain) * pDownloader->elapsed() / pDownloader->bytesReceived() : 1e18;
+        const double dExpected = pDownloader->segmentSize() / dPeerRate;
+        if (dRemainTime < MinStragglerTime || pDownloader->elapsed() + dRemainTime < StragglerFactor * dExpected)
+        {
+            continue;
+        }
+        if (dRemainTime > dWorst)
+        {
+            dWorst = dRemainTime;
+            nStraggler = pair.first;
+        }
+    }
+    const int nMirror = selectMirror();
+    if (nStraggler < 0 || nMirror < 0)
+    {
+        return false;
+    }
+
+    Downloader *pOriginal = m_mapDownloader[nStraggler].get();
+    const int nDuplicate = DuplicateIndexBase + nStraggler;
+    const qint64 nStart = pOriginal->offset();
+    // 两者共享写入位置，同一字节只由先收到的一方写入
+    std::shared_ptr<qint64> pWatermark = std::make_shared<qint64>(nStart);
+    pOriginal->setWatermark(pWatermark);
+
+    Downloader *pDuplicate = createDownloader(nDuplicate);
+    // start()会重置摘要，启动之后再共享原请求的摘要
+    pDuplicate->setChecksum(nullptr);
+    // 重复的字节不计入进度
+    m_mapBytes.remove(nDuplicate);
+    pDuplicate->setFilePath(m_strDstFilePath);
+    pDuplicate->setDropCache(m_bDropCache);
+    pDuplicate->setSyncInterval(m_nSyncInterval);
+    pDuplicate->setExpectedEntity(m_nFileSize, m_strETag);
+    pDuplicate->setWatermark(pWatermark);
+
+    NETWORK_LOG(eLogInfo, eCategoryMTDownload) << "Part" << nStraggler << "is straggling:" << (pOriginal->endPoint() + 1 - nStart)
+        << "bytes left, about" << qint64(dWorst) << "ms - duplicate on" << m_vecMirror.at(nMirror).url.toString();
+    NETWORK_TRACE_INSTANT("segment", "hedge", nStraggler, "bytes", pOriginal->endPoint() + 1 - nStart);
+    m_mapDuplicate.insert(nStraggler, nDuplicate);
+    m_mapSegmentMirror.insert(nDuplicate, nMirror);
+    ++m_vecMirror[nMirror].nActive;
+    if (!pDuplicate->start(m_vecMirror.at(nMirror).url, nStart, pOriginal->endPoint()))
+    {
+        m_mapDuplicate.remove(nStraggler);
+        m_setSuperseded.insert(nDuplicate);
+        releaseMirror(nDuplicate, true);
+        return false;
+    }
+    pDuplicate->setChecksum(pOriginal->checksum());
+    return true;
+}
+
+void NetworkMTDownloadRequest::scheduleStragglerCheck()
+{
+    if (nullptr == m_pStragglerTimer)
+    {
+        m_pStragglerTimer = new QTimer(this);
+        m_pStragglerTimer->setSingleShot(true);
+        connect(m_pStragglerTimer, SIGNAL(timeout()), this, SLOT(onStragglerTimeout()));
+    }
+    if (!m_pStragglerTimer->isActive())
+    {
+        m_pStragglerTimer->start(StragglerCheckInterval);
+    }
+}
+
+void NetworkMTDownloadRequest::onStragglerTimeout()
+{
+    // 已结束（成功、失败或取消）
+    if (m_bAbortManual || m_nFailed > 0 || m_nSuccess == m_nThreadCount)
     {
-        emit requestFinished(false, QByteArray(), m_strError);
         return;
     }
+    if (!hedgeStraggler())
+    {
+        scheduleStragglerCheck();
+    }
+}
 
-    if (m_bAbortManual)
+void NetworkMTDownloadRequest::finishDuplicate(int index)
+{
+    const int nOriginal = (index >= DuplicateIndexBase) ? index - DuplicateIndexBase : index;
+    if (!m_mapDuplicate.contains(nOriginal))
+    {
+        return;
+    }
+    const int nPartner = (index == nOriginal) ? m_mapDuplicate.value(nOriginal) : nOriginal;
+    m_mapDuplicate.remove(nOriginal);
+    m_setSuperseded.insert(nPartner);
+    auto iter = m_mapDownloader.find(nPartner);
+    if (iter == m_mapDownloader.end() || !iter->second.get())
     {
         return;
     }
 
-    clearDownloaders();
-    m_nThreadCount = m_request.nDownloadThreadCount;
-    if (m_nThreadCount < 1)
+    NETWORK_LOG(eLogInfo, eCategoryMTDownload) << "Part" << nOriginal << "finished by the"
+        << ((index == nOriginal) ? "original" : "duplicate") << "request";
+    NETWORK_TRACE_INSTANT("segment", "hedge_win", nOriginal, "duplicate", (index == nOriginal) ? 0 : 1);
+    releaseMirror(nPartner, true);
+    // 另一方已收到的数据也是本段的一部分，写完之后才能结束请求（onSubPartWritten）
+    if (iter->second->supersede())
+    {
+        ++m_nSupersededWriting;
+    }
+}
+
+bool NetworkMTDownloadRequest::dropDuplicate(int index)
+{
+    const int nOriginal = (index >= DuplicateIndexBase) ? index - DuplicateIndexBase : index;
+    auto iter = m_mapDownloader.find(index);
+    if (!m_mapDuplicate.contains(nOriginal) || iter == m_mapDownloader.end() || !iter->second.get()
+        || iter->second->isLocalError())
+    {
+        return false;
+    }
+
+    // 失败的一方已收到的数据都已写入，另一方从共享的写入位置之后继续
+    NETWORK_LOG(eLogInfo, eCategoryMTDownload) << "Part" << nOriginal << ((index == nOriginal) ? "original" : "duplicate")
+        << "request failed, the other one continues";
+    m_mapDuplicate.remove(nOriginal);
+    m_setSuperseded.insert(index);
+    // 另一方还在下载，出错的镜像按偶发错误计数（文件不一致时弃用）
+    releaseMirror(index, false, iter->second->isMirrorMismatch());
+    return true;
+}
+
+bool NetworkMTDownloadRequest::planSegments(const Downloader *pProbe, bool bRangeSupported, qint64& nOffset, int& nCount) const
+{
+    if (!bRangeSupported || m_nFileSize <= 0)
+    {
+        return false;
+    }
+
+    nCount = m_request.nDownloadThreadCount;
+    if (nCount < 1)
     {
-        m_nThreadCount = 1;
+        nCount = 1;
     }
-    if (m_nThreadCount > 10)
+    if (nCount > 10)
     {
-        m_nThreadCount = 10;
+        nCount = 10;
     }
 
-    //将文件分成n段，用异步的方式下载
-    for (int i = 0; i < m_nThreadCount; i++)
+    if (m_request.eType != eTypeAutoDownload)
     {
-        qint64 start = 0;
-        qint64 end = -1;
-        if (m_nThreadCount > 1 && m_nFileSize > 0)
+        // 第一段只请求了开头的ProbeChunkSize字节，其余部分分给nCount个分段
+        if (pProbe->endPoint() < 0)
         {
-            //先算出每段的开头和结尾（HTTP协议所需要的信息）
-            start = m_nFileSize * i / m_nThreadCount;
-            end = m_nFileSize * (i + 1) / m_nThreadCount;
-            if (i == m_nThreadCount - 1)
-            {
-                end--;
-            }
+            return false;
         }
-
-        //分段下载该文件
-        std::unique_ptr<Downloader> downloader;
-#if defined(_MSC_VER) && _MSC_VER < 1700
-        downloader.reset(new Downloader(i, m_strDstFilePath, m_pNetworkManager, m_request.bShowProgress, m_request.nMaxRedirectionCount, this));
-#else
-        downloader = std::make_unique<Downloader>(i, m_strDstFilePath, m_pNetworkManager, m_request.bShowProgress, m_request.nMaxRedirectionCount, this);
-#endif
-        connect(downloader.get(), SIGNAL(downloadFinished(int, bool, const QString&)),
-            this, SLOT(onSubPartFinished(int, bool, const QString&)));
-        connect(downloader.get(), SIGNAL(downloadProgress(int, qint64, qint64)),
-            this, SLOT(onSubPartDownloadProgress(int, qint64, qint64)));
-        if (downloader->start(m_request.url, start, end))
+        nOffset = pProbe->endPoint() + 1;
+    }
+    else
+    {
+        NetworkHostHistory *pHistory = NetworkHostHistory::globalInstance();
+        // Accept-Ranges不可信：该主机以前忽略过Range
+        if (pProbe->httpStatusCode() != 206
+            && pHistory->rangeSupport(m_strHost) == NetworkHostHistory::eRangeUnsupported)
         {
-            m_mapDownloader[i] = std::move(downloader);
-            m_mapBytes.insert(i, ProgressData());
+            return false;
         }
-        else
+        if (m_nFileSize < m_request.nAutoMTThreshold)
         {
-            abort();
-            m_strError = QStringLiteral("part %1 download failed!").arg(i);
-            emit requestFinished(false, QByteArray(), m_strError);
-            return;
+            return false;
+        }
+        const int nLimit = pHistory->maxChannels(m_strHost);
+        if (nLimit > 0 && nCount > nLimit)
+        {
+            nCount = nLimit;
         }
+        const qint64 nMinSegment = qMax<qint64>(m_request.nAutoMinSegmentSize, 1);
+        nCount = static_cast<int>(qMin<qint64>(nCount, (m_nFileSize + nMinSegment - 1) / nMinSegment));
+        if (nCount <= 1)
+        {
+            return false;
+        }
+        // 第一段缩短为第一份，其余nCount-1份分给新的分段
+        nOffset = m_nFileSize / nCount;
+        nCount -= 1;
+    }
+
+    // 每段至少一个字节
+    const qint64 nRemain = m_nFileSize - nOffset;
+    if (nRemain <= 0)
+    {
+        return false;
+    }
+    if (nCount > nRemain)
+    {
+        nCount = static_cast<int>(nRemain);
     }
+    return true;
 }
 
 void NetworkMTDownloadRequest::onSubPartFinished(int index, bool bSuccess, const QString& strErr)
 {
-    if (m_bAbortManual)
+    if (m_bAbortManual || m_setSuperseded.contains(index))
     {
         return;
     }
 
     if (bSuccess)
     {
+        auto iterFinished = m_mapDownloader.find(index);
+        if (iterFinished != m_mapDownloader.end() && iterFinished->second.get())
+        {
+            m_nFinishedBytes += iterFinished->second->bytesReceived();
+            m_nFinishedElapsed += iterFinished->second->elapsed();
+        }
         m_nSuccess++;
+        releaseMirror(index, true);
+        finishDuplicate(index);
+        // 空出的通道下载下一段
+        if (!m_listPendingSegment.isEmpty())
+        {
+            const int nNext = m_listPendingSegment.takeFirst();
+            if (!startSegment(nNext))
+            {
+                bSuccess = false;
+                m_strError = QStringLiteral("part %1 download failed!").arg(nNext);
+                ++m_nFailed;
+                abort();
+            }
+        }
+        else if (!hedgeStraggler())
+        {
+            // 没有待下载的分段时，空出的通道帮落后的分段下载剩余部分
+            scheduleStragglerCheck();
+        }
     }
     else
     {
+        // 重复下载的分段由另一方继续
+        if (dropDuplicate(index))
+        {
+            return;
+        }
+
+        // 有镜像时换一个镜像继续这一段
+        if (failoverSegment(index, strErr))
+        {
+            return;
+        }
+
+        // 只重试失败的这一段，其它分段继续下载
+        auto iterRetry = m_mapDownloader.find(index);
+        if (iterRetry != m_mapDownloader.end() && iterRetry->second.get() && iterRetry->second->canRetry())
+        {
+            Downloader *pDownloader = iterRetry->second.get();
+            NETWORK_LOG(eLogWarn, eCategoryMTDownload) << "Part" << index << strErr << "- retry in" << pDownloader->retryDelay() << "ms";
+            QTimer::singleShot(pDownloader->retryDelay(), pDownloader, SLOT(onRetry()));
+            return;
+        }
+
         if (++m_nFailed == 1)
         {
+            auto iter = m_mapDownloader.find(index);
+            if (iter != m_mapDownloader.end() && iter->second.get())
+            {
+                m_nHttpStatusCode = iter->second->httpStatusCode();
+                m_nNetworkError = iter->second->networkError();
+                // 记下服务器的限制，之后的eTypeAutoDownload少开通道或不再分段
+                if (index > 0 && m_nHttpStatusCode == 200)
+                {
+                    NetworkHostHistory::globalInstance()->setRangeSupport(m_strHost, NetworkHostHistory::eRangeUnsupported);
+                }
+                else if (index > 0 && (m_nHttpStatusCode == 429 || m_nHttpStatusCode == 503))
+                {
+                    NetworkHostHistory::globalInstance()->limitChannels(m_strHost, m_nChannelCount - 1);
+                }
+            }
             abort();
         }
         if (m_strError.isEmpty())
@@ -193,15 +708,134 @@ void NetworkMTDownloadRequest::onSubPartFinished(int index, bool bSuccess, const
         }
     }
 
-    //如果完成数等于文件段数，则说明文件下载成功；失败数大于0，说明下载失败
-    if (m_nSuccess == m_nThreadCount || m_nFailed > 0)
+    checkFinished();
+}
+
+void NetworkMTDownloadRequest::onSubPartWritten(int index, bool bSuccess, const QString& strErr)
+{
+    if (m_bAbortManual)
+    {
+        return;
+    }
+
+    --m_nSupersededWriting;
+    if (!bSuccess)
+    {
+        m_strError = strErr;
+        NETWORK_LOG(eLogError, eCategoryMTDownload) << "Part" << index << strErr;
+        ++m_nFailed;
+        abort();
+    }
+    checkFinished();
+}
+
+void NetworkMTDownloadRequest::checkFinished()
+{
+    //如果完成数等于文件段数（被取代的一方也已写完），则说明文件下载成功；失败数大于0，说明下载失败
+    if ((m_nSuccess == m_nThreadCount && m_nSupersededWriting == 0) || m_nFailed > 0)
     {
-        emit requestFinished((m_nFailed == 0), QByteArray(), m_strError);
-        if (m_nFailed == 0)
+        m_request.timing.iLastByte = NetworkUtility::monotonicTime();
+        for (const std::pair<const int, std::unique_ptr<Downloader>>& pair : m_mapDownloader)
         {
-            qDebug() << "[QMultiThreadNetwork] MT download success.";
+            if (pair.second.get())
+            {
+                m_request.timing.iBytesReceived += pair.second->bytesReceived();
+            }
+        }
+        bool bSuccess = (m_nFailed == 0) && commitFile();
+        if (!bSuccess)
+        {
+            QFile::remove(m_strDstFilePath);
+        }
+        emit requestFinished(bSuccess, QByteArray(), m_strError);
+        if (bSuccess)
+        {
+            NETWORK_LOG(eLogDebug, eCategoryMTDownload) << "MT download success.";
+        }
+    }
+}
+
+bool NetworkMTDownloadRequest::verifyChecksum()
+{
+    if (!m_pChecksum.get())
+    {
+        return true;
+    }
+
+    NETWORK_TRACE_SCOPE("checksum", "verify", m_request.uiId);
+    // 各分段都已写完，写线程已按顺序计入全部数据
+    if (m_pOrderedChecksum.get())
+    {
+        return m_pOrderedChecksum->verify(m_nFileSize, m_strError);
+    }
+
+    std::shared_ptr<NetworkChecksum> pChecksum;
+    for (std::pair<const int, std::unique_ptr<Downloader>>& pair : m_mapDownloader)
+    {
+        // 重复请求不计算摘要
+        if (pair.first >= DuplicateIndexBase)
+        {
+            continue;
+        }
+        std::shared_ptr<NetworkChecksum> pPart;
+        if (pair.second.get())
+        {
+            pPart = pair.second->checksum();
+        }
+        if (!pPart.get())
+        {
+            break;
+        }
+        if (!pChecksum.get())
+        {
+            pChecksum = pPart;
+        }
+        else
+        {
+            pChecksum->combine(*pPart);
         }
     }
+    if (!pChecksum.get())
+    {
+        pChecksum = m_pChecksum->clone();
+    }
+
+    // 各分段的摘要必须覆盖整个文件，不从文件读取
+    if (m_nFileSize >= 0 && pChecksum->size() != m_nFileSize)
+    {
+        m_strError = QStringLiteral("Error: %1 checksum covers %2 of %3 bytes")
+            .arg(QString::fromLatin1(pChecksum->algorithm())).arg(pChecksum->size()).arg(m_nFileSize);
+        NETWORK_LOG(eLogError, eCategoryMTDownload) << m_strError;
+        return false;
+    }
+    return pChecksum->verify(m_strError);
+}
+
+bool NetworkMTDownloadRequest::commitFile()
+{
+    if (!verifyChecksum())
+    {
+        return false;
+    }
+
+    // 各分段只把数据交给系统，最后对整个文件fsync一次
+    const bool bDurable = (m_request.eDurability != eDurabilityNone);
+    if (bDurable)
+    {
+        NETWORK_TRACE_SCOPE("disk", "fsync", m_request.uiId);
+        std::shared_ptr<NetworkWriteFile> pFile = NetworkWriteFile::open(m_strDstFilePath, m_strError);
+        if (!pFile.get())
+        {
+            return false;
+        }
+        if (!pFile->flush())
+        {
+            m_strError = QStringLiteral("Error: fsync(%1) failed").arg(m_strDstFilePath);
+            NETWORK_LOG(eLogError, eCategoryMTDownload) << m_strError;
+            return false;
+        }
+    }
+    return NetworkUtility::renamePartFile(m_strDstFilePath, bDurable, m_strError);
 }
 
 void NetworkMTDownloadRequest::onSubPartDownloadProgress(int index, qint64 bytesReceived, qint64 bytesTotal)
@@ -232,81 +866,31 @@ void NetworkMTDownloadRequest::onSubPartDownloadProgress(int index, qint64 bytes
                 bytesTotalIncreased = bytesTotal - bytesTo;
                 m_bytesTotal += bytesTotalIncreased;
             }
-            m_mapBytes[index].bytesTotal = bytesTotal;
-        }
-
-        if (m_bytesTotal > 0 && m_bytesReceived > 0)
-        {
-            int progress = m_bytesReceived * 100 / m_bytesTotal;
-            if (m_nProgress < progress)
-            {
-                m_nProgress = progress;
-                NetworkProgressEvent *event = new NetworkProgressEvent;
-                event->uiId = m_request.uiId;
-                event->uiBatchId = m_request.uiBatchId;
-                event->iBtyes = m_bytesReceived;
-                event->iTotalBtyes = m_bytesTotal;
-                QCoreApplication::postEvent(NetworkManager::globalInstance(), event);
-            }
-        }
-    }
-}
-
-void NetworkMTDownloadRequest::onFinished()
-{
-    bool bSuccess = (m_pNetworkReply->error() == QNetworkReply::NoError);
-    int statusCode = m_pNetworkReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-    if (isHttpProxy(m_url.scheme()) || isHttpsProxy(m_url.scheme()))
-    {
-        bSuccess = bSuccess && (statusCode >= 200 && statusCode < 300);
-    }
-    if (!bSuccess)
-    {
-        if (statusCode == 301 || statusCode == 302)
-        {//301,302重定向
-            const QVariant& redirectionTarget = m_pNetworkReply->attribute(QNetworkRequest::RedirectionTargetAttribute);
-            const QUrl& redirectUrl = m_url.resolved(redirectionTarget.toUrl());
-            if (redirectUrl.isValid() && m_url != redirectUrl)
-            {
-                qDebug() << "[QMultiThreadNetwork] url:" << m_url.toString() << "redirectUrl:" << redirectUrl.toString();
-
-                m_pNetworkReply->deleteLater();
-                m_pNetworkReply = nullptr;
-
-                requestFileSize(redirectUrl);
-                return;
-            }
-        }
-
-        m_strError = QStringLiteral("[MT] Fail to get file size! http status code(%1)").arg(statusCode);
-        qDebug() << "[QMultiThreadNetwork]" << m_strError;
-
-        emit requestFinished(false, QByteArray(), m_strError);
-        return;
-    }
-    else
-    {
-        if (m_request.uiBatchId == 0)
+            m_mapBytes[index].bytesTotal = bytesTotal;
+        }
+
+        if (m_bytesTotal > 0 && m_bytesReceived > 0)
         {
-            foreach(const QByteArray& header, m_pNetworkReply->rawHeaderList())
+            int progress = m_bytesReceived * 100 / m_bytesTotal;
+            if (m_nProgress < progress)
             {
-                qDebug() << header << ":" << m_pNetworkReply->rawHeader(header);
+                m_nProgress = progress;
+                NetworkProgressEvent *event = new NetworkProgressEvent;
+                event->uiId = m_request.uiId;
+                event->uiBatchId = m_request.uiBatchId;
+                event->iBtyes = m_bytesReceived;
+                event->iTotalBtyes = m_bytesTotal;
+                QCoreApplication::postEvent(NetworkManager::globalInstance(), event);
             }
         }
-        clearProgress();
-
-        const QVariant& var = m_pNetworkReply->header(QNetworkRequest::ContentLengthHeader);
-        m_nFileSize = var.toLongLong();
-        m_bytesTotal = m_nFileSize;
-        qDebug() << "[QMultiThreadNetwork] File size:" << m_nFileSize;
-
-        m_pNetworkReply->deleteLater();
-        m_pNetworkReply = nullptr;
-
-        startMTDownload();
     }
 }
 
+void NetworkMTDownloadRequest::onFinished()
+{
+    // 不再发送HEAD请求，文件大小由第一段的响应头得到（onSubPartResponse）
+}
+
 void NetworkMTDownloadRequest::clearDownloaders()
 {
     for (std::pair<const int, std::unique_ptr<Downloader>>& pair : m_mapDownloader)
@@ -314,6 +898,8 @@ void NetworkMTDownloadRequest::clearDownloaders()
         if (pair.second.get())
         {
             pair.second->abort();
+            // 可能正在该分段的信号里，延迟删除
+            pair.second.release()->deleteLater();
         }
     }
     m_mapDownloader.clear();
@@ -334,11 +920,29 @@ Downloader::Downloader(int index, const QString& strDstFile, QNetworkAccessManag
     , m_bAbortManual(false)
     , m_nStartPoint(0)
     , m_nEndPoint(0)
-    , m_hFile(0)
+    , m_nResumePoint(0)
+    , m_nSegmentSize(-1)
+    , m_nBytesReceived(0)
+    , m_nRetryCount(0)
+    , m_bRetryable(true)
+    , m_bRangeChecked(false)
+    , m_bRangeValid(false)
+    , m_bProbe(false)
+    , m_bTruncated(false)
+    , m_bEndReached(false)
+    , m_bLocalError(false)
+    , m_bMirrorMismatch(false)
+    , m_bReplySuccess(false)
+    , m_bSuperseded(false)
+    , m_nExpectedTotal(-1)
     , m_nRedirectionCount(0)
     , m_pNetworkManager(QPointer<QNetworkAccessManager>(pNetworkManager))
     , m_bShowProgress(bShowProgress)
     , m_nMaxRedirectionCount(nMaxRedirectionCount)
+    , m_nHttpStatusCode(0)
+    , m_nNetworkError(0)
+    , m_bDropCache(false)
+    , m_nSyncInterval(0)
     , m_strDstFilePath(strDstFile)
 {
     TRACE_CLASS_CONSTRUCTOR(Downloader);
@@ -362,60 +966,104 @@ void Downloader::abort()
         m_pNetworkReply->deleteLater();
         m_pNetworkReply = nullptr;
     }
-    if (m_hFile)
+    if (m_pWriter.get())
     {
-        CloseHandle(m_hFile);
-        m_hFile = nullptr;
+        m_pWriter->discard();
+        m_pWriter.reset();
     }
     m_pNetworkManager = nullptr;
 }
 
+bool Downloader::supersede()
+{
+    m_bAbortManual = true;
+    m_bSuperseded = true;
+    if (m_pNetworkReply)
+    {
+        NETWORK_TRACE_ASYNC_END("segment", "part", reinterpret_cast<quintptr>(this), "index", m_nIndex);
+        m_pNetworkReply->disconnect(this);
+        if (m_pNetworkReply->isRunning())
+        {
+            m_pNetworkReply->abort();
+        }
+        m_pNetworkReply->deleteLater();
+        m_pNetworkReply = nullptr;
+    }
+    if (!m_pWriter.get())
+    {
+        return false;
+    }
+    // 请求已结束时写线程已在写剩余的数据
+    if (!m_pWriter->isFinished())
+    {
+        m_pWriter->finish("onWriterFinished");
+    }
+    return true;
+}
+
+void Downloader::setEndPoint(qint64 nEndPoint)
+{
+    m_nEndPoint = nEndPoint;
+    m_nSegmentSize = nEndPoint - m_nStartPoint + 1;
+    m_bTruncated = true;
+}
+
 bool Downloader::start(const QUrl &url, qint64 startPoint, qint64 endPoint)
 {
-    if (nullptr == m_pNetworkManager || m_strDstFilePath.isEmpty() || !url.isValid())
+    if (nullptr == m_pNetworkManager || !url.isValid())
         return false;
 
     m_bAbortManual = false;
+    m_bSuperseded = false;
 
     m_url = url;
     m_nStartPoint = startPoint;
     m_nEndPoint = endPoint;
-
-#ifdef WIN32
-    m_hFile = CreateFileW(m_strDstFilePath.toStdWString().c_str(), GENERIC_WRITE,
-        FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
-    if (m_hFile != nullptr && m_hFile != INVALID_HANDLE_VALUE)
-    {
-        LARGE_INTEGER li = { 0 };
-        li.HighPart = (long)(startPoint << 32);
-        li.LowPart = (DWORD)startPoint;
-        if (!SetFilePointerEx(m_hFile, li, nullptr, FILE_BEGIN))
-        {
-            qCritical() << "[QMultiThreadNetwork] SetFilePointerEx error:" << GetLastError();
-            return false;
-        }
-    }
-    else
+    m_nResumePoint = startPoint;
+    m_nSegmentSize = (endPoint >= 0) ? (endPoint - startPoint + 1) : -1;
+    m_nBytesReceived = 0;
+    m_nRetryCount = 0;
+    m_bLocalError = false;
+    m_timer.start();
+    if (m_pChecksum.get())
     {
-        qCritical() << "[QMultiThreadNetwork] CreateFileW error:" << GetLastError();
-        return false;
+        m_pChecksum->reset();
     }
-#else
-    return false;
-#endif
+    return sendRequest();
+}
 
-    //根据HTTP协议，写入RANGE头部，说明请求文件的范围
+bool Downloader::sendRequest()
+{
+    m_bRangeChecked = false;
+    m_bRangeValid = false;
+    m_bRetryable = true;
+    m_bEndReached = false;
+    m_bMirrorMismatch = false;
+
+    //根据HTTP协议，写入RANGE头部，说明请求文件的范围（重试时从已写入的位置继续）
     QNetworkRequest request;
-    request.setUrl(url);
+    request.setUrl(m_url);
     QString range;
-    range.sprintf("Bytes=%lld-%lld", m_nStartPoint, m_nEndPoint);
-    request.setRawHeader("Range", range.toLocal8Bit());
+    if (m_nEndPoint >= 0)
+    {
+        range.sprintf("bytes=%lld-%lld", m_nResumePoint, m_nEndPoint);
+    }
+    else if (m_nResumePoint > 0 || m_bProbe)
+    {
+        // 探测请求带上bytes=0-，由响应是否为206判断服务器是否支持分段
+        range.sprintf("bytes=%lld-", m_nResumePoint);
+    }
+    if (!range.isEmpty())
+    {
+        request.setRawHeader("Range", range.toLatin1());
+    }
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/octet-stream");
-    request.setRawHeader("Accept-Encoding", "gzip,deflate,compress,br");
+    // Content-Range是按传输的字节计算的，分段下载不能压缩
+    request.setRawHeader("Accept-Encoding", "identity");
     request.setRawHeader("Connection", "keep-alive");
 
 #ifndef QT_NO_SSL
-    if (isHttpsProxy(url.scheme()))
+    if (isHttpsProxy(m_url.scheme()))
     {
         // 发送https请求前准备工作;
         QSslConfiguration conf = request.sslConfiguration();
@@ -425,59 +1073,332 @@ bool Downloader::start(const QUrl &url, qint64 startPoint, qint64 endPoint)
     }
 #endif
 
-    qDebug() << "[QMultiThreadNetwork] Part" << m_nIndex << "Range:" << range;
+    NETWORK_LOG(eLogDebug, eCategoryMTDownload) << "Part" << m_nIndex << "Range:" << range;
 
     m_pNetworkReply = m_pNetworkManager->get(request);
     if (m_pNetworkReply)
     {
+        NETWORK_TRACE_ASYNC_BEGIN("segment", "part", reinterpret_cast<quintptr>(this), "index", m_nIndex);
         connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onFinished()));
         connect(m_pNetworkReply, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
         connect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
         if (m_bShowProgress)
         {
+            const qint64 nCommitted = m_nResumePoint - m_nStartPoint;
             connect(m_pNetworkReply, &QNetworkReply::downloadProgress, this, [=](qint64 bytesReceived, qint64 bytesTotal) {
                 if (m_bAbortManual || bytesReceived < 0 || bytesTotal < 0)
                     return;
-                emit downloadProgress(m_nIndex, bytesReceived, bytesTotal);
+                // 重试时加上之前已写入的部分，进度不会倒退
+                emit downloadProgress(m_nIndex, nCommitted + bytesReceived, nCommitted + bytesTotal);
             });
         }
     }
     return true;
 }
 
+bool Downloader::openWriter()
+{
+    // 各分段以偏移写入同一个文件，由磁盘写线程执行
+    std::shared_ptr<NetworkWriteFile> pFile;
+    if (!m_strDstFilePath.isEmpty())
+    {
+        pFile = NetworkWriteFile::open(m_strDstFilePath, m_strError);
+    }
+    if (!pFile.get())
+    {
+        if (m_strError.isEmpty())
+        {
+            m_strError = QStringLiteral("Part %1 has no destination file").arg(m_nIndex);
+        }
+        NETWORK_LOG(eLogError, eCategoryMTDownload) << m_strError;
+        m_bRetryable = false;
+        m_bLocalError = true;
+        m_bRangeValid = false;
+        m_pNetworkReply->abort();
+        return false;
+    }
+    m_pWriter.reset(new NetworkFileWriter(pFile, m_nResumePoint, this, "onWriterDrained"));
+    m_pWriter->setDropCache(m_bDropCache);
+    m_pWriter->setSyncInterval(m_nSyncInterval);
+    m_pWriter->setOrderedChecksum(m_pOrderedChecksum);
+    return true;
+}
+
+bool Downloader::retry()
+{
+    if (!m_bRetryable || m_nRetryCount >= MaxRetryCount || m_bAbortManual)
+    {
+        return false;
+    }
+    ++m_nRetryCount;
+    NETWORK_LOG(eLogWarn, eCategoryMTDownload) << "Part" << m_nIndex << "retry" << m_nRetryCount
+        << "from" << m_nResumePoint << "to" << m_nEndPoint;
+    NETWORK_TRACE_INSTANT("segment", "retry", m_nIndex, "attempt", m_nRetryCount);
+    m_strError.clear();
+    return sendRequest();
+}
+
+bool Downloader::restart(const QUrl& url)
+{
+    if (m_bAbortManual || nullptr == m_pNetworkManager || !url.isValid())
+    {
+        return false;
+    }
+    NETWORK_LOG(eLogInfo, eCategoryMTDownload) << "Part" << m_nIndex << "switch to" << url.toString()
+        << "from" << m_nResumePoint << "to" << m_nEndPoint;
+    m_url = url;
+    m_nRetryCount = 0;
+    m_nRedirectionCount = 0;
+    m_strError.clear();
+    return sendRequest();
+}
+
+int Downloader::retryDelay() const
+{
+    // 1s, 2s, 4s ...
+    return RetryBaseDelay << qMin(m_nRetryCount, 10);
+}
+
+bool Downloader::checkResponseRange()
+{
+    m_bRangeChecked = true;
+    const int statusCode = m_pNetworkReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    m_nHttpStatusCode = statusCode;
+    bool bOk = false;
+    const qint64 nContentLength = m_pNetworkReply->header(QNetworkRequest::ContentLengthHeader).toLongLong(&bOk);
+    if (!isHttpProxy(m_url.scheme()) && !isHttpsProxy(m_url.scheme()))
+    {
+        if (!m_bProbe)
+        {
+            return true;
+        }
+        m_nEndPoint = -1;
+        m_nSegmentSize = bOk ? nContentLength : -1;
+        return notifyResponse(m_nSegmentSize, false);
+    }
+    if (statusCode < 200 || statusCode >= 300)
+    {
+        // 重定向或出错的响应体不写入文件
+        return false;
+    }
+
+    // 镜像返回的必须是同一个文件
+    m_strETag = m_pNetworkReply->rawHeader("ETag");
+    if (!m_strExpectedETag.isEmpty() && !m_strETag.isEmpty() && m_strETag != m_strExpectedETag)
+    {
+        m_strError = QStringLiteral("Part %1 ETag mismatch: expected %2, got %3")
+            .arg(m_nIndex).arg(QString::fromLatin1(m_strExpectedETag)).arg(QString::fromLatin1(m_strETag));
+        m_bRetryable = false;
+        m_bMirrorMismatch = true;
+        NETWORK_LOG(eLogError, eCategoryMTDownload) << m_strError;
+        m_pNetworkReply->abort();
+        return false;
+    }
+
+    if (m_bProbe && QMTNETWORK_LOG_MIN_LEVEL <= eLogTrace && NetworkLog::isEnabled(eCategoryMTDownload, eLogTrace))
+    {
+        foreach(const QByteArray& header, m_pNetworkReply->rawHeaderList())
+        {
+            NETWORK_LOG(eLogTrace, eCategoryMTDownload) << header << ":" << m_pNetworkReply->rawHeader(header);
+        }
+    }
+
+    const bool bRangeRequested = (m_nEndPoint >= 0 || m_nResumePoint > 0);
+    bool bValid = false;
+    qint64 nTotalSize = -1;
+    if (statusCode == 206)
+    {
+        const QByteArray& strRange = m_pNetworkReply->rawHeader("Content-Range").trimmed();
+        qint64 nFirst = -1, nLast = -1, nTotal = -1;
+        const bool bRangeOk = NetworkUtility::parseContentRange(strRange, nFirst, nLast, nTotal);
+        const bool bOk3 = (nTotal >= 0);
+        if (bOk3)
+        {
+            nTotalSize = nTotal;
+        }
+        // 探测请求的范围可以超过文件末尾，服务器只返回到最后一个字节
+        if (m_bProbe && bOk3 && m_nEndPoint >= nTotal)
+        {
+            m_nEndPoint = nTotal - 1;
+        }
+        if (m_nExpectedTotal >= 0 && bOk3 && nTotal != m_nExpectedTotal)
+        {
+            m_strError = QStringLiteral("Part %1 size mismatch: expected %2, got \"%3\"")
+                .arg(m_nIndex).arg(m_nExpectedTotal).arg(QString::fromLatin1(strRange));
+        }
+        else if (bRangeOk && nFirst == m_nResumePoint && (m_nEndPoint < 0 || nLast == m_nEndPoint))
+        {
+            bValid = true;
+        }
+        else
+        {
+            m_strError = QStringLiteral("Part %1 Content-Range mismatch: requested %2-%3, got \"%4\"")
+                .arg(m_nIndex).arg(m_nResumePoint).arg(m_nEndPoint).arg(QString::fromLatin1(strRange));
+        }
+    }
+    else if (!bRangeRequested || (m_bProbe && m_nResumePoint == 0))
+    {
+        // 服务器不支持分段时，探测请求收到的是整个文件
+        m_nEndPoint = -1;
+        nTotalSize = bOk ? nContentLength : -1;
+        bValid = true;
+    }
+    else
+    {
+        m_strError = QStringLiteral("Part %1 server ignored Range (HTTP %2)").arg(m_nIndex).arg(statusCode);
+    }
+
+    if (!bValid)
+    {
+        // 服务器不支持分段，重试也无济于事
+        m_bRetryable = false;
+        m_bMirrorMismatch = true;
+        NETWORK_LOG(eLogError, eCategoryMTDownload) << m_strError;
+        m_pNetworkReply->abort();
+        return false;
+    }
+
+    if (m_nEndPoint >= 0)
+    {
+        m_nSegmentSize = m_nEndPoint - m_nStartPoint + 1;
+    }
+    else
+    {
+        // 没有指定结束位置时按Content-Length校验
+        m_nSegmentSize = bOk ? (m_nResumePoint - m_nStartPoint + nContentLength) : -1;
+    }
+    if (!m_bProbe)
+    {
+        return true;
+    }
+    // 服务器忽略了Range但声明支持时，仍然可以用Range请求其余部分
+    const bool bAcceptRanges = m_pNetworkReply->rawHeader("Accept-Ranges").toLower().contains("bytes");
+    return notifyResponse(nTotalSize, statusCode == 206 || bAcceptRanges);
+}
+
+bool Downloader::notifyResponse(qint64 nTotalSize, bool bRangeSupported)
+{
+    m_bProbe = false;
+    emit responseReceived(m_nIndex, nTotalSize, bRangeSupported);
+    // 槽函数中整个请求可能已经取消
+    if (m_bAbortManual || !m_pNetworkReply)
+    {
+        return false;
+    }
+    if (m_strDstFilePath.isEmpty())
+    {
+        m_strError = QStringLiteral("Part %1 has no destination file").arg(m_nIndex);
+        m_bRetryable = false;
+        m_pNetworkReply->abort();
+        return false;
+    }
+    return true;
+}
+
 void Downloader::onReadyRead()
 {
-#ifdef WIN32
     if (m_pNetworkReply
         && m_pNetworkReply->error() == QNetworkReply::NoError
         && m_pNetworkReply->isOpen())
     {
-        if (m_hFile != nullptr)
+        if (!m_bRangeChecked)
         {
-            const QByteArray& bytesRev = m_pNetworkReply->readAll();
-            if (!bytesRev.isEmpty())
-            {
-                DWORD byteWritten = 0;
-                if (!WriteFile(m_hFile, bytesRev.data(), bytesRev.size(), &byteWritten, nullptr))
-                {
-                    qCritical() << "[QMultiThreadNetwork] WriteFile error:" << GetLastError();
-                }
-                if (byteWritten != bytesRev.size())
-                {
-                    qCritical() << "[QMultiThreadNetwork] incompatible bytes! receive:" << bytesRev.size() << "write:" << byteWritten;
-                }
-            }
+            m_bRangeValid = checkResponseRange();
         }
+        if (!m_bRangeValid)
+        {
+            return;
+        }
+        if (!m_pWriter.get() && !openWriter())
+        {
+            return;
+        }
+        // 写线程跟不上时暂停读取
+        if (m_pWriter->isBackedUp())
+        {
+            m_pNetworkReply->setReadBufferSize(NetworkFileWriter::ReplyReadBufferSize);
+            return;
+        }
+        readToWriter();
+    }
+}
+
+void Downloader::readToWriter()
+{
+    QByteArray bytesRev = m_pNetworkReply->readAll();
+    if (m_bEndReached)
+    {
+        return;
+    }
+    // 本段被缩短过：丢弃超出的数据，并关闭连接（服务器仍在发送整个文件）
+    bool bEndReached = false;
+    if (m_bTruncated && m_nBytesReceived + bytesRev.size() > m_nSegmentSize)
+    {
+        bytesRev.truncate(static_cast<int>(m_nSegmentSize - m_nBytesReceived));
+        bEndReached = true;
+    }
+    if (!bytesRev.isEmpty())
+    {
+        const qint64 nOffset = m_nStartPoint + m_nBytesReceived;
+        m_nBytesReceived += bytesRev.size();
+        NETWORK_TRACE_SCOPE("disk", "write", m_nIndex, "bytes", bytesRev.size());
+        // 与重复请求同时下载本段：另一方已写入的部分跳过
+        qint64 nSkip = 0;
+        if (m_pWatermark.get())
+        {
+            nSkip = qBound<qint64>(0, *m_pWatermark - nOffset, bytesRev.size());
+            *m_pWatermark = qMax<qint64>(*m_pWatermark, nOffset + bytesRev.size());
+            m_pWriter->skip(nSkip);
+        }
+        // 摘要与重复请求共享，只计入写入的部分，两者写入的数据按文件中的顺序首尾相接
+        if (m_pChecksum.get() && nSkip < bytesRev.size())
+        {
+            m_pChecksum->update(bytesRev.constData() + nSkip, bytesRev.size() - nSkip);
+        }
+        if (nSkip < bytesRev.size() && !m_pWriter->write(bytesRev.constData() + nSkip, bytesRev.size() - nSkip))
+        {
+            // 磁盘出错时重试和换镜像都没有用，立即结束本段，不再接收剩余的数据
+            m_strError = QStringLiteral("Part %1 write failed - %2").arg(m_nIndex).arg(m_pWriter->errorString());
+            NETWORK_LOG(eLogError, eCategoryMTDownload) << m_strError;
+            m_bRetryable = false;
+            m_bLocalError = true;
+            m_bRangeValid = false;
+            m_pNetworkReply->abort();
+            return;
+        }
+    }
+    if (bEndReached)
+    {
+        m_bEndReached = true;
+        NETWORK_LOG(eLogDebug, eCategoryMTDownload) << "Part" << m_nIndex << "reached end point" << m_nEndPoint;
+        m_pNetworkReply->abort();
+    }
+}
+
+void Downloader::onWriterDrained()
+{
+    if (m_pNetworkReply)
+    {
+        m_pNetworkReply->setReadBufferSize(0);
+        onReadyRead();
     }
-#endif
 }
 
 void Downloader::onFinished()
 {
+    NETWORK_TRACE_ASYNC_END("segment", "part", reinterpret_cast<quintptr>(this), "index", m_nIndex);
     try
     {
         bool bSuccess = (m_pNetworkReply->error() == QNetworkReply::NoError);
         int statusCode = m_pNetworkReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        m_nHttpStatusCode = statusCode;
+        m_nNetworkError = m_pNetworkReply->error();
+        // 缩短的分段收完后由本端取消
+        if (m_bEndReached)
+        {
+            bSuccess = true;
+            m_nNetworkError = QNetworkReply::NoError;
+        }
         if (isHttpProxy(m_url.scheme()) || isHttpsProxy(m_url.scheme()))
         {
             bSuccess = bSuccess && (statusCode >= 200 && statusCode < 300);
@@ -490,68 +1411,141 @@ void Downloader::onFinished()
                 const QUrl& redirectUrl = m_url.resolved(redirectionTarget.toUrl());
                 if (redirectUrl.isValid() && redirectUrl != m_url && ++m_nRedirectionCount <= m_nMaxRedirectionCount)
                 {
-                    qDebug() << "[QMultiThreadNetwork] url:" << m_url.toString() << "redirectUrl:" << redirectUrl.toString();
+                    NETWORK_LOG(eLogDebug, eCategoryMTDownload) << "url:" << m_url.toString() << "redirectUrl:" << redirectUrl.toString();
+                    NETWORK_TRACE_INSTANT("net", "redirect", m_nIndex, "count", m_nRedirectionCount);
 
                     m_pNetworkReply->deleteLater();
                     m_pNetworkReply = nullptr;
-#ifdef WIN32
-                    if (m_hFile)
+                    if (m_pWriter.get())
                     {
-                        CloseHandle(m_hFile);
-                        m_hFile = nullptr;
+                        m_pWriter->discard();
+                        m_pWriter.reset();
+                    }
+                    m_url = redirectUrl;
+                    if (!sendRequest())
+                    {
+                        emit downloadFinished(m_nIndex, false, m_strError);
                     }
-#endif
-                    start(redirectUrl, m_nStartPoint, m_nEndPoint);
                     return;
                 }
             }
 
             if (statusCode != 200 && statusCode != 0)
             {
-                qDebug() << "[QMultiThreadNetwork] HttpStatusCode: " << statusCode;
+                NETWORK_LOG(eLogDebug, eCategoryMTDownload) << "HttpStatusCode: " << statusCode;
+            }
+            // 4xx重试也不会成功
+            if (statusCode >= 400 && statusCode < 500)
+            {
+                m_bRetryable = false;
             }
         }
-        else
+
+        // 没有响应体时不会触发readyRead，在这里校验（探测请求要在这里创建文件）
+        if (bSuccess && !m_bRangeChecked)
         {
-#ifdef WIN32
-            if (m_hFile)
+            m_bRangeValid = checkResponseRange();
+            bSuccess = m_bRangeValid;
+            if (m_bAbortManual)
             {
-                FlushFileBuffers(m_hFile);
+                return;
             }
-#endif
         }
-
-        if (!bSuccess)
+        if (!m_pWriter.get() && m_bRangeValid && m_pNetworkReply->isOpen() && m_pNetworkReply->bytesAvailable() > 0)
         {
-            qDebug() << "[QMultiThreadNetwork] Part" << m_nIndex << "download failed!";
+            bSuccess = openWriter() && bSuccess;
         }
-
-        m_pNetworkReply->deleteLater();
-        m_pNetworkReply = nullptr;
-#ifdef WIN32
-        if (m_hFile)
+        if (m_pWriter.get())
         {
-            CloseHandle(m_hFile);
-            m_hFile = nullptr;
+            // 暂停读取时留在缓冲区里的数据（失败时也保留已收到的数据，重试从这里继续）
+            if (m_bRangeValid && m_pNetworkReply->isOpen() && m_pNetworkReply->bytesAvailable() > 0)
+            {
+                readToWriter();
+            }
+
+            // 不在网络线程中等待磁盘，写线程写完后在onWriterFinished()中结束本段
+            m_bReplySuccess = bSuccess;
+            m_pNetworkReply->deleteLater();
+            m_pNetworkReply = nullptr;
+            m_pWriter->finish("onWriterFinished");
+            return;
         }
-#endif
 
-        emit downloadFinished(m_nIndex, bSuccess, m_strError);
+        m_pNetworkReply->deleteLater();
+        m_pNetworkReply = nullptr;
+        finishPart(bSuccess);
     }
     catch (std::exception* e)
     {
-        qCritical() << "Part" << m_nIndex << "Downloader::onFinished() exception:" << QString::fromUtf8(e->what());
+        NETWORK_LOG(eLogError, eCategoryMTDownload) << "Part" << m_nIndex << "Downloader::onFinished() exception:" << QString::fromUtf8(e->what());
     }
     catch (...)
     {
-        qCritical() << "Part" << m_nIndex << "Downloader::onFinishede() exception:" << GetLastError();
+        NETWORK_LOG(eLogError, eCategoryMTDownload) << "Part" << m_nIndex << "Downloader::onFinished() unknown exception";
+    }
+}
+
+void Downloader::onWriterFinished(bool bSuccess, const QString& strError)
+{
+    // 写入者已被丢弃（abort()或重定向）
+    if (!m_pWriter.get() || !m_pWriter->isFinished())
+    {
+        return;
+    }
+    m_pWriter.reset();
+
+    if (m_bSuperseded)
+    {
+        emit writeFinished(m_nIndex, bSuccess, strError);
+        return;
+    }
+
+    if (!bSuccess)
+    {
+        m_bRetryable = false;
+        m_bLocalError = true;
+        m_strError = strError;
+    }
+    else
+    {
+        m_nResumePoint = m_nStartPoint + m_nBytesReceived;
+    }
+    finishPart(m_bReplySuccess && bSuccess);
+}
+
+void Downloader::finishPart(bool bSuccess)
+{
+    // 本段的数据必须完整，连接提前关闭时Qt不一定报错
+    if (bSuccess && m_nSegmentSize >= 0 && m_nBytesReceived != m_nSegmentSize)
+    {
+        bSuccess = false;
+        m_strError = QStringLiteral("Part %1 short read: %2 of %3 bytes").arg(m_nIndex).arg(m_nBytesReceived).arg(m_nSegmentSize);
+    }
+
+    if (!bSuccess)
+    {
+        NETWORK_LOG(eLogWarn, eCategoryMTDownload) << "Part" << m_nIndex << "download failed!" << m_strError;
+    }
+    emit downloadFinished(m_nIndex, bSuccess, m_strError);
+}
+
+void Downloader::onRetry()
+{
+    if (!retry())
+    {
+        emit downloadFinished(m_nIndex, false, m_strError);
     }
 }
 
 void Downloader::onError(QNetworkReply::NetworkError code)
 {
     Q_UNUSED(code);
+    // 本地出错时主动取消的请求，保留本地的错误
+    if (m_bEndReached || m_bLocalError)
+    {
+        return;
+    }
 
     m_strError = m_pNetworkReply->errorString();
-    qDebug() << "[QMultiThreadNetwork] Downloader::onError - Part" << m_nIndex << m_strError;
+    NETWORK_LOG(eLogWarn, eCategoryMTDownload) << "Downloader::onError - Part" << m_nIndex << m_strError;
 }
\ No newline at end of file
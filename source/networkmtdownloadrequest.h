@@ -4,10 +4,17 @@
 #include <QObject>
 #include <QPointer>
 #include <QMutex>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QSet>
 #include "networkrequest.h"
 
 class QFile;
+class QTimer;
 class Downloader;
+class NetworkFileWriter;
+class NetworkChecksum;
+class NetworkOrderedChecksum;
 
 //多线程下载请求(这里的线程是指下载的通道。一个文件被分成多个部分，由多个下载通道同时下载)
 class NetworkMTDownloadRequest : public NetworkRequest
@@ -24,20 +31,114 @@ public Q_SLOTS:
     void onFinished() Q_DECL_OVERRIDE;
     void onSubPartFinished(int index, bool bSuccess, const QString& strErr);
     void onSubPartDownloadProgress(int index, qint64 bytesReceived, qint64 bytesTotal);
+    // 第一段收到响应头：创建文件，把剩余部分分给其它分段
+    void onSubPartResponse(int index, qint64 nTotalSize, bool bRangeSupported);
+    // 被取代的一方已收到的数据写完
+    void onSubPartWritten(int index, bool bSuccess, const QString& strErr);
+    // 没有待下载的分段时定时检查落后的分段
+    void onStragglerTimeout();
 
 private:
-    bool requestFileSize(const QUrl& url);
-    void startMTDownload();
+    enum
+    {
+        // 第一段请求的字节数（同时用来得到文件大小，不再单独发送HEAD请求）
+        ProbeChunkSize = 1024 * 1024,
+        // 有镜像时剩余部分按通道数的倍数切成小段，下载快的镜像会领到更多的段
+        MirrorChunksPerChannel = 4,
+        MinMirrorChunkSize = 1024 * 1024,
+        // 重复请求的编号 = DuplicateIndexBase + 原分段的编号
+        DuplicateIndexBase = 0x10000,
+        // 预计用时超过按已完成分段的平均速度所需时间的多少倍时视为落后
+        StragglerFactor = 2,
+        // 剩余时间（毫秒）或剩余字节数低于下限时不值得重复下载
+        MinStragglerTime = 2000,
+        MinStragglerBytes = 512 * 1024,
+        // 没有分段结束时检查落后分段的间隔（毫秒）
+        StragglerCheckInterval = 1000,
+        // 镜像连续出错多少次后弃用（文件大小/ETag不一致时立即弃用）
+        MaxMirrorFailures = 3,
+        // 镜像出错后暂停使用的时间（毫秒），连续出错时每次加倍
+        MirrorCoolDown = 2000,
+    };
+
+    Downloader *createDownloader(int index);
+    // 根据第一段的响应决定其余分段：从nOffset开始分成nCount段. 返回false时由第一段下载整个文件
+    bool planSegments(const Downloader *pProbe, bool bRangeSupported, qint64& nOffset, int& nCount) const;
+    // 第一段的地址和listMirrorUrls中有效的地址
+    void initMirrors(const QUrl& primaryUrl);
+    // 按吞吐/(进行中的段数+1)选择镜像，还没有测到吞吐的镜像优先，跳过nExclude和已弃用的镜像.
+    //	bCoolingAllowed为false时跳过出错后暂停使用中的镜像. 没有可用镜像时返回-1
+    int selectMirror(int nExclude = -1, bool bCoolingAllowed = false) const;
+    // 没有可用镜像时使用第一段的地址
+    bool startSegment(int index);
+    // 某一段结束（成功或失败），更新该段所用镜像的统计. 失败时bFatal为true（文件不一致）立即弃用该镜像，
+    //	否则累计出错次数并暂停使用一段时间，连续出错MaxMirrorFailures次后弃用
+    void releaseMirror(int index, bool bSuccess, bool bFatal = false);
+    // 该段从已写入的位置改由其它镜像继续下载. 没有其它可用镜像时返回false，由调用者在原地址上重试
+    bool failoverSegment(int index, const QString& strErr);
+    // 没有待下载的分段时，用空出的通道重复下载落后最多的一段的剩余部分
+    bool hedgeStraggler();
+    // 落后的分段可能还没到判断的时间（如连接停滞在MinStragglerTime之前），StragglerCheckInterval之后再检查
+    void scheduleStragglerCheck();
+    // 重复下载的分段先完成的一方有效，停止另一方（保留它已收到的数据，写完前不结束请求）
+    void finishDuplicate(int index);
+    // 重复下载的分段有一方失败时由另一方继续，返回true
+    bool dropDuplicate(int index);
+    // 全部分段（及被取代的一方的写入）完成或有分段失败时结束请求
+    void checkFinished();
+    // 全部分段下载完成，按持久化策略fsync后把临时文件改名为目标文件
+    bool commitFile();
+    // 合并各分段的摘要（crc32c）或取写线程按顺序计算的摘要（其它算法），与期望值比较
+    bool verifyChecksum();
     void clearDownloaders();
     void clearProgress();
 
 private:
-    QUrl m_url;
     QString m_strDstFilePath;
+    // 第一段重定向之后的主机，用于记录主机的历史（NetworkHostHistory）
+    QString m_strHost;
     qint64 m_nFileSize;
+    std::unique_ptr<NetworkChecksum> m_pChecksum;
+    // 无法合并的算法：各分段的写线程按文件顺序计算
+    std::shared_ptr<NetworkOrderedChecksum> m_pOrderedChecksum;
 
     std::map<int, std::unique_ptr<Downloader>> m_mapDownloader;
     int m_nThreadCount;//分割成多少段下载
+    int m_nChannelCount;//同时下载的段数
+
+    struct MirrorState
+    {
+        QUrl url;
+        bool bFailed;
+        int nActive;
+        qint64 nBytes;
+        qint64 nElapsed;// 毫秒
+        // 连续出错的次数，成功完成一段后清零
+        int nFailures;
+        // 暂停使用到此时刻（NetworkUtility::monotonicTime，微秒）
+        qint64 nCoolDownUntil;
+        MirrorState() : bFailed(false), nActive(0), nBytes(0), nElapsed(0), nFailures(0), nCoolDownUntil(0) {}
+    };
+    QVector<MirrorState> m_vecMirror;
+    // 分段使用的镜像
+    QMap<int, int> m_mapSegmentMirror;
+    // 还没有开始的分段（按文件中的顺序）
+    QList<int> m_listPendingSegment;
+    QMap<int, QPair<qint64, qint64>> m_mapSegmentRange;
+    // 第一段响应的ETag，各镜像的响应必须一致
+    QByteArray m_strETag;
+    bool m_bDropCache;
+    qint64 m_nSyncInterval;
+    // 正在重复下载的分段 -> 重复请求的编号
+    QMap<int, int> m_mapDuplicate;
+    // 已被另一方取代的分段或重复请求，不再处理它们的结束信号
+    QSet<int> m_setSuperseded;
+    // 被取代后还在写入已收到数据的分段数
+    int m_nSupersededWriting;
+    // 已完成分段的字节数和用时（毫秒），用于判断落后的分段
+    qint64 m_nFinishedBytes;
+    qint64 m_nFinishedElapsed;
+    QTimer *m_pStragglerTimer;
     int m_nSuccess;
     int m_nFailed;
 
@@ -68,18 +169,100 @@ public:
 
     virtual ~Downloader();
 
+    enum
+    {
+        // 单个分段失败后最多重试的次数
+        MaxRetryCount = 3,
+        // 第一次重试的等待时间（毫秒），之后每次加倍
+        RetryBaseDelay = 1000,
+    };
+
     bool start(const QUrl &url, qint64 startPoint = 0, qint64 endPoint = -1);
+    // 探测请求：接受超过文件末尾的范围，服务器不支持分段（200）时下载整个文件，
+    //	收到响应头后发出responseReceived，在槽函数中调用setFilePath()
+    void setProbe(bool bProbe) { m_bProbe = bProbe; }
+    // 写入的文件，在收到数据之前设置
+    void setFilePath(const QString& strFilePath) { m_strDstFilePath = strFilePath; }
+    // 缩短本段（在responseReceived的槽函数中调用）：超出的数据不写入，到达结束位置后关闭连接
+    void setEndPoint(qint64 nEndPoint);
+    qint64 endPoint() const { return m_nEndPoint; }
+    // 从已写入的位置继续下载本段（服务器不支持分段、4xx、写文件失败时不能重试）
+    bool canRetry() const { return m_bRetryable && m_nRetryCount < MaxRetryCount && !m_bAbortManual; }
+    int retryDelay() const;
+    // 换一个地址（镜像）从已写入的位置继续下载本段
+    bool restart(const QUrl& url);
+    // 本地错误（写文件失败），换镜像也无济于事
+    bool isLocalError() const { return m_bLocalError; }
+    // 响应的文件大小、ETag或Content-Range与请求不一致：该地址提供的不是同一个文件（或不支持分段）
+    bool isMirrorMismatch() const { return m_bMirrorMismatch; }
+    // 各响应必须与第一段的文件大小、ETag一致（-1/空: 不检查），在start()之前设置
+    void setExpectedEntity(qint64 nTotalSize, const QByteArray& strETag) { m_nExpectedTotal = nTotalSize; m_strExpectedETag = strETag; }
+    // 与重复请求共享的写入位置：之前的数据已由某一方写入，只写入超出的部分
+    void setWatermark(const std::shared_ptr<qint64>& pWatermark) { m_pWatermark = pWatermark; }
+    // 被重复请求取代：关闭连接，把已收到的数据写完，不再发出downloadFinished.
+    //	返回true时还有数据在写入，写完后发出writeFinished
+    bool supersede();
 
     void abort();
 
+    // 大文件模式（写完的数据从页缓存中丢弃），在收到数据之前设置
+    void setDropCache(bool bDropCache) { m_bDropCache = bDropCache; }
+    // 每写入nBytes字节fsync一次（0: 不fsync），在收到数据之前设置
+    void setSyncInterval(qint64 nBytes) { m_nSyncInterval = nBytes; }
+    // 边下载边计算本段数据的摘要，在start()之前设置（重复请求在start()之后设置原请求的摘要，两者共享）
+    void setChecksum(const std::shared_ptr<NetworkChecksum>& pChecksum) { m_pChecksum = pChecksum; }
+    std::shared_ptr<NetworkChecksum> checksum() const { return m_pChecksum; }
+    // 写完的数据由写线程按文件顺序计入摘要（各分段共享），在收到数据之前设置
+    void setOrderedChecksum(const std::shared_ptr<NetworkOrderedChecksum>& pChecksum) { m_pOrderedChecksum = pChecksum; }
+
+    // 已接收的字节数
+    qint64 bytesReceived() const { return m_nBytesReceived; }
+    // 下一个字节在文件中的位置
+    qint64 offset() const { return m_nStartPoint + m_nBytesReceived; }
+    // 本段的字节数，未知时为-1
+    qint64 segmentSize() const { return m_nSegmentSize; }
+    // 请求进行中（不在等待重试）
+    bool isRunning() const { return m_pNetworkReply != nullptr; }
+    // 从start()到现在的毫秒数
+    qint64 elapsed() const { return m_timer.isValid() ? m_timer.elapsed() : 0; }
+    // 响应头中的ETag
+    const QByteArray& eTag() const { return m_strETag; }
+    // 重定向之后的地址
+    const QUrl& url() const { return m_url; }
+    int httpStatusCode() const { return m_nHttpStatusCode; }
+    int networkError() const { return m_nNetworkError; }
+
 Q_SIGNALS:
     void downloadFinished(int index, bool bSuccess, const QString& strErr);
     void downloadProgress(int index, qint64 bytesReceived, qint64 bytesTotal);
+    // 探测请求的响应头已通过校验. nTotalSize: 文件大小，未知时为-1
+    //	bRangeSupported: 返回了206，或返回200但带有Accept-Ranges: bytes
+    void responseReceived(int index, qint64 nTotalSize, bool bRangeSupported);
+    // 被取代（supersede()）之后，已收到的数据写完
+    void writeFinished(int index, bool bSuccess, const QString& strErr);
 
 public Q_SLOTS:
     void onFinished();
     void onReadyRead();
     void onError(QNetworkReply::NetworkError code);
+    // 写线程已追上，恢复读取
+    void onWriterDrained();
+    // 写线程已写完本段的数据
+    void onWriterFinished(bool bSuccess, const QString& strError);
+    void onRetry();
+
+private:
+    bool sendRequest();
+    bool retry();
+    // 校验响应的状态码和Content-Range是否与请求的范围一致
+    bool checkResponseRange();
+    // 发出responseReceived，槽函数没有设置文件路径时结束本段
+    bool notifyResponse(qint64 nTotalSize, bool bRangeSupported);
+    // 收到第一块数据时才打开文件（探测请求在响应头到达后才知道文件路径）
+    bool openWriter();
+    void readToWriter();
+    // 请求和写入都已结束，发出downloadFinished
+    void finishPart(bool bSuccess);
 
 private:
     QPointer<QNetworkAccessManager> m_pNetworkManager;
@@ -90,12 +273,41 @@ private:
     const int m_nIndex;
     qint64 m_nStartPoint;
     qint64 m_nEndPoint;
+    // 本次请求的起始位置（重试时为已写入的位置）
+    qint64 m_nResumePoint;
+    // 本段的字节数，未知时为-1
+    qint64 m_nSegmentSize;
+    qint64 m_nBytesReceived;
+    int m_nRetryCount;
+    bool m_bRetryable;
+    bool m_bRangeChecked;
+    bool m_bRangeValid;
+    bool m_bProbe;
+    // 本段被setEndPoint()缩短过
+    bool m_bTruncated;
+    // 已收到缩短后的全部数据，主动关闭了连接
+    bool m_bEndReached;
+    bool m_bLocalError;
+    bool m_bMirrorMismatch;
+    // 请求结束时的结果，等写线程写完后再结束本段
+    bool m_bReplySuccess;
+    bool m_bSuperseded;
+    qint64 m_nExpectedTotal;
+    QByteArray m_strExpectedETag;
+    QByteArray m_strETag;
+    QElapsedTimer m_timer;
     bool m_bShowProgress;
     quint16 m_nRedirectionCount;
     quint16 m_nMaxRedirectionCount;
+    int m_nHttpStatusCode;
+    int m_nNetworkError;
+    bool m_bDropCache;
+    qint64 m_nSyncInterval;
 
-    typedef void * HANDLE;
-    HANDLE m_hFile;
+    std::unique_ptr<NetworkFileWriter> m_pWriter;
+    std::shared_ptr<NetworkChecksum> m_pChecksum;
+    std::shared_ptr<NetworkOrderedChecksum> m_pOrderedChecksum;
+    std::shared_ptr<qint64> m_pWatermark;
     QString m_strDstFilePath;
 };
 
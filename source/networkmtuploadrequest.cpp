@@ -0,0 +1,569 @@
+﻿#include "networkmtuploadrequest.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QTimer>
+#include <QUrlQuery>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+#include <QCoreApplication>
+#include <QNetworkAccessManager>
+#include "networkmanager.h"
+#include "networkmappedfile.h"
+#include "networkutility.h"
+#include "networktracer.h"
+#include "networklog.h"
+
+using namespace QMTNetwork;
+
+NetworkMTUploadRequest::NetworkMTUploadRequest(QObject *parent /* = nullptr */)
+    : NetworkRequest(parent)
+    , m_nFileSize(0)
+    , m_nFileModified(0)
+    , m_nPartSize(0)
+    , m_eStage(eStageParts)
+    , m_nNextPart(0)
+    , m_nActive(0)
+    , m_nChannelCount(1)
+    , m_nBytesDone(0)
+    , m_nBytesInFlight(0)
+{
+}
+
+NetworkMTUploadRequest::~NetworkMTUploadRequest()
+{
+    abortParts();
+}
+
+void NetworkMTUploadRequest::abort()
+{
+    NetworkRequest::abort();
+    abortParts();
+}
+
+void NetworkMTUploadRequest::abortParts()
+{
+    for (PartState& part : m_vecPart)
+    {
+        if (part.pReply)
+        {
+            QNetworkReply *pReply = part.pReply;
+            part.pReply = nullptr;
+            pReply->disconnect(this);
+            if (pReply->isRunning())
+            {
+                pReply->abort();
+            }
+            pReply->deleteLater();
+        }
+        part.nSent = 0;
+    }
+    m_nActive = 0;
+    m_nBytesInFlight = 0;
+}
+
+void NetworkMTUploadRequest::start()
+{
+    NetworkRequest::start();
+
+    abortParts();
+    m_vecPart.clear();
+    m_strUploadId.clear();
+    m_bytesLastPart.clear();
+    m_nNextPart = 0;
+    m_nBytesDone = 0;
+    m_stateTimer.invalidate();
+
+    m_url = QUrl(m_request.url);
+    if (!m_url.isValid() || !(isHttpProxy(m_url.scheme()) || isHttpsProxy(m_url.scheme())))
+    {
+        m_strError = QStringLiteral("Error: Invaild Url - %1 (eTypeMTUpload supports http(s) only)").arg(m_request.url);
+        emit requestFinished(false, QByteArray(), m_strError);
+        return;
+    }
+
+    m_pFile.reset(new QFile(m_request.strReqArg));
+    if (!m_pFile->open(QIODevice::ReadOnly))
+    {
+        m_strError = QStringLiteral("Error: open file(%1) failed - %2").arg(m_request.strReqArg).arg(m_pFile->errorString());
+        m_pFile.reset();
+        emit requestFinished(false, QByteArray(), m_strError);
+        return;
+    }
+    m_nFileSize = m_pFile->size();
+    m_nFileModified = QFileInfo(*m_pFile).lastModified().toMSecsSinceEpoch();
+
+    m_nPartSize = qMax<qint64>(m_request.nUploadPartSize, MinPartSize);
+    if ((m_nFileSize + m_nPartSize - 1) / m_nPartSize > MaxPartCount)
+    {
+        m_nPartSize = (m_nFileSize + MaxPartCount - 1) / MaxPartCount;
+    }
+    // 空文件也上传一块
+    const int nParts = static_cast<int>(qMax<qint64>((m_nFileSize + m_nPartSize - 1) / m_nPartSize, 1));
+    m_vecPart.resize(nParts);
+    for (int i = 0; i < nParts; ++i)
+    {
+        m_vecPart[i].nOffset = m_nPartSize * i;
+        m_vecPart[i].nSize = qMin(m_nPartSize, m_nFileSize - m_vecPart[i].nOffset);
+    }
+    m_nChannelCount = qBound(1, int(m_request.nUploadThreadCount), 10);
+
+    if (nullptr == m_pNetworkManager)
+    {
+        m_pNetworkManager = new QNetworkAccessManager;
+    }
+
+    loadState();
+    NETWORK_LOG(eLogDebug, eCategoryUpload) << "MT upload:" << m_request.strReqArg << m_nFileSize << "bytes," << nParts
+        << "parts," << m_nBytesDone << "bytes uploaded before";
+
+    if (m_request.eUploadProtocol == eUploadS3Multipart && m_strUploadId.isEmpty())
+    {
+        sendInitiate();
+    }
+    else
+    {
+        startParts();
+    }
+}
+
+void NetworkMTUploadRequest::loadState()
+{
+    if (m_request.strUploadStateFile.isEmpty())
+    {
+        return;
+    }
+    QFile file(m_request.strUploadStateFile);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return;
+    }
+
+    const QJsonObject obj = QJsonDocument::fromJson(file.readAll()).object();
+    if (obj.value(QStringLiteral("url")).toString() != m_request.url
+        || obj.value(QStringLiteral("file")).toString() != QFileInfo(*m_pFile).absoluteFilePath()
+        || qint64(obj.value(QStringLiteral("size")).toDouble()) != m_nFileSize
+        || qint64(obj.value(QStringLiteral("modified")).toDouble()) != m_nFileModified
+        || qint64(obj.value(QStringLiteral("partSize")).toDouble()) != m_nPartSize
+        || obj.value(QStringLiteral("protocol")).toInt() != m_request.eUploadProtocol)
+    {
+        NETWORK_LOG(eLogInfo, eCategoryUpload) << "Upload state" << m_request.strUploadStateFile << "does not match, upload from the beginning";
+        return;
+    }
+
+    m_strUploadId = obj.value(QStringLiteral("uploadId")).toString();
+    const QJsonArray parts = obj.value(QStringLiteral("parts")).toArray();
+    for (const QJsonValue& value : parts)
+    {
+        const QJsonObject part = value.toObject();
+        const int index = part.value(QStringLiteral("n")).toInt() - 1;
+        if (index < 0 || index >= m_vecPart.size() || m_vecPart.at(index).bDone)
+        {
+            continue;
+        }
+        m_vecPart[index].bDone = true;
+        m_vecPart[index].strETag = part.value(QStringLiteral("etag")).toString().toLatin1();
+        m_nBytesDone += m_vecPart.at(index).nSize;
+    }
+}
+
+void NetworkMTUploadRequest::saveState()
+{
+    if (m_request.strUploadStateFile.isEmpty())
+    {
+        return;
+    }
+    m_stateTimer.start();
+
+    QJsonArray parts;
+    for (int i = 0; i < m_vecPart.size(); ++i)
+    {
+        if (m_vecPart.at(i).bDone)
+        {
+            QJsonObject part;
+            part.insert(QStringLiteral("n"), i + 1);
+            part.insert(QStringLiteral("etag"), QString::fromLatin1(m_vecPart.at(i).strETag));
+            parts.append(part);
+        }
+    }
+    QJsonObject obj;
+    obj.insert(QStringLiteral("url"), m_request.url);
+    obj.insert(QStringLiteral("file"), QFileInfo(*m_pFile).absoluteFilePath());
+    obj.insert(QStringLiteral("size"), double(m_nFileSize));
+    obj.insert(QStringLiteral("modified"), double(m_nFileModified));
+    obj.insert(QStringLiteral("partSize"), double(m_nPartSize));
+    obj.insert(QStringLiteral("protocol"), int(m_request.eUploadProtocol));
+    obj.insert(QStringLiteral("uploadId"), m_strUploadId);
+    obj.insert(QStringLiteral("parts"), parts);
+
+    QSaveFile file(m_request.strUploadStateFile);
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact)) < 0
+        || !file.commit())
+    {
+        NETWORK_LOG(eLogWarn, eCategoryUpload) << "Save upload state" << m_request.strUploadStateFile << "failed:" << file.errorString();
+    }
+}
+
+QNetworkRequest NetworkMTUploadRequest::createRequest(const QUrl& url, const QByteArray& strContentType) const
+{
+    QNetworkRequest request(url);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, strContentType);
+    request.setRawHeader("Connection", "keep-alive");
+    auto iter = m_request.mapRawHeader.cbegin();
+    for (; iter != m_request.mapRawHeader.cend(); ++iter)
+    {
+        request.setRawHeader(iter.key(), iter.value());
+    }
+#ifndef QT_NO_SSL
+    if (isHttpsProxy(url.scheme()))
+    {
+        // 发送https请求前准备工作;
+        QSslConfiguration conf = request.sslConfiguration();
+        conf.setPeerVerifyMode(QSslSocket::VerifyNone);
+        conf.setProtocol(QSsl::TlsV1SslV3);
+        request.setSslConfiguration(conf);
+    }
+#endif
+    return request;
+}
+
+void NetworkMTUploadRequest::sendInitiate()
+{
+    m_eStage = eStageInitiate;
+    QUrl url(m_url);
+    QUrlQuery query(url);
+    query.addQueryItem(QStringLiteral("uploads"), QString());
+    url.setQuery(query);
+
+    QNetworkRequest request = createRequest(url, "application/octet-stream");
+    request.setHeader(QNetworkRequest::ContentLengthHeader, 0);
+    m_pNetworkReply = m_pNetworkManager->post(request, QByteArray());
+    trackReply(m_pNetworkReply);
+    connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onFinished()));
+    connect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
+}
+
+void NetworkMTUploadRequest::sendComplete()
+{
+    m_eStage = eStageComplete;
+    QByteArray bytes;
+    QXmlStreamWriter xml(&bytes);
+    xml.writeStartElement(QStringLiteral("CompleteMultipartUpload"));
+    for (int i = 0; i < m_vecPart.size(); ++i)
+    {
+        xml.writeStartElement(QStringLiteral("Part"));
+        xml.writeTextElement(QStringLiteral("PartNumber"), QString::number(i + 1));
+        xml.writeTextElement(QStringLiteral("ETag"), QString::fromLatin1(m_vecPart.at(i).strETag));
+        xml.writeEndElement();
+    }
+    xml.writeEndElement();
+
+    QUrl url(m_url);
+    QUrlQuery query(url);
+    query.addQueryItem(QStringLiteral("uploadId"), m_strUploadId);
+    url.setQuery(query);
+
+    QNetworkRequest request = createRequest(url, "application/xml");
+    request.setHeader(QNetworkRequest::ContentLengthHeader, bytes.size());
+    m_pNetworkReply = m_pNetworkManager->post(request, bytes);
+    trackReply(m_pNetworkReply);
+    connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onFinished()));
+    connect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
+}
+
+void NetworkMTUploadRequest::onFinished()
+{
+    QNetworkReply *pReply = m_pNetworkReply;
+    m_pNetworkReply = nullptr;
+    if (nullptr == pReply)
+    {
+        return;
+    }
+    pReply->deleteLater();
+    if (m_bAbortManual)
+    {
+        return;
+    }
+
+    const int statusCode = pReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const bool bSuccess = (pReply->error() == QNetworkReply::NoError) && (statusCode >= 200 && statusCode < 300);
+    const QByteArray bytes = pReply->isOpen() ? pReply->readAll() : QByteArray();
+    const char *pStage = (m_eStage == eStageInitiate) ? "Initiate" : "Complete";
+    if (!bSuccess)
+    {
+        if (m_strError.isEmpty())
+        {
+            m_strError = pReply->errorString();
+        }
+        m_strError.append(QString::fromUtf8(bytes));
+        NETWORK_LOG(eLogWarn, eCategoryUpload) << pStage << "multipart upload failed: HTTP" << statusCode << m_strError;
+        finish(false);
+        return;
+    }
+
+    if (m_eStage == eStageInitiate)
+    {
+        QXmlStreamReader xml(bytes);
+        while (!xml.atEnd() && m_strUploadId.isEmpty())
+        {
+            if (xml.readNext() == QXmlStreamReader::StartElement && xml.name() == QLatin1String("UploadId"))
+            {
+                m_strUploadId = xml.readElementText().trimmed();
+            }
+        }
+        if (m_strUploadId.isEmpty())
+        {
+            m_strError = QStringLiteral("Error: no UploadId in the response - %1").arg(QString::fromUtf8(bytes));
+            finish(false);
+            return;
+        }
+        NETWORK_LOG(eLogDebug, eCategoryUpload) << "UploadId:" << m_strUploadId;
+        saveState();
+        startParts();
+    }
+    else
+    {
+        // S3在200响应中也可能返回错误
+        if (bytes.contains("<Error>"))
+        {
+            m_strError = QString::fromUtf8(bytes);
+            NETWORK_LOG(eLogWarn, eCategoryUpload) << pStage << "multipart upload failed:" << m_strError;
+            finish(false);
+            return;
+        }
+        finish(true, bytes);
+    }
+}
+
+void NetworkMTUploadRequest::startParts()
+{
+    m_eStage = eStageParts;
+    while (m_nActive < m_nChannelCount && m_nNextPart < m_vecPart.size())
+    {
+        const int index = m_nNextPart++;
+        if (m_vecPart.at(index).bDone)
+        {
+            continue;
+        }
+        if (!sendPart(index))
+        {
+            finish(false);
+            return;
+        }
+        ++m_nActive;
+    }
+
+    // 全部块都已上传
+    if (m_nActive == 0 && m_nNextPart >= m_vecPart.size())
+    {
+        if (m_request.eUploadProtocol == eUploadS3Multipart)
+        {
+            sendComplete();
+        }
+        else
+        {
+            finish(true, m_bytesLastPart);
+        }
+    }
+}
+
+bool NetworkMTUploadRequest::sendPart(int index)
+{
+    PartState& part = m_vecPart[index];
+    // 每块映射文件中对应的一段发送（或按块读取），不复制到堆内存
+    QIODevice *pBody = NetworkMappedFile::create(m_request.strReqArg, part.nOffset, part.nSize, m_strError);
+    if (nullptr == pBody)
+    {
+        NETWORK_LOG(eLogError, eCategoryUpload) << m_strError;
+        return false;
+    }
+
+    QUrl url(m_url);
+    if (m_request.eUploadProtocol == eUploadS3Multipart)
+    {
+        QUrlQuery query(url);
+        query.addQueryItem(QStringLiteral("partNumber"), QString::number(index + 1));
+        query.addQueryItem(QStringLiteral("uploadId"), m_strUploadId);
+        url.setQuery(query);
+    }
+    QNetworkRequest request = createRequest(url, "application/octet-stream");
+    request.setHeader(QNetworkRequest::ContentLengthHeader, part.nSize);
+    if (m_request.eUploadProtocol == eUploadContentRange && part.nSize > 0)
+    {
+        QString range;
+        range.sprintf("bytes %lld-%lld/%lld", part.nOffset, part.nOffset + part.nSize - 1, m_nFileSize);
+        request.setRawHeader("Content-Range", range.toLatin1());
+    }
+
+    NETWORK_LOG(eLogDebug, eCategoryUpload) << "Part" << (index + 1) << "/" << m_vecPart.size() << "offset" << part.nOffset << "size" << part.nSize;
+    m_nBytesInFlight -= part.nSent;
+    part.nSent = 0;
+    part.pReply = m_pNetworkManager->put(request, pBody);
+    if (nullptr == part.pReply)
+    {
+        delete pBody;
+        m_strError = QStringLiteral("part %1 upload failed!").arg(index + 1);
+        return false;
+    }
+    // 请求体随reply一起释放
+    pBody->setParent(part.pReply);
+    if (m_request.timing.iRequestSent == 0)
+    {
+        m_request.timing.iRequestSent = NetworkUtility::monotonicTime();
+    }
+    NETWORK_TRACE_ASYNC_BEGIN("segment", "upload_part", reinterpret_cast<quintptr>(part.pReply), "index", index + 1);
+    connect(part.pReply, &QNetworkReply::finished, this, [this, index]() {
+        onPartFinished(index);
+    });
+    connect(part.pReply, &QNetworkReply::uploadProgress, this, [this, index](qint64 iSent, qint64) {
+        onPartProgress(index, iSent);
+    });
+    return true;
+}
+
+void NetworkMTUploadRequest::onPartFinished(int index)
+{
+    PartState& part = m_vecPart[index];
+    QNetworkReply *pReply = part.pReply;
+    part.pReply = nullptr;
+    if (nullptr == pReply)
+    {
+        return;
+    }
+    NETWORK_TRACE_ASYNC_END("segment", "upload_part", reinterpret_cast<quintptr>(pReply), "index", index + 1);
+    pReply->deleteLater();
+    m_nBytesInFlight -= part.nSent;
+    part.nSent = 0;
+    if (m_bAbortManual)
+    {
+        return;
+    }
+
+    const int statusCode = pReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    m_nHttpStatusCode = statusCode;
+    m_nNetworkError = pReply->error();
+    bool bSuccess = (pReply->error() == QNetworkReply::NoError) && (statusCode >= 200 && statusCode < 300);
+    const QByteArray bytes = pReply->isOpen() ? pReply->readAll() : QByteArray();
+    const qint64 iNow = NetworkUtility::monotonicTime();
+    if (m_request.timing.iFirstByte == 0)
+    {
+        m_request.timing.iFirstByte = iNow;
+    }
+    m_request.timing.iLastByte = iNow;
+
+    QString strError;
+    if (bSuccess && m_request.eUploadProtocol == eUploadS3Multipart)
+    {
+        // 完成请求需要各块的ETag
+        part.strETag = pReply->rawHeader("ETag");
+        if (part.strETag.isEmpty())
+        {
+            bSuccess = false;
+            strError = QStringLiteral("Part %1: no ETag in the response").arg(index + 1);
+        }
+    }
+    if (bSuccess)
+    {
+        part.bDone = true;
+        m_nBytesDone += part.nSize;
+        m_request.timing.iBytesSent += part.nSize;
+        m_bytesLastPart = bytes;
+        --m_nActive;
+        if (!m_stateTimer.isValid() || m_stateTimer.hasExpired(StateSaveInterval))
+        {
+            saveState();
+        }
+        startParts();
+        return;
+    }
+
+    if (strError.isEmpty())
+    {
+        strError = QStringLiteral("Part %1 upload failed (HTTP %2): %3").arg(index + 1).arg(statusCode)
+            .arg(pReply->errorString() + QString::fromUtf8(bytes));
+    }
+    // 4xx重试也不会成功（408/429除外）
+    const bool bRetryable = !(statusCode >= 400 && statusCode < 500 && statusCode != 408 && statusCode != 429);
+    if (bRetryable && part.nRetryCount < MaxRetryCount)
+    {
+        // 1s, 2s, 4s ...，等待期间仍占用该通道
+        const int nDelay = RetryBaseDelay << part.nRetryCount;
+        ++part.nRetryCount;
+        NETWORK_LOG(eLogWarn, eCategoryUpload) << strError << "- retry in" << nDelay << "ms";
+        NETWORK_TRACE_INSTANT("segment", "retry", index + 1, "attempt", part.nRetryCount);
+        QTimer::singleShot(nDelay, this, [this, index]() {
+            if (!m_bAbortManual && !sendPart(index))
+            {
+                finish(false);
+            }
+        });
+        return;
+    }
+
+    --m_nActive;
+    m_strError = strError;
+    NETWORK_LOG(eLogWarn, eCategoryUpload) << m_strError;
+    if (m_request.eUploadProtocol == eUploadS3Multipart && statusCode == 404)
+    {
+        // UploadId已失效（过期或被服务器清理），已完成的块作废，下次从头上传
+        m_strUploadId.clear();
+        for (PartState& state : m_vecPart)
+        {
+            state.bDone = false;
+        }
+    }
+    finish(false);
+}
+
+void NetworkMTUploadRequest::onPartProgress(int index, qint64 nSent)
+{
+    if (m_bAbortManual || nSent <= 0 || index >= m_vecPart.size() || !m_vecPart.at(index).pReply)
+        return;
+
+    m_nBytesInFlight += nSent - m_vecPart.at(index).nSent;
+    m_vecPart[index].nSent = nSent;
+    if (!m_request.bShowProgress || m_nFileSize <= 0)
+        return;
+
+    const qint64 iSent = m_nBytesDone + m_nBytesInFlight;
+    int progress = iSent * 100 / m_nFileSize;
+    if (m_nProgress < progress)
+    {
+        m_nProgress = progress;
+        NetworkProgressEvent *event = new NetworkProgressEvent;
+        event->bDownload = false;
+        event->uiId = m_request.uiId;
+        event->uiBatchId = m_request.uiBatchId;
+        event->iBtyes = iSent;
+        event->iTotalBtyes = m_nFileSize;
+        QCoreApplication::postEvent(NetworkManager::globalInstance(), event);
+    }
+}
+
+void NetworkMTUploadRequest::finish(bool bSuccess, const QByteArray& bytesContent)
+{
+    if (bSuccess)
+    {
+        if (!m_request.strUploadStateFile.isEmpty())
+        {
+            QFile::remove(m_request.strUploadStateFile);
+        }
+        NETWORK_LOG(eLogDebug, eCategoryUpload) << "MT upload success." << m_request.strReqArg;
+    }
+    else
+    {
+        // 已完成的块留给下一次上传
+        if (m_pFile.get())
+        {
+            saveState();
+        }
+        abort();
+    }
+    m_pFile.reset();
+    emit requestFinished(bSuccess, bytesContent, m_strError);
+}
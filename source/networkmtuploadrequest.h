@@ -0,0 +1,101 @@
+﻿#ifndef NETWORKMTUPLOADREQUEST_H
+#define NETWORKMTUPLOADREQUEST_H
+
+#include <QObject>
+#include <QUrl>
+#include <QVector>
+#include <QElapsedTimer>
+#include "networkrequest.h"
+
+class QFile;
+
+//分块并发上传请求：文件切成nUploadPartSize大小的块，由多个连接同时上传（支持http(s)）
+//	协议见RequestTask::eUploadProtocol. 每块单独重试；设置了strUploadStateFile时记录已完成的块，
+//	以相同的参数重新上传（包括进程重启后）时跳过这些块.
+class NetworkMTUploadRequest : public NetworkRequest
+{
+    Q_OBJECT;
+
+public:
+    explicit NetworkMTUploadRequest(QObject *parent = 0);
+    ~NetworkMTUploadRequest();
+
+public Q_SLOTS:
+    void start() Q_DECL_OVERRIDE;
+    void abort() Q_DECL_OVERRIDE;
+    // 初始化/完成请求（S3风格）结束
+    void onFinished() Q_DECL_OVERRIDE;
+
+private:
+    enum
+    {
+        // 单块失败后最多重试的次数
+        MaxRetryCount = 3,
+        // 第一次重试的等待时间（毫秒），之后每次加倍
+        RetryBaseDelay = 1000,
+        MinPartSize = 64 * 1024,
+        // S3最多10000块，超出时加大每块的字节数
+        MaxPartCount = 10000,
+        // 状态文件最多每秒写一次（进程崩溃时最多重传这段时间内完成的块）
+        StateSaveInterval = 1000,
+    };
+
+    enum Stage
+    {
+        eStageInitiate,
+        eStageParts,
+        eStageComplete,
+    };
+
+    struct PartState
+    {
+        qint64 nOffset;
+        qint64 nSize;
+        // S3: 该块响应的ETag
+        QByteArray strETag;
+        bool bDone;
+        int nRetryCount;
+        // 本次请求已发送的字节数
+        qint64 nSent;
+        QNetworkReply *pReply;
+        PartState() : nOffset(0), nSize(0), bDone(false), nRetryCount(0), nSent(0), pReply(nullptr) {}
+    };
+
+    // 读取状态文件，文件和参数都一致时恢复UploadId和已完成的块
+    void loadState();
+    // 记录已完成的块（先写临时文件再改名）
+    void saveState();
+    QNetworkRequest createRequest(const QUrl& url, const QByteArray& strContentType) const;
+    void sendInitiate();
+    // 空出的通道上传下一块，全部完成后发送完成请求（S3）或结束
+    void startParts();
+    bool sendPart(int index);
+    void onPartFinished(int index);
+    void onPartProgress(int index, qint64 nSent);
+    void sendComplete();
+    void finish(bool bSuccess, const QByteArray& bytesContent = QByteArray());
+    void abortParts();
+
+private:
+    QUrl m_url;
+    std::unique_ptr<QFile> m_pFile;
+    qint64 m_nFileSize;
+    // 文件的修改时间（毫秒），与状态文件中的不一致时从头上传
+    qint64 m_nFileModified;
+    qint64 m_nPartSize;
+    Stage m_eStage;
+    QString m_strUploadId;
+    QVector<PartState> m_vecPart;
+    int m_nNextPart;
+    int m_nActive;
+    int m_nChannelCount;
+    // 已完成的块的字节数
+    qint64 m_nBytesDone;
+    // 进行中的块已发送的字节数
+    qint64 m_nBytesInFlight;
+    QElapsedTimer m_stateTimer;
+    // 最后一块的响应内容（Content-Range方式作为请求的返回内容）
+    QByteArray m_bytesLastPart;
+};
+
+#endif // NETWORKMTUPLOADREQUEST_H
@@ -0,0 +1,908 @@
+﻿#include "networknativehttprequest.h"
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QSocketNotifier>
+#include <QCoreApplication>
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#endif
+#include "networkmanager.h"
+#include "networkutility.h"
+#include "networktracer.h"
+#include "networklog.h"
+
+using namespace QMTNetwork;
+
+namespace {
+    bool isRedirect(int nStatusCode)
+    {
+        return nStatusCode == 301 || nStatusCode == 302 || nStatusCode == 303
+            || nStatusCode == 307 || nStatusCode == 308;
+    }
+
+#ifdef Q_OS_LINUX
+    QString errnoString()
+    {
+        return QString::fromLocal8Bit(strerror(errno));
+    }
+#endif
+}
+
+NetworkNativeHttpRequest::NetworkNativeHttpRequest(QObject *parent /* = nullptr */)
+    : NetworkRequest(parent)
+    , m_eStage(eStageDone)
+    , m_fdSocket(-1)
+    , m_fdEpoll(-1)
+    , m_pNotifier(nullptr)
+    , m_pAddrInfo(nullptr)
+    , m_pAddrNext(nullptr)
+    , m_nSendPos(0)
+    , m_nBodySize(0)
+    , m_nBodySent(0)
+    , m_nContentLength(-1)
+    , m_nReceived(0)
+    , m_nPipeBytes(0)
+    , m_bChunked(false)
+    , m_eChunkState(eChunkSize)
+    , m_nChunkRemain(0)
+{
+    m_fdPipe[0] = m_fdPipe[1] = -1;
+}
+
+NetworkNativeHttpRequest::~NetworkNativeHttpRequest()
+{
+    closeSocket();
+    closeFile(false);
+}
+
+bool NetworkNativeHttpRequest::isAvailable()
+{
+#ifdef Q_OS_LINUX
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool NetworkNativeHttpRequest::isSupported(const RequestTask& task)
+{
+    if (!isAvailable() || (task.eType != eTypeDownload && task.eType != eTypeUpload))
+    {
+        return false;
+    }
+    // 请求体压缩和断点续传需要经过用户空间，使用默认传输
+    if (task.eType == eTypeUpload && (task.bResumableUpload || task.eBodyEncoding != eEncodingIdentity))
+    {
+        return false;
+    }
+    // 数据不经过用户空间，无法边下载边计算摘要；不为校验再读一遍文件，使用默认传输
+    if (task.eType == eTypeDownload && !task.strChecksum.isEmpty())
+    {
+        return false;
+    }
+    return isHttpProxy(NetworkUtility::currentRequestUrl(task).scheme());
+}
+
+void NetworkNativeHttpRequest::start()
+{
+    NetworkRequest::start();
+
+    const QUrl& url = NetworkUtility::currentRequestUrl(m_request);
+    if (!url.isValid() || !isHttpProxy(url.scheme()))
+    {
+        m_strError = QStringLiteral("Error: Invaild Url -").arg(url.toString());
+        emit requestFinished(false, QByteArray(), m_strError);
+        return;
+    }
+
+#ifdef Q_OS_LINUX
+    const bool bDownload = (m_request.eType == eTypeDownload);
+    m_bytesRecv.clear();
+    m_bytesLocation.clear();
+    m_nBodySize = 0;
+    m_nBodySent = 0;
+    m_nContentLength = -1;
+    m_nReceived = 0;
+    m_nPipeBytes = 0;
+    m_bChunked = false;
+    m_eChunkState = eChunkSize;
+    m_nChunkRemain = 0;
+    m_bytesChunk.clear();
+    m_nHttpStatusCode = 0;
+    m_nNetworkError = 0;
+
+    if (bDownload)
+    {
+        m_pFile = std::move(NetworkUtility::createAndOpenFile(m_request, m_strError));
+        if (!m_pFile.get())
+        {
+            emit requestFinished(false, QByteArray(), m_strError);
+            return;
+        }
+        m_strFilePath = m_pFile->fileName();
+    }
+    else
+    {
+        m_pFile.reset(new QFile(m_request.strReqArg));
+        if (!m_pFile->open(QIODevice::ReadOnly))
+        {
+            m_strError = QStringLiteral("Error: QFile::open(%1) - %2").arg(m_request.strReqArg).arg(m_pFile->errorString());
+            m_pFile.reset();
+            emit requestFinished(false, QByteArray(), m_strError);
+            return;
+        }
+        m_nBodySize = m_pFile->size();
+    }
+
+    // 请求头，mapRawHeader中的字段优先
+    // IPv6地址在Host中需要加方括号
+    QByteArray bytesHost = url.host(QUrl::FullyEncoded).toUtf8();
+    if (bytesHost.contains(':'))
+    {
+        bytesHost = "[" + bytesHost + "]";
+    }
+    bytesHost += ((url.port() > 0 && url.port() != 80) ? ":" + QByteArray::number(url.port()) : QByteArray());
+    QByteArray bytesPath = url.toEncoded(QUrl::RemoveScheme | QUrl::RemoveAuthority | QUrl::RemoveFragment);
+    if (bytesPath.isEmpty())
+    {
+        bytesPath = "/";
+    }
+    QByteArray bytesMethod = "GET";
+    QList<QPair<QByteArray, QByteArray>> listHeader;
+    listHeader << qMakePair(QByteArray("Host"), bytesHost);
+    if (bDownload)
+    {
+        // splice要求响应体就是文件内容
+        listHeader << qMakePair(QByteArray("Accept-Encoding"), QByteArray("identity"));
+    }
+    else
+    {
+        bytesMethod = m_request.bUploadUsePut ? "PUT" : "POST";
+        listHeader << qMakePair(QByteArray("Content-Type"), QByteArray("application/octet-stream"));
+    }
+    m_bytesSend = bytesMethod + " " + bytesPath + " HTTP/1.1\r\n";
+    for (const auto& header : listHeader)
+    {
+        if (!m_request.mapRawHeader.contains(header.first))
+        {
+            m_bytesSend += header.first + ": " + header.second + "\r\n";
+        }
+    }
+    for (auto iter = m_request.mapRawHeader.cbegin(); iter != m_request.mapRawHeader.cend(); ++iter)
+    {
+        // 连接和长度由本传输决定
+        if (qstricmp(iter.key().constData(), "Connection") != 0
+            && qstricmp(iter.key().constData(), "Content-Length") != 0)
+        {
+            m_bytesSend += iter.key() + ": " + iter.value() + "\r\n";
+        }
+    }
+    if (!bDownload)
+    {
+        m_bytesSend += "Content-Length: " + QByteArray::number(m_nBodySize) + "\r\n";
+    }
+    m_bytesSend += "Connection: close\r\n\r\n";
+    m_nSendPos = 0;
+
+    // 在线程池的线程中解析，不阻塞其它请求
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *pResult = nullptr;
+    const int nPort = url.port(80);
+    const int nRet = getaddrinfo(url.host().toUtf8().constData(), QByteArray::number(nPort).constData(), &hints, &pResult);
+    if (nRet != 0 || nullptr == pResult)
+    {
+        fail(QStringLiteral("Error: getaddrinfo(%1) - %2").arg(url.host()).arg(QString::fromLocal8Bit(gai_strerror(nRet))),
+            QNetworkReply::HostNotFoundError);
+        return;
+    }
+
+    // 依次尝试解析出的每个地址（如IPv6不通时改用IPv4），直到连接成功
+    freeAddrInfo();
+    m_pAddrInfo = pResult;
+    m_pAddrNext = pResult;
+    QString strError;
+    int nNetworkError = 0;
+    if (!connectNext(strError, nNetworkError))
+    {
+        fail(strError, nNetworkError);
+        return;
+    }
+
+    if (bDownload)
+    {
+        if (pipe2(m_fdPipe, O_NONBLOCK | O_CLOEXEC) < 0)
+        {
+            fail(QStringLiteral("Error: pipe2() - %1").arg(errnoString()), QNetworkReply::UnknownNetworkError);
+            return;
+        }
+        // 加大pipe，减少splice的次数（超过/proc/sys/fs/pipe-max-size时保持默认大小）
+        fcntl(m_fdPipe[1], F_SETPIPE_SZ, static_cast<int>(ChunkSize));
+    }
+
+    m_fdEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_fdEpoll < 0 || !watchSocket())
+    {
+        fail(QStringLiteral("Error: epoll - %1").arg(errnoString()), QNetworkReply::UnknownNetworkError);
+        return;
+    }
+    m_pNotifier = new QSocketNotifier(m_fdEpoll, QSocketNotifier::Read, this);
+    connect(m_pNotifier, SIGNAL(activated(int)), this, SLOT(onEpollEvent()));
+
+    m_eStage = eStageConnect;
+    if (m_request.timing.iRequestSent == 0)
+    {
+        m_request.timing.iRequestSent = NetworkUtility::monotonicTime();
+    }
+    NETWORK_TRACE_ASYNC_BEGIN("net", "native", m_request.uiId);
+#else
+    fail(QStringLiteral("Error: native transport is not available on this platform"), QNetworkReply::ProtocolUnknownError);
+#endif
+}
+
+void NetworkNativeHttpRequest::abort()
+{
+    closeSocket();
+    NetworkRequest::abort();
+}
+
+void NetworkNativeHttpRequest::watch(bool bWrite)
+{
+#ifdef Q_OS_LINUX
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = bWrite ? EPOLLOUT : EPOLLIN;
+    epoll_ctl(m_fdEpoll, EPOLL_CTL_MOD, m_fdSocket, &event);
+#else
+    Q_UNUSED(bWrite);
+#endif
+}
+
+void NetworkNativeHttpRequest::onEpollEvent()
+{
+#ifdef Q_OS_LINUX
+    if (m_fdEpoll < 0)
+        return;
+
+    epoll_event event;
+    if (epoll_wait(m_fdEpoll, &event, 1, 0) <= 0)
+        return;
+
+    switch (m_eStage)
+    {
+    case eStageConnect:		onConnected(); break;
+    case eStageSendHeader:	sendHeader(); break;
+    case eStageSendBody:	sendBody(); break;
+    case eStageRecvHeader:	recvHeader(); break;
+    case eStageRecvBody:	recvBody(); break;
+    default:
+        break;
+    }
+#endif
+}
+
+bool NetworkNativeHttpRequest::connectNext(QString& strError, int& nNetworkError)
+{
+#ifdef Q_OS_LINUX
+    const QString& strAuthority = NetworkUtility::currentRequestUrl(m_request).authority();
+    while (m_pAddrNext)
+    {
+        const addrinfo *pAddr = m_pAddrNext;
+        m_pAddrNext = m_pAddrNext->ai_next;
+        if (m_fdSocket >= 0)
+        {
+            if (m_fdEpoll >= 0)
+            {
+                epoll_ctl(m_fdEpoll, EPOLL_CTL_DEL, m_fdSocket, nullptr);
+            }
+            ::close(m_fdSocket);
+        }
+
+        m_fdSocket = ::socket(pAddr->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (m_fdSocket < 0)
+        {
+            strError = QStringLiteral("Error: socket() - %1").arg(errnoString());
+            nNetworkError = QNetworkReply::UnknownNetworkError;
+            continue;
+        }
+        const int nNoDelay = 1;
+        setsockopt(m_fdSocket, IPPROTO_TCP, TCP_NODELAY, &nNoDelay, sizeof(nNoDelay));
+        if (::connect(m_fdSocket, pAddr->ai_addr, pAddr->ai_addrlen) == 0 || errno == EINPROGRESS)
+        {
+            // 连接中的socket换到epoll中（start()中epoll尚未创建）
+            if (m_fdEpoll >= 0 && !watchSocket())
+            {
+                strError = QStringLiteral("Error: epoll - %1").arg(errnoString());
+                nNetworkError = QNetworkReply::UnknownNetworkError;
+                return false;
+            }
+            return true;
+        }
+        strError = QStringLiteral("Error: connect(%1) - %2").arg(strAuthority).arg(errnoString());
+        nNetworkError = QNetworkReply::ConnectionRefusedError;
+        NETWORK_LOG(eLogDebug, eCategoryRequest) << strError << "- trying the next address";
+    }
+    return false;
+#else
+    Q_UNUSED(strError);
+    Q_UNUSED(nNetworkError);
+    return false;
+#endif
+}
+
+bool NetworkNativeHttpRequest::watchSocket()
+{
+#ifdef Q_OS_LINUX
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLOUT;
+    return epoll_ctl(m_fdEpoll, EPOLL_CTL_ADD, m_fdSocket, &event) == 0;
+#else
+    return false;
+#endif
+}
+
+void NetworkNativeHttpRequest::freeAddrInfo()
+{
+#ifdef Q_OS_LINUX
+    if (m_pAddrInfo)
+    {
+        freeaddrinfo(m_pAddrInfo);
+        m_pAddrInfo = nullptr;
+    }
+#endif
+    m_pAddrNext = nullptr;
+}
+
+bool NetworkNativeHttpRequest::onConnected()
+{
+#ifdef Q_OS_LINUX
+    int nError = 0;
+    socklen_t nLen = sizeof(nError);
+    if (getsockopt(m_fdSocket, SOL_SOCKET, SO_ERROR, &nError, &nLen) < 0 || nError != 0)
+    {
+        errno = nError;
+        QString strError = QStringLiteral("Error: connect(%1) - %2").arg(NetworkUtility::currentRequestUrl(m_request).authority()).arg(errnoString());
+        int nNetworkError = QNetworkReply::ConnectionRefusedError;
+        // 异步连接失败，换下一个地址
+        if (m_pAddrNext)
+        {
+            NETWORK_LOG(eLogDebug, eCategoryRequest) << strError << "- trying the next address";
+            if (connectNext(strError, nNetworkError))
+            {
+                return true;
+            }
+        }
+        fail(strError, nNetworkError);
+        return false;
+    }
+    freeAddrInfo();
+    m_eStage = eStageSendHeader;
+    return sendHeader();
+#else
+    return false;
+#endif
+}
+
+bool NetworkNativeHttpRequest::sendHeader()
+{
+#ifdef Q_OS_LINUX
+    while (m_nSendPos < m_bytesSend.size())
+    {
+        const ssize_t nSent = ::send(m_fdSocket, m_bytesSend.constData() + m_nSendPos, m_bytesSend.size() - m_nSendPos, MSG_NOSIGNAL);
+        if (nSent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            fail(QStringLiteral("Error: send() - %1").arg(errnoString()), QNetworkReply::RemoteHostClosedError);
+            return false;
+        }
+        m_nSendPos += static_cast<int>(nSent);
+    }
+    m_request.timing.iBytesSent += m_bytesSend.size();
+    m_bytesSend.clear();
+
+    if (m_request.eType == eTypeUpload && m_nBodySize > 0)
+    {
+        m_eStage = eStageSendBody;
+        return sendBody();
+    }
+    m_eStage = eStageRecvHeader;
+    watch(false);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool NetworkNativeHttpRequest::sendBody()
+{
+#ifdef Q_OS_LINUX
+    while (m_nBodySent < m_nBodySize)
+    {
+        off_t nOffset = static_cast<off_t>(m_nBodySent);
+        const size_t nSize = static_cast<size_t>(qMin<qint64>(ChunkSize, m_nBodySize - m_nBodySent));
+        const ssize_t nSent = ::sendfile(m_fdSocket, m_pFile->handle(), &nOffset, nSize);
+        if (nSent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            fail(QStringLiteral("Error: sendfile(%1) - %2").arg(m_request.strReqArg).arg(errnoString()), QNetworkReply::RemoteHostClosedError);
+            return false;
+        }
+        if (nSent == 0)
+        {
+            fail(QStringLiteral("Error: File is truncated(%1)").arg(m_request.strReqArg), QNetworkReply::UnknownContentError);
+            return false;
+        }
+        m_nBodySent += nSent;
+        m_request.timing.iBytesSent += nSent;
+    }
+    progress(m_nBodySent, m_nBodySize, false);
+
+    if (m_nBodySent == m_nBodySize)
+    {
+        m_eStage = eStageRecvHeader;
+        watch(false);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool NetworkNativeHttpRequest::recvHeader()
+{
+#ifdef Q_OS_LINUX
+    // 先窥视，只取走响应头，响应体留在socket中由splice直接移到文件
+    char buffer[4096];
+    const ssize_t nPeek = ::recv(m_fdSocket, buffer, sizeof(buffer), MSG_PEEK);
+    if (nPeek < 0)
+    {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            return true;
+        fail(QStringLiteral("Error: recv() - %1").arg(errnoString()), QNetworkReply::RemoteHostClosedError);
+        return false;
+    }
+    if (nPeek == 0)
+    {
+        fail(QStringLiteral("Error: Connection closed before the response header"), QNetworkReply::RemoteHostClosedError);
+        return false;
+    }
+    if (m_request.timing.iFirstByte == 0)
+    {
+        m_request.timing.iFirstByte = NetworkUtility::monotonicTime();
+    }
+
+    const int nOldSize = m_bytesRecv.size();
+    m_bytesRecv.append(buffer, static_cast<int>(nPeek));
+    const int nEnd = m_bytesRecv.indexOf("\r\n\r\n", qMax(0, nOldSize - 3));
+    const int nConsume = (nEnd >= 0) ? (nEnd + 4 - nOldSize) : static_cast<int>(nPeek);
+    m_bytesRecv.resize(nOldSize + nConsume);
+    if (::recv(m_fdSocket, buffer, nConsume, 0) != nConsume)
+    {
+        fail(QStringLiteral("Error: recv() - %1").arg(errnoString()), QNetworkReply::RemoteHostClosedError);
+        return false;
+    }
+    m_request.timing.iBytesReceived += nConsume;
+
+    if (nEnd < 0)
+    {
+        if (m_bytesRecv.size() > MaxHeaderSize)
+        {
+            fail(QStringLiteral("Error: Response header is too large"), QNetworkReply::ProtocolFailure);
+            return false;
+        }
+        return true;
+    }
+
+    const QByteArray bytesHeader = m_bytesRecv;
+    m_bytesRecv.clear();
+    if (!parseHeader(bytesHeader))
+    {
+        return false;
+    }
+    m_eStage = eStageRecvBody;
+    if (m_nContentLength == 0)
+    {
+        onFinished();
+        return false;
+    }
+    return recvBody();
+#else
+    return false;
+#endif
+}
+
+bool NetworkNativeHttpRequest::parseHeader(const QByteArray& bytesHeader)
+{
+    const QList<QByteArray> lines = bytesHeader.split('\n');
+    const QList<QByteArray> status = lines.first().trimmed().split(' ');
+    if (status.size() < 2 || !status.at(0).startsWith("HTTP/1."))
+    {
+        fail(QStringLiteral("Error: Invalid response - %1").arg(QString::fromLatin1(lines.first().trimmed())), QNetworkReply::ProtocolFailure);
+        return false;
+    }
+    m_nHttpStatusCode = status.at(1).toInt();
+
+    bool bChunked = false;
+    for (int i = 1; i < lines.size(); ++i)
+    {
+        const QByteArray& line = lines.at(i);
+        const int nColon = line.indexOf(':');
+        if (nColon <= 0)
+            continue;
+        const QByteArray name = line.left(nColon).trimmed().toLower();
+        const QByteArray value = line.mid(nColon + 1).trimmed();
+        if (name == "content-length")
+        {
+            m_nContentLength = value.toLongLong();
+        }
+        else if (name == "transfer-encoding")
+        {
+            bChunked = (value.toLower() != "identity");
+        }
+        else if (name == "location")
+        {
+            m_bytesLocation = value;
+        }
+    }
+    if (bChunked)
+    {
+        // chunked的长度不可信，读入内存的响应体按块解码到结束块为止
+        m_nContentLength = -1;
+        m_bChunked = true;
+    }
+    if (m_nHttpStatusCode == 204 || m_nHttpStatusCode == 304)
+    {
+        m_nContentLength = 0;
+        m_bChunked = false;
+    }
+
+    if (isRedirect(m_nHttpStatusCode) && !m_bytesLocation.isEmpty())
+    {
+        return true;
+    }
+    const bool bSuccess = (m_nHttpStatusCode >= 200 && m_nHttpStatusCode < 300);
+    if (bSuccess && m_request.eType == eTypeDownload && bChunked)
+    {
+        fail(QStringLiteral("Error: Chunked response is not supported by the native transport, url: %1")
+            .arg(NetworkUtility::currentRequestUrl(m_request).toString()), QNetworkReply::ProtocolFailure);
+        return false;
+    }
+    return true;
+}
+
+bool NetworkNativeHttpRequest::recvBody()
+{
+#ifdef Q_OS_LINUX
+    const bool bSuccess = (m_nHttpStatusCode >= 200 && m_nHttpStatusCode < 300);
+    if (bSuccess && m_request.eType == eTypeDownload)
+    {
+        return spliceBody();
+    }
+
+    // 上传的响应、重定向和失败的响应体读入内存
+    char buffer[16 * 1024];
+    while (m_bChunked ? (m_eChunkState != eChunkDone) : (m_nContentLength < 0 || m_nReceived < m_nContentLength))
+    {
+        const ssize_t nRead = ::recv(m_fdSocket, buffer, sizeof(buffer), 0);
+        if (nRead < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            fail(QStringLiteral("Error: recv() - %1").arg(errnoString()), QNetworkReply::RemoteHostClosedError);
+            return false;
+        }
+        if (nRead == 0)
+        {
+            if (m_bChunked)
+            {
+                fail(QStringLiteral("Error: Connection closed before the end of the chunked response"), QNetworkReply::RemoteHostClosedError);
+                return false;
+            }
+            break;
+        }
+        m_nReceived += nRead;
+        m_request.timing.iBytesReceived += nRead;
+        if (m_bChunked)
+        {
+            if (!decodeChunked(buffer, static_cast<int>(nRead)))
+            {
+                fail(QStringLiteral("Error: Invalid chunked response"), QNetworkReply::ProtocolFailure);
+                return false;
+            }
+        }
+        else if (m_bytesRecv.size() < MaxContentSize)
+        {
+            m_bytesRecv.append(buffer, static_cast<int>(nRead));
+        }
+    }
+    onFinished();
+    return false;
+#else
+    return false;
+#endif
+}
+
+bool NetworkNativeHttpRequest::decodeChunked(const char *pData, int nSize)
+{
+    m_bytesChunk.append(pData, nSize);
+    int nPos = 0;
+    while (m_eChunkState != eChunkDone)
+    {
+        if (m_eChunkState == eChunkData)
+        {
+            const int nTake = static_cast<int>(qMin<qint64>(m_nChunkRemain, m_bytesChunk.size() - nPos));
+            if (nTake <= 0)
+                break;
+            if (m_bytesRecv.size() < MaxContentSize)
+            {
+                m_bytesRecv.append(m_bytesChunk.constData() + nPos, qMin(nTake, MaxContentSize - m_bytesRecv.size()));
+            }
+            nPos += nTake;
+            m_nChunkRemain -= nTake;
+            if (m_nChunkRemain == 0)
+            {
+                m_eChunkState = eChunkDataEnd;
+            }
+            continue;
+        }
+
+        // 块大小行、块数据后的CRLF和结束块之后的trailer都以行为单位
+        const int nEnd = m_bytesChunk.indexOf("\r\n", nPos);
+        if (nEnd < 0)
+        {
+            // 一行不应超过响应头的长度
+            if (m_bytesChunk.size() - nPos > MaxHeaderSize)
+                return false;
+            break;
+        }
+        const QByteArray line = m_bytesChunk.mid(nPos, nEnd - nPos);
+        nPos = nEnd + 2;
+        if (m_eChunkState == eChunkDataEnd)
+        {
+            if (!line.isEmpty())
+                return false;
+            m_eChunkState = eChunkSize;
+        }
+        else if (m_eChunkState == eChunkSize)
+        {
+            // 忽略chunk-ext（";name=value"）
+            const int nExt = line.indexOf(';');
+            bool bOk = false;
+            m_nChunkRemain = (nExt >= 0 ? line.left(nExt) : line).trimmed().toLongLong(&bOk, 16);
+            if (!bOk || m_nChunkRemain < 0)
+                return false;
+            m_eChunkState = (m_nChunkRemain == 0) ? eChunkTrailer : eChunkData;
+        }
+        else if (line.isEmpty())
+        {
+            m_eChunkState = eChunkDone;
+        }
+    }
+    m_bytesChunk.remove(0, nPos);
+    return true;
+}
+
+bool NetworkNativeHttpRequest::spliceBody()
+{
+#ifdef Q_OS_LINUX
+    NETWORK_TRACE_SCOPE("disk", "splice", m_request.uiId);
+    const int fdFile = m_pFile->handle();
+    while (true)
+    {
+        qint64 nWant = ChunkSize;
+        if (m_nContentLength >= 0)
+        {
+            nWant = qMin(nWant, m_nContentLength - m_nReceived);
+            if (nWant <= 0)
+                break;
+        }
+
+        const ssize_t nIn = ::splice(m_fdSocket, nullptr, m_fdPipe[1], nullptr, static_cast<size_t>(nWant), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (nIn < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                progress(m_nReceived, m_nContentLength, true);
+                return true;
+            }
+            fail(QStringLiteral("Error: splice() - %1").arg(errnoString()), QNetworkReply::RemoteHostClosedError);
+            return false;
+        }
+        if (nIn == 0)
+        {
+            if (m_nContentLength >= 0)
+            {
+                fail(QStringLiteral("Error: Connection closed, received %1 of %2 bytes").arg(m_nReceived).arg(m_nContentLength),
+                    QNetworkReply::RemoteHostClosedError);
+                return false;
+            }
+            break;
+        }
+        m_nPipeBytes += nIn;
+        m_request.timing.iBytesReceived += nIn;
+
+        // pipe中的数据全部移到文件（写文件不会EAGAIN）
+        while (m_nPipeBytes > 0)
+        {
+            loff_t nOffset = static_cast<loff_t>(m_nReceived);
+            const ssize_t nOut = ::splice(m_fdPipe[0], nullptr, fdFile, &nOffset, static_cast<size_t>(m_nPipeBytes), SPLICE_F_MOVE);
+            if (nOut <= 0)
+            {
+                if (nOut < 0 && errno == EINTR)
+                    continue;
+                fail(QStringLiteral("Error: splice(%1) - %2").arg(m_strFilePath).arg(errnoString()), QNetworkReply::UnknownContentError);
+                return false;
+            }
+            m_nReceived += nOut;
+            m_nPipeBytes -= nOut;
+        }
+    }
+    progress(m_nReceived, m_nContentLength, true);
+    onFinished();
+    return false;
+#else
+    return false;
+#endif
+}
+
+void NetworkNativeHttpRequest::onFinished()
+{
+    m_eStage = eStageDone;
+    closeSocket();
+    m_request.timing.iLastByte = NetworkUtility::monotonicTime();
+    NETWORK_TRACE_ASYNC_END("net", "native", m_request.uiId, "status", m_nHttpStatusCode);
+
+    const QUrl& url = NetworkUtility::currentRequestUrl(m_request);
+    if (isRedirect(m_nHttpStatusCode) && !m_bytesLocation.isEmpty())
+    {//重定向
+        const QUrl& redirectUrl = url.resolved(QUrl::fromEncoded(m_bytesLocation));
+        if (redirectUrl.isValid() && url != redirectUrl && ++m_nRedirectionCount <= m_request.nMaxRedirectionCount)
+        {
+            m_request.redirectUrl = redirectUrl.toString();
+            NETWORK_LOG(eLogDebug, eCategoryRequest) << "url:" << url.toString() << "redirectUrl:" << m_request.redirectUrl;
+            NETWORK_TRACE_INSTANT("net", "redirect", m_request.uiId, "count", m_nRedirectionCount);
+
+            closeFile(true);
+            if (isHttpProxy(redirectUrl.scheme()))
+            {
+                start();
+            }
+            else
+            {
+                m_strError = QStringLiteral("Error: Redirected to %1, which the native transport does not support").arg(m_request.redirectUrl);
+                emit requestFinished(false, QByteArray(), m_strError);
+            }
+            return;
+        }
+    }
+
+    bool bSuccess = (m_nHttpStatusCode >= 200 && m_nHttpStatusCode < 300);
+    if (!bSuccess)
+    {
+        NETWORK_LOG(eLogDebug, eCategoryRequest) << "HttpStatusCode:" << m_nHttpStatusCode;
+        m_strError = QStringLiteral("Error: HTTP %1 - %2").arg(m_nHttpStatusCode).arg(QString::fromUtf8(m_bytesRecv));
+    }
+
+    QByteArray bytesContent;
+    if (m_request.eType == eTypeDownload)
+    {
+#ifdef Q_OS_LINUX
+        if (bSuccess && m_request.eDurability != eDurabilityNone && ::fsync(m_pFile->handle()) != 0)
+        {
+            bSuccess = false;
+            m_strError = QStringLiteral("Error: fsync(%1) - %2").arg(m_strFilePath).arg(errnoString());
+        }
+#endif
+        const QString strPartFilePath = m_strFilePath;
+        closeFile(!bSuccess);
+        if (bSuccess && !NetworkUtility::renamePartFile(strPartFilePath, m_request.eDurability != eDurabilityNone, m_strError))
+        {
+            bSuccess = false;
+            QFile::remove(strPartFilePath);
+        }
+    }
+    else
+    {
+        bytesContent = m_bytesRecv;
+        closeFile(false);
+    }
+    emit requestFinished(bSuccess, bytesContent, m_strError);
+}
+
+void NetworkNativeHttpRequest::fail(const QString& strError, int nNetworkError)
+{
+    NETWORK_LOG(eLogWarn, eCategoryRequest) << strError;
+    m_eStage = eStageDone;
+    m_strError = strError;
+    m_nNetworkError = nNetworkError;
+    closeSocket();
+    closeFile(m_request.eType == eTypeDownload);
+    emit requestFinished(false, QByteArray(), m_strError);
+}
+
+void NetworkNativeHttpRequest::progress(qint64 iBytes, qint64 iTotal, bool bDownload)
+{
+    if (!m_request.bShowProgress || m_bAbortManual || iBytes <= 0 || iTotal <= 0)
+        return;
+
+    const int nProgress = iBytes * 100 / iTotal;
+    if (m_nProgress < nProgress)
+    {
+        m_nProgress = nProgress;
+        NetworkProgressEvent *event = new NetworkProgressEvent;
+        event->bDownload = bDownload;
+        event->uiId = m_request.uiId;
+        event->uiBatchId = m_request.uiBatchId;
+        event->iBtyes = iBytes;
+        event->iTotalBtyes = iTotal;
+        QCoreApplication::postEvent(NetworkManager::globalInstance(), event);
+    }
+}
+
+void NetworkNativeHttpRequest::closeSocket()
+{
+    freeAddrInfo();
+    if (m_pNotifier)
+    {
+        m_pNotifier->setEnabled(false);
+        m_pNotifier->deleteLater();
+        m_pNotifier = nullptr;
+    }
+#ifdef Q_OS_LINUX
+    if (m_fdEpoll >= 0)
+    {
+        ::close(m_fdEpoll);
+        m_fdEpoll = -1;
+    }
+    if (m_fdSocket >= 0)
+    {
+        ::close(m_fdSocket);
+        m_fdSocket = -1;
+    }
+    for (int& fd : m_fdPipe)
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+#endif
+}
+
+void NetworkNativeHttpRequest::closeFile(bool bRemove)
+{
+    if (m_pFile.get())
+    {
+        m_pFile->close();
+        m_pFile.reset();
+    }
+    if (bRemove && !m_strFilePath.isEmpty())
+    {
+        QFile::remove(m_strFilePath);
+    }
+    m_strFilePath.clear();
+}
@@ -0,0 +1,122 @@
+﻿#ifndef NETWORKNATIVEHTTPREQUEST_H
+#define NETWORKNATIVEHTTPREQUEST_H
+
+#include <QObject>
+#include <memory>
+#include "networkrequest.h"
+
+class QFile;
+class QSocketNotifier;
+struct addrinfo;
+
+// Linux原生HTTP/1.1传输（RequestTask::strTransport为"native"时使用，仅http，eTypeDownload/eTypeUpload）
+//	非阻塞socket注册在epoll中，epoll描述符由QSocketNotifier挂在执行请求的线程的事件循环上.
+//	上传用sendfile（文件 -> socket），下载用splice（socket -> pipe -> 文件），数据不经过用户空间.
+//	每个请求一个连接（Connection: close）. 不支持chunked响应体、https和代理，这些情况请使用默认传输.
+class NetworkNativeHttpRequest : public NetworkRequest
+{
+    Q_OBJECT;
+
+public:
+    explicit NetworkNativeHttpRequest(QObject *parent = 0);
+    ~NetworkNativeHttpRequest();
+
+    // 当前平台是否支持（Linux）
+    static bool isAvailable();
+    // 该任务能否使用原生传输
+    static bool isSupported(const QMTNetwork::RequestTask& task);
+
+public Q_SLOTS:
+    void start() Q_DECL_OVERRIDE;
+    void abort() Q_DECL_OVERRIDE;
+    void onFinished() Q_DECL_OVERRIDE;
+
+private Q_SLOTS:
+    void onEpollEvent();
+
+private:
+    enum Stage
+    {
+        eStageConnect,
+        eStageSendHeader,
+        eStageSendBody,
+        eStageRecvHeader,
+        eStageRecvBody,
+        eStageDone,
+    };
+    // 读入内存的chunked响应体的解码状态
+    enum ChunkState
+    {
+        eChunkSize,
+        eChunkData,
+        // 块数据之后的CRLF
+        eChunkDataEnd,
+        // 结束块（大小为0）之后的trailer，到空行为止
+        eChunkTrailer,
+        eChunkDone,
+    };
+    enum
+    {
+        // 每次splice/sendfile的最大字节数
+        ChunkSize = 1024 * 1024,
+        // 响应头的最大长度
+        MaxHeaderSize = 64 * 1024,
+        // 非下载（或失败）响应体的最大保留长度
+        MaxContentSize = 1024 * 1024,
+    };
+
+    // 关闭当前socket，连接地址列表中的下一个地址（非阻塞），全部失败时返回false
+    bool connectNext(QString& strError, int& nNetworkError);
+    // 把socket加入epoll，等待连接完成
+    bool watchSocket();
+    void freeAddrInfo();
+    // 以下各函数返回false表示请求已结束（出错或完成）
+    bool onConnected();
+    bool sendHeader();
+    bool sendBody();
+    bool recvHeader();
+    bool recvBody();
+    bool spliceBody();
+    // 解码收到的chunked数据，追加到m_bytesRecv；格式错误时返回false
+    bool decodeChunked(const char *pData, int nSize);
+    bool parseHeader(const QByteArray& bytesHeader);
+    void watch(bool bWrite);
+    void fail(const QString& strError, int nNetworkError);
+    void progress(qint64 iBytes, qint64 iTotal, bool bDownload);
+    // 关闭socket、epoll和pipe
+    void closeSocket();
+    void closeFile(bool bRemove);
+
+private:
+    Stage m_eStage;
+    int m_fdSocket;
+    int m_fdEpoll;
+    int m_fdPipe[2];
+    QSocketNotifier *m_pNotifier;
+    // getaddrinfo的结果，连接成功后释放；m_pAddrNext为连接失败时尝试的下一个地址
+    addrinfo *m_pAddrInfo;
+    addrinfo *m_pAddrNext;
+    // 上传的源文件或下载的.part文件
+    std::unique_ptr<QFile> m_pFile;
+    QString m_strFilePath;
+
+    QByteArray m_bytesSend;
+    int m_nSendPos;
+    // 响应头，之后为非下载（或失败）的响应体
+    QByteArray m_bytesRecv;
+    QByteArray m_bytesLocation;
+    qint64 m_nBodySize;
+    qint64 m_nBodySent;
+    // -1: 响应没有Content-Length，读到连接关闭为止
+    qint64 m_nContentLength;
+    qint64 m_nReceived;
+    // 已读入pipe还未写入文件的字节数
+    qint64 m_nPipeBytes;
+    // 非下载的chunked响应体：解码状态、当前块剩余的字节数、未解码的数据
+    bool m_bChunked;
+    ChunkState m_eChunkState;
+    qint64 m_nChunkRemain;
+    QByteArray m_bytesChunk;
+};
+
+#endif // NETWORKNATIVEHTTPREQUEST_H
@@ -1,10 +1,21 @@
 ﻿#include "networkrequest.h"
+#include <vector>
 #include <QDebug>
+#include <QBuffer>
+#include <QDir>
+#include <QTemporaryFile>
 #include "classmemorytracer.h"
 #include "networkdownloadrequest.h"
 #include "networkuploadrequest.h"
 #include "networkcommonrequest.h"
 #include "networkmtdownloadrequest.h"
+#include "networkmtuploadrequest.h"
+#include "networkcompressor.h"
+#include "networknativehttprequest.h"
+#include "networktransportrequest.h"
+#include "networkutility.h"
+#include "networktracer.h"
+#include "networklog.h"
 
 using namespace QMTNetwork;
 
@@ -15,6 +26,8 @@ NetworkRequest::NetworkRequest(QObject *parent)
     , m_pNetworkReply(nullptr)
     , m_nProgress(0)
     , m_nRedirectionCount(0)
+    , m_nHttpStatusCode(0)
+    , m_nNetworkError(0)
 {
     TRACE_CLASS_CONSTRUCTOR(NetworkRequest);
 }
@@ -51,21 +64,169 @@ void NetworkRequest::start()
     m_nProgress = 0;
 }
 
+RequestTiming NetworkRequest::timing() const
+{
+    RequestTiming timing = m_request.timing;
+    timing.nRedirectCount = m_nRedirectionCount;
+    return timing;
+}
+
+QIODevice *NetworkRequest::createCompressedBody(QIODevice *pSource, QNetworkRequest& request, QString& strError)
+{
+    if (m_request.eBodyEncoding == eEncodingIdentity)
+    {
+        return nullptr;
+    }
+    if (!NetworkCompressDevice::isSupported(m_request.eBodyEncoding))
+    {
+        NETWORK_LOG(eLogWarn, eCategoryRequest) << "Content-Encoding" << NetworkCompressDevice::encodingName(m_request.eBodyEncoding)
+            << "not compiled in, sending uncompressed";
+        return nullptr;
+    }
+
+    // 先压缩完再发送，请求带Content-Length：Qt 5对没有Content-Length的请求体会在内存中缓存全部数据
+    std::unique_ptr<QIODevice> pOutput;
+    if (!pSource->isSequential() && pSource->size() - pSource->pos() <= NetworkCompressDevice::MaxMemoryBodySize)
+    {
+        QBuffer *pBuffer = new QBuffer;
+        pBuffer->open(QIODevice::ReadWrite);
+        pOutput.reset(pBuffer);
+    }
+    else
+    {
+        QTemporaryFile *pFile = new QTemporaryFile(QDir::temp().filePath(QStringLiteral("qmtnetwork_body_XXXXXX")));
+        pOutput.reset(pFile);
+        if (!pFile->open())
+        {
+            strError = QStringLiteral("Error: QTemporaryFile::open(%1) - %2").arg(pFile->fileTemplate()).arg(pFile->errorString());
+            NETWORK_LOG(eLogError, eCategoryRequest) << strError;
+            return nullptr;
+        }
+    }
+
+    {
+        NETWORK_TRACE_SCOPE("compress", "body", m_request.uiId);
+        NetworkCompressDevice compressor(pSource, m_request.eBodyEncoding, m_request.nBodyCompressLevel);
+        std::vector<char> buffer(NetworkCompressDevice::BlockSize);
+        qint64 nRead = 0;
+        while ((nRead = compressor.read(buffer.data(), buffer.size())) > 0)
+        {
+            if (pOutput->write(buffer.data(), nRead) != nRead)
+            {
+                strError = QStringLiteral("Error: write compressed body - %1").arg(pOutput->errorString());
+                NETWORK_LOG(eLogError, eCategoryRequest) << strError;
+                return nullptr;
+            }
+        }
+        if (compressor.isFailed())
+        {
+            strError = compressor.errorString();
+            return nullptr;
+        }
+    }
+
+    delete pSource;
+    pOutput->seek(0);
+    request.setRawHeader("Content-Encoding", NetworkCompressDevice::encodingName(m_request.eBodyEncoding));
+    request.setHeader(QNetworkRequest::ContentLengthHeader, pOutput->size());
+    return pOutput.release();
+}
+
+void NetworkRequest::trackReply(QNetworkReply *pReply)
+{
+    if (nullptr == pReply)
+        return;
+
+    RequestTiming& timing = m_request.timing;
+    if (timing.iRequestSent == 0)
+    {
+        timing.iRequestSent = NetworkUtility::monotonicTime();
+    }
+
+    // 重定向后的请求继续累加字节数
+    const qint64 iReceivedBase = timing.iBytesReceived;
+    const qint64 iSentBase = timing.iBytesSent;
+    connect(pReply, &QNetworkReply::metaDataChanged, this, [this]() {
+        if (m_request.timing.iFirstByte == 0)
+        {
+            m_request.timing.iFirstByte = NetworkUtility::monotonicTime();
+        }
+    });
+    connect(pReply, &QNetworkReply::downloadProgress, this, [this, iReceivedBase](qint64 iReceived, qint64) {
+        m_request.timing.iBytesReceived = iReceivedBase + iReceived;
+    });
+    connect(pReply, &QNetworkReply::uploadProgress, this, [this, iSentBase](qint64 iSent, qint64) {
+        m_request.timing.iBytesSent = iSentBase + iSent;
+    });
+    connect(pReply, &QNetworkReply::finished, this, [this, pReply]() {
+        m_nHttpStatusCode = pReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        m_nNetworkError = pReply->error();
+        if (m_request.timing.iFirstByte == 0)
+        {
+            m_request.timing.iFirstByte = NetworkUtility::monotonicTime();
+        }
+        m_request.timing.iLastByte = NetworkUtility::monotonicTime();
+    });
+}
+
 void NetworkRequest::onError(QNetworkReply::NetworkError code)
 {
     Q_UNUSED(code);
 
     m_strError = m_pNetworkReply->errorString();
-    qDebug() << "[QMultiThreadNetwork] Error" << QString("[%1]").arg(getRequestTypeString(m_request.eType)) << m_strError;
+    NETWORK_LOG(eLogWarn, eCategoryRequest) << "Error" << QString("[%1]").arg(getRequestTypeString(m_request.eType)) << m_strError;
 }
 
 void NetworkRequest::onAuthenticationRequired(QNetworkReply *r, QAuthenticator *a)
 {
     Q_UNUSED(a);
-    qDebug() << "[QMultiThreadNetwork] Authentication Required." << r->readAll();
+    NETWORK_LOG(eLogDebug, eCategoryRequest) << "Authentication Required." << r->readAll();
 }
 
 
+std::unique_ptr<NetworkRequest> NetworkRequestFactory::create(const RequestTask& task)
+{
+    std::unique_ptr<NetworkRequest> pRequest;
+    const QString& strTransport = NetworkTransportRegistry::transportName(task);
+    if (strTransport.isEmpty() || strTransport == QLatin1String("qnam"))
+    {
+        return create(task.eType);
+    }
+
+    if (strTransport == QLatin1String("native"))
+    {
+        if (NetworkNativeHttpRequest::isSupported(task))
+        {
+#if defined(_MSC_VER) && _MSC_VER < 1700
+            pRequest.reset(new NetworkNativeHttpRequest());
+#else
+            pRequest = std::make_unique<NetworkNativeHttpRequest>();
+#endif
+            return pRequest;
+        }
+    }
+    else if (NetworkTransportRequest::isSupportedType(task.eType))
+    {
+        std::unique_ptr<NetworkTransport> pTransport = NetworkTransportRegistry::create(strTransport);
+        if (!pTransport.get())
+        {
+            NETWORK_LOG(eLogWarn, eCategoryRequest) << "Unknown transport:" << strTransport << ", using QNetworkAccessManager";
+            return create(task.eType);
+        }
+        if (pTransport->supports(task))
+        {
+#if defined(_MSC_VER) && _MSC_VER < 1700
+            pRequest.reset(new NetworkTransportRequest(std::move(pTransport)));
+#else
+            pRequest = std::make_unique<NetworkTransportRequest>(std::move(pTransport));
+#endif
+            return pRequest;
+        }
+    }
+    NETWORK_LOG(eLogDebug, eCategoryRequest) << strTransport << "transport unsupported for" << task.url << ", using QNetworkAccessManager";
+    return create(task.eType);
+}
+
 std::unique_ptr<NetworkRequest> NetworkRequestFactory::create(const RequestType& eType)
 {
     std::unique_ptr<NetworkRequest> pRequest;
@@ -81,6 +242,7 @@ std::unique_ptr<NetworkRequest> NetworkRequestFactory::create(const RequestType&
     }
     break;
     case eTypeMTDownload:
+    case eTypeAutoDownload:
     {
 #if defined(_MSC_VER) && _MSC_VER < 1700
         pRequest.reset(new NetworkMTDownloadRequest());
@@ -95,6 +257,15 @@ std::unique_ptr<NetworkRequest> NetworkRequestFactory::create(const RequestType&
         pRequest.reset(new NetworkUploadRequest());
 #else
         pRequest = std::make_unique<NetworkUploadRequest>();
+#endif
+    }
+    break;
+    case eTypeMTUpload:
+    {
+#if defined(_MSC_VER) && _MSC_VER < 1700
+        pRequest.reset(new NetworkMTUploadRequest());
+#else
+        pRequest = std::make_unique<NetworkMTUploadRequest>();
 #endif
     }
     break;
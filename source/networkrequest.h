@@ -19,6 +19,11 @@ public:
     void setRequestTask(const QMTNetwork::RequestTask &request) { m_request = request; }
 
     const QString errorString() const { return m_strError; }
+    // 请求各阶段的时间点
+    QMTNetwork::RequestTiming timing() const;
+    // 最后一个响应的HTTP状态码和QNetworkReply::NetworkError
+    int httpStatusCode() const { return m_nHttpStatusCode; }
+    int networkError() const { return m_nNetworkError; }
 
 public Q_SLOTS:
     virtual void start();
@@ -31,12 +36,22 @@ Q_SIGNALS:
     void requestFinished(bool bSuccess, const QByteArray& strContent, const QString& strError);
     void aboutToAbort();
 
+protected:
+    // 请求已发出，记录该请求的各阶段时间点、收发字节数和响应状态
+    void trackReply(QNetworkReply *pReply);
+    // 按m_request.eBodyEncoding压缩整个请求体（阻塞，大的数据源多块并行压缩），设置Content-Encoding和Content-Length，
+    //	返回压缩后的数据（不超过NetworkCompressDevice::MaxMemoryBodySize的数据源在内存中，否则为临时文件），pSource被释放.
+    //	不压缩（未指定或编译时没有该算法）时返回nullptr，pSource不变；压缩失败时返回nullptr，strError为失败原因，pSource不变.
+    QIODevice *createCompressedBody(QIODevice *pSource, QNetworkRequest& request, QString& strError);
+
 protected:
     QMTNetwork::RequestTask m_request;
     bool m_bAbortManual;
     QString m_strError;
     int m_nProgress;
     quint16 m_nRedirectionCount;
+    int m_nHttpStatusCode;
+    int m_nNetworkError;
     QNetworkAccessManager *m_pNetworkManager;
     QNetworkReply *m_pNetworkReply;
 };
@@ -47,6 +62,8 @@ class NetworkRequestFactory
 public:
     ///根据类型创建request对象
     static std::unique_ptr<NetworkRequest> create(const QMTNetwork::RequestType& type);
+    ///根据任务（类型和传输，见NetworkTransportRegistry）创建request对象
+    static std::unique_ptr<NetworkRequest> create(const QMTNetwork::RequestTask& task);
 };
 
 inline bool isHttpProxy(const QString& strScheme) { return (strScheme.compare(QLatin1String("http"), Qt::CaseInsensitive) == 0); }
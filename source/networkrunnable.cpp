@@ -5,6 +5,9 @@
 #include "classmemorytracer.h"
 #include "networkrequest.h"
 #include "networkmanager.h"
+#include "networkutility.h"
+#include "networktracer.h"
+#include "networklog.h"
 
 using namespace QMTNetwork;
 
@@ -14,6 +17,10 @@ NetworkRunnable::NetworkRunnable(const RequestTask &task, QObject *parent)
 {
     TRACE_CLASS_CONSTRUCTOR(NetworkRunnable);
     setAutoDelete(false);
+
+    // 重试的任务重新计时
+    m_task.timing = RequestTiming();
+    m_task.timing.iEnqueue = NetworkUtility::monotonicTime();
 }
 
 NetworkRunnable::~NetworkRunnable()
@@ -24,6 +31,9 @@ NetworkRunnable::~NetworkRunnable()
 void NetworkRunnable::run()
 {
     RequestTask task = m_task;
+    task.timing.iThreadStart = NetworkUtility::monotonicTime();
+    NETWORK_TRACE_ASYNC_END("task", "queued", task.uiId);
+    NETWORK_TRACE_SCOPE("task", "run", task.uiId, "type", task.eType);
     std::unique_ptr<NetworkRequest> pRequest = nullptr;
 
     bool bQuit = false;
@@ -42,15 +52,18 @@ void NetworkRunnable::run()
 
         if (!bQuit)
         {
-            pRequest = std::move(NetworkRequestFactory::create(task.eType));
+            pRequest = std::move(NetworkRequestFactory::create(task));
 
             if (pRequest.get())
             {
                 connect(pRequest.get(), &NetworkRequest::requestFinished,
-                    [this, &task](bool bSuccess, const QByteArray& bytesContent, const QString& strError) {
+                    [this, &task, &pRequest](bool bSuccess, const QByteArray& bytesContent, const QString& strError) {
                     task.bSuccess = bSuccess;
                     task.bytesContent = bytesContent;
                     task.strError = strError;
+                    task.timing = pRequest->timing();
+                    task.nHttpStatusCode = pRequest->httpStatusCode();
+                    task.nNetworkError = pRequest->networkError();
                     emit requestFinished(task);
                 });
                 pRequest->setRequestTask(task);
@@ -58,7 +71,7 @@ void NetworkRunnable::run()
             }
             else
             {
-                qWarning() << QString("[QMultiThreadNetwork] Unsupported type(%1) ----").arg(task.eType) << task.url;
+                NETWORK_LOG(eLogWarn, eCategoryRequest) << QString("Unsupported type(%1) ----").arg(task.eType) << task.url;
 
                 task.bSuccess = false;
                 task.strError = QString("[QMultiThreadNetwork] Unsupported type(%1)").arg(task.eType);
@@ -69,11 +82,11 @@ void NetworkRunnable::run()
     }
     catch (std::exception* e)
     {
-        qCritical() << "[QMultiThreadNetwork] NetworkRunnable::run() exception:" << QString::fromUtf8(e->what());
+        NETWORK_LOG(eLogError, eCategoryRequest) << "NetworkRunnable::run() exception:" << QString::fromUtf8(e->what());
     }
     catch (...)
     {
-        qCritical() << "[QMultiThreadNetwork] NetworkRunnable::run() unknown exception";
+        NETWORK_LOG(eLogError, eCategoryRequest) << "NetworkRunnable::run() unknown exception";
     }
 
     if (pRequest.get())
@@ -0,0 +1,184 @@
+﻿#include "networktracer.h"
+#include <QDebug>
+#include <QFile>
+#include <QThread>
+#include <QThreadStorage>
+#include <QMutexLocker>
+#include <QCoreApplication>
+#include "networkutility.h"
+#include "networklog.h"
+
+class NetworkTraceBuffer
+{
+public:
+    NetworkTraceBuffer(int nCapacity, int nGeneration)
+        : vecEvent(nCapacity)
+        , uiWritten(0)
+        , nGeneration(nGeneration)
+        , uiThreadId(reinterpret_cast<quintptr>(QThread::currentThreadId()))
+    {
+        QThread *pThread = QThread::currentThread();
+        if (QCoreApplication::instance() && pThread == QCoreApplication::instance()->thread())
+        {
+            strThreadName = QStringLiteral("main");
+        }
+        else if (pThread && !pThread->objectName().isEmpty())
+        {
+            strThreadName = pThread->objectName();
+        }
+        else
+        {
+            strThreadName = QStringLiteral("thread %1").arg(uiThreadId);
+        }
+    }
+
+    std::vector<NetworkTraceEvent> vecEvent;
+    // 只有所属线程写入，结束跟踪时由其它线程读取
+    std::atomic<quint64> uiWritten;
+    const int nGeneration;
+    const quint64 uiThreadId;
+    QString strThreadName;
+};
+
+std::atomic<bool> NetworkTracer::ms_bEnabled(false);
+
+NetworkTracer *NetworkTracer::globalInstance()
+{
+    static NetworkTracer s_instance;
+    return &s_instance;
+}
+
+NetworkTracer::NetworkTracer()
+    : m_nGeneration(0)
+    , m_nEventsPerThread(65536)
+{
+}
+
+void NetworkTracer::start(int nEventsPerThread)
+{
+    QMutexLocker locker(&m_mutex);
+    ms_bEnabled = false;
+    m_vecBuffer.clear();
+    m_nEventsPerThread = qMax(1024, nEventsPerThread);
+    ++m_nGeneration;
+    ms_bEnabled = true;
+}
+
+NetworkTraceBuffer *NetworkTracer::currentThreadBuffer()
+{
+    static QThreadStorage<std::shared_ptr<NetworkTraceBuffer>> s_buffer;
+
+    const int nGeneration = m_nGeneration.load(std::memory_order_acquire);
+    std::shared_ptr<NetworkTraceBuffer>& buffer = s_buffer.localData();
+    if (!buffer.get() || buffer->nGeneration != nGeneration)
+    {
+        // 每个线程每次跟踪只会进入一次
+        QMutexLocker locker(&m_mutex);
+        buffer = std::make_shared<NetworkTraceBuffer>(m_nEventsPerThread, nGeneration);
+        m_vecBuffer.push_back(buffer);
+    }
+    return buffer.get();
+}
+
+void NetworkTracer::record(char chPhase, const char *pCategory, const char *pName,
+    quint64 uiId, const char *pArgName, qint64 iArg)
+{
+    if (!isEnabled())
+    {
+        return;
+    }
+
+    NetworkTraceBuffer *pBuffer = currentThreadBuffer();
+    const quint64 uiWritten = pBuffer->uiWritten.load(std::memory_order_relaxed);
+    NetworkTraceEvent& event = pBuffer->vecEvent[uiWritten % pBuffer->vecEvent.size()];
+    event.pName = pName;
+    event.pCategory = pCategory;
+    event.pArgName = pArgName;
+    event.iTimestamp = NetworkUtility::monotonicTime();
+    event.uiId = uiId;
+    event.iArg = iArg;
+    event.chPhase = chPhase;
+    pBuffer->uiWritten.store(uiWritten + 1, std::memory_order_release);
+}
+
+bool NetworkTracer::stop(const QString& strFilePath, QString& strError)
+{
+    std::vector<std::shared_ptr<NetworkTraceBuffer>> vecBuffer;
+    {
+        QMutexLocker locker(&m_mutex);
+        ms_bEnabled = false;
+        vecBuffer.swap(m_vecBuffer);
+    }
+
+    QFile file(strFilePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        strError = QStringLiteral("Error: QFile::open(%1) - %2").arg(strFilePath).arg(file.errorString());
+        return false;
+    }
+
+    const QByteArray strPid = QByteArray::number(QCoreApplication::applicationPid());
+    QByteArray bytes;
+    bytes.reserve(1024 * 1024);
+    bytes += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool bFirst = true;
+    for (const std::shared_ptr<NetworkTraceBuffer>& pBuffer : vecBuffer)
+    {
+        const QByteArray strTid = QByteArray::number(pBuffer->uiThreadId);
+        if (!bFirst)
+        {
+            bytes += ",\n";
+        }
+        bFirst = false;
+        QByteArray strThreadName = pBuffer->strThreadName.toUtf8();
+        strThreadName.replace('\\', "\\\\").replace('"', "\\\"");
+        bytes += "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" + strPid + ",\"tid\":" + strTid
+            + ",\"args\":{\"name\":\"" + strThreadName + "\"}}";
+
+        const quint64 uiWritten = pBuffer->uiWritten.load(std::memory_order_acquire);
+        const quint64 uiCapacity = pBuffer->vecEvent.size();
+        const quint64 uiBegin = (uiWritten > uiCapacity) ? (uiWritten - uiCapacity) : 0;
+        for (quint64 i = uiBegin; i < uiWritten; ++i)
+        {
+            const NetworkTraceEvent& event = pBuffer->vecEvent[i % uiCapacity];
+            bytes += ",\n{\"ph\":\"";
+            bytes += event.chPhase;
+            bytes += QByteArray("\",\"cat\":\"") + event.pCategory + "\",\"name\":\"" + event.pName
+                + "\",\"ts\":" + QByteArray::number(event.iTimestamp)
+                + ",\"pid\":" + strPid + ",\"tid\":" + strTid;
+            if (event.chPhase == 'b' || event.chPhase == 'e')
+            {
+                bytes += ",\"id\":\"0x" + QByteArray::number(event.uiId, 16) + '"';
+            }
+            else if (event.chPhase == 'i')
+            {
+                bytes += ",\"s\":\"t\"";
+            }
+            if (event.pArgName || event.uiId != 0)
+            {
+                bytes += ",\"args\":{\"id\":" + QByteArray::number(event.uiId);
+                if (event.pArgName)
+                {
+                    bytes += QByteArray(",\"") + event.pArgName + "\":" + QByteArray::number(event.iArg);
+                }
+                bytes += '}';
+            }
+            bytes += '}';
+
+            if (bytes.size() > 768 * 1024)
+            {
+                file.write(bytes);
+                bytes.clear();
+            }
+        }
+    }
+    bytes += "\n]}\n";
+
+    if (file.write(bytes) != bytes.size() || !file.flush())
+    {
+        strError = QStringLiteral("Error: QFile::write(%1) - %2").arg(strFilePath).arg(file.errorString());
+        return false;
+    }
+    NETWORK_LOG(eLogInfo, eCategoryTrace) << "Trace saved:" << strFilePath << "threads:" << vecBuffer.size();
+    return true;
+}
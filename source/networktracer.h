@@ -0,0 +1,105 @@
+﻿#ifndef NETWORKTRACER_H
+#define NETWORKTRACER_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <QMutex>
+#include <QString>
+
+// 事件跟踪（Chrome Trace Event格式，可用chrome://tracing或Perfetto打开）
+//	默认关闭，关闭时每个跟踪点只有一次原子读.
+//	每个线程有自己的环形缓冲区，写入时无锁；缓冲区满了会覆盖最早的事件.
+//	事件名和分类必须是字符串常量（只保存指针）.
+struct NetworkTraceEvent
+{
+    const char *pName;
+    const char *pCategory;
+    const char *pArgName;
+    qint64 iTimestamp;
+    quint64 uiId;
+    qint64 iArg;
+    char chPhase;
+};
+
+class NetworkTraceBuffer;
+class NetworkTracer
+{
+public:
+    static NetworkTracer *globalInstance();
+
+    static bool isEnabled()
+    {
+        return ms_bEnabled.load(std::memory_order_relaxed);
+    }
+
+    // 开始跟踪（清空之前的事件）. nEventsPerThread: 每个线程缓冲区的事件数
+    void start(int nEventsPerThread = 65536);
+    // 结束跟踪并把事件写入JSON文件
+    bool stop(const QString& strFilePath, QString& strError);
+
+    // chPhase: 'B'/'E' 同一线程内的开始/结束, 'b'/'e' 跨线程的异步开始/结束（以uiId匹配）, 'i' 瞬时事件
+    void record(char chPhase, const char *pCategory, const char *pName,
+        quint64 uiId = 0, const char *pArgName = nullptr, qint64 iArg = 0);
+
+private:
+    NetworkTracer();
+    Q_DISABLE_COPY(NetworkTracer);
+
+    NetworkTraceBuffer *currentThreadBuffer();
+
+private:
+    static std::atomic<bool> ms_bEnabled;
+    // 缓冲区的代数，开始新的跟踪时各线程重新申请缓冲区
+    std::atomic<int> m_nGeneration;
+    int m_nEventsPerThread;
+    QMutex m_mutex;
+    std::vector<std::shared_ptr<NetworkTraceBuffer>> m_vecBuffer;
+};
+
+// 作用域内的同步事件
+class NetworkTraceScope
+{
+public:
+    NetworkTraceScope(const char *pCategory, const char *pName, quint64 uiId = 0,
+        const char *pArgName = nullptr, qint64 iArg = 0)
+        : m_pCategory(nullptr)
+        , m_pName(pName)
+    {
+        if (NetworkTracer::isEnabled())
+        {
+            m_pCategory = pCategory;
+            NetworkTracer::globalInstance()->record('B', pCategory, pName, uiId, pArgName, iArg);
+        }
+    }
+    ~NetworkTraceScope()
+    {
+        if (m_pCategory)
+        {
+            NetworkTracer::globalInstance()->record('E', m_pCategory, m_pName);
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(NetworkTraceScope);
+    const char *m_pCategory;
+    const char *m_pName;
+};
+
+#define NETWORK_TRACE_CONCAT_(a, b) a##b
+#define NETWORK_TRACE_CONCAT(a, b) NETWORK_TRACE_CONCAT_(a, b)
+
+#define NETWORK_TRACE_SCOPE(category, name, ...) \
+    NetworkTraceScope NETWORK_TRACE_CONCAT(_networkTraceScope, __LINE__)(category, name, ##__VA_ARGS__)
+
+#define NETWORK_TRACE_EVENT_(phase, category, name, ...) \
+    do { \
+        if (NetworkTracer::isEnabled()) \
+            NetworkTracer::globalInstance()->record(phase, category, name, ##__VA_ARGS__); \
+    } while (0)
+
+#define NETWORK_TRACE_ASYNC_BEGIN(category, name, id, ...)	NETWORK_TRACE_EVENT_('b', category, name, id, ##__VA_ARGS__)
+#define NETWORK_TRACE_ASYNC_END(category, name, id, ...)	NETWORK_TRACE_EVENT_('e', category, name, id, ##__VA_ARGS__)
+#define NETWORK_TRACE_INSTANT(category, name, ...)			NETWORK_TRACE_EVENT_('i', category, name, ##__VA_ARGS__)
+
+#endif // NETWORKTRACER_H
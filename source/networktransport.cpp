@@ -0,0 +1,119 @@
+﻿#include "networktransport.h"
+#include <QReadWriteLock>
+#include "networklocaltransport.h"
+#include "networkutility.h"
+
+using namespace QMTNetwork;
+
+namespace {
+    const QLatin1String TransportQnam("qnam");
+    const QLatin1String TransportNative("native");
+
+    struct TransportTable
+    {
+        QReadWriteLock lock;
+        QMap<QString, NetworkTransportRegistry::Factory> mapFactory;
+        // 协议（小写） -> 传输名
+        QMap<QString, QString> mapScheme;
+
+        TransportTable()
+        {
+            mapFactory.insert(QStringLiteral("mock"), []() {
+                return std::unique_ptr<NetworkTransport>(new NetworkMockTransport);
+            });
+            mapFactory.insert(QStringLiteral("file"), []() {
+                return std::unique_ptr<NetworkTransport>(new NetworkFileTransport);
+            });
+            // mock://不是Qt支持的协议，默认由"mock"执行. file://默认仍由QNetworkAccessManager执行，
+            //	需要时用strTransport或setSchemeTransport("file", "file")指定
+            mapScheme.insert(QStringLiteral("mock"), QStringLiteral("mock"));
+        }
+    };
+
+    TransportTable *transportTable()
+    {
+        static TransportTable s_table;
+        return &s_table;
+    }
+}
+
+bool NetworkTransportRegistry::registerTransport(const QString& strName, const Factory& factory, const QStringList& listSchemes)
+{
+    if (strName.isEmpty() || !factory || strName == TransportQnam || strName == TransportNative)
+    {
+        return false;
+    }
+
+    TransportTable *pTable = transportTable();
+    QWriteLocker locker(&pTable->lock);
+    pTable->mapFactory.insert(strName, factory);
+    for (const QString& strScheme : listSchemes)
+    {
+        pTable->mapScheme.insert(strScheme.toLower(), strName);
+    }
+    return true;
+}
+
+void NetworkTransportRegistry::setSchemeTransport(const QString& strScheme, const QString& strName)
+{
+    TransportTable *pTable = transportTable();
+    QWriteLocker locker(&pTable->lock);
+    if (strName.isEmpty())
+    {
+        pTable->mapScheme.remove(strScheme.toLower());
+    }
+    else
+    {
+        pTable->mapScheme.insert(strScheme.toLower(), strName);
+    }
+}
+
+void NetworkTransportRegistry::unregisterTransport(const QString& strName)
+{
+    TransportTable *pTable = transportTable();
+    QWriteLocker locker(&pTable->lock);
+    pTable->mapFactory.remove(strName);
+    for (auto iter = pTable->mapScheme.begin(); iter != pTable->mapScheme.end();)
+    {
+        if (iter.value() == strName)
+        {
+            iter = pTable->mapScheme.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+}
+
+QStringList NetworkTransportRegistry::transports()
+{
+    TransportTable *pTable = transportTable();
+    QReadLocker locker(&pTable->lock);
+    return QStringList() << TransportQnam << TransportNative << pTable->mapFactory.keys();
+}
+
+QString NetworkTransportRegistry::transportName(const RequestTask& task)
+{
+    if (!task.strTransport.isEmpty())
+    {
+        return task.strTransport;
+    }
+
+    const QString& strScheme = NetworkUtility::currentRequestUrl(task).scheme().toLower();
+    TransportTable *pTable = transportTable();
+    QReadLocker locker(&pTable->lock);
+    return pTable->mapScheme.value(strScheme);
+}
+
+std::unique_ptr<NetworkTransport> NetworkTransportRegistry::create(const QString& strName)
+{
+    Factory factory;
+    {
+        TransportTable *pTable = transportTable();
+        QReadLocker locker(&pTable->lock);
+        factory = pTable->mapFactory.value(strName);
+    }
+    // 在锁外调用，工厂函数中可以再访问注册表
+    return factory ? factory() : std::unique_ptr<NetworkTransport>();
+}
@@ -0,0 +1,307 @@
+﻿#include "networktransportrequest.h"
+#include <QDebug>
+#include <QFile>
+#include <QCoreApplication>
+#include "networkmanager.h"
+#include "networkutility.h"
+#include "networkfilewriter.h"
+#include "networkchecksum.h"
+#include "networktracer.h"
+#include "networklog.h"
+
+using namespace QMTNetwork;
+
+NetworkTransportRequest::NetworkTransportRequest(std::unique_ptr<NetworkTransport> pTransport, QObject *parent /* = nullptr */)
+    : NetworkRequest(parent)
+    , m_pTransport(std::move(pTransport))
+    , m_bRunning(false)
+    , m_bTransportSuccess(false)
+{
+}
+
+NetworkTransportRequest::~NetworkTransportRequest()
+{
+    if (m_bRunning && m_pTransport.get())
+    {
+        m_pTransport->abort();
+    }
+    m_pTransport.reset();
+    closeFile(false);
+}
+
+bool NetworkTransportRequest::isSupportedType(RequestType eType)
+{
+    switch (eType)
+    {
+    case eTypeDownload:
+    case eTypeUpload:
+    case eTypeGet:
+    case eTypePost:
+    case eTypePut:
+    case eTypeDelete:
+    case eTypeHead:
+        return true;
+    default:
+        break;
+    }
+    return false;
+}
+
+void NetworkTransportRequest::start()
+{
+    NetworkRequest::start();
+
+    const QUrl& url = NetworkUtility::currentRequestUrl(m_request);
+    if (!url.isValid())
+    {
+        m_strError = QStringLiteral("Error: Invaild Url -").arg(url.toString());
+        emit requestFinished(false, QByteArray(), m_strError);
+        return;
+    }
+
+    m_bytesContent.clear();
+    m_nHttpStatusCode = 0;
+    m_bTransportSuccess = false;
+    if (m_request.eType == eTypeDownload)
+    {
+        m_pChecksum.reset();
+        if (!m_request.strChecksum.isEmpty())
+        {
+            m_pChecksum = NetworkChecksum::create(m_request.strChecksum, m_strError);
+            if (!m_pChecksum.get())
+            {
+                emit requestFinished(false, QByteArray(), m_strError);
+                return;
+            }
+        }
+
+        std::unique_ptr<QFile> pFile = std::move(NetworkUtility::createAndOpenFile(m_request, m_strError));
+        if (!pFile.get())
+        {
+            emit requestFinished(false, QByteArray(), m_strError);
+            return;
+        }
+        m_strFilePath = pFile->fileName();
+        pFile->close();
+        pFile.reset();
+
+        std::shared_ptr<NetworkWriteFile> pWriteFile = NetworkWriteFile::open(m_strFilePath, m_strError);
+        if (!pWriteFile.get())
+        {
+            closeFile(true);
+            emit requestFinished(false, QByteArray(), m_strError);
+            return;
+        }
+        m_pWriter.reset(new NetworkFileWriter(pWriteFile, 0, this, "onWriterDrained"));
+        if (m_request.eDurability == eDurabilityPeriodic)
+        {
+            m_pWriter->setSyncInterval(qint64(qMax<quint32>(m_request.nSyncIntervalMB, 1)) * 1024 * 1024);
+        }
+    }
+
+    if (m_request.timing.iRequestSent == 0)
+    {
+        m_request.timing.iRequestSent = NetworkUtility::monotonicTime();
+    }
+    NETWORK_TRACE_ASYNC_BEGIN("net", "transport", m_request.uiId);
+    m_bRunning = true;
+    m_pTransport->start(m_request, this);
+}
+
+void NetworkTransportRequest::abort()
+{
+    if (m_bRunning && m_pTransport.get())
+    {
+        m_bRunning = false;
+        m_pTransport->abort();
+    }
+    NetworkRequest::abort();
+}
+
+bool NetworkTransportRequest::isSuccessStatus() const
+{
+    // 传输没有给出状态码时以传输的结果为准
+    return m_nHttpStatusCode == 0 || (m_nHttpStatusCode >= 200 && m_nHttpStatusCode < 300);
+}
+
+void NetworkTransportRequest::setMetaData(int nStatusCode, qint64 nContentLength, const QMap<QByteArray, QByteArray>& mapHeader)
+{
+    Q_UNUSED(mapHeader);
+    m_nHttpStatusCode = nStatusCode;
+    if (m_request.timing.iFirstByte == 0)
+    {
+        m_request.timing.iFirstByte = NetworkUtility::monotonicTime();
+    }
+    if (m_pWriter.get() && isSuccessStatus() && m_request.nLargeFileThreshold > 0
+        && nContentLength >= m_request.nLargeFileThreshold && !m_pWriter->isDropCache())
+    {
+        NETWORK_LOG(eLogInfo, eCategoryDownload) << "Large file mode:" << m_strFilePath << nContentLength;
+        m_pWriter->setDropCache(true);
+    }
+}
+
+bool NetworkTransportRequest::write(const char *pData, qint64 nSize)
+{
+    if (!m_bRunning || nSize <= 0)
+    {
+        return m_bRunning;
+    }
+    m_request.timing.iBytesReceived += nSize;
+
+    // 失败的响应体作为错误信息
+    if (m_pWriter.get() && isSuccessStatus())
+    {
+        if (m_pChecksum.get())
+        {
+            m_pChecksum->update(pData, nSize);
+        }
+        if (!m_pWriter->write(pData, nSize))
+        {
+            NETWORK_LOG(eLogError, eCategoryDownload) << "Write failed:" << m_strFilePath;
+            return false;
+        }
+        return true;
+    }
+    m_bytesContent.append(pData, static_cast<int>(nSize));
+    return true;
+}
+
+bool NetworkTransportRequest::isBackedUp() const
+{
+    return m_pWriter.get() && m_pWriter->isBackedUp();
+}
+
+void NetworkTransportRequest::setProgress(qint64 iBytes, qint64 iTotalBytes, bool bDownload)
+{
+    if (!bDownload)
+    {
+        m_request.timing.iBytesSent = iBytes;
+    }
+    if (!m_request.bShowProgress || !m_bRunning || iBytes <= 0 || iTotalBytes <= 0)
+        return;
+
+    const int nProgress = iBytes * 100 / iTotalBytes;
+    if (m_nProgress < nProgress)
+    {
+        m_nProgress = nProgress;
+        NetworkProgressEvent *event = new NetworkProgressEvent;
+        event->bDownload = bDownload;
+        event->uiId = m_request.uiId;
+        event->uiBatchId = m_request.uiBatchId;
+        event->iBtyes = iBytes;
+        event->iTotalBtyes = iTotalBytes;
+        QCoreApplication::postEvent(NetworkManager::globalInstance(), event);
+    }
+}
+
+void NetworkTransportRequest::finish(bool bSuccess, const QString& strError)
+{
+    if (!m_bRunning)
+        return;
+
+    m_bRunning = false;
+    m_bTransportSuccess = bSuccess;
+    m_strError = strError;
+    // 传输可能在start()或自己的回调中结束，之后再处理，避免在传输的调用栈中释放它
+    QMetaObject::invokeMethod(this, "onFinished", Qt::QueuedConnection);
+}
+
+void NetworkTransportRequest::onWriterDrained()
+{
+    if (m_bRunning && m_pTransport.get())
+    {
+        m_pTransport->resume();
+    }
+}
+
+void NetworkTransportRequest::onFinished()
+{
+    if (m_bAbortManual)
+        return;
+
+    m_request.timing.iLastByte = NetworkUtility::monotonicTime();
+    if (m_request.timing.iFirstByte == 0)
+    {
+        m_request.timing.iFirstByte = m_request.timing.iLastByte;
+    }
+    NETWORK_TRACE_ASYNC_END("net", "transport", m_request.uiId, "status", m_nHttpStatusCode);
+
+    bool bSuccess = m_bTransportSuccess && isSuccessStatus();
+    if (!isSuccessStatus())
+    {
+        NETWORK_LOG(eLogDebug, eCategoryRequest) << "HttpStatusCode:" << m_nHttpStatusCode;
+        if (m_strError.isEmpty())
+        {
+            m_strError = QStringLiteral("Error: HTTP %1 - %2").arg(m_nHttpStatusCode).arg(QString::fromUtf8(m_bytesContent));
+        }
+    }
+
+    if (m_pWriter.get())
+    {
+        m_bytesContent.clear();
+        if (bSuccess)
+        {
+            // 不在网络线程中等待磁盘，写线程写完后在onWriterFinished()中结束
+            m_pWriter->finish("onWriterFinished", m_request.eDurability != eDurabilityNone);
+            return;
+        }
+        finishDownload(false);
+        return;
+    }
+
+    QByteArray bytesContent;
+    if (bSuccess)
+    {
+        bytesContent = m_bytesContent;
+    }
+    m_bytesContent.clear();
+    emit requestFinished(bSuccess, bytesContent, m_strError);
+}
+
+void NetworkTransportRequest::onWriterFinished(bool bSuccess, const QString& strError)
+{
+    // 文件已被关闭（取消或释放）
+    if (m_bAbortManual || !m_pWriter.get() || !m_pWriter->isFinished())
+    {
+        return;
+    }
+
+    if (!bSuccess)
+    {
+        m_strError = strError;
+    }
+    else if (m_pChecksum.get() && !m_pChecksum->verify(m_strError))
+    {
+        bSuccess = false;
+    }
+    finishDownload(bSuccess);
+}
+
+void NetworkTransportRequest::finishDownload(bool bSuccess)
+{
+    const QString strPartFilePath = m_strFilePath;
+    closeFile(!bSuccess);
+    if (bSuccess && !NetworkUtility::renamePartFile(strPartFilePath, m_request.eDurability != eDurabilityNone, m_strError))
+    {
+        bSuccess = false;
+        QFile::remove(strPartFilePath);
+    }
+    emit requestFinished(bSuccess, QByteArray(), m_strError);
+}
+
+void NetworkTransportRequest::closeFile(bool bRemove)
+{
+    if (m_pWriter.get())
+    {
+        if (bRemove)
+        {
+            m_pWriter->discard();
+        }
+        m_pWriter.reset();
+    }
+    if (bRemove && !m_strFilePath.isEmpty())
+    {
+        QFile::remove(m_strFilePath);
+    }
+    m_strFilePath.clear();
+}
@@ -0,0 +1,58 @@
+﻿#ifndef NETWORKTRANSPORTREQUEST_H
+#define NETWORKTRANSPORTREQUEST_H
+
+#include <QObject>
+#include <memory>
+#include "networkrequest.h"
+#include "networktransport.h"
+
+class NetworkFileWriter;
+class NetworkChecksum;
+
+// 用已注册的传输（NetworkTransport）执行请求
+//	eTypeDownload的响应体由写线程写入.part文件，其它类型的响应体作为bytesContent返回.
+class NetworkTransportRequest : public NetworkRequest, public NetworkTransportSink
+{
+    Q_OBJECT;
+
+public:
+    explicit NetworkTransportRequest(std::unique_ptr<NetworkTransport> pTransport, QObject *parent = 0);
+    ~NetworkTransportRequest();
+
+    // 可由传输执行的请求类型（多线程下载/上传只能使用默认传输）
+    static bool isSupportedType(QMTNetwork::RequestType eType);
+
+public Q_SLOTS:
+    void start() Q_DECL_OVERRIDE;
+    void abort() Q_DECL_OVERRIDE;
+    void onFinished() Q_DECL_OVERRIDE;
+    // 写线程已追上，恢复传输
+    void onWriterDrained();
+    // 写线程已写完全部数据（NetworkFileWriter::finish()）
+    void onWriterFinished(bool bSuccess, const QString& strError);
+
+protected:
+    // NetworkTransportSink
+    void setMetaData(int nStatusCode, qint64 nContentLength, const QMap<QByteArray, QByteArray>& mapHeader) Q_DECL_OVERRIDE;
+    bool write(const char *pData, qint64 nSize) Q_DECL_OVERRIDE;
+    bool isBackedUp() const Q_DECL_OVERRIDE;
+    void setProgress(qint64 iBytes, qint64 iTotalBytes, bool bDownload) Q_DECL_OVERRIDE;
+    void finish(bool bSuccess, const QString& strError) Q_DECL_OVERRIDE;
+
+private:
+    void closeFile(bool bRemove);
+    // 关闭文件，成功时把临时文件改名为目标文件，发出requestFinished
+    void finishDownload(bool bSuccess);
+    bool isSuccessStatus() const;
+
+private:
+    std::unique_ptr<NetworkTransport> m_pTransport;
+    QString m_strFilePath;
+    std::unique_ptr<NetworkFileWriter> m_pWriter;
+    std::unique_ptr<NetworkChecksum> m_pChecksum;
+    QByteArray m_bytesContent;
+    bool m_bRunning;
+    bool m_bTransportSuccess;
+};
+
+#endif // NETWORKTRANSPORTREQUEST_H
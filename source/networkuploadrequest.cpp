@@ -1,20 +1,37 @@
 ﻿#include "networkuploadrequest.h"
 #include <QDebug>
 #include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QCoreApplication>
 #include <QNetworkAccessManager>
 #include "networkmanager.h"
+#include "networkmappedfile.h"
 #include "networkutility.h"
+#include "networktracer.h"
+#include "networklog.h"
 
 using namespace QMTNetwork;
 
 NetworkUploadRequest::NetworkUploadRequest(QObject *parent /* = nullptr */)
     : NetworkRequest(parent)
+    , m_eStage(eStageCreate)
+    , m_nFileSize(0)
+    , m_nFileModified(0)
+    , m_nResumeOffset(0)
+    , m_nConfirmedOffset(0)
+    , m_nResumeCount(0)
 {
 }
 
 NetworkUploadRequest::~NetworkUploadRequest()
 {
+    // PATCH的请求体读自m_pFile，先于文件结束请求
+    abort();
 }
 
 void NetworkUploadRequest::start()
@@ -29,8 +46,15 @@ void NetworkUploadRequest::start()
         return;
     }
 
-    QByteArray bytes;
-    if (NetworkUtility::readFileContent(m_request.strReqArg, bytes, m_strError))
+    if (m_request.bResumableUpload && (isHttpProxy(url.scheme()) || isHttpsProxy(url.scheme())))
+    {
+        startResumable(url);
+        return;
+    }
+
+    // 文件映射到内存发送（或按块读取），不把整个文件复制到堆内存
+    QIODevice *pBody = NetworkMappedFile::create(m_request.strReqArg, m_strError);
+    if (pBody)
     {
         if (nullptr == m_pNetworkManager)
         {
@@ -40,7 +64,7 @@ void NetworkUploadRequest::start()
 
         QNetworkRequest request(url);
         request.setHeader(QNetworkRequest::ContentTypeHeader, "application/octet-stream");
-        request.setHeader(QNetworkRequest::ContentLengthHeader, bytes.length());
+        request.setHeader(QNetworkRequest::ContentLengthHeader, pBody->size());
         request.setRawHeader("Connection", "keep-alive");
         auto iter = m_request.mapRawHeader.cbegin();
         for (; iter != m_request.mapRawHeader.cend(); ++iter)
@@ -50,7 +74,7 @@ void NetworkUploadRequest::start()
 
         if (isFtpProxy(url.scheme()))
         {
-            m_pNetworkReply = m_pNetworkManager->put(request, bytes);
+            m_pNetworkReply = m_pNetworkManager->put(request, pBody);
         }
         else // http / https
         {
@@ -64,16 +88,32 @@ void NetworkUploadRequest::start()
                 request.setSslConfiguration(conf);
             }
 #endif
+            // 没有编译对应的压缩算法时直接发送文件
+            QString strCompressError;
+            if (QIODevice *pCompressed = createCompressedBody(pBody, request, strCompressError))
+            {
+                pBody = pCompressed;
+            }
+            else if (!strCompressError.isEmpty())
+            {
+                delete pBody;
+                m_strError = strCompressError;
+                emit requestFinished(false, QByteArray(), m_strError);
+                return;
+            }
             if (m_request.bUploadUsePut)
             {
-                m_pNetworkReply = m_pNetworkManager->put(request, bytes);
+                m_pNetworkReply = m_pNetworkManager->put(request, pBody);
             }
             else
             {
-                m_pNetworkReply = m_pNetworkManager->post(request, bytes);
+                m_pNetworkReply = m_pNetworkManager->post(request, pBody);
             }
         }
+        // 请求体（映射的文件）随reply一起释放
+        pBody->setParent(m_pNetworkReply);
 
+        trackReply(m_pNetworkReply);
         connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onFinished()));
         connect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
         connect(m_pNetworkManager, SIGNAL(authenticationRequired(QNetworkReply *, QAuthenticator *)),
@@ -109,7 +149,8 @@ void NetworkUploadRequest::onFinished()
             if (redirectUrl.isValid() && url != redirectUrl && ++m_nRedirectionCount <= m_request.nMaxRedirectionCount)
             {
                 m_request.redirectUrl = redirectUrl.toString();
-                qDebug() << "[QMultiThreadNetwork] url:" << url.toString() << "redirectUrl:" << m_request.redirectUrl;
+                NETWORK_LOG(eLogDebug, eCategoryUpload) << "url:" << url.toString() << "redirectUrl:" << m_request.redirectUrl;
+                NETWORK_TRACE_INSTANT("net", "redirect", m_request.uiId, "count", m_nRedirectionCount);
 
                 m_pNetworkReply->deleteLater();
                 m_pNetworkReply = nullptr;
@@ -120,7 +161,7 @@ void NetworkUploadRequest::onFinished()
         }
         else if (statusCode != 200 && statusCode != 0)
         {
-            qDebug() << "[QMultiThreadNetwork] HttpStatusCode: " << statusCode;
+            NETWORK_LOG(eLogDebug, eCategoryUpload) << "HttpStatusCode: " << statusCode;
         }
     }
 
@@ -145,6 +186,295 @@ void NetworkUploadRequest::onFinished()
     m_pNetworkReply = nullptr;
 }
 
+void NetworkUploadRequest::startResumable(const QUrl& url)
+{
+    m_pFile.reset(new QFile(m_request.strReqArg));
+    if (!m_pFile->open(QIODevice::ReadOnly))
+    {
+        m_strError = QStringLiteral("Error: open file(%1) failed - %2").arg(m_request.strReqArg).arg(m_pFile->errorString());
+        m_pFile.reset();
+        emit requestFinished(false, QByteArray(), m_strError);
+        return;
+    }
+    m_nFileSize = m_pFile->size();
+    m_nFileModified = QFileInfo(*m_pFile).lastModified().toMSecsSinceEpoch();
+    m_nResumeOffset = 0;
+    m_nConfirmedOffset = 0;
+    m_nResumeCount = 0;
+
+    if (nullptr == m_pNetworkManager)
+    {
+        m_pNetworkManager = new QNetworkAccessManager;
+    }
+
+    // 上次未完成的上传先询问服务器已收到多少
+    m_uploadUrl = loadResumableState();
+    if (m_uploadUrl.isValid())
+    {
+        NETWORK_LOG(eLogDebug, eCategoryUpload) << "Resume upload:" << m_request.strReqArg << "->" << m_uploadUrl.toString();
+        sendResumable(eStageQuery);
+    }
+    else
+    {
+        m_uploadUrl = url;
+        sendResumable(eStageCreate);
+    }
+}
+
+QNetworkRequest NetworkUploadRequest::createResumableRequest(const QUrl& url) const
+{
+    QNetworkRequest request(url);
+    request.setRawHeader("Tus-Resumable", "1.0.0");
+    request.setRawHeader("Connection", "keep-alive");
+    auto iter = m_request.mapRawHeader.cbegin();
+    for (; iter != m_request.mapRawHeader.cend(); ++iter)
+    {
+        request.setRawHeader(iter.key(), iter.value());
+    }
+#ifndef QT_NO_SSL
+    if (isHttpsProxy(url.scheme()))
+    {
+        // 发送https请求前准备工作;
+        QSslConfiguration conf = request.sslConfiguration();
+        conf.setPeerVerifyMode(QSslSocket::VerifyNone);
+        conf.setProtocol(QSsl::TlsV1SslV3);
+        request.setSslConfiguration(conf);
+    }
+#endif
+    return request;
+}
+
+void NetworkUploadRequest::sendResumable(ResumableStage eStage, qint64 nOffset)
+{
+    m_eStage = eStage;
+    m_strError.clear();
+    QNetworkRequest request = createResumableRequest(m_uploadUrl);
+    switch (eStage)
+    {
+    case eStageCreate:
+    {
+        request.setRawHeader("Upload-Length", QByteArray::number(m_nFileSize));
+        request.setHeader(QNetworkRequest::ContentLengthHeader, 0);
+        m_pNetworkReply = m_pNetworkManager->post(request, QByteArray());
+    }
+    break;
+    case eStageQuery:
+    {
+        m_pNetworkReply = m_pNetworkManager->head(request);
+    }
+    break;
+    case eStagePatch:
+    {
+        // 请求体直接读文件，从nOffset到文件末尾
+        m_nResumeOffset = nOffset;
+        m_pFile->seek(nOffset);
+        request.setRawHeader("Upload-Offset", QByteArray::number(nOffset));
+        request.setHeader(QNetworkRequest::ContentTypeHeader, "application/offset+octet-stream");
+        request.setHeader(QNetworkRequest::ContentLengthHeader, m_nFileSize - nOffset);
+        m_pNetworkReply = m_pNetworkManager->sendCustomRequest(request, "PATCH", m_pFile.get());
+    }
+    break;
+    }
+
+    trackReply(m_pNetworkReply);
+    connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onResumableFinished()));
+    connect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
+    if (eStage == eStagePatch && m_request.bShowProgress)
+    {
+        connect(m_pNetworkReply, &QNetworkReply::uploadProgress, this, [this](qint64 iSent, qint64) {
+            onUploadProgress(m_nResumeOffset + iSent, m_nFileSize);
+        });
+    }
+}
+
+void NetworkUploadRequest::onResumableFinished()
+{
+    QNetworkReply *pReply = m_pNetworkReply;
+    m_pNetworkReply = nullptr;
+    if (nullptr == pReply)
+    {
+        return;
+    }
+    pReply->deleteLater();
+    if (m_bAbortManual)
+    {
+        return;
+    }
+
+    const int statusCode = pReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const bool bNetworkOk = (pReply->error() == QNetworkReply::NoError) && (statusCode >= 200 && statusCode < 300);
+    bool bOk = false;
+    const qint64 nServerOffset = pReply->rawHeader("Upload-Offset").toLongLong(&bOk);
+    const QByteArray bytes = pReply->isOpen() ? pReply->readAll() : QByteArray();
+
+    switch (m_eStage)
+    {
+    case eStageCreate:
+    {
+        const QByteArray& strLocation = pReply->rawHeader("Location");
+        if (!bNetworkOk || strLocation.isEmpty())
+        {
+            m_strError = QStringLiteral("Error: create upload failed (HTTP %1) %2%3")
+                .arg(statusCode).arg(m_strError).arg(QString::fromUtf8(bytes));
+            finishResumable(false, bytes);
+            return;
+        }
+        m_uploadUrl = m_uploadUrl.resolved(QUrl(QString::fromUtf8(strLocation)));
+        NETWORK_LOG(eLogDebug, eCategoryUpload) << "Upload created:" << m_uploadUrl.toString();
+        saveResumableState();
+        sendResumable(eStagePatch, 0);
+    }
+    break;
+    case eStageQuery:
+    {
+        if (statusCode == 404 || statusCode == 410)
+        {
+            // 服务器已清理该上传，重新创建
+            NETWORK_LOG(eLogInfo, eCategoryUpload) << "Upload" << m_uploadUrl.toString() << "expired (HTTP" << statusCode << "), start over";
+            m_uploadUrl = NetworkUtility::currentRequestUrl(m_request);
+            sendResumable(eStageCreate);
+        }
+        else if (bNetworkOk && bOk && nServerOffset >= 0 && nServerOffset <= m_nFileSize)
+        {
+            NETWORK_LOG(eLogInfo, eCategoryUpload) << "Server has" << nServerOffset << "of" << m_nFileSize << "bytes:" << m_request.strReqArg;
+            NETWORK_TRACE_INSTANT("net", "resume_upload", m_request.uiId, "offset", nServerOffset);
+            // 上次中断前有进展，不计入连续失败的次数
+            if (nServerOffset > m_nConfirmedOffset)
+            {
+                m_nConfirmedOffset = nServerOffset;
+                m_nResumeCount = 0;
+            }
+            if (nServerOffset == m_nFileSize)
+            {
+                finishResumable(true, bytes);
+            }
+            else
+            {
+                sendResumable(eStagePatch, nServerOffset);
+            }
+        }
+        else if (statusCode >= 400 && statusCode < 500 && statusCode != 408 && statusCode != 429)
+        {
+            m_strError = QStringLiteral("Error: query upload offset failed (HTTP %1) %2").arg(statusCode).arg(m_strError);
+            finishResumable(false, bytes);
+        }
+        else
+        {
+            resumeLater();
+        }
+    }
+    break;
+    case eStagePatch:
+    {
+        if (bNetworkOk && bOk && nServerOffset == m_nFileSize)
+        {
+            finishResumable(true, bytes);
+        }
+        else if (bNetworkOk || statusCode == 409 || statusCode == 408 || statusCode == 429
+            || statusCode == 0 || statusCode >= 500)
+        {
+            // 连接中断、偏移不一致（409）或服务器暂时出错：重新查询偏移后继续
+            NETWORK_LOG(eLogWarn, eCategoryUpload) << "Upload interrupted at" << (bOk ? nServerOffset : m_nResumeOffset)
+                << "(HTTP" << statusCode << ")" << m_strError;
+            resumeLater();
+        }
+        else
+        {
+            m_strError = QStringLiteral("Error: upload failed (HTTP %1) %2%3").arg(statusCode).arg(m_strError).arg(QString::fromUtf8(bytes));
+            finishResumable(false, bytes);
+        }
+    }
+    break;
+    }
+}
+
+void NetworkUploadRequest::resumeLater()
+{
+    if (m_nResumeCount >= MaxResumeCount)
+    {
+        if (m_strError.isEmpty())
+        {
+            m_strError = QStringLiteral("Error: upload interrupted");
+        }
+        finishResumable(false, QByteArray());
+        return;
+    }
+    // 1s, 2s, 4s ...
+    const int nDelay = ResumeBaseDelay << m_nResumeCount;
+    ++m_nResumeCount;
+    NETWORK_LOG(eLogWarn, eCategoryUpload) << "Resume upload" << m_request.strReqArg << "in" << nDelay << "ms, attempt" << m_nResumeCount;
+    QTimer::singleShot(nDelay, this, [this]() {
+        if (!m_bAbortManual)
+        {
+            sendResumable(eStageQuery);
+        }
+    });
+}
+
+QUrl NetworkUploadRequest::loadResumableState() const
+{
+    if (m_request.strUploadStateFile.isEmpty())
+    {
+        return QUrl();
+    }
+    QFile file(m_request.strUploadStateFile);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return QUrl();
+    }
+    const QJsonObject obj = QJsonDocument::fromJson(file.readAll()).object();
+    if (obj.value(QStringLiteral("url")).toString() != m_request.url
+        || obj.value(QStringLiteral("file")).toString() != QFileInfo(*m_pFile).absoluteFilePath()
+        || qint64(obj.value(QStringLiteral("size")).toDouble()) != m_nFileSize
+        || qint64(obj.value(QStringLiteral("modified")).toDouble()) != m_nFileModified)
+    {
+        NETWORK_LOG(eLogInfo, eCategoryUpload) << "Upload state" << m_request.strUploadStateFile << "does not match, upload from the beginning";
+        return QUrl();
+    }
+    return QUrl(obj.value(QStringLiteral("location")).toString());
+}
+
+void NetworkUploadRequest::saveResumableState() const
+{
+    if (m_request.strUploadStateFile.isEmpty())
+    {
+        return;
+    }
+    QJsonObject obj;
+    obj.insert(QStringLiteral("url"), m_request.url);
+    obj.insert(QStringLiteral("file"), QFileInfo(*m_pFile).absoluteFilePath());
+    obj.insert(QStringLiteral("size"), double(m_nFileSize));
+    obj.insert(QStringLiteral("modified"), double(m_nFileModified));
+    obj.insert(QStringLiteral("location"), m_uploadUrl.toString());
+
+    QSaveFile file(m_request.strUploadStateFile);
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact)) < 0
+        || !file.commit())
+    {
+        NETWORK_LOG(eLogWarn, eCategoryUpload) << "Save upload state" << m_request.strUploadStateFile << "failed:" << file.errorString();
+    }
+}
+
+void NetworkUploadRequest::finishResumable(bool bSuccess, const QByteArray& bytes)
+{
+    if (bSuccess)
+    {
+        if (!m_request.strUploadStateFile.isEmpty())
+        {
+            QFile::remove(m_request.strUploadStateFile);
+        }
+        NETWORK_LOG(eLogDebug, eCategoryUpload) << "Resumable upload success." << m_request.strReqArg;
+    }
+    else
+    {
+        // 状态文件保留，之后的任务从服务器已收到的位置继续
+        NETWORK_LOG(eLogWarn, eCategoryUpload) << "Resumable upload failed:" << m_request.strReqArg << m_strError;
+    }
+    m_pFile.reset();
+    emit requestFinished(bSuccess, bytes, m_strError);
+}
+
 void NetworkUploadRequest::onUploadProgress(qint64 iSent, qint64 iTotal)
 {
     if (m_bAbortManual || iSent <= 0 || iTotal <= 0)
@@ -2,6 +2,7 @@
 #define NETWORKUPLOADREQUEST_H
 
 #include <QObject>
+#include <QUrl>
 #include "networkrequest.h"
 
 class QFile;
@@ -19,10 +20,53 @@ public Q_SLOTS:
     void start() Q_DECL_OVERRIDE;
     void onFinished() Q_DECL_OVERRIDE;
     void onUploadProgress(qint64, qint64);
+    // 断点续传模式（bResumableUpload）的请求结束
+    void onResumableFinished();
 
 private:
+    enum
+    {
+        // 断点续传：服务器收到的字节数没有增加时，最多连续续传的次数
+        MaxResumeCount = 3,
+        // 第一次续传的等待时间（毫秒），之后每次加倍
+        ResumeBaseDelay = 1000,
+    };
+
+    // 断点续传（tus 1.0协议）的阶段
+    enum ResumableStage
+    {
+        // POST url，Upload-Length: 文件大小，响应的Location为该文件的上传地址
+        eStageCreate,
+        // HEAD 上传地址，响应的Upload-Offset为服务器已收到的字节数
+        eStageQuery,
+        // PATCH 上传地址，Upload-Offset: 起始位置，请求体为之后的数据
+        eStagePatch,
+    };
+
     //读取本地文件的内容
     bool readLocalFile(const QString& strFilePath, QByteArray& bytes);
+    void startResumable(const QUrl& url);
+    QNetworkRequest createResumableRequest(const QUrl& url) const;
+    void sendResumable(ResumableStage eStage, qint64 nOffset = 0);
+    // 连接中断或服务器出错时，稍后查询已收到的字节数并继续
+    void resumeLater();
+    // 状态文件记录上传地址，文件不变时进程重启后也能继续
+    QUrl loadResumableState() const;
+    void saveResumableState() const;
+    void finishResumable(bool bSuccess, const QByteArray& bytes);
+
+private:
+    std::unique_ptr<QFile> m_pFile;
+    QUrl m_uploadUrl;
+    ResumableStage m_eStage;
+    qint64 m_nFileSize;
+    // 文件的修改时间（毫秒），与状态文件中的不一致时重新创建上传
+    qint64 m_nFileModified;
+    // 本次PATCH的起始位置
+    qint64 m_nResumeOffset;
+    // 服务器已确认收到的最大字节数，增加时清零续传次数（只计连续没有进展的续传）
+    qint64 m_nConfirmedOffset;
+    int m_nResumeCount;
 };
 
 #endif // NETWORKUPLOADREQUEST_H
\ No newline at end of file
@@ -0,0 +1,126 @@
+﻿#include "networkuring.h"
+#ifdef QMTNETWORK_USE_IO_URING
+#include <errno.h>
+#include <string.h>
+#include <liburing.h>
+#endif
+#include "networklog.h"
+
+NetworkUring::NetworkUring()
+    : m_pRing(nullptr)
+    , m_nEntries(0)
+{
+}
+
+NetworkUring::~NetworkUring()
+{
+#ifdef QMTNETWORK_USE_IO_URING
+    if (m_pRing)
+    {
+        io_uring_queue_exit(m_pRing);
+        delete m_pRing;
+        m_pRing = nullptr;
+    }
+#endif
+}
+
+bool NetworkUring::isCompiledIn()
+{
+#ifdef QMTNETWORK_USE_IO_URING
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool NetworkUring::init(unsigned int nEntries)
+{
+#ifdef QMTNETWORK_USE_IO_URING
+    io_uring *pRing = new io_uring;
+    const int nRet = io_uring_queue_init(nEntries, pRing, 0);
+    if (nRet < 0)
+    {
+        NETWORK_LOG(eLogInfo, eCategoryDownload) << "io_uring unavailable:" << strerror(-nRet) << ", using synchronous writes";
+        delete pRing;
+        return false;
+    }
+    m_pRing = pRing;
+    m_nEntries = nEntries;
+    return true;
+#else
+    Q_UNUSED(nEntries);
+    return false;
+#endif
+}
+
+bool NetworkUring::execute(std::vector<NetworkUringOp>& vecOp, qint64& nSyscalls)
+{
+#ifdef QMTNETWORK_USE_IO_URING
+    if (!m_pRing)
+    {
+        return false;
+    }
+
+    size_t nNext = 0;
+    while (nNext < vecOp.size())
+    {
+        // 一次最多提交队列大小个请求
+        unsigned int nQueued = 0;
+        while (nNext < vecOp.size() && nQueued < m_nEntries)
+        {
+            io_uring_sqe *pSqe = io_uring_get_sqe(m_pRing);
+            if (!pSqe)
+            {
+                break;
+            }
+            NetworkUringOp& op = vecOp[nNext];
+            if (op.bSync)
+            {
+                io_uring_prep_fsync(pSqe, op.fd, 0);
+                // 等之前的写入完成后再fsync
+                io_uring_sqe_set_flags(pSqe, IOSQE_IO_DRAIN);
+            }
+            else
+            {
+                io_uring_prep_write(pSqe, op.fd, op.pData, op.nSize, static_cast<__u64>(op.nOffset));
+            }
+            io_uring_sqe_set_data(pSqe, &op);
+            ++nQueued;
+            ++nNext;
+        }
+
+        const int nSubmitted = io_uring_submit_and_wait(m_pRing, nQueued);
+        ++nSyscalls;
+        if (nSubmitted < 0)
+        {
+            NETWORK_LOG(eLogWarn, eCategoryDownload) << "io_uring_submit_and_wait:" << strerror(-nSubmitted);
+            return false;
+        }
+
+        unsigned int nReaped = 0;
+        while (nReaped < nQueued)
+        {
+            io_uring_cqe *pCqe = nullptr;
+            const int nRet = io_uring_wait_cqe(m_pRing, &pCqe);
+            if (nRet < 0)
+            {
+                if (nRet == -EINTR)
+                {
+                    continue;
+                }
+                NETWORK_LOG(eLogWarn, eCategoryDownload) << "io_uring_wait_cqe:" << strerror(-nRet);
+                return false;
+            }
+            NetworkUringOp *pOp = static_cast<NetworkUringOp *>(io_uring_cqe_get_data(pCqe));
+            pOp->nResult = pCqe->res;
+            io_uring_cqe_seen(m_pRing, pCqe);
+            ++nReaped;
+        }
+    }
+    return true;
+#else
+    Q_UNUSED(vecOp);
+    Q_UNUSED(nSyscalls);
+    return false;
+#endif
+}
@@ -0,0 +1,45 @@
+﻿#ifndef NETWORKURING_H
+#define NETWORKURING_H
+
+#include <vector>
+#include <QtGlobal>
+
+// Linux io_uring磁盘IO（需要liburing，定义QMTNETWORK_USE_IO_URING时启用）
+//	一批偏移写入和fsync一次提交，再一次收割全部完成事件.
+//	内核不支持（或被seccomp禁止）时init()返回false，调用者应回退到同步写入.
+struct NetworkUringOp
+{
+    int fd;
+    const char *pData;
+    unsigned int nSize;
+    qint64 nOffset;
+    // true: fsync（在之前提交的写入全部完成后执行）
+    bool bSync;
+    // 完成结果：写入的字节数，或-errno
+    int nResult;
+
+    NetworkUringOp() : fd(-1), pData(nullptr), nSize(0), nOffset(0), bSync(false), nResult(0) {}
+};
+
+struct io_uring;
+class NetworkUring
+{
+public:
+    NetworkUring();
+    ~NetworkUring();
+
+    static bool isCompiledIn();
+
+    bool init(unsigned int nEntries);
+    bool isValid() const { return m_pRing != nullptr; }
+
+    // 提交并等待全部完成. nSyscalls返回进入内核的次数
+    bool execute(std::vector<NetworkUringOp>& vecOp, qint64& nSyscalls);
+
+private:
+    Q_DISABLE_COPY(NetworkUring);
+    io_uring *m_pRing;
+    unsigned int m_nEntries;
+};
+
+#endif // NETWORKURING_H
@@ -2,6 +2,12 @@
 #ifdef WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #endif
 #include <QUrlQuery>
 #include <QList>
@@ -9,6 +15,11 @@
 #include <QDir>
 #include <QDebug>
 #include <QFile>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#if (QT_VERSION >= QT_VERSION_CHECK(5,4,0))
+#include <QStorageInfo>
+#endif
 #include "networkdefs.h"
 
 
@@ -41,37 +52,25 @@ std::unique_ptr<QFile> NetworkUtility::createAndOpenFile(const QMTNetwork::Reque
         return pFile;
     }
 
-    //ļڲbReplaceFileIfExistرļƳ
+    //ļѴδbReplaceFileIfExistʱʧܣʱԭļسɹrenamePartFileԭ滻
     const QString& strFilePath = QDir::toNativeSeparators(strSaveDir + strFileName);
-    if (QFile::exists(strFilePath))
+    if (QFile::exists(strFilePath) && !request.bReplaceFileIfExist)
     {
-        if (request.bReplaceFileIfExist)
-        {
-            QString strFileErr;
-            if (!removeFile(strFilePath, strFileErr))
-            {
-                strError = QStringLiteral("Error: QFile::remove(%1) - %2").arg(strFilePath).arg(strFileErr);
-                qWarning() << strError;
-                return pFile;
-            }
-        }
-        else
-        {
-            strError = QStringLiteral("Error: File is already exist(%1)").arg(strFilePath);
-            qWarning() << strError;
-            return pFile;
-        }
+        strError = QStringLiteral("Error: File is already exist(%1)").arg(strFilePath);
+        qWarning() << strError;
+        return pFile;
     }
 
-    //ļ
+    //ʱļϴδɵʱļգ
+    const QString& strPartFilePath = partFilePath(strFilePath);
 #if defined(_MSC_VER) && _MSC_VER < 1700
-    pFile.reset(new QFile(strFilePath));
+    pFile.reset(new QFile(strPartFilePath));
 #else
-    pFile = std::make_unique<QFile>(strFilePath);
+    pFile = std::make_unique<QFile>(strPartFilePath);
 #endif
-    if (!pFile->open(QIODevice::WriteOnly))
+    if (!pFile->open(QIODevice::WriteOnly | QIODevice::Truncate))
     {
-        strError = QStringLiteral("Error: QFile::open(%1) - %2").arg(strFilePath).arg(pFile->errorString());
+        strError = QStringLiteral("Error: QFile::open(%1) - %2").arg(strPartFilePath).arg(pFile->errorString());
         qWarning() << strError;
         pFile.reset();
         return pFile;
@@ -101,13 +100,11 @@ bool NetworkUtility::readFileContent(const QString& strFilePath, QByteArray& byt
     return false;
 }
 
-QString NetworkUtility::createSharedRWFileWin32(const QMTNetwork::RequestTask& request, QString& strError, qint64 nDefaultFileSize)
+QString NetworkUtility::createSharedRWFile(const QMTNetwork::RequestTask& request, QString& strError, qint64 nDefaultFileSize)
 {
     QString strCreatedFile;
     strError.clear();
 
-#ifdef WIN32
-
     //ȡļĿ¼
     const QString& strSaveDir = getDownloadFileSaveDir(request, strError);
     if (strSaveDir.isEmpty())
@@ -117,65 +114,149 @@ QString NetworkUtility::createSharedRWFileWin32(const QMTNetwork::RequestTask& r
 
     //ȡرļ
     const QString& strFileName = getDownloadFileSaveName(request);
-    if (strSaveDir.isEmpty())
+    if (strFileName.isEmpty())
     {
         strError = QLatin1String("Error: fileName is empty!");
         qWarning() << strError;
         return strCreatedFile;
     }
 
-    //ļڲbReplaceFileIfExistرļƳ
+    //ļѴδbReplaceFileIfExistʱʧܣʱԭļسɹrenamePartFileԭ滻
     const QString& strFilePath = QDir::toNativeSeparators(strSaveDir + strFileName);
-    if (QFile::exists(strFilePath))
+    if (QFile::exists(strFilePath) && !request.bReplaceFileIfExist)
     {
-        if (request.bReplaceFileIfExist)
-        {
-            QString strFileErr;
-            if (!removeFile(strFilePath, strFileErr))
-            {
-                strError = QStringLiteral("Error: QFile::remove(%1) - %2").arg(strFilePath).arg(strFileErr);
-                qWarning() << strError;
-                return strCreatedFile;
-            }
-        }
-        else
+        strError = QStringLiteral("Error: File is already exist(%1)").arg(strFilePath);
+        qWarning() << strError;
+        return strCreatedFile;
+    }
+
+    //̿ռ䲻ʱڴκ֮ǰʧ
+#if (QT_VERSION >= QT_VERSION_CHECK(5,4,0))
+    if (nDefaultFileSize > 0)
+    {
+        const QStorageInfo storage(strSaveDir);
+        if (storage.isValid() && storage.bytesAvailable() < nDefaultFileSize)
         {
-            strError = QStringLiteral("Error: File is already exist(%1)").arg(strFilePath);
+            strError = QStringLiteral("Error: Not enough disk space(%1) - need %2 bytes, available %3 bytes")
+                .arg(strSaveDir).arg(nDefaultFileSize).arg(storage.bytesAvailable());
             qWarning() << strError;
             return strCreatedFile;
         }
     }
+#endif
 
-    HANDLE hFile = CreateFileW(strFilePath.toStdWString().c_str(), GENERIC_READ | GENERIC_WRITE,
-        FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS,
+    //ʱļϴδɵʱļգ
+    const QString& strPartFilePath = partFilePath(strFilePath);
+#ifdef WIN32
+    HANDLE hFile = CreateFileW(strPartFilePath.toStdWString().c_str(), GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, CREATE_ALWAYS,
         FILE_ATTRIBUTE_NORMAL, nullptr);
-    if (hFile != nullptr && hFile != INVALID_HANDLE_VALUE)
+    if (hFile == nullptr || hFile == INVALID_HANDLE_VALUE)
+    {
+        strError = QStringLiteral("Error: CreateFileW(%1)").arg(GetLastError());
+        qWarning() << strError;
+        return strCreatedFile;
+    }
+    if (nDefaultFileSize > 0)
     {
-        if (nDefaultFileSize > 0)
+        //һļմСNTFSһηÿռ䣬ֶдʱչļ
+        //SetFileValidDataҪSE_MANAGE_VOLUME_NAMEȨһᱩ¶ϵľݣʹã
+        LARGE_INTEGER li = { 0 };
+        li.QuadPart = nDefaultFileSize;
+        if (!SetFilePointerEx(hFile, li, nullptr, FILE_BEGIN) || !SetEndOfFile(hFile))
         {
-            LARGE_INTEGER li = { 0 };
-            li.QuadPart = nDefaultFileSize;
-            if (!SetFilePointerEx(hFile, li, &li, FILE_BEGIN))
-            {
-                strError = QStringLiteral("Error: SetFilePointerEx(%1)").arg(GetLastError());
-                qWarning() << strError;
-                return strCreatedFile;
-            }
+            strError = QStringLiteral("Error: SetEndOfFile(%1) - %2").arg(strPartFilePath).arg(GetLastError());
+            qWarning() << strError;
+            CloseHandle(hFile);
+            QFile::remove(strPartFilePath);
+            return strCreatedFile;
         }
-        CloseHandle(hFile);
-        strCreatedFile = strFilePath;
     }
-    else
+    CloseHandle(hFile);
+#else
+    const int fd = ::open(QFile::encodeName(strPartFilePath).constData(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
     {
-        strError = QStringLiteral("Error: CreateFileW(%1)").arg(GetLastError());
+        strError = QStringLiteral("Error: open(%1) - %2").arg(strPartFilePath).arg(QString::fromLocal8Bit(strerror(errno)));
         qWarning() << strError;
         return strCreatedFile;
     }
+    if (nDefaultFileSize > 0)
+    {
+        //ԤմСĴ̿ռ䣬ֶдƬƵԪݸ
+        int nRet = EOPNOTSUPP;
+#if defined(Q_OS_LINUX)
+        nRet = posix_fallocate(fd, 0, static_cast<off_t>(nDefaultFileSize));
+#endif
+        if (nRet == EOPNOTSUPP || nRet == EINVAL)
+        {
+            //ļϵͳ֧Ԥ䣬ֻļСϡļ
+            nRet = (::ftruncate(fd, static_cast<off_t>(nDefaultFileSize)) == 0) ? 0 : errno;
+        }
+        if (nRet != 0)
+        {
+            strError = QStringLiteral("Error: posix_fallocate(%1) - %2").arg(strPartFilePath).arg(QString::fromLocal8Bit(strerror(nRet)));
+            qWarning() << strError;
+            ::close(fd);
+            QFile::remove(strPartFilePath);
+            return strCreatedFile;
+        }
+    }
+    ::close(fd);
+#endif
+
+    strCreatedFile = strPartFilePath;
+    return strCreatedFile;
+}
+
+QString NetworkUtility::partFilePath(const QString& strFilePath)
+{
+    return strFilePath + QLatin1String(".part");
+}
+
+QString NetworkUtility::finalFilePath(const QString& strPartFilePath)
+{
+    if (strPartFilePath.endsWith(QLatin1String(".part")))
+    {
+        return strPartFilePath.left(strPartFilePath.size() - 5);
+    }
+    return strPartFilePath;
+}
 
+bool NetworkUtility::renamePartFile(const QString& strPartFilePath, bool bDurable, QString& strError)
+{
+    const QString& strFilePath = finalFilePath(strPartFilePath);
+#ifdef WIN32
+    DWORD dwFlags = MOVEFILE_REPLACE_EXISTING;
+    if (bDurable)
+    {
+        dwFlags |= MOVEFILE_WRITE_THROUGH;
+    }
+    if (!MoveFileExW(strPartFilePath.toStdWString().c_str(), strFilePath.toStdWString().c_str(), dwFlags))
+    {
+        strError = QStringLiteral("Error: MoveFileExW(%1) - %2").arg(strFilePath).arg(GetLastError());
+        qWarning() << strError;
+        return false;
+    }
 #else
-    strError = QStringLiteral("Error: createSharedRWFileWin32() only support win32 platform.");
+    if (::rename(QFile::encodeName(strPartFilePath).constData(), QFile::encodeName(strFilePath).constData()) != 0)
+    {
+        strError = QStringLiteral("Error: rename(%1) - %2").arg(strFilePath).arg(QString::fromLocal8Bit(strerror(errno)));
+        qWarning() << strError;
+        return false;
+    }
+    if (bDurable)
+    {
+        //¼Ŀ¼УfsyncĿ¼ܱ֤ϵĿļ
+        const int fd = ::open(QFile::encodeName(QFileInfo(strFilePath).absolutePath()).constData(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            ::fsync(fd);
+            ::close(fd);
+        }
+    }
 #endif
-    return strFilePath;
+    return true;
 }
 
 QString NetworkUtility::getDownloadFileSaveName(const QMTNetwork::RequestTask& request)
@@ -241,9 +322,9 @@ QString NetworkUtility::getDownloadFileSaveDir(const QMTNetwork::RequestTask& re
         qWarning() << strError;
         return QString();
     }
-    if (!strSaveDir.endsWith("\\"))
+    if (!strSaveDir.endsWith(QDir::separator()))
     {
-        strSaveDir.append("\\");
+        strSaveDir.append(QDir::separator());
     }
     return strSaveDir;
 }
@@ -285,4 +366,52 @@ QUrl NetworkUtility::currentRequestUrl(const QMTNetwork::RequestTask& request)
         url = QUrl(request.url);
     }
     return url;
-}
\ No newline at end of file
+}
+
+qint64 NetworkUtility::monotonicTime()
+{
+    struct MonotonicClock
+    {
+        MonotonicClock() { timer.start(); }
+        QElapsedTimer timer;
+    };
+    static MonotonicClock s_clock;
+    // 1ʼ0ʾ"δ"
+    return s_clock.timer.nsecsElapsed() / 1000 + 1;
+}
+
+bool NetworkUtility::parseContentRange(const QByteArray& strRange, qint64& nFirst, qint64& nLast, qint64& nTotal)
+{
+    nFirst = nLast = nTotal = -1;
+    const QByteArray& strValue = strRange.trimmed();
+    const int nSpace = strValue.indexOf(' ');
+    const int nDash = strValue.indexOf('-', nSpace + 1);
+    const int nSlash = strValue.indexOf('/', nSpace + 1);
+    if (nSpace <= 0 || nSlash < 0 || strValue.left(nSpace).toLower() != "bytes")
+    {
+        return false;
+    }
+
+    // ܴС"*"416ӦΪ"bytes */<total>"
+    bool bOk = false;
+    const qint64 nValue = strValue.mid(nSlash + 1).trimmed().toLongLong(&bOk);
+    if (bOk && nValue >= 0)
+    {
+        nTotal = nValue;
+    }
+    if (nDash < 0 || nDash > nSlash)
+    {
+        return false;
+    }
+
+    bool bOk1 = false, bOk2 = false;
+    const qint64 nValue1 = strValue.mid(nSpace + 1, nDash - nSpace - 1).trimmed().toLongLong(&bOk1);
+    const qint64 nValue2 = strValue.mid(nDash + 1, nSlash - nDash - 1).trimmed().toLongLong(&bOk2);
+    if (!bOk1 || !bOk2 || nValue1 < 0 || nValue1 > nValue2 || (nTotal >= 0 && nValue2 >= nTotal))
+    {
+        return false;
+    }
+    nFirst = nValue1;
+    nLast = nValue2;
+    return true;
+}
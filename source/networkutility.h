@@ -12,11 +12,17 @@ namespace QMTNetwork {
 class NetworkUtility
 {
 public:
-    //ļ
+    //صʱļ
     static std::unique_ptr<QFile> createAndOpenFile(const QMTNetwork::RequestTask&, QString& errMessage);
 
-    //дļ
-    static QString createSharedRWFileWin32(const QMTNetwork::RequestTask&, QString& errMessage, qint64 nDefaultFileSize = 0);
+    //дʱļ·nDefaultFileSize > 0ʱԤļС̿ռ䲻ʱʧܣ
+    static QString createSharedRWFile(const QMTNetwork::RequestTask&, QString& errMessage, qint64 nDefaultFileSize = 0);
+
+    //صдʱļĿļ+".part"ɺٸΪĿļ
+    static QString partFilePath(const QString& strFilePath);
+    static QString finalFilePath(const QString& strPartFilePath);
+    //ʱļΪĿļѴڵļbDurable: fsyncĿ¼֤д
+    static bool renamePartFile(const QString& strPartFilePath, bool bDurable, QString& errMessage);
 
     //ȡļ
     static bool readFileContent(const QString& strFilePath, QByteArray& bytes, QString& errMessage);
@@ -31,6 +37,13 @@ public:
     static bool removeFile(const QString& strFilePath, QString& errMessage);
     static QUrl currentRequestUrl(const QMTNetwork::RequestTask&);
 
+    //ʱӵĵǰʱ䣨΢룩ڼ¼׶εʱ
+    static qint64 monotonicTime();
+
+    //206ӦContent-Range"bytes <first>-<last>/<total>"nTotalΪ"*"ʱΪ-1
+    //	Χʽfirst > lastlast >= totalʱfalsenTotalΪܴС
+    static bool parseContentRange(const QByteArray& strRange, qint64& nFirst, qint64& nLast, qint64& nTotal);
+
 private:
     NetworkUtility();
     ~NetworkUtility();
@@ -0,0 +1,11 @@
+######################################################################
+# NetworkBatchManifest: CSV/JSON Lines清单的解析（含mirrors）、跳过无效行、从指定行继续
+######################################################################
+
+TEMPLATE = app
+TARGET = tst_networkbatchmanifest
+
+CONFIG += qmtnetwork_lib
+include(../test.pri)
+
+SOURCES += tst_networkbatchmanifest.cpp
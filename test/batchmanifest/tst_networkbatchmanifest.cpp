@@ -0,0 +1,248 @@
+﻿#include <QtTest>
+#include <QTemporaryDir>
+#include "networkbatchmanifest.h"
+
+using namespace QMTNetwork;
+
+class TestNetworkBatchManifest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void csv();
+    void jsonLines();
+    void autoFormat_data();
+    void autoFormat();
+    void seekLine();
+    void emptyFile();
+    void missingFile();
+
+private:
+    QString writeManifest(const QString& strName, const QByteArray& bytes);
+
+    QTemporaryDir m_dir;
+};
+
+QString TestNetworkBatchManifest::writeManifest(const QString& strName, const QByteArray& bytes)
+{
+    const QString& strFilePath = m_dir.filePath(strName);
+    QFile file(strFilePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(bytes) != bytes.size())
+    {
+        return QString();
+    }
+    return strFilePath;
+}
+
+void TestNetworkBatchManifest::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+}
+
+void TestNetworkBatchManifest::csv()
+{
+    // BOM、CRLF、注释、空行、引号内的逗号和转义的引号、type为空时使用模板的类型
+    const QByteArray bytes =
+        "\xEF\xBB\xBF# url,type,arg,saveFileName,headers,checksum\r\n"
+        "http://host/a.zip,0,/tmp/dl,a.bin,Authorization: Bearer x|X-Trace: 1,crc32c:e3069283\r\n"
+        "\r\n"
+        "  http://host/b.txt,,\"a=1,b=\"\"2\"\"\"\r\n"
+        "http://host/c,notanumber,x\r\n"
+        ",0,missing-url\r\n"
+        "http://host/d,4,k=v";
+    const QString& strFilePath = writeManifest("tasks.csv", bytes);
+    QVERIFY(!strFilePath.isEmpty());
+
+    NetworkBatchManifest manifest;
+    QString strError;
+    QVERIFY2(manifest.open(strFilePath, NetworkBatchManifest::eFormatCsv, strError), qPrintable(strError));
+    QCOMPARE(manifest.size(), static_cast<qint64>(bytes.size()));
+
+    RequestTask templ;
+    templ.eType = eTypeGet;
+    templ.mapRawHeader.insert("User-Agent", "test");
+
+    RequestTask task = templ;
+    qint64 nLine = -1;
+    QVERIFY(manifest.readNext(task, nLine));
+    QCOMPARE(nLine, 1LL);
+    QCOMPARE(task.url, QString("http://host/a.zip"));
+    QCOMPARE(task.eType, eTypeDownload);
+    QCOMPARE(task.strReqArg, QString("/tmp/dl"));
+    QCOMPARE(task.strSaveFileName, QString("a.bin"));
+    QCOMPARE(task.mapRawHeader.value("Authorization"), QByteArray("Bearer x"));
+    QCOMPARE(task.mapRawHeader.value("X-Trace"), QByteArray("1"));
+    QCOMPARE(task.mapRawHeader.value("User-Agent"), QByteArray("test"));
+    QCOMPARE(task.strChecksum, QString("crc32c:e3069283"));
+
+    task = templ;
+    QVERIFY(manifest.readNext(task, nLine));
+    QCOMPARE(nLine, 3LL);
+    QCOMPARE(task.url, QString("http://host/b.txt"));
+    QCOMPARE(task.eType, eTypeGet);
+    QCOMPARE(task.strReqArg, QString("a=1,b=\"2\""));
+    QVERIFY(task.strSaveFileName.isEmpty());
+    QVERIFY(task.strChecksum.isEmpty());
+
+    // 第4、5行格式错误，被跳过
+    task = templ;
+    QVERIFY(manifest.readNext(task, nLine));
+    QCOMPARE(nLine, 6LL);
+    QCOMPARE(task.url, QString("http://host/d"));
+    QCOMPARE(task.eType, eTypePost);
+    QCOMPARE(task.strReqArg, QString("k=v"));
+
+    task = templ;
+    QVERIFY(!manifest.readNext(task, nLine));
+    QVERIFY(manifest.atEnd());
+    QCOMPARE(manifest.invalidLineCount(), 2LL);
+    QCOMPARE(manifest.bytesRead(), manifest.size());
+}
+
+void TestNetworkBatchManifest::jsonLines()
+{
+    const QByteArray bytes =
+        "{\"url\":\"http://host/a.iso\",\"type\":1,\"arg\":\"/tmp/dl\",\"saveFileName\":\"a.iso\","
+        "\"headers\":{\"Authorization\":\"Bearer x\"},\"checksum\":\"sha256:" + QByteArray(64, 'a') + "\","
+        "\"mirrors\":[\"http://mirror1/a.iso\",\" \",\"http://mirror2/a.iso\"]}\n"
+        "# comment\n"
+        "{\"url\":\"http://host/b\"}\n"
+        "{\"url\":\"http://host/broken\"\n"
+        "{\"type\":0}\n"
+        "[\"http://host/array\"]\n"
+        "{\"url\":\"http://host/c\",\"mirrors\":\"http://not-an-array\"}\n";
+    const QString& strFilePath = writeManifest("tasks.jsonl", bytes);
+    QVERIFY(!strFilePath.isEmpty());
+
+    NetworkBatchManifest manifest;
+    QString strError;
+    QVERIFY2(manifest.open(strFilePath, NetworkBatchManifest::eFormatJsonLines, strError), qPrintable(strError));
+
+    // 清单中的镜像追加在模板的镜像之后
+    RequestTask templ;
+    templ.eType = eTypeDownload;
+    templ.listMirrorUrls << "http://template-mirror/";
+
+    RequestTask task = templ;
+    qint64 nLine = -1;
+    QVERIFY(manifest.readNext(task, nLine));
+    QCOMPARE(nLine, 0LL);
+    QCOMPARE(task.url, QString("http://host/a.iso"));
+    QCOMPARE(task.eType, eTypeMTDownload);
+    QCOMPARE(task.strReqArg, QString("/tmp/dl"));
+    QCOMPARE(task.strSaveFileName, QString("a.iso"));
+    QCOMPARE(task.mapRawHeader.value("Authorization"), QByteArray("Bearer x"));
+    QCOMPARE(task.strChecksum, QString("sha256:" + QString(64, 'a')));
+    QCOMPARE(task.listMirrorUrls, QStringList() << "http://template-mirror/" << "http://mirror1/a.iso" << "http://mirror2/a.iso");
+
+    task = templ;
+    QVERIFY(manifest.readNext(task, nLine));
+    QCOMPARE(nLine, 2LL);
+    QCOMPARE(task.url, QString("http://host/b"));
+    QCOMPARE(task.eType, eTypeDownload);
+    QCOMPARE(task.listMirrorUrls, templ.listMirrorUrls);
+
+    // JSON错误、缺少url、不是对象的行被跳过；mirrors不是数组时忽略
+    task = templ;
+    QVERIFY(manifest.readNext(task, nLine));
+    QCOMPARE(nLine, 6LL);
+    QCOMPARE(task.url, QString("http://host/c"));
+    QCOMPARE(task.listMirrorUrls, templ.listMirrorUrls);
+
+    task = templ;
+    QVERIFY(!manifest.readNext(task, nLine));
+    QCOMPARE(manifest.invalidLineCount(), 3LL);
+}
+
+void TestNetworkBatchManifest::autoFormat_data()
+{
+    QTest::addColumn<QString>("strName");
+    QTest::addColumn<bool>("bJson");
+
+    QTest::newRow("jsonl") << "list.jsonl" << true;
+    QTest::newRow("ndjson") << "list.NDJSON" << true;
+    QTest::newRow("json") << "list.json" << true;
+    QTest::newRow("csv") << "list.csv" << false;
+    QTest::newRow("txt") << "list.txt" << false;
+}
+
+void TestNetworkBatchManifest::autoFormat()
+{
+    QFETCH(QString, strName);
+    QFETCH(bool, bJson);
+
+    // 同一行按JSON解析得到url，按CSV解析则整行（去掉引号）被当作url
+    const QString& strFilePath = writeManifest(strName, "{\"url\":\"http://host/x\"}\n");
+    QVERIFY(!strFilePath.isEmpty());
+
+    NetworkBatchManifest manifest;
+    QString strError;
+    QVERIFY2(manifest.open(strFilePath, NetworkBatchManifest::eFormatAuto, strError), qPrintable(strError));
+    RequestTask task;
+    qint64 nLine = -1;
+    QVERIFY(manifest.readNext(task, nLine));
+    QCOMPARE(task.url == QLatin1String("http://host/x"), bJson);
+}
+
+void TestNetworkBatchManifest::seekLine()
+{
+    QByteArray bytes;
+    for (int i = 0; i < 10; ++i)
+    {
+        bytes += "http://host/" + QByteArray::number(i) + ",3\n";
+    }
+    const QString& strFilePath = writeManifest("seek.csv", bytes);
+    QVERIFY(!strFilePath.isEmpty());
+
+    NetworkBatchManifest manifest;
+    QString strError;
+    QVERIFY2(manifest.open(strFilePath, NetworkBatchManifest::eFormatAuto, strError), qPrintable(strError));
+
+    // 从上次中断的第7行继续，不能往回跳
+    QVERIFY(manifest.seekLine(7));
+    QCOMPARE(manifest.currentLine(), 7LL);
+    QVERIFY(!manifest.seekLine(3));
+
+    RequestTask task;
+    qint64 nLine = -1;
+    QVERIFY(manifest.readNext(task, nLine));
+    QCOMPARE(nLine, 7LL);
+    QCOMPARE(task.url, QString("http://host/7"));
+    QVERIFY(!manifest.seekLine(20));
+
+    // 重新打开后从头读取
+    QVERIFY2(manifest.open(strFilePath, NetworkBatchManifest::eFormatCsv, strError), qPrintable(strError));
+    QCOMPARE(manifest.currentLine(), 0LL);
+    QVERIFY(manifest.readNext(task, nLine));
+    QCOMPARE(nLine, 0LL);
+    QCOMPARE(task.url, QString("http://host/0"));
+}
+
+void TestNetworkBatchManifest::emptyFile()
+{
+    const QString& strFilePath = writeManifest("empty.csv", QByteArray());
+    QVERIFY(!strFilePath.isEmpty());
+
+    NetworkBatchManifest manifest;
+    QString strError;
+    QVERIFY2(manifest.open(strFilePath, NetworkBatchManifest::eFormatAuto, strError), qPrintable(strError));
+    QVERIFY(manifest.isOpen());
+    QVERIFY(manifest.atEnd());
+    RequestTask task;
+    qint64 nLine = -1;
+    QVERIFY(!manifest.readNext(task, nLine));
+    QCOMPARE(manifest.size(), 0LL);
+}
+
+void TestNetworkBatchManifest::missingFile()
+{
+    NetworkBatchManifest manifest;
+    QString strError;
+    QVERIFY(!manifest.open(m_dir.filePath("not-exist.csv"), NetworkBatchManifest::eFormatAuto, strError));
+    QVERIFY(!strError.isEmpty());
+    QVERIFY(!manifest.isOpen());
+}
+
+QTEST_GUILESS_MAIN(TestNetworkBatchManifest)
+#include "tst_networkbatchmanifest.moc"
@@ -0,0 +1,12 @@
+######################################################################
+# NetworkChecksum: 各算法的标准测试向量、分块计算、crc32c分段合并、从文件读取
+######################################################################
+
+TEMPLATE = app
+TARGET = tst_networkchecksum
+
+include(../test.pri)
+
+HEADERS += $$SOURCE_DIR/networkchecksum.h
+SOURCES += tst_networkchecksum.cpp \
+           $$SOURCE_DIR/networkchecksum.cpp
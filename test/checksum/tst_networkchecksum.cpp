@@ -0,0 +1,234 @@
+﻿#include <QtTest>
+#include <QTemporaryFile>
+#include "networkchecksum.h"
+
+namespace {
+    // 不重复的数据，长度不是8和32的整数倍时也能覆盖尾部的处理
+    QByteArray makeData(int nSize)
+    {
+        QByteArray bytes(nSize, Qt::Uninitialized);
+        quint32 nSeed = 12345;
+        for (int i = 0; i < nSize; ++i)
+        {
+            nSeed = nSeed * 1103515245 + 12345;
+            bytes[i] = static_cast<char>(nSeed >> 16);
+        }
+        return bytes;
+    }
+
+    std::unique_ptr<NetworkChecksum> create(const QString& strChecksum)
+    {
+        QString strError;
+        std::unique_ptr<NetworkChecksum> pChecksum = NetworkChecksum::create(strChecksum, strError);
+        if (!pChecksum.get())
+        {
+            qWarning() << strError;
+        }
+        return pChecksum;
+    }
+}
+
+class TestNetworkChecksum : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void knownVectors_data();
+    void knownVectors();
+    void chunkedUpdate_data();
+    void chunkedUpdate();
+    void crc32cCombine_data();
+    void crc32cCombine();
+    void mismatchFails();
+    void invalidChecksum_data();
+    void invalidChecksum();
+    void updateFromFile();
+};
+
+void TestNetworkChecksum::knownVectors_data()
+{
+    QTest::addColumn<QString>("strChecksum");
+    QTest::addColumn<QByteArray>("bytes");
+
+    // crc32c: RFC 3720 附录B.4；xxh64: 参考实现（seed = 0）
+    QTest::newRow("crc32c-empty") << "crc32c:00000000" << QByteArray();
+    QTest::newRow("crc32c-123456789") << "crc32c:e3069283" << QByteArray("123456789");
+    QTest::newRow("crc32c-32zeros") << "crc32c:8a9136aa" << QByteArray(32, '\0');
+    QTest::newRow("xxh64-empty") << "xxh64:ef46db3751d8e999" << QByteArray();
+    QTest::newRow("xxh64-abc") << "xxh64:44bc2cf5ad770999" << QByteArray("abc");
+    QTest::newRow("xxh64-long") << "xxh64:fbcea83c8a378bf1" << QByteArray("Nobody inspects the spammish repetition");
+    QTest::newRow("md5-abc") << "md5:900150983cd24fb0d6963f7d28e17f72" << QByteArray("abc");
+    QTest::newRow("sha256-abc") << "SHA-256:BA7816BF8F01CFEA414140DE5DAE2223B00361A396177A9CB410FF61F20015AD" << QByteArray("abc");
+}
+
+void TestNetworkChecksum::knownVectors()
+{
+    QFETCH(QString, strChecksum);
+    QFETCH(QByteArray, bytes);
+
+    std::unique_ptr<NetworkChecksum> pChecksum = create(strChecksum);
+    QVERIFY(pChecksum.get());
+    pChecksum->update(bytes);
+    QCOMPARE(pChecksum->size(), static_cast<qint64>(bytes.size()));
+    QCOMPARE(pChecksum->hexDigest(), strChecksum.mid(strChecksum.indexOf(':') + 1).toLower().toLatin1());
+    QString strError;
+    QVERIFY2(pChecksum->verify(strError), qPrintable(strError));
+}
+
+void TestNetworkChecksum::chunkedUpdate_data()
+{
+    QTest::addColumn<QString>("strAlgorithm");
+    QTest::addColumn<int>("nChunk");
+
+    const char *arrAlgorithm[] = { "crc32c", "xxh64", "sha1" };
+    const int arrChunk[] = { 1, 7, 31, 32, 33, 4096 };
+    for (const char *pAlgorithm : arrAlgorithm)
+    {
+        for (int nChunk : arrChunk)
+        {
+            QTest::newRow(qPrintable(QString("%1-%2").arg(pAlgorithm).arg(nChunk))) << QString(pAlgorithm) << nChunk;
+        }
+    }
+}
+
+void TestNetworkChecksum::chunkedUpdate()
+{
+    QFETCH(QString, strAlgorithm);
+    QFETCH(int, nChunk);
+
+    // 期望值不参与计算，只需格式正确
+    const int nHexLength = (strAlgorithm == "crc32c") ? 8 : (strAlgorithm == "xxh64") ? 16 : 40;
+    const QString strChecksum = strAlgorithm + ':' + QString(nHexLength, '0');
+    std::unique_ptr<NetworkChecksum> pWhole = create(strChecksum);
+    std::unique_ptr<NetworkChecksum> pChunked = create(strChecksum);
+    QVERIFY(pWhole.get() && pChunked.get());
+
+    // 数据随网络分块到达，结果应与一次计算相同
+    const QByteArray& bytes = makeData(10000 + 13);
+    pWhole->update(bytes);
+    for (int nPos = 0; nPos < bytes.size(); nPos += nChunk)
+    {
+        pChunked->update(bytes.constData() + nPos, qMin(nChunk, bytes.size() - nPos));
+    }
+    QCOMPARE(pChunked->size(), pWhole->size());
+    QCOMPARE(pChunked->hexDigest(), pWhole->hexDigest());
+
+    // reset之后重新计算
+    pChunked->reset();
+    QCOMPARE(pChunked->size(), static_cast<qint64>(0));
+    pChunked->update(bytes);
+    QCOMPARE(pChunked->hexDigest(), pWhole->hexDigest());
+}
+
+void TestNetworkChecksum::crc32cCombine_data()
+{
+    QTest::addColumn<QList<int> >("listPart");
+
+    // 多线程下载的分段大小，含空的分段
+    QTest::newRow("two") << (QList<int>() << 1000 << 2345);
+    QTest::newRow("one-byte") << (QList<int>() << 1 << 1 << 1);
+    QTest::newRow("empty-part") << (QList<int>() << 500 << 0 << 700);
+    QTest::newRow("uneven") << (QList<int>() << 65536 << 3 << 100000 << 17);
+}
+
+void TestNetworkChecksum::crc32cCombine()
+{
+    QFETCH(QList<int>, listPart);
+
+    int nTotal = 0;
+    for (int nSize : listPart)
+    {
+        nTotal += nSize;
+    }
+    const QByteArray& bytes = makeData(nTotal);
+    std::unique_ptr<NetworkChecksum> pWhole = create("crc32c:00000000");
+    QVERIFY(pWhole.get());
+    QVERIFY(pWhole->isCombinable());
+    pWhole->update(bytes);
+
+    // 各分段单独计算，按文件中的顺序合并
+    std::unique_ptr<NetworkChecksum> pCombined;
+    int nPos = 0;
+    for (int nSize : listPart)
+    {
+        std::unique_ptr<NetworkChecksum> pPart = pWhole->clone();
+        QCOMPARE(pPart->size(), static_cast<qint64>(0));
+        pPart->update(bytes.constData() + nPos, nSize);
+        nPos += nSize;
+        if (!pCombined.get())
+        {
+            pCombined = std::move(pPart);
+        }
+        else
+        {
+            pCombined->combine(*pPart);
+        }
+    }
+    QCOMPARE(pCombined->size(), static_cast<qint64>(nTotal));
+    QCOMPARE(pCombined->hexDigest(), pWhole->hexDigest());
+}
+
+void TestNetworkChecksum::mismatchFails()
+{
+    std::unique_ptr<NetworkChecksum> pChecksum = create("crc32c:e3069284");
+    QVERIFY(pChecksum.get());
+    pChecksum->update(QByteArray("123456789"));
+    QString strError;
+    QVERIFY(!pChecksum->verify(strError));
+    QVERIFY(!strError.isEmpty());
+
+    // xxh64等算法不能合并
+    std::unique_ptr<NetworkChecksum> pXxh64 = create("xxh64:ef46db3751d8e999");
+    QVERIFY(pXxh64.get());
+    QVERIFY(!pXxh64->isCombinable());
+}
+
+void TestNetworkChecksum::invalidChecksum_data()
+{
+    QTest::addColumn<QString>("strChecksum");
+
+    QTest::newRow("no-algorithm") << "e3069283";
+    QTest::newRow("empty-algorithm") << ":e3069283";
+    QTest::newRow("unsupported") << "crc64:0123456789abcdef";
+    QTest::newRow("short-digest") << "crc32c:e30692";
+    QTest::newRow("not-hex") << "crc32c:e306928z";
+}
+
+void TestNetworkChecksum::invalidChecksum()
+{
+    QFETCH(QString, strChecksum);
+
+    QString strError;
+    QVERIFY(!NetworkChecksum::create(strChecksum, strError).get());
+    QVERIFY(!strError.isEmpty());
+}
+
+void TestNetworkChecksum::updateFromFile()
+{
+    // 无法合并的算法：第一段边下载边计算，其余部分从文件读取
+    const QByteArray& bytes = makeData(3 * 1024 * 1024 + 5);
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QCOMPARE(file.write(bytes), static_cast<qint64>(bytes.size()));
+    QVERIFY(file.flush());
+
+    std::unique_ptr<NetworkChecksum> pWhole = create("sha256:" + QString(64, '0'));
+    QVERIFY(pWhole.get());
+    pWhole->update(bytes);
+
+    const int nInline = 1000;
+    std::unique_ptr<NetworkChecksum> pChecksum = pWhole->clone();
+    pChecksum->update(bytes.constData(), nInline);
+    QString strError;
+    QVERIFY2(pChecksum->updateFromFile(file.fileName(), nInline, bytes.size() - nInline, strError), qPrintable(strError));
+    QCOMPARE(pChecksum->size(), static_cast<qint64>(bytes.size()));
+    QCOMPARE(pChecksum->hexDigest(), pWhole->hexDigest());
+
+    // 文件比要求的短时失败
+    std::unique_ptr<NetworkChecksum> pShort = pWhole->clone();
+    QVERIFY(!pShort->updateFromFile(file.fileName(), 0, bytes.size() + 1, strError));
+    QVERIFY(!strError.isEmpty());
+}
+
+QTEST_GUILESS_MAIN(TestNetworkChecksum)
+#include "tst_networkchecksum.moc"
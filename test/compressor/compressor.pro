@@ -0,0 +1,25 @@
+######################################################################
+# NetworkCompressDevice: gzip/zstd压缩后解压与原数据一致，压缩失败时报告错误
+######################################################################
+
+TEMPLATE = app
+TARGET = tst_networkcompressor
+
+include(../test.pri)
+
+HEADERS += $$SOURCE_DIR/networkcompressor.h
+SOURCES += tst_networkcompressor.cpp \
+           $$SOURCE_DIR/networkcompressor.cpp \
+           $$SOURCE_DIR/networktracer.cpp
+
+unix {
+    CONFIG += link_pkgconfig
+    packagesExist(zlib) {
+        DEFINES += QMTNETWORK_USE_ZLIB
+        PKGCONFIG += zlib
+    }
+    packagesExist(libzstd) {
+        DEFINES += QMTNETWORK_USE_ZSTD
+        PKGCONFIG += libzstd
+    }
+}
@@ -0,0 +1,200 @@
+﻿#include <QtTest>
+#include <QBuffer>
+#ifdef QMTNETWORK_USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef QMTNETWORK_USE_ZSTD
+#include <zstd.h>
+#endif
+#include "networkcompressor.h"
+
+using namespace QMTNetwork;
+
+Q_DECLARE_METATYPE(QMTNetwork::ContentEncoding)
+
+namespace {
+    // 可压缩但不是全部重复的数据
+    QByteArray makeData(int nSize)
+    {
+        QByteArray bytes;
+        bytes.reserve(nSize);
+        quint32 nSeed = 12345;
+        while (bytes.size() < nSize)
+        {
+            nSeed = nSeed * 1103515245 + 12345;
+            bytes.append(QByteArray::number((nSeed >> 16) % 1000)).append(' ');
+        }
+        bytes.resize(nSize);
+        return bytes;
+    }
+
+    QByteArray compress(const QByteArray& bytes, ContentEncoding eEncoding, NetworkCompressDevice **ppDevice = nullptr)
+    {
+        QBuffer *pSource = new QBuffer;
+        pSource->setData(bytes);
+        pSource->open(QIODevice::ReadOnly);
+        NetworkCompressDevice *pDevice = new NetworkCompressDevice(pSource, eEncoding, 0);
+        pSource->setParent(pDevice);
+        const QByteArray& bytesOut = pDevice->readAll();
+        if (ppDevice)
+        {
+            *ppDevice = pDevice;
+        }
+        else
+        {
+            delete pDevice;
+        }
+        return bytesOut;
+    }
+
+    // 解压多个拼接的gzip member，失败时返回false
+    bool gunzip(const QByteArray& bytes, QByteArray& bytesOut)
+    {
+#ifdef QMTNETWORK_USE_ZLIB
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, 15 + 16) != Z_OK)
+        {
+            return false;
+        }
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(bytes.constData()));
+        stream.avail_in = static_cast<uInt>(bytes.size());
+        char buffer[64 * 1024];
+        bool bSuccess = false;
+        for (;;)
+        {
+            stream.next_out = reinterpret_cast<Bytef *>(buffer);
+            stream.avail_out = sizeof(buffer);
+            const int nRet = inflate(&stream, Z_NO_FLUSH);
+            bytesOut.append(buffer, static_cast<int>(sizeof(buffer) - stream.avail_out));
+            if (nRet == Z_STREAM_END)
+            {
+                if (stream.avail_in == 0)
+                {
+                    bSuccess = true;
+                    break;
+                }
+                // 下一个member
+                inflateReset(&stream);
+            }
+            else if (nRet != Z_OK || (stream.avail_in == 0 && stream.avail_out != 0))
+            {
+                // 出错或数据被截断
+                break;
+            }
+        }
+        inflateEnd(&stream);
+        return bSuccess;
+#else
+        Q_UNUSED(bytes);
+        Q_UNUSED(bytesOut);
+        return false;
+#endif
+    }
+
+    // 解压多个拼接的zstd frame，失败时返回false
+    bool unzstd(const QByteArray& bytes, QByteArray& bytesOut)
+    {
+#ifdef QMTNETWORK_USE_ZSTD
+        ZSTD_DStream *pStream = ZSTD_createDStream();
+        ZSTD_initDStream(pStream);
+        ZSTD_inBuffer in = { bytes.constData(), static_cast<size_t>(bytes.size()), 0 };
+        char buffer[64 * 1024];
+        bool bSuccess = true;
+        size_t nRet = 0;
+        ZSTD_outBuffer out = { buffer, sizeof(buffer), 0 };
+        do
+        {
+            out.pos = 0;
+            nRet = ZSTD_decompressStream(pStream, &out, &in);
+            if (ZSTD_isError(nRet))
+            {
+                bSuccess = false;
+                break;
+            }
+            bytesOut.append(buffer, static_cast<int>(out.pos));
+        } while (in.pos < in.size || out.pos == out.size);
+        ZSTD_freeDStream(pStream);
+        // nRet不为0表示最后一个frame不完整
+        return bSuccess && nRet == 0;
+#else
+        Q_UNUSED(bytes);
+        Q_UNUSED(bytesOut);
+        return false;
+#endif
+    }
+}
+
+class TestNetworkCompressor : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void roundTrip_data();
+    void roundTrip();
+    void unsupportedEncodingFails();
+};
+
+void TestNetworkCompressor::roundTrip_data()
+{
+    QTest::addColumn<ContentEncoding>("eEncoding");
+    QTest::addColumn<int>("nSize");
+
+    // 空数据、不足一块、刚好一块、多块、超过ParallelThreshold（多线程压缩）
+    const int arrSize[] = { 0, 1000, NetworkCompressDevice::BlockSize, 3 * NetworkCompressDevice::BlockSize + 17,
+        NetworkCompressDevice::ParallelThreshold + NetworkCompressDevice::BlockSize / 2 };
+    for (int nSize : arrSize)
+    {
+        QTest::newRow(qPrintable(QString("gzip-%1").arg(nSize))) << eEncodingGzip << nSize;
+        QTest::newRow(qPrintable(QString("zstd-%1").arg(nSize))) << eEncodingZstd << nSize;
+    }
+}
+
+void TestNetworkCompressor::roundTrip()
+{
+    QFETCH(ContentEncoding, eEncoding);
+    QFETCH(int, nSize);
+    if (!NetworkCompressDevice::isSupported(eEncoding))
+    {
+        QSKIP("Content-Encoding not compiled in");
+    }
+
+    const QByteArray& bytes = makeData(nSize);
+    NetworkCompressDevice *pDevice = nullptr;
+    const QByteArray& bytesCompressed = compress(bytes, eEncoding, &pDevice);
+    QScopedPointer<NetworkCompressDevice> device(pDevice);
+    QVERIFY(!device->isFailed());
+    QVERIFY(device->atEnd());
+    QCOMPARE(device->sourceBytes(), static_cast<qint64>(nSize));
+    QCOMPARE(device->compressedBytes(), static_cast<qint64>(bytesCompressed.size()));
+    QVERIFY(!bytesCompressed.isEmpty());
+    if (nSize > 0)
+    {
+        QVERIFY(bytesCompressed.size() < nSize);
+    }
+
+    QByteArray bytesOut;
+    const bool bSuccess = (eEncoding == eEncodingGzip) ? gunzip(bytesCompressed, bytesOut) : unzstd(bytesCompressed, bytesOut);
+    QVERIFY(bSuccess);
+    QCOMPARE(bytesOut.size(), bytes.size());
+    QVERIFY(bytesOut == bytes);
+}
+
+void TestNetworkCompressor::unsupportedEncodingFails()
+{
+    // 没有对应的压缩算法时每块都压缩失败：读取结束，不输出数据，报告错误
+    NetworkCompressDevice *pDevice = nullptr;
+    const QByteArray& bytesCompressed = compress(makeData(1000), eEncodingIdentity, &pDevice);
+    QScopedPointer<NetworkCompressDevice> device(pDevice);
+    QVERIFY(bytesCompressed.isEmpty());
+    QVERIFY(device->isFailed());
+    QVERIFY(device->atEnd());
+    QVERIFY(!device->errorString().isEmpty());
+    QCOMPARE(device->compressedBytes(), static_cast<qint64>(0));
+
+    char buffer[16];
+    QCOMPARE(device->read(buffer, sizeof(buffer)), static_cast<qint64>(-1));
+}
+
+QTEST_GUILESS_MAIN(TestNetworkCompressor)
+#include "tst_networkcompressor.moc"
@@ -0,0 +1,10 @@
+######################################################################
+# NetworkUtility::parseContentRange: 分段下载校验206响应的Content-Range
+######################################################################
+
+TEMPLATE = app
+TARGET = tst_networkcontentrange
+
+include(../test.pri)
+
+SOURCES += tst_networkcontentrange.cpp
@@ -0,0 +1,58 @@
+﻿#include <QtTest>
+#include "networkutility.h"
+
+class TestNetworkContentRange : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void parse_data();
+    void parse();
+};
+
+void TestNetworkContentRange::parse_data()
+{
+    QTest::addColumn<QByteArray>("strRange");
+    QTest::addColumn<bool>("bValid");
+    QTest::addColumn<qint64>("nFirst");
+    QTest::addColumn<qint64>("nLast");
+    QTest::addColumn<qint64>("nTotal");
+
+    QTest::newRow("segment") << QByteArray("bytes 0-1023/4096") << true << 0LL << 1023LL << 4096LL;
+    QTest::newRow("last-byte") << QByteArray("bytes 4095-4095/4096") << true << 4095LL << 4095LL << 4096LL;
+    QTest::newRow("unknown-total") << QByteArray("bytes 100-199/*") << true << 100LL << 199LL << -1LL;
+    QTest::newRow("whitespace") << QByteArray("  bytes 1-2/3  ") << true << 1LL << 2LL << 3LL;
+    QTest::newRow("unit-case") << QByteArray("Bytes 0-0/1") << true << 0LL << 0LL << 1LL;
+    QTest::newRow("large") << QByteArray("bytes 5000000000-5999999999/8589934592") << true
+        << 5000000000LL << 5999999999LL << 8589934592LL;
+
+    // 416响应：只有总大小
+    QTest::newRow("unsatisfied") << QByteArray("bytes */4096") << false << -1LL << -1LL << 4096LL;
+    // 格式错误时总大小仍可用于判断是否同一个文件
+    QTest::newRow("reversed") << QByteArray("bytes 200-100/4096") << false << -1LL << -1LL << 4096LL;
+    QTest::newRow("past-end") << QByteArray("bytes 0-4096/4096") << false << -1LL << -1LL << 4096LL;
+    QTest::newRow("negative") << QByteArray("bytes -5-10/4096") << false << -1LL << -1LL << 4096LL;
+    QTest::newRow("not-number") << QByteArray("bytes a-b/4096") << false << -1LL << -1LL << 4096LL;
+    QTest::newRow("no-slash") << QByteArray("bytes 0-1023") << false << -1LL << -1LL << -1LL;
+    QTest::newRow("no-unit") << QByteArray("0-1023/4096") << false << -1LL << -1LL << -1LL;
+    QTest::newRow("other-unit") << QByteArray("items 0-1/2") << false << -1LL << -1LL << -1LL;
+    QTest::newRow("empty") << QByteArray() << false << -1LL << -1LL << -1LL;
+}
+
+void TestNetworkContentRange::parse()
+{
+    QFETCH(QByteArray, strRange);
+    QFETCH(bool, bValid);
+    QFETCH(qint64, nFirst);
+    QFETCH(qint64, nLast);
+    QFETCH(qint64, nTotal);
+
+    qint64 nActualFirst = 0, nActualLast = 0, nActualTotal = 0;
+    QCOMPARE(NetworkUtility::parseContentRange(strRange, nActualFirst, nActualLast, nActualTotal), bValid);
+    QCOMPARE(nActualFirst, nFirst);
+    QCOMPARE(nActualLast, nLast);
+    QCOMPARE(nActualTotal, nTotal);
+}
+
+QTEST_GUILESS_MAIN(TestNetworkContentRange)
+#include "tst_networkcontentrange.moc"
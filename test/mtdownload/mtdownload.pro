@@ -0,0 +1,12 @@
+######################################################################
+# NetworkMTDownloadRequest: 进程内的HTTP服务器注入故障（分段中途断开、错误的Content-Range、
+#	ETag不同的镜像、停滞的分段），下载的文件必须与服务器上的内容一致（通过NetworkManager执行请求）
+######################################################################
+
+TEMPLATE = app
+TARGET = tst_networkmtdownload
+
+CONFIG += qmtnetwork_lib
+include(../test.pri)
+
+SOURCES += tst_networkmtdownload.cpp
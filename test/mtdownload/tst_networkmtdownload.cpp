@@ -0,0 +1,325 @@
+﻿#include <memory>
+#include <QtTest>
+#include <QCryptographicHash>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include "networkmanager.h"
+#include "networkreply.h"
+
+using namespace QMTNetwork;
+
+namespace {
+    // 探测请求1MB，其余8MB分给4个通道（有镜像时切成8段）
+    const qint64 FileSize = 9 * 1024 * 1024;
+    const qint64 SendChunkSize = 64 * 1024;
+    const int DownloadThreadCount = 4;
+    const QLatin1String FileName("mt.bin");
+
+    // 由种子生成的伪随机内容，各处的字节都不相同，错位或混入别的文件都能发现
+    QByteArray makeContent(quint32 nSeed)
+    {
+        QByteArray bytes(static_cast<int>(FileSize), Qt::Uninitialized);
+        char *pData = bytes.data();
+        quint32 x = nSeed;
+        for (int i = 0; i < bytes.size(); ++i)
+        {
+            x = x * 1664525u + 1013904223u;
+            pData[i] = static_cast<char>(x >> 24);
+        }
+        return bytes;
+    }
+
+    // 进程内的HTTP服务器：按Range返回文件的一部分（206），每个请求一个连接（Connection: close）.
+    //	在第一个分段请求（起始位置大于0，不是探测请求）上注入一次故障
+    class RangeServer : public QTcpServer
+    {
+    public:
+        enum Fault
+        {
+            eFaultNone,
+            // 发出一半数据后关闭连接
+            eFaultCloseMidSegment,
+            // Content-Range的起始位置错一个字节
+            eFaultWrongRange,
+            // 发出SendChunkSize字节后停止发送，连接保持打开
+            eFaultStall,
+        };
+
+        RangeServer(const QByteArray& bytesFile, const QByteArray& strETag, Fault eFault = eFaultNone)
+            : m_bytesFile(bytesFile)
+            , m_strETag(strETag)
+            , m_eFault(eFault)
+            , m_nRequests(0)
+            , m_nFaults(0)
+        {
+            QObject::connect(this, &QTcpServer::newConnection, [this]() {
+                while (QTcpSocket *pSocket = nextPendingConnection())
+                {
+                    serve(pSocket);
+                }
+            });
+        }
+
+        bool start() { return listen(QHostAddress::LocalHost); }
+        QString url() const { return QStringLiteral("http://127.0.0.1:%1/%2").arg(serverPort()).arg(QString(FileName)); }
+        int requestCount() const { return m_nRequests; }
+        int faultCount() const { return m_nFaults; }
+
+    private:
+        struct Connection
+        {
+            QByteArray bytesHeader;
+            bool bStarted;
+            bool bStall;
+            qint64 nPos;
+            qint64 nEnd;
+            Connection() : bStarted(false), bStall(false), nPos(0), nEnd(0) {}
+        };
+
+        // "Range: bytes=first-last"（last可省略），没有Range时返回false
+        static bool parseRange(const QByteArray& bytesHeader, qint64& nFirst, qint64& nLast)
+        {
+            for (const QByteArray& line : bytesHeader.split('\n'))
+            {
+                const QByteArray strLine = line.trimmed();
+                if (!strLine.toLower().startsWith("range:"))
+                {
+                    continue;
+                }
+                const QByteArray strRange = strLine.mid(strLine.indexOf('=') + 1);
+                const int nDash = strRange.indexOf('-');
+                nFirst = strRange.left(nDash).toLongLong();
+                const QByteArray strLast = strRange.mid(nDash + 1).trimmed();
+                nLast = strLast.isEmpty() ? FileSize - 1 : qMin(strLast.toLongLong(), FileSize - 1);
+                return true;
+            }
+            return false;
+        }
+
+        void serve(QTcpSocket *pSocket)
+        {
+            std::shared_ptr<Connection> pConn = std::make_shared<Connection>();
+
+            auto fnPump = [=]() {
+                while (pConn->nPos < pConn->nEnd && pSocket->bytesToWrite() < 4 * SendChunkSize)
+                {
+                    const qint64 nSize = qMin(pConn->nEnd - pConn->nPos, SendChunkSize);
+                    pSocket->write(m_bytesFile.constData() + pConn->nPos, nSize);
+                    pConn->nPos += nSize;
+                }
+                if (pConn->bStarted && !pConn->bStall && pConn->nPos == pConn->nEnd && pSocket->bytesToWrite() == 0)
+                {
+                    pSocket->disconnectFromHost();
+                }
+            };
+
+            QObject::connect(pSocket, &QTcpSocket::readyRead, [=]() {
+                if (pConn->bStarted)
+                {
+                    pSocket->readAll();
+                    return;
+                }
+                pConn->bytesHeader.append(pSocket->readAll());
+                if (!pConn->bytesHeader.contains("\r\n\r\n"))
+                {
+                    return;
+                }
+                pConn->bStarted = true;
+                ++m_nRequests;
+
+                qint64 nFirst = 0;
+                qint64 nLast = FileSize - 1;
+                const bool bRange = parseRange(pConn->bytesHeader, nFirst, nLast);
+                const bool bFault = (m_eFault != eFaultNone && m_nFaults == 0 && nFirst > 0);
+                if (bFault)
+                {
+                    ++m_nFaults;
+                }
+
+                const qint64 nRangeFirst = (bFault && m_eFault == eFaultWrongRange) ? nFirst + 1 : nFirst;
+                QByteArray bytesResponse = bRange ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+                bytesResponse += "Content-Type: application/octet-stream\r\n";
+                bytesResponse += "Content-Length: " + QByteArray::number(nLast - nFirst + 1) + "\r\n";
+                if (bRange)
+                {
+                    bytesResponse += "Content-Range: bytes " + QByteArray::number(nRangeFirst) + "-" + QByteArray::number(nLast)
+                        + "/" + QByteArray::number(FileSize) + "\r\n";
+                }
+                bytesResponse += "Accept-Ranges: bytes\r\nETag: " + m_strETag + "\r\nConnection: close\r\n\r\n";
+                pSocket->write(bytesResponse);
+
+                pConn->nPos = nFirst;
+                pConn->nEnd = nLast + 1;
+                if (bFault && m_eFault == eFaultCloseMidSegment)
+                {
+                    pConn->nEnd = nFirst + (nLast - nFirst + 1) / 2;
+                }
+                else if (bFault && m_eFault == eFaultStall)
+                {
+                    pConn->nEnd = nFirst + SendChunkSize;
+                    pConn->bStall = true;
+                }
+                fnPump();
+            });
+            QObject::connect(pSocket, &QTcpSocket::bytesWritten, fnPump);
+            QObject::connect(pSocket, &QTcpSocket::disconnected, pSocket, &QObject::deleteLater);
+        }
+
+    private:
+        const QByteArray m_bytesFile;
+        const QByteArray m_strETag;
+        const Fault m_eFault;
+        int m_nRequests;
+        int m_nFaults;
+    };
+}
+
+class TestNetworkMTDownload : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+
+    void closedMidSegment();
+    void wrongContentRange();
+    void mirrorWithOtherETag();
+    void stalledSegment();
+
+private:
+    // 多线程下载strUrl（可带镜像）到临时目录，按sha256校验，等待结果
+    RequestTask download(const QString& strUrl, const QStringList& listMirrorUrls = QStringList());
+    QByteArray readDownloadedFile() const;
+
+    QByteArray m_bytesFile;
+    std::unique_ptr<QTemporaryDir> m_pDir;
+};
+
+void TestNetworkMTDownload::initTestCase()
+{
+    m_bytesFile = makeContent(1);
+    NetworkManager::initialize();
+}
+
+void TestNetworkMTDownload::cleanupTestCase()
+{
+    NetworkManager::unInitialize();
+}
+
+void TestNetworkMTDownload::init()
+{
+    m_pDir.reset(new QTemporaryDir);
+    QVERIFY(m_pDir->isValid());
+}
+
+RequestTask TestNetworkMTDownload::download(const QString& strUrl, const QStringList& listMirrorUrls)
+{
+    RequestTask task;
+    task.eType = eTypeMTDownload;
+    task.url = strUrl;
+    task.listMirrorUrls = listMirrorUrls;
+    task.strReqArg = m_pDir->path();
+    task.strSaveFileName = FileName;
+    task.nDownloadThreadCount = DownloadThreadCount;
+    task.strChecksum = QStringLiteral("sha256:")
+        + QString::fromLatin1(QCryptographicHash::hash(m_bytesFile, QCryptographicHash::Sha256).toHex());
+
+    NetworkReply *pReply = NetworkManager::globalInstance()->addRequest(task);
+    if (nullptr == pReply)
+    {
+        task.bSuccess = false;
+        task.strError = QStringLiteral("addRequest returned nullptr");
+        return task;
+    }
+    QSignalSpy spy(pReply, SIGNAL(requestFinished(const QMTNetwork::RequestTask&)));
+    if (!spy.wait(30000) || spy.isEmpty())
+    {
+        task.bSuccess = false;
+        task.strError = QStringLiteral("timeout");
+        return task;
+    }
+    return qvariant_cast<RequestTask>(spy.at(0).at(0));
+}
+
+QByteArray TestNetworkMTDownload::readDownloadedFile() const
+{
+    QFile file(QDir(m_pDir->path()).filePath(FileName));
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return QByteArray();
+    }
+    return file.readAll();
+}
+
+void TestNetworkMTDownload::closedMidSegment()
+{
+    RangeServer server(m_bytesFile, "\"v1\"", RangeServer::eFaultCloseMidSegment);
+    QVERIFY(server.start());
+
+    // 没有镜像，该段从已写入的位置重试
+    const RequestTask& result = download(server.url());
+    QVERIFY2(result.bSuccess, qPrintable(result.strError));
+    QCOMPARE(server.faultCount(), 1);
+    QVERIFY(server.requestCount() > 1 + DownloadThreadCount);
+
+    const QByteArray& bytes = readDownloadedFile();
+    QCOMPARE(bytes.size(), m_bytesFile.size());
+    QVERIFY(bytes == m_bytesFile);
+}
+
+void TestNetworkMTDownload::wrongContentRange()
+{
+    RangeServer primary(m_bytesFile, "\"v1\"", RangeServer::eFaultWrongRange);
+    RangeServer mirror(m_bytesFile, "\"v1\"");
+    QVERIFY(primary.start());
+    QVERIFY(mirror.start());
+
+    // 错位的响应不写入，该段改由镜像下载
+    const RequestTask& result = download(primary.url(), QStringList() << mirror.url());
+    QVERIFY2(result.bSuccess, qPrintable(result.strError));
+    QCOMPARE(primary.faultCount(), 1);
+    QVERIFY(mirror.requestCount() > 0);
+
+    const QByteArray& bytes = readDownloadedFile();
+    QCOMPARE(bytes.size(), m_bytesFile.size());
+    QVERIFY(bytes == m_bytesFile);
+}
+
+void TestNetworkMTDownload::mirrorWithOtherETag()
+{
+    // 镜像上是另一个文件（大小相同）
+    RangeServer primary(m_bytesFile, "\"v1\"");
+    RangeServer mirror(makeContent(2), "\"v2\"");
+    QVERIFY(primary.start());
+    QVERIFY(mirror.start());
+
+    const RequestTask& result = download(primary.url(), QStringList() << mirror.url());
+    QVERIFY2(result.bSuccess, qPrintable(result.strError));
+    QVERIFY(mirror.requestCount() > 0);
+
+    const QByteArray& bytes = readDownloadedFile();
+    QCOMPARE(bytes.size(), m_bytesFile.size());
+    QVERIFY(bytes == m_bytesFile);
+}
+
+void TestNetworkMTDownload::stalledSegment()
+{
+    RangeServer server(m_bytesFile, "\"v1\"", RangeServer::eFaultStall);
+    QVERIFY(server.start());
+
+    // 其它分段完成后，停滞的分段由重复请求下载剩余部分
+    const RequestTask& result = download(server.url());
+    QVERIFY2(result.bSuccess, qPrintable(result.strError));
+    QCOMPARE(server.faultCount(), 1);
+    QVERIFY(server.requestCount() > 1 + DownloadThreadCount);
+
+    const QByteArray& bytes = readDownloadedFile();
+    QCOMPARE(bytes.size(), m_bytesFile.size());
+    QVERIFY(bytes == m_bytesFile);
+}
+
+QTEST_GUILESS_MAIN(TestNetworkMTDownload)
+#include "tst_networkmtdownload.moc"
@@ -0,0 +1,49 @@
+######################################################################
+# 单元测试的公共设置
+#	被测试的类大多是内部类（不导出），默认直接编译所需的源文件，不链接QMultiThreadNetwork；
+#	只使用公开接口的测试在include本文件之前设置CONFIG += qmtnetwork_lib，链接QMultiThreadNetwork
+######################################################################
+
+QT += core network testlib
+QT -= gui
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+SOURCE_DIR = $$PWD/../source
+
+qmtnetwork_lib {
+    INCLUDEPATH += $$PWD/../include
+
+    greaterThan(QT_MAJOR_VERSION, 4) {
+        TARGET_ARCH=$${QT_ARCH}
+    } else {
+        TARGET_ARCH=$${QMAKE_HOST.arch}
+    }
+
+    CONFIG(debug, debug|release) {
+        contains(TARGET_ARCH, x86_64) {
+            LIBPATH += $$PWD/../bin/x64/Debug
+        } else {
+            LIBPATH += $$PWD/../bin/Win32/Debug
+        }
+        LIBS += -lQMultiThreadNetworkd
+    } else {
+        contains(TARGET_ARCH, x86_64) {
+            LIBPATH += $$PWD/../bin/x64/Release
+        } else {
+            LIBPATH += $$PWD/../bin/Win32/Release
+        }
+        LIBS += -lQMultiThreadNetwork
+    }
+    unix: QMAKE_RPATHDIR += $$LIBPATH
+} else {
+    INCLUDEPATH += $$SOURCE_DIR \
+                   $$SOURCE_DIR/inc \
+                   $$PWD/../ThirdParty/log4cplus/include
+
+    DEFINES += UNICODE QT_MTNETWORK_STATIC
+
+    # 日志和工具函数几乎所有模块都用到
+    SOURCES += $$SOURCE_DIR/networklog.cpp \
+               $$SOURCE_DIR/networkutility.cpp
+}
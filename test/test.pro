@@ -1,3 +1,8 @@
 TEMPLATE = subdirs
 
-SUBDIRS += 
+SUBDIRS += batchmanifest \
+           checksum \
+           compressor \
+           contentrange \
+           mtdownload \
+           transport
@@ -0,0 +1,11 @@
+######################################################################
+# NetworkTransportRegistry: 按strTransport/协议选择已注册的传输（通过NetworkManager执行请求）
+######################################################################
+
+TEMPLATE = app
+TARGET = tst_networktransport
+
+CONFIG += qmtnetwork_lib
+include(../test.pri)
+
+SOURCES += tst_networktransport.cpp
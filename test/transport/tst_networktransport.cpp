@@ -0,0 +1,205 @@
+﻿#include <atomic>
+#include <QtTest>
+#include "networkmanager.h"
+#include "networkreply.h"
+#include "networktransport.h"
+
+using namespace QMTNetwork;
+
+namespace {
+    const QLatin1String TestTransport("test");
+    const QLatin1String TestScheme("testproto");
+    const QByteArray TestBody("hello from the test transport");
+
+    // 在start()中同步返回固定的响应，记录被调用的次数
+    class EchoTransport : public NetworkTransport
+    {
+    public:
+        static std::atomic<int> s_nStarted;
+
+        void start(const RequestTask& task, NetworkTransportSink *pSink) Q_DECL_OVERRIDE
+        {
+            Q_UNUSED(task);
+            ++s_nStarted;
+            pSink->setMetaData(200, TestBody.size(), QMap<QByteArray, QByteArray>());
+            pSink->write(TestBody.constData(), TestBody.size());
+            pSink->finish(true, QString());
+        }
+
+        void abort() Q_DECL_OVERRIDE {}
+    };
+
+    std::atomic<int> EchoTransport::s_nStarted(0);
+
+    NetworkTransportRegistry::Factory echoFactory()
+    {
+        return []() { return std::unique_ptr<NetworkTransport>(new EchoTransport); };
+    }
+}
+
+class TestNetworkTransport : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void cleanup();
+
+    void builtInTransports();
+    void rejectsInvalidRegistration();
+    void schemeSelectsRegisteredTransport();
+    void strTransportOverridesScheme();
+    void unregisterFallsBackToDefault();
+    void mockTransport();
+    void fileSchemeIsOptIn();
+
+private:
+    // 执行请求并等待结果
+    RequestTask run(RequestTask task);
+};
+
+void TestNetworkTransport::initTestCase()
+{
+    NetworkManager::initialize();
+}
+
+void TestNetworkTransport::cleanupTestCase()
+{
+    NetworkManager::unInitialize();
+}
+
+void TestNetworkTransport::cleanup()
+{
+    NetworkTransportRegistry::unregisterTransport(TestTransport);
+    NetworkTransportRegistry::setSchemeTransport(QStringLiteral("file"), QString());
+    EchoTransport::s_nStarted = 0;
+}
+
+RequestTask TestNetworkTransport::run(RequestTask task)
+{
+    NetworkReply *pReply = NetworkManager::globalInstance()->addRequest(task);
+    if (nullptr == pReply)
+    {
+        task.bSuccess = false;
+        task.strError = QStringLiteral("addRequest returned nullptr");
+        return task;
+    }
+    QSignalSpy spy(pReply, SIGNAL(requestFinished(const QMTNetwork::RequestTask&)));
+    if (!spy.wait(10000) || spy.isEmpty())
+    {
+        task.bSuccess = false;
+        task.strError = QStringLiteral("timeout");
+        return task;
+    }
+    return qvariant_cast<RequestTask>(spy.at(0).at(0));
+}
+
+void TestNetworkTransport::builtInTransports()
+{
+    const QStringList& listTransports = NetworkTransportRegistry::transports();
+    QVERIFY(listTransports.contains(QStringLiteral("qnam")));
+    QVERIFY(listTransports.contains(QStringLiteral("native")));
+    QVERIFY(listTransports.contains(QStringLiteral("mock")));
+    QVERIFY(listTransports.contains(QStringLiteral("file")));
+}
+
+void TestNetworkTransport::rejectsInvalidRegistration()
+{
+    QVERIFY(!NetworkTransportRegistry::registerTransport(QStringLiteral("qnam"), echoFactory()));
+    QVERIFY(!NetworkTransportRegistry::registerTransport(QStringLiteral("native"), echoFactory()));
+    QVERIFY(!NetworkTransportRegistry::registerTransport(QString(), echoFactory()));
+    QVERIFY(!NetworkTransportRegistry::registerTransport(TestTransport, NetworkTransportRegistry::Factory()));
+    QVERIFY(!NetworkTransportRegistry::transports().contains(TestTransport));
+
+    QVERIFY(NetworkTransportRegistry::registerTransport(TestTransport, echoFactory()));
+    QVERIFY(NetworkTransportRegistry::transports().contains(TestTransport));
+}
+
+void TestNetworkTransport::schemeSelectsRegisteredTransport()
+{
+    QVERIFY(NetworkTransportRegistry::registerTransport(TestTransport, echoFactory(), QStringList() << QStringLiteral("TestProto")));
+
+    RequestTask task;
+    task.eType = eTypeGet;
+    task.url = QStringLiteral("testproto://host/path");
+    const RequestTask& result = run(task);
+    QVERIFY2(result.bSuccess, qPrintable(result.strError));
+    QCOMPARE(result.bytesContent, TestBody);
+    QCOMPARE(EchoTransport::s_nStarted.load(), 1);
+}
+
+void TestNetworkTransport::strTransportOverridesScheme()
+{
+    QVERIFY(NetworkTransportRegistry::registerTransport(TestTransport, echoFactory()));
+
+    // mock://默认由"mock"执行，strTransport优先
+    RequestTask task;
+    task.eType = eTypeGet;
+    task.url = QStringLiteral("mock://host/path?size=1000");
+    task.strTransport = TestTransport;
+    const RequestTask& result = run(task);
+    QVERIFY2(result.bSuccess, qPrintable(result.strError));
+    QCOMPARE(result.bytesContent, TestBody);
+    QCOMPARE(EchoTransport::s_nStarted.load(), 1);
+}
+
+void TestNetworkTransport::unregisterFallsBackToDefault()
+{
+    QVERIFY(NetworkTransportRegistry::registerTransport(TestTransport, echoFactory(), QStringList() << TestScheme));
+    NetworkTransportRegistry::unregisterTransport(TestTransport);
+    QVERIFY(!NetworkTransportRegistry::transports().contains(TestTransport));
+
+    // 协议的映射一起删除，QNetworkAccessManager不支持该协议
+    RequestTask task;
+    task.eType = eTypeGet;
+    task.url = QStringLiteral("testproto://host/path");
+    const RequestTask& result = run(task);
+    QVERIFY(!result.bSuccess);
+    QCOMPARE(EchoTransport::s_nStarted.load(), 0);
+}
+
+void TestNetworkTransport::mockTransport()
+{
+    RequestTask task;
+    task.eType = eTypeGet;
+    task.url = QStringLiteral("mock://host/path?size=4096");
+    const RequestTask& result = run(task);
+    QVERIFY2(result.bSuccess, qPrintable(result.strError));
+    QCOMPARE(result.bytesContent.size(), 4096);
+
+    task.url = QStringLiteral("mock://host/path?size=10&status=404");
+    QVERIFY(!run(task).bSuccess);
+}
+
+void TestNetworkTransport::fileSchemeIsOptIn()
+{
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(TestBody);
+    file.close();
+    QVERIFY(NetworkTransportRegistry::registerTransport(TestTransport, echoFactory()));
+
+    RequestTask task;
+    task.eType = eTypeGet;
+    task.url = QUrl::fromLocalFile(file.fileName()).toString();
+
+    // 默认由QNetworkAccessManager读取
+    RequestTask result = run(task);
+    QVERIFY2(result.bSuccess, qPrintable(result.strError));
+    QCOMPARE(result.bytesContent, TestBody);
+    QCOMPARE(EchoTransport::s_nStarted.load(), 0);
+
+    // 指定之后file://改由该传输执行
+    NetworkTransportRegistry::setSchemeTransport(QStringLiteral("FILE"), TestTransport);
+    result = run(task);
+    QVERIFY2(result.bSuccess, qPrintable(result.strError));
+    QCOMPARE(EchoTransport::s_nStarted.load(), 1);
+
+    NetworkTransportRegistry::setSchemeTransport(QStringLiteral("file"), QString());
+    run(task);
+    QCOMPARE(EchoTransport::s_nStarted.load(), 1);
+}
+
+QTEST_GUILESS_MAIN(TestNetworkTransport)
+#include "tst_networktransport.moc"